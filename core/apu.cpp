@@ -0,0 +1,547 @@
+#include "apu.h"
+#include "bus.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numbers>
+
+#define IO(reg)					io[(reg) & BUS_PAGE_MASK]
+#define NR(ch, n)				IO(REG_NR10 + 5 * (ch) + (n))
+
+#define BLEP_CUTOFF				0.9				// of the output Nyquist frequency
+#define HIGH_PASS_SHIFT			10				// the output capacitor, a few Hz at 48 kHz
+#define AMPLITUDE_SCALE			8				// a full mix of four channels at volume 8 is +-30720
+
+typedef std::array<std::array<i32, BLEP_TAPS>, BLEP_PHASES> BlepKernel;
+
+/* OR-ed into reads of NR10 to 0xFF2F: write-only and unused bits read as 1 */
+static const u8 readMasks[REG_WAVE_RAM - REG_NR10] = {
+	0x80, 0x3F, 0x00, 0xFF, 0xBF,
+	0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+	0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+	0xFF, 0xFF, 0x00, 0x00, 0xBF,
+	0x00, 0x00, 0x70,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+/* bit n is duty step n */
+static const u8 dutyPatterns[4] = { 0x80, 0x81, 0xE1, 0x7E };
+static const u8 noiseDivisors[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+/* NR32 output level: mute, 100%, 50%, 25% */
+static const u8 waveShifts[4] = { 4, 0, 1, 2 };
+
+/*
+	Blackman-windowed sinc impulses for a step BLEP_TAPS / 2 - 1 samples ahead, at each
+	sub-sample phase. Each is rounded to integers that sum to exactly 1 << BLEP_UNIT_SHIFT,
+	so a step summed out of the buffer lands on its level with no error building up.
+*/
+static const BlepKernel& Kernel()
+{
+	static const BlepKernel kernel = [] {
+		BlepKernel k;
+
+		for (u32 phase = 0; phase < BLEP_PHASES; phase++) {
+			std::array<double, BLEP_TAPS> taps;
+			double sum = 0;
+			i32 total = 0;
+			u32 peak = 0;
+
+			for (u32 i = 0; i < BLEP_TAPS; i++) {
+				double x = static_cast<double>(i) - (BLEP_TAPS / 2 - 1) - static_cast<double>(phase) / BLEP_PHASES;
+				double window = 0.42 + 0.5 * std::cos(2 * std::numbers::pi * x / BLEP_TAPS) + 0.08 * std::cos(4 * std::numbers::pi * x / BLEP_TAPS);
+
+				taps[i] = window * (x == 0 ? 1 : std::sin(std::numbers::pi * BLEP_CUTOFF * x) / (std::numbers::pi * BLEP_CUTOFF * x));
+				sum += taps[i];
+			}
+			for (u32 i = 0; i < BLEP_TAPS; i++) {
+				k[phase][i] = static_cast<i32>(std::lround(taps[i] / sum * (1 << BLEP_UNIT_SHIFT)));
+				total += k[phase][i];
+				if (k[phase][i] > k[phase][peak])
+					peak = i;
+			}
+			k[phase][peak] += (1 << BLEP_UNIT_SHIFT) - total;
+		}
+		return k;
+	}();
+
+	return kernel;
+}
+
+bool Apu::DacOn(u32 ch) const
+{
+	return ch == APU_WAVE ? IO(REG_NR30) & 0x80 : NR(ch, 2) & 0xF8;
+}
+
+u16 Apu::Frequency(u32 ch) const
+{
+	return NR(ch, 3) | ((NR(ch, 4) & 0x07) << 8);
+}
+
+/* T-cycles per waveform step; 0 when the noise clock is stopped */
+u32 Apu::Period(u32 ch) const
+{
+	u8 nr43 = IO(REG_NR43);
+
+	switch (ch) {
+	case APU_WAVE:
+		return (2048 - Frequency(ch)) * 2;
+	case APU_NOISE:
+		return (nr43 >> 4) >= 14 ? 0 : noiseDivisors[nr43 & 0x07] << (nr43 >> 4);
+	default:
+		return (2048 - Frequency(ch)) * 4;
+	}
+}
+
+/* the tone itself is above the output Nyquist frequency, only its average can be heard */
+bool Apu::Averaged(u32 ch, u32 period) const
+{
+	switch (ch) {
+	case APU_WAVE:
+		return period * 16 < cyclesPerSample;
+	case APU_NOISE:
+		return false;
+	default:
+		return period * 4 < cyclesPerSample;
+	}
+}
+
+/* the channel's DAC output, -120 to 120 for levels 0 to 15; 0 when it is off */
+i32 Apu::Amplitude(u32 ch) const
+{
+	const Channel& c = channels[ch];
+	u32 period = Period(ch);
+	u8 shift = waveShifts[(IO(REG_NR32) >> 5) & 0x03];
+	i32 sum = 0;
+
+	if (!c.enabled)
+		return 0;
+	switch (ch) {
+	case APU_WAVE:
+		if (Averaged(ch, period)) {
+			for (u32 i = 0; i < 16; i++)
+				sum += (IO(REG_WAVE_RAM + i) >> 4 >> shift) + ((IO(REG_WAVE_RAM + i) & 0x0F) >> shift);
+			return sum / 2 - 120;
+		}
+		return 16 * (((IO(REG_WAVE_RAM + c.position / 2) >> ((c.position & 1) ? 0 : 4)) & 0x0F) >> shift) - 120;
+	case APU_NOISE:
+		return (c.lfsr & 1 ? 0 : 16 * c.volume) - 120;
+	default:
+		if (Averaged(ch, period))
+			return 2 * c.volume * std::popcount(dutyPatterns[NR(ch, 1) >> 6]) - 120;
+		return ((dutyPatterns[NR(ch, 1) >> 6] >> c.position) & 1 ? 16 * c.volume : 0) - 120;
+	}
+}
+
+/*
+	Restarts the channel from its registers. The length counter is only refilled if it ran
+	out, square duty positions carry on, as on hardware.
+*/
+void Apu::Trigger(u32 ch)
+{
+	Channel& c = channels[ch];
+	u8 nr10 = IO(REG_NR10);
+
+	c.enabled = DacOn(ch);
+	if (!c.length)
+		c.length = ch == APU_WAVE ? 256 : 64;
+	c.volume = NR(ch, 2) >> 4;
+	c.envelopeTimer = NR(ch, 2) & 0x07;
+	c.untilStep = Period(ch);
+	if (ch == APU_WAVE)
+		c.position = 0;
+	if (ch == APU_NOISE)
+		c.lfsr = 0x7FFF;
+	if (ch == APU_SQUARE1) {
+		sweepShadow = Frequency(ch);
+		sweepTimer = (nr10 >> 4) & 0x07 ? (nr10 >> 4) & 0x07 : 8;
+		sweepEnabled = nr10 & 0x77;
+		if (nr10 & 0x07)
+			SweepTarget();
+	}
+}
+
+/* the next sweep frequency; past 2047 the channel stops */
+u16 Apu::SweepTarget()
+{
+	u8 nr10 = IO(REG_NR10);
+	u16 delta = sweepShadow >> (nr10 & 0x07);
+	u16 target = nr10 & 0x08 ? sweepShadow - delta : sweepShadow + delta;
+
+	if (target > 2047)
+		channels[APU_SQUARE1].enabled = false;
+	return target;
+}
+
+/* square 1's frequency moves, NR13 and NR14 included, and is checked again for overflow */
+void Apu::ClockSweep()
+{
+	u8 nr10 = IO(REG_NR10);
+	u16 target;
+
+	if (sweepTimer > 1) {
+		sweepTimer--;
+		return;
+	}
+	sweepTimer = (nr10 >> 4) & 0x07 ? (nr10 >> 4) & 0x07 : 8;
+	if (!sweepEnabled || !((nr10 >> 4) & 0x07))
+		return;
+	target = SweepTarget();
+	if (target <= 2047 && (nr10 & 0x07)) {
+		sweepShadow = target;
+		IO(REG_NR13) = target & 0xFF;
+		IO(REG_NR14) = (IO(REG_NR14) & ~0x07) | (target >> 8);
+		SweepTarget();
+	}
+}
+
+/* length on even steps, sweep on 2 and 6, envelopes on 7 */
+void Apu::ClockSequencer()
+{
+	for (u32 ch = 0; ch < APU_CHANNEL_COUNT && !(sequencerStep & 1); ch++) {
+		Channel& c = channels[ch];
+
+		if ((NR(ch, 4) & NRX4_LENGTH_ENABLE) && c.length && !--c.length)
+			c.enabled = false;
+	}
+	if (sequencerStep == 2 || sequencerStep == 6)
+		ClockSweep();
+	for (u32 ch = 0; ch < APU_CHANNEL_COUNT && sequencerStep == 7; ch++) {
+		Channel& c = channels[ch];
+		u8 envelope = NR(ch, 2);
+
+		if (ch == APU_WAVE || !(envelope & 0x07))
+			continue;
+		if (c.envelopeTimer > 1) {
+			c.envelopeTimer--;
+			continue;
+		}
+		c.envelopeTimer = envelope & 0x07;
+		if ((envelope & 0x08) && c.volume < 15)
+			c.volume++;
+		else if (!(envelope & 0x08) && c.volume)
+			c.volume--;
+	}
+	sequencerStep = (sequencerStep + 1) & 7;
+}
+
+/* off clears NR10 to NR51 and stops every channel; on restarts the frame sequencer */
+void Apu::SetPower(bool on)
+{
+	if (!on) {
+		for (u16 addr = REG_NR10; addr < REG_NR52; addr++)
+			IO(addr) = 0;
+		for (Channel& c : channels)
+			c.enabled = false;
+		sweepEnabled = false;
+	} else if (!(IO(REG_NR52) & NR52_POWER)) {
+		sequencerCycles = APU_SEQUENCER_T_CYCLES;
+		sequencerStep = 0;
+	}
+	IO(REG_NR52) = on ? NR52_POWER : 0;
+}
+
+void Apu::Step(u32 ch, u64 steps)
+{
+	Channel& c = channels[ch];
+
+	stats.steps += steps;
+	switch (ch) {
+	case APU_WAVE:
+		c.position = (c.position + steps) & 31;
+		break;
+	case APU_NOISE:
+		for (u64 i = 0; i < steps; i++) {
+			u16 bit = (c.lfsr ^ (c.lfsr >> 1)) & 1;
+
+			c.lfsr = (c.lfsr >> 1) | (bit << 14);
+			if (IO(REG_NR43) & 0x08)
+				c.lfsr = (c.lfsr & ~0x40) | (bit << 6);
+		}
+		break;
+	default:
+		c.position = (c.position + steps) & 7;
+		break;
+	}
+}
+
+/*
+	Takes the channel's waveform steps before end. An averaged tone only moves its position.
+	Otherwise each step is emitted, or with steps shorter than an output sample, the last
+	of every group that fits in one.
+*/
+void Apu::RunChannel(u32 ch, u64 end)
+{
+	Channel& c = channels[ch];
+	u32 period = Period(ch);
+	bool averaged;
+	u64 group, when;
+
+	if (!c.enabled || !period)
+		return;
+	averaged = Averaged(ch, period);
+	group = period < cyclesPerSample ? cyclesPerSample / period : 1;
+	when = syncTime + c.untilStep;
+	while (when < end) {
+		u64 steps = (end - when + period - 1) / period;
+
+		if (!averaged)
+			steps = std::min(steps, group);
+		Step(ch, steps);
+		when += steps * period;
+		if (!averaged)
+			Emit(ch, when - period);
+	}
+	c.untilStep = when - end;
+}
+
+/* the channel's level through NR51 and NR50 into each side, as a step wherever it changed */
+void Apu::Emit(u32 ch, u64 when)
+{
+	Channel& c = channels[ch];
+	i32 amplitude = Amplitude(ch) * AMPLITUDE_SCALE;
+	u8 panning = IO(REG_NR51);
+	u8 volume = IO(REG_NR50);
+	std::array<i32, 2> out = {
+		(panning >> (4 + ch)) & 1 ? amplitude * (((volume >> 4) & 0x07) + 1) : 0,
+		(panning >> ch) & 1 ? amplitude * ((volume & 0x07) + 1) : 0,
+	};
+
+	for (u32 side = 0; side < 2; side++) {
+		if (out[side] != c.out[side]) {
+			AddDelta(side, when, out[side] - c.out[side]);
+			c.out[side] = out[side];
+		}
+	}
+}
+
+/* after a register write or a sequencer clock: every channel's level as of syncTime */
+void Apu::Refresh()
+{
+	if (!Synthesizing())
+		return;
+	for (u32 ch = 0; ch < APU_CHANNEL_COUNT; ch++)
+		Emit(ch, syncTime);
+}
+
+void Apu::AddDelta(u32 side, u64 when, i32 delta)
+{
+	u64 pos = writePos + (when - syncTime) * sampleRate;
+	const std::array<i32, BLEP_TAPS>& impulse = Kernel()[(pos % APU_CLOCK_HZ) * BLEP_PHASES / APU_CLOCK_HZ];
+	i32* out = buffer[side].data() + pos / APU_CLOCK_HZ;
+
+	stats.deltas++;
+	for (u32 i = 0; i < BLEP_TAPS; i++)
+		out[i] += delta * impulse[i];
+}
+
+/*
+	Sums the first count samples of each side into the output level and drops them from
+	the buffer. With out, they are written there interleaved, left first, after the
+	high-pass the DMG has on its output.
+*/
+void Apu::Consume(size_t count, i16* out)
+{
+	size_t live = writePos / APU_CLOCK_HZ + BLEP_TAPS;
+
+	for (u32 side = 0; side < 2; side++) {
+		std::vector<i32>& samples = buffer[side];
+
+		for (size_t i = 0; i < count; i++) {
+			i64 sample;
+
+			level[side] += samples[i];
+			if (!out)
+				continue;
+			sample = static_cast<i64>(level[side] >> BLEP_UNIT_SHIFT) << 16;
+			highPass[side] += (sample - highPass[side]) >> HIGH_PASS_SHIFT;
+			out[i * 2 + side] = static_cast<i16>(std::clamp<i64>((sample - highPass[side]) >> 16, INT16_MIN, INT16_MAX));
+		}
+		std::copy(samples.begin() + count, samples.begin() + live, samples.begin());
+		std::fill(samples.begin() + live - count, samples.begin() + live, 0);
+	}
+	writePos -= count * APU_CLOCK_HZ;
+}
+
+/*
+	Runs everything up to now, one frame sequencer period at a time at most. Samples the
+	host has not read for APU_BUFFER_SAMPLES are dropped to make room.
+*/
+void Apu::CatchUp(u64 now)
+{
+	while (syncTime < now) {
+		u64 end = std::min(now, syncTime + sequencerCycles);
+
+		if (Synthesizing()) {
+			u64 last = (writePos + (end - syncTime) * sampleRate) / APU_CLOCK_HZ;
+
+			if (last > APU_BUFFER_SAMPLES)
+				Consume(last - APU_BUFFER_SAMPLES, nullptr);
+			for (u32 ch = 0; ch < APU_CHANNEL_COUNT; ch++)
+				RunChannel(ch, end);
+			writePos += (end - syncTime) * sampleRate;
+		}
+		sequencerCycles -= end - syncTime;
+		syncTime = end;
+		if (!sequencerCycles) {
+			sequencerCycles = APU_SEQUENCER_T_CYCLES;
+			if (IO(REG_NR52) & NR52_POWER) {
+				ClockSequencer();
+				Refresh();
+			}
+		}
+	}
+}
+
+/* NR52 reports which channels are still on, which needs length and sweep up to date */
+u8 Apu::Read(u16 addr)
+{
+	u8 val = IO(REG_NR52) | readMasks[REG_NR52 - REG_NR10];
+
+	if (addr >= REG_WAVE_RAM)
+		return IO(addr);
+	if (addr != REG_NR52)
+		return IO(addr) | readMasks[addr - REG_NR10];
+	CatchUp(scheduler->Now());
+	for (u32 ch = 0; ch < APU_CHANNEL_COUNT; ch++)
+		val |= channels[ch].enabled << ch;
+	return val;
+}
+
+/* everything before the write is synthesized with the old value. Powered off, only NR52 and wave RAM take writes */
+void Apu::Write(u16 addr, u8 val)
+{
+	u32 ch = (addr - REG_NR10) / 5;
+
+	CatchUp(scheduler->Now());
+	if (addr == REG_NR52) {
+		SetPower(val & NR52_POWER);
+	} else if (addr >= REG_WAVE_RAM) {
+		IO(addr) = val;
+	} else if (addr > REG_NR52 || !(IO(REG_NR52) & NR52_POWER)) {
+		return;
+	} else if (addr >= REG_NR50) {
+		IO(addr) = val;
+	} else {
+		IO(addr) = val;
+		if ((addr - REG_NR10) % 5 == 1)
+			channels[ch].length = ch == APU_WAVE ? 256 - val : 64 - (val & 0x3F);
+		if ((addr - REG_NR10) % 5 == 4 && (val & NRX4_TRIGGER))
+			Trigger(ch);
+		if (!DacOn(ch))
+			channels[ch].enabled = false;
+	}
+	Refresh();
+}
+
+/* brings the APU, and the samples ready for the host, up to the clock */
+void Apu::Sync()
+{
+	CatchUp(scheduler->Now());
+}
+
+/* up to count stereo samples, interleaved left then right; returns how many were written */
+size_t Apu::ReadSamples(i16* out, size_t count)
+{
+	CatchUp(scheduler->Now());
+	count = std::min<size_t>(count, writePos / APU_CLOCK_HZ);
+	Consume(count, out);
+	stats.samples += count;
+	return count;
+}
+
+/* drops the samples not read yet */
+int Apu::SetSampleRate(u32 rate)
+{
+	if (!IN_RANGE(rate, APU_MIN_SAMPLE_RATE, APU_MAX_SAMPLE_RATE))
+		return STT_FAILED;
+	CatchUp(scheduler->Now());
+	sampleRate = rate;
+	cyclesPerSample = APU_CLOCK_HZ / rate;
+	writePos = 0;
+	for (std::vector<i32>& samples : buffer)
+		std::fill(samples.begin(), samples.end(), 0);
+	return STT_SUCCESS;
+}
+
+u32 Apu::SampleRate() const
+{
+	return sampleRate;
+}
+
+/* no synthesis at all; registers, NR52 and the timing of the channels still behave */
+void Apu::SetHeadless(bool enable)
+{
+	CatchUp(scheduler->Now());
+	headless = enable;
+	Refresh();
+}
+
+/* with output off, emulated time goes by without producing samples, see Emulator::SetOutputEnabled() */
+void Apu::SetOutputEnabled(bool enable)
+{
+	CatchUp(scheduler->Now());
+	outputEnabled = enable;
+	Refresh();
+}
+
+const ApuStats& Apu::GetStats() const
+{
+	return stats;
+}
+
+/* caught up first, so the same machine saves the same bytes however often it was synced */
+void Apu::SaveState(ApuSaveState& save)
+{
+	CatchUp(scheduler->Now());
+	save = {};
+	save.syncTime = syncTime;
+	save.sequencerCycles = sequencerCycles;
+	save.sweepShadow = sweepShadow;
+	save.sequencerStep = sequencerStep;
+	save.sweepEnabled = sweepEnabled;
+	save.sweepTimer = sweepTimer;
+	for (u32 ch = 0; ch < APU_CHANNEL_COUNT; ch++) {
+		save.lengths[ch] = channels[ch].length;
+		save.enabled[ch] = channels[ch].enabled;
+		save.volumes[ch] = channels[ch].volume;
+		save.envelopeTimers[ch] = channels[ch].envelopeTimer;
+	}
+}
+
+/*
+	Expects the bus restored, the registers are read from its I/O page. Samples already
+	produced stay where they are and the restored levels follow on from them, so loading
+	does not click or rewind the output.
+*/
+void Apu::LoadState(const ApuSaveState& save)
+{
+	syncTime = save.syncTime;
+	sequencerCycles = save.sequencerCycles;
+	sweepShadow = save.sweepShadow;
+	sequencerStep = save.sequencerStep;
+	sweepEnabled = save.sweepEnabled;
+	sweepTimer = save.sweepTimer;
+	for (u32 ch = 0; ch < APU_CHANNEL_COUNT; ch++) {
+		channels[ch].length = save.lengths[ch];
+		channels[ch].enabled = save.enabled[ch];
+		channels[ch].volume = save.volumes[ch];
+		channels[ch].envelopeTimer = save.envelopeTimers[ch];
+		channels[ch].untilStep = std::min(channels[ch].untilStep, Period(ch));
+	}
+	Refresh();
+}
+
+/* starts powered off, as NR52 in the I/O page says until the boot ROM turns it on */
+Apu::Apu(Bus* pBus, Scheduler* pScheduler) : bus(pBus), scheduler(pScheduler)
+{
+	io = bus->IoRegisters();
+	cyclesPerSample = APU_CLOCK_HZ / sampleRate;
+	for (std::vector<i32>& samples : buffer)
+		samples.assign(APU_BUFFER_SAMPLES + BLEP_TAPS, 0);
+	bus->SetApu(this);
+}
+
+Apu::~Apu()
+{
+
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "common.h"
+#include "scheduler.h"
+#include <cstddef>
+#include <vector>
+
+class Bus;
+
+#define APU_CLOCK_HZ			4194304
+#define APU_SEQUENCER_T_CYCLES	8192			// 512 Hz: length, sweep and envelope clocks
+#define APU_DEFAULT_SAMPLE_RATE	48000
+#define APU_MIN_SAMPLE_RATE		8000
+#define APU_MAX_SAMPLE_RATE		192000
+#define APU_BUFFER_SAMPLES		8192			// per side, held until read; older ones are dropped
+#define APU_REG_END				0xFF3F			// NR10 to the end of wave RAM
+
+#define NR52_POWER				(1U << 7)
+#define NRX4_TRIGGER			(1U << 7)
+#define NRX4_LENGTH_ENABLE		(1U << 6)
+
+#define BLEP_TAPS				16
+#define BLEP_PHASES				64				// sub-sample positions a step can land on
+#define BLEP_UNIT_SHIFT			13				// each impulse sums to 1 << BLEP_UNIT_SHIFT
+
+typedef enum {
+	APU_SQUARE1,
+	APU_SQUARE2,
+	APU_WAVE,
+	APU_NOISE,
+	APU_CHANNEL_COUNT,
+} ApuChannelId;
+
+/*
+	savestate block, see savestate.h. The registers and wave RAM are saved with the bus I/O
+	page. Waveform positions and the noise LFSR only shape the sound, nothing a game can
+	read, and are left out so a headless machine saves the same bytes as one with audio.
+*/
+typedef struct ApuSaveState {
+	u64 syncTime;
+	u32 sequencerCycles;
+	u16 sweepShadow;
+	u8 sequencerStep;
+	u8 sweepEnabled;
+	u16 lengths[APU_CHANNEL_COUNT];
+	u8 enabled[APU_CHANNEL_COUNT];
+	u8 volumes[APU_CHANNEL_COUNT];
+	u8 envelopeTimers[APU_CHANNEL_COUNT];
+	u8 sweepTimer;
+	u8 reserved[3];
+} ApuSaveState;
+
+typedef struct ApuStats {
+	u64 steps;				// waveform steps taken
+	u64 deltas;				// band-limited steps put in the buffer
+	u64 samples;			// stereo samples handed out
+} ApuStats;
+
+/*
+	Two square channels, the wave channel and noise, synthesized only when something needs
+	them to be up to date: an NRxx or wave RAM write, an NR52 read, a savestate and the host
+	asking for samples. Catching up runs each channel from one waveform step to the next and
+	puts a band-limited step (BLEP) in the output buffer wherever its level changes, at the
+	sub-sample position it changed at, so the 4 MHz signal is never generated or filtered;
+	the buffer holds the steps' impulses and is summed as it is read. A channel whose tone
+	is above the output Nyquist frequency plays its average level, and faster steps are
+	taken in groups of one output sample, so the cost follows register activity and the
+	output sample rate rather than the emulated clock.
+	The frame sequencer is clocked during the same catch-up every 8192 T-cycles from power
+	on; it does not follow DIV resets. Length, sweep and envelope always run, since NR52
+	shows them; headless, or with output off, the waveforms and the buffer stand still.
+*/
+class Apu {
+private:
+	typedef struct Channel {
+		bool enabled;
+		u16 length;					// length counter, the channel stops when it runs out
+		u8 volume;					// envelope
+		u8 envelopeTimer;
+		u32 untilStep;				// T-cycles from syncTime to the next waveform step
+		u32 position;				// duty step or wave sample
+		u16 lfsr;
+		std::array<i32, 2> out;		// level last put in the left and right buffers
+	} Channel;
+
+	Bus* bus;
+	Scheduler* scheduler;
+	u8* io;
+	std::array<Channel, APU_CHANNEL_COUNT> channels = {};
+	u64 syncTime = 0;				// T-cycle everything is up to date for
+	u32 sequencerCycles = APU_SEQUENCER_T_CYCLES;
+	u8 sequencerStep = 0;
+	bool sweepEnabled = false;
+	u8 sweepTimer = 0;
+	u16 sweepShadow = 0;
+	bool headless = false;
+	bool outputEnabled = true;
+	u32 sampleRate = APU_DEFAULT_SAMPLE_RATE;
+	u32 cyclesPerSample;
+	u64 writePos = 0;				// where syncTime falls in the buffer, in 1/APU_CLOCK_HZ samples
+	std::array<std::vector<i32>, 2> buffer;
+	std::array<i32, 2> level = {};	// running sum of what was read, in 1 << BLEP_UNIT_SHIFT units
+	std::array<i64, 2> highPass = {};
+	ApuStats stats = {};
+
+	bool Synthesizing() const { return !headless && outputEnabled; }
+	bool DacOn(u32) const;
+	u16 Frequency(u32) const;
+	u32 Period(u32) const;
+	bool Averaged(u32, u32) const;
+	i32 Amplitude(u32) const;
+	void Trigger(u32);
+	u16 SweepTarget();
+	void ClockSweep();
+	void ClockSequencer();
+	void SetPower(bool);
+	void Step(u32, u64);
+	void RunChannel(u32, u64);
+	void Emit(u32, u64);
+	void Refresh();
+	void AddDelta(u32, u64, i32);
+	void Consume(size_t, i16*);
+	void CatchUp(u64);
+public:
+	u8 Read(u16);
+	void Write(u16, u8);
+	void Sync();
+	size_t ReadSamples(i16*, size_t);
+	int SetSampleRate(u32);
+	u32 SampleRate() const;
+	void SetHeadless(bool);
+	void SetOutputEnabled(bool);
+	const ApuStats& GetStats() const;
+	void SaveState(ApuSaveState&);
+	void LoadState(const ApuSaveState&);
+	Apu(Bus*, Scheduler*);
+	Apu(const Apu&) = delete;
+	Apu& operator=(const Apu&) = delete;
+	~Apu();
+};
\ No newline at end of file
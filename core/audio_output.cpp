@@ -0,0 +1,136 @@
+#include "audio_output.h"
+#include <algorithm>
+#include <chrono>
+
+#define FIXED_ONE				(1ULL << 32)
+
+/* emulation thread: output frames at 1 / ratio input frames apart, lastInput then input[0..count) */
+size_t AudioOutput::Resample(size_t count)
+{
+	u64 step = static_cast<u64>(FIXED_ONE / ratio);
+	u64 end = static_cast<u64>(count) << 32;
+	size_t frames = 0;
+
+	for (; phase < end; phase += step, frames++) {
+		size_t i = phase >> 32;
+		i64 frac = (phase >> 16) & 0xFFFF;
+
+		/* a full-scale step times a 16-bit fraction does not fit in 32 bits */
+		for (u32 side = 0; side < 2; side++) {
+			i64 from = i ? input[(i - 1) * 2 + side] : lastInput[side];
+			i64 to = input[i * 2 + side];
+
+			output[frames * 2 + side] = static_cast<i16>(from + (((to - from) * frac) >> 16));
+		}
+	}
+	phase -= end;
+	lastInput = { input[(count - 1) * 2], input[(count - 1) * 2 + 1] };
+	return frames;
+}
+
+/*
+	Emulation thread, after each frame or so: moves everything the APU has into the ring.
+	The ratio is set once per call from the fill, a ring over the target gets fewer frames
+	per APU frame and one under it more. Frames that do not fit are dropped and counted.
+*/
+void AudioOutput::Produce()
+{
+	double error;
+	size_t count;
+
+	lastFill = ring.Fill();
+	error = std::clamp((static_cast<double>(lastFill) - targetFill) / (targetFill * AUDIO_CONTROL_SPAN), -1.0, 1.0);
+	drift = std::clamp(drift - AUDIO_DRIFT_GAIN * error, -maxRateDelta, maxRateDelta);
+	ratio = 1.0 + std::clamp(drift - maxRateDelta * error, -maxRateDelta, maxRateDelta);
+	while ((count = emulator->ReadAudio(input.data(), AUDIO_READ_FRAMES))) {
+		size_t frames = Resample(count);
+		size_t taken = ring.Write(output.data(), frames);
+
+		produced += taken;
+		overrunFrames += frames - taken;
+	}
+}
+
+/*
+	Audio thread, or a device callback: fills frames with what the ring has. Silence until
+	the ring has first reached the target, then the last frame held over any shortfall.
+	Returns the frames that came from the ring.
+*/
+size_t AudioOutput::Pull(i16* out, size_t frames)
+{
+	size_t count = 0;
+
+	if (!primed)
+		primed = ring.Fill() >= targetFill;
+	if (primed)
+		count = ring.Read(out, frames);
+	if (count)
+		lastOutput = { out[(count - 1) * 2], out[(count - 1) * 2 + 1] };
+	for (size_t i = count; i < frames; i++) {
+		out[i * 2] = lastOutput[0];
+		out[i * 2 + 1] = lastOutput[1];
+	}
+	played.fetch_add(count, std::memory_order_relaxed);
+	if (primed)
+		underrunFrames.fetch_add(frames - count, std::memory_order_relaxed);
+	return count;
+}
+
+/* audio thread: one period to the sink per period of real time, on a schedule that does not drift */
+void AudioOutput::Play()
+{
+	std::chrono::duration<double> periodTime(static_cast<double>(sink->PeriodFrames()) / sink->SampleRate());
+	auto start = std::chrono::steady_clock::now();
+
+	for (u64 periods = 1; !stopping.load(std::memory_order_acquire); periods++) {
+		std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(periodTime * periods));
+		Pull(period.data(), sink->PeriodFrames());
+		sink->Play(period.data(), sink->PeriodFrames());
+	}
+}
+
+/* drives the sink from an audio thread of its own; a device with its own callback calls Pull() instead */
+void AudioOutput::Start()
+{
+	if (worker.joinable())
+		return;
+	stopping.store(false, std::memory_order_release);
+	worker = std::thread(&AudioOutput::Play, this);
+}
+
+void AudioOutput::Stop()
+{
+	stopping.store(true, std::memory_order_release);
+	if (worker.joinable())
+		worker.join();
+}
+
+/* emulation thread */
+AudioStats AudioOutput::Stats() const
+{
+	AudioStats stats;
+
+	stats.produced = produced;
+	stats.played = played.load(std::memory_order_relaxed);
+	stats.underrunFrames = underrunFrames.load(std::memory_order_relaxed);
+	stats.overrunFrames = overrunFrames;
+	stats.fill = lastFill;
+	stats.ratio = ratio;
+	stats.latencyMs = (lastFill + sink->PeriodFrames()) * 1000.0 / sink->SampleRate();
+	return stats;
+}
+
+/* the APU is set to the sink's rate, so the ratio only ever carries the correction */
+AudioOutput::AudioOutput(Emulator* pEmulator, AudioSink* pSink, u32 latencyMs, double pMaxRateDelta) : emulator(pEmulator), sink(pSink),
+	ring(std::max<size_t>(AUDIO_RING_FRAMES, static_cast<size_t>(latencyMs) * pSink->SampleRate() / 500)),
+	targetFill(std::max<size_t>(1, static_cast<size_t>(latencyMs) * pSink->SampleRate() / 1000)), maxRateDelta(pMaxRateDelta),
+	input(AUDIO_READ_FRAMES * 2), output((static_cast<size_t>(AUDIO_READ_FRAMES / (1.0 - pMaxRateDelta)) + 2) * 2),
+	period(pSink->PeriodFrames() * 2)
+{
+	emulator->SetAudioSampleRate(sink->SampleRate());
+}
+
+AudioOutput::~AudioOutput()
+{
+	Stop();
+}
\ No newline at end of file
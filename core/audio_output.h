@@ -0,0 +1,81 @@
+#pragma once
+
+#include "common.h"
+#include "emulator.h"
+#include "audio_ring.h"
+#include "audio_sink.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define AUDIO_RING_FRAMES			4096
+#define AUDIO_DEFAULT_LATENCY_MS	20			// ring fill aimed for, a device period comes on top
+#define AUDIO_MAX_RATE_DELTA		0.005		// furthest the rate is bent from nominal, inaudible
+#define AUDIO_CONTROL_SPAN			0.25		// of the target: a fill this far off gets the whole delta
+#define AUDIO_DRIFT_GAIN			0.00004		// how fast the steady correction follows the fill, per Produce()
+#define AUDIO_READ_FRAMES			1024		// taken from the APU at a time
+
+typedef struct AudioStats {
+	u64 produced;					// frames into the ring
+	u64 played;						// frames out of it
+	u64 underrunFrames;				// frames the ring came up short, played as the last frame held
+	u64 overrunFrames;				// frames the ring had no room for, dropped
+	size_t fill;					// frames in the ring when last produced
+	double ratio;					// output frames per APU frame last used
+	double latencyMs;				// fill and one device period
+} AudioStats;
+
+/*
+	Takes the APU's samples on the emulation thread and hands them to an AudioSink on an
+	audio thread through an AudioRing, with no lock on either side. The emulator and the
+	device never run at exactly the same rate, a frame rate of 59.73 Hz shown on a 60 Hz
+	host being the usual case, so the ring would slowly run dry or over. Dynamic rate
+	control keeps it near the target fill instead: each time frames are produced the
+	resampling ratio is set from how far the fill is from the target, bent by at most
+	AUDIO_MAX_RATE_DELTA once it is AUDIO_CONTROL_SPAN of the target out. That moves pitch by well under what can be heard. A slow drift
+	term learns the steady difference between the two rates, so the fill, and with it the
+	latency, settles on the target rather than wherever the correction balances it.
+	The resampler interpolates linearly; the APU output is band-limited already and the
+	ratio stays within a fraction of a percent of 1. The audio thread does not start
+	playing until the ring first reaches the target, and an underrun repeats the last frame
+	rather than dropping to 0, so neither starting nor running short pops.
+*/
+class AudioOutput {
+private:
+	Emulator* emulator;
+	AudioSink* sink;
+	AudioRing ring;
+	size_t targetFill;
+	double maxRateDelta;
+	/* emulation thread */
+	std::vector<i16> input;
+	std::vector<i16> output;
+	std::array<i16, 2> lastInput = {};
+	u64 phase = 0;					// output position past lastInput, 32.32 input frames
+	double ratio = 1.0;
+	double drift = 0;				// the steady part of the correction
+	u64 produced = 0;
+	u64 overrunFrames = 0;
+	size_t lastFill = 0;
+	/* audio thread */
+	std::array<i16, 2> lastOutput = {};
+	bool primed = false;
+	std::vector<i16> period;
+	std::atomic<u64> played = 0;
+	std::atomic<u64> underrunFrames = 0;
+	std::atomic<bool> stopping = false;
+	std::thread worker;
+
+	size_t Resample(size_t);
+	void Play();
+public:
+	void Produce();
+	size_t Pull(i16*, size_t);
+	void Start();
+	void Stop();
+	AudioStats Stats() const;
+	AudioOutput(Emulator*, AudioSink*, u32 = AUDIO_DEFAULT_LATENCY_MS, double = AUDIO_MAX_RATE_DELTA);
+	AudioOutput(const AudioOutput&) = delete;
+	AudioOutput& operator=(const AudioOutput&) = delete;
+	~AudioOutput();
+};
\ No newline at end of file
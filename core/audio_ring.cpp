@@ -0,0 +1,59 @@
+#include "audio_ring.h"
+#include <algorithm>
+#include <bit>
+
+/* producer: copies up to count frames in, in at most two runs, and returns how many fit */
+size_t AudioRing::Write(const i16* frames, size_t count)
+{
+	u32 head = written.load(std::memory_order_relaxed);
+	u32 tail = read.load(std::memory_order_acquire);
+	size_t start = head & mask;
+	size_t first;
+
+	count = std::min<size_t>(count, Capacity() - (head - tail));
+	first = std::min(count, Capacity() - start);
+	std::copy(frames, frames + first * 2, samples.begin() + start * 2);
+	std::copy(frames + first * 2, frames + count * 2, samples.begin());
+	written.store(head + count, std::memory_order_release);
+	return count;
+}
+
+/* consumer: copies up to count frames out and returns how many there were */
+size_t AudioRing::Read(i16* frames, size_t count)
+{
+	u32 tail = read.load(std::memory_order_relaxed);
+	u32 head = written.load(std::memory_order_acquire);
+	size_t start = tail & mask;
+	size_t first;
+
+	count = std::min<size_t>(count, head - tail);
+	first = std::min(count, Capacity() - start);
+	std::copy(samples.begin() + start * 2, samples.begin() + (start + first) * 2, frames);
+	std::copy(samples.begin(), samples.begin() + (count - first) * 2, frames + first * 2);
+	read.store(tail + count, std::memory_order_release);
+	return count;
+}
+
+/* frames waiting; exact on either thread for its own side, a snapshot otherwise */
+size_t AudioRing::Fill() const
+{
+	u32 tail = read.load(std::memory_order_acquire);
+
+	return written.load(std::memory_order_acquire) - tail;
+}
+
+size_t AudioRing::Capacity() const
+{
+	return mask + 1;
+}
+
+/* frames is rounded up to a power of two */
+AudioRing::AudioRing(size_t frames) : samples(std::bit_ceil(frames) * 2, 0), mask(std::bit_ceil(frames) - 1)
+{
+
+}
+
+AudioRing::~AudioRing()
+{
+
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#define AUDIO_CACHE_LINE		64
+
+/*
+	Single-producer, single-consumer ring of stereo frames, two i16 each, left first. The
+	emulation thread writes and the audio thread reads, each owning one free-running
+	counter; a side publishes its counter with a release store after touching the frames
+	and reads the other's with an acquire load, so neither ever waits or locks. The
+	counters sit on cache lines of their own to keep the two threads from sharing one.
+	A full ring takes what fits and an empty one gives what it has: the caller decides
+	what to do with the rest.
+*/
+class AudioRing {
+private:
+	std::vector<i16> samples;
+	u32 mask;						// frames - 1, the capacity is a power of two
+	alignas(AUDIO_CACHE_LINE) std::atomic<u32> written = 0;
+	alignas(AUDIO_CACHE_LINE) std::atomic<u32> read = 0;
+public:
+	size_t Write(const i16*, size_t);
+	size_t Read(i16*, size_t);
+	size_t Fill() const;
+	size_t Capacity() const;
+	AudioRing(size_t);
+	AudioRing(const AudioRing&) = delete;
+	AudioRing& operator=(const AudioRing&) = delete;
+	~AudioRing();
+};
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include "audio_sink.h"
+#include <bit>
+
+#define WAV_HEADER_BYTES		44
+#define WAV_FRAME_BYTES			4
+
+void NullAudioSink::Play(const i16* samples, size_t count)
+{
+	frames += count;
+}
+
+u64 NullAudioSink::Frames() const
+{
+	return frames;
+}
+
+NullAudioSink::NullAudioSink(u32 rate, u32 period) : sampleRate(rate), periodFrames(period)
+{
+
+}
+
+NullAudioSink::~NullAudioSink()
+{
+
+}
+
+/* RIFF, little-endian; the data size is whatever was played so far */
+void WavFileSink::WriteHeader()
+{
+	u32 dataBytes = static_cast<u32>(frames * WAV_FRAME_BYTES);
+	u32 fields[] = {
+		0x46464952, WAV_HEADER_BYTES - 8 + dataBytes, 0x45564157,		// "RIFF" size "WAVE"
+		0x20746D66, 16, 0x00020001, sampleRate,							// "fmt " size, PCM, 2 channels
+		sampleRate * WAV_FRAME_BYTES, 0x00100000 | WAV_FRAME_BYTES,		// byte rate, block align, 16 bits
+		0x61746164, dataBytes,											// "data" size
+	};
+
+	static_assert(sizeof(fields) == WAV_HEADER_BYTES && std::endian::native == std::endian::little);
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+}
+
+void WavFileSink::Play(const i16* samples, size_t count)
+{
+	file.write(reinterpret_cast<const char*>(samples), count * WAV_FRAME_BYTES);
+	frames += count;
+}
+
+bool WavFileSink::IsOpen() const
+{
+	return file.is_open() && file.good();
+}
+
+u64 WavFileSink::Frames() const
+{
+	return frames;
+}
+
+WavFileSink::WavFileSink(const char* path, u32 rate, u32 period) : file(path, std::ios::binary), sampleRate(rate), periodFrames(period)
+{
+	if (file)
+		WriteHeader();
+}
+
+WavFileSink::~WavFileSink()
+{
+	if (!file)
+		return;
+	WriteHeader();
+	file.close();
+}
\ No newline at end of file
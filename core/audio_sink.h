@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common.h"
+#include <cstddef>
+#include <fstream>
+
+#define AUDIO_DEFAULT_PERIOD_FRAMES	256
+
+/*
+	Where the sound goes. A device backend plays each period it is given and says how big
+	its periods are and at what rate it plays them; AudioOutput calls Play() on its audio
+	thread once per period of real time, standing in for the device's own callback. The
+	sinks here have no device behind them and stand in for one in tests and headless runs.
+*/
+class AudioSink {
+public:
+	virtual u32 SampleRate() const = 0;
+	virtual u32 PeriodFrames() const = 0;
+	/* audio thread: one period of stereo frames, left first */
+	virtual void Play(const i16*, size_t) = 0;
+	virtual ~AudioSink() = default;
+};
+
+/* drops everything, counting what went by */
+class NullAudioSink : public AudioSink {
+private:
+	u32 sampleRate;
+	u32 periodFrames;
+	u64 frames = 0;
+public:
+	u32 SampleRate() const override { return sampleRate; }
+	u32 PeriodFrames() const override { return periodFrames; }
+	void Play(const i16*, size_t) override;
+	u64 Frames() const;
+	NullAudioSink(u32, u32 = AUDIO_DEFAULT_PERIOD_FRAMES);
+	~NullAudioSink();
+};
+
+/* 16-bit stereo PCM .wav; the header's sizes are filled in when the sink is destroyed */
+class WavFileSink : public AudioSink {
+private:
+	std::ofstream file;
+	u32 sampleRate;
+	u32 periodFrames;
+	u64 frames = 0;
+
+	void WriteHeader();
+public:
+	u32 SampleRate() const override { return sampleRate; }
+	u32 PeriodFrames() const override { return periodFrames; }
+	void Play(const i16*, size_t) override;
+	bool IsOpen() const;
+	u64 Frames() const;
+	WavFileSink(const char*, u32, u32 = AUDIO_DEFAULT_PERIOD_FRAMES);
+	WavFileSink(const WavFileSink&) = delete;
+	WavFileSink& operator=(const WavFileSink&) = delete;
+	~WavFileSink();
+};
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include "batch_runner.h"
+#include <algorithm>
+#include <chrono>
+
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+static double Percentile(const std::vector<u32>& sorted, double fraction)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))] / 1000.0;
+}
+
+/* home worker, first round */
+void BatchRunner::Create(u32 index)
+{
+	const std::string& rom = config.roms[index % config.roms.size()];
+
+	instances[index] = std::make_unique<Emulator>();
+	if (instances[index]->Load(rom.c_str()) != STT_SUCCESS) {
+		failed[index] = 1;
+		return;
+	}
+	if (config.headless) {
+		instances[index]->SetRenderMode(RENDER_NONE);
+		instances[index]->SetAudioEnabled(false);
+	}
+}
+
+void BatchRunner::RunQuantum(u32 index, u64 frames)
+{
+	auto start = std::chrono::steady_clock::now();
+	u64 nanoseconds;
+
+	if (failed[index])
+		return;
+	for (u64 i = 0; i < frames; i++) {
+		if (instances[index]->RunFrame() != STT_SUCCESS) {
+			failed[index] = 1;
+			break;
+		}
+	}
+	nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	latencies[index].push_back(static_cast<u32>(std::min<u64>(nanoseconds, UINT32_MAX)));
+}
+
+/*
+	Runs config.frames more frames on every instance and reports on them. Creating and
+	loading the instances, on the first call, is not part of the time.
+*/
+BatchReport BatchRunner::Run()
+{
+	u32 count = static_cast<u32>(instances.size());
+	u64 quantum = std::max(1U, config.quantumFrames);
+	u64 rounds = (config.frames + quantum - 1) / quantum;
+	BatchReport report = {};
+	std::vector<u64> startFrames(count);
+	std::vector<u32> all;
+	WorkPoolStats before;
+
+	pool.Run(count, [&](u32 index, u32) {
+		if (!instances[index])
+			Create(index);
+		startFrames[index] = instances[index]->GetFrameCount();
+		latencies[index].clear();
+		latencies[index].reserve(rounds);
+	});
+	before = pool.Stats();
+	auto start = std::chrono::steady_clock::now();
+	for (u64 round = 0; round < rounds; round++) {
+		u64 frames = std::min(quantum, config.frames - round * quantum);
+
+		pool.Run(count, [&](u32 index, u32) { RunQuantum(index, frames); });
+	}
+	report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	report.pool = pool.Stats();
+	report.pool.rounds -= before.rounds;
+	report.pool.items -= before.items;
+	report.pool.steals -= before.steals;
+
+	report.instances = count;
+	report.threads = pool.Workers();
+	report.perInstance.resize(count);
+	for (u32 i = 0; i < count; i++) {
+		BatchInstanceReport& instance = report.perInstance[i];
+
+		std::sort(latencies[i].begin(), latencies[i].end());
+		instance.frames = instances[i]->GetFrameCount() - startFrames[i];
+		instance.failed = failed[i];
+		instance.p50Us = Percentile(latencies[i], 0.50);
+		instance.p99Us = Percentile(latencies[i], 0.99);
+		instance.maxUs = latencies[i].empty() ? 0 : latencies[i].back() / 1000.0;
+		report.frames += instance.frames;
+		report.failed += failed[i];
+		if (instance.p99Us > report.perInstance[report.slowestInstance].p99Us)
+			report.slowestInstance = i;
+		all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+	}
+	std::sort(all.begin(), all.end());
+	report.framesPerSecond = report.seconds > 0 ? report.frames / report.seconds : 0;
+	report.p50Us = Percentile(all, 0.50);
+	report.p90Us = Percentile(all, 0.90);
+	report.p99Us = Percentile(all, 0.99);
+	report.maxUs = all.empty() ? 0 : all.back() / 1000.0;
+	return report;
+}
+
+u32 BatchRunner::InstanceCount() const
+{
+	return static_cast<u32>(instances.size());
+}
+
+/* null until the first Run(); only between runs */
+Emulator* BatchRunner::Instance(u32 index)
+{
+	return instances[index].get();
+}
+
+BatchRunner::BatchRunner(const BatchConfig& pConfig) : config(pConfig), pool(pConfig.threads),
+	instances(pConfig.roms.empty() ? 0 : pConfig.instances), failed(instances.size(), 0), latencies(instances.size())
+{
+	if (config.roms.empty())
+		spdlog::error("The batch has no ROMs to run.");
+}
+
+BatchRunner::~BatchRunner()
+{
+
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "common.h"
+#include "emulator.h"
+#include "work_pool.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef struct BatchConfig {
+	std::vector<std::string> roms;		// instance i runs roms[i % roms.size()]
+	u32 instances = 1;
+	u64 frames = 600;					// per instance, each Run()
+	u32 threads = 0;					// 0: one per hardware thread
+	u32 quantumFrames = 1;				// frames an instance runs each time it is picked up
+	bool headless = true;				// no pixels drawn and no sound made
+} BatchConfig;
+
+/* quantum latencies are wall time in microseconds for one instance to run one quantum */
+typedef struct BatchInstanceReport {
+	u64 frames;
+	bool failed;						// did not load, or hit an invalid opcode
+	double p50Us;
+	double p99Us;
+	double maxUs;
+} BatchInstanceReport;
+
+typedef struct BatchReport {
+	u32 instances;
+	u32 threads;
+	u32 failed;
+	u64 frames;							// all instances together
+	double seconds;
+	double framesPerSecond;
+	double p50Us;						// over every quantum of every instance
+	double p90Us;
+	double p99Us;
+	double maxUs;
+	u32 slowestInstance;				// the highest p99
+	WorkPoolStats pool;
+	std::vector<BatchInstanceReport> perInstance;
+} BatchReport;
+
+/*
+	Runs many independent emulators, RL environments or a regression set, over a WorkPool.
+	Time is handed out in quanta of whole frames: each round every instance runs one
+	quantum, on the worker whose block it is in, which is the same one every round unless
+	it gets stolen, so an instance's state stays in one core's caches. Instances are
+	created and loaded by their home worker, so their memory is first touched there too.
+	Instances that fail stop where they failed and are left out of later rounds.
+*/
+class BatchRunner {
+private:
+	BatchConfig config;
+	WorkPool pool;
+	std::vector<std::unique_ptr<Emulator>> instances;
+	std::vector<u8> failed;
+	std::vector<std::vector<u32>> latencies;	// ns per quantum, this Run()
+
+	void Create(u32);
+	void RunQuantum(u32, u64);
+public:
+	BatchReport Run();
+	u32 InstanceCount() const;
+	Emulator* Instance(u32);
+	BatchRunner(const BatchConfig&);
+	BatchRunner(const BatchRunner&) = delete;
+	BatchRunner& operator=(const BatchRunner&) = delete;
+	~BatchRunner();
+};
\ No newline at end of file
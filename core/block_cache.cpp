@@ -0,0 +1,82 @@
+#include "block_cache.h"
+
+#define FRONT_INDEX(key)		(((key) ^ ((key) >> 16) * 0x9E5) & (BLOCK_FRONT_CACHE_SIZE - 1))
+#define NO_KEY					0xFFFFFFFFU
+
+void BlockCache::ClearFront()
+{
+	for (auto& i : front)
+		i = { NO_KEY, nullptr };
+}
+
+Block* BlockCache::Lookup(u32 key)
+{
+	FrontEntry& entry = front[FRONT_INDEX(key)];
+
+	stats.lookups++;
+	if (entry.key == key) {
+		stats.hits++;
+		return entry.block;
+	}
+
+	auto it = blocks.find(key);
+	if (it == blocks.end())
+		return nullptr;
+	stats.hits++;
+	entry = { key, &it->second };
+	return entry.block;
+}
+
+Block* BlockCache::Insert(u32 key, Block&& block, bool watchWrites)
+{
+	u8 firstPage = block.startPC >> 8, lastPage = (u16)(block.endPC - 1) >> 8;
+	auto [it, inserted] = blocks.insert_or_assign(key, std::move(block));
+
+	stats.builds++;
+	if (watchWrites) {
+		for (u8 page = firstPage;; page++) {
+			pageBlocks[page].push_back(key);
+			watchedPages[page] = true;
+			if (page == lastPage)
+				break;
+		}
+	}
+	front[FRONT_INDEX(key)] = { key, &it->second };
+	return &it->second;
+}
+
+/*
+	Called by the bus on a write to a watched page. Blocks spanning two pages are listed on
+	both, so a key may already be gone when the second page is dropped; erase() copes with that.
+*/
+void BlockCache::InvalidatePage(u8 page)
+{
+	for (u32 key : pageBlocks[page])
+		blocks.erase(key);
+	pageBlocks[page].clear();
+	watchedPages[page] = false;
+	generation++;
+	stats.invalidations++;
+	ClearFront();
+}
+
+void BlockCache::Clear()
+{
+	blocks.clear();
+	for (auto& i : pageBlocks)
+		i.clear();
+	watchedPages.fill(false);
+	generation++;
+	ClearFront();
+}
+
+BlockCache::BlockCache() : stats()
+{
+	watchedPages.fill(false);
+	ClearFront();
+}
+
+BlockCache::~BlockCache()
+{
+
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "common.h"
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+class Cpu;
+struct JitBlock;
+
+typedef void (Cpu::*OpHandler)();
+
+#define BLOCK_MAX_OPS				32
+#define BLOCK_FRONT_CACHE_SIZE		4096
+#define BLOCK_MAX_BRANCH_MCYCLES	3		// taken CALL cc/RET cc over baseMCycles
+
+/* code bank ids that are not ROM bank numbers */
+#define CODE_BANK_RAM				0xFFFE
+#define CODE_BANK_BOOT_ROM			0xFFFF
+
+/*
+	A predecoded instruction: the handler to call and the bytes it would have fetched.
+	CB-prefixed instructions point straight at their CB handler.
+*/
+typedef struct DecodedOp {
+	OpHandler handler;
+	u8 opcode;
+	u8 opr1;
+	u8 opr2;
+	u8 length;
+	u8 mCycles;
+} DecodedOp;
+
+/*
+	A straight run of instructions that ends at the first control flow instruction,
+	at a code bank boundary or after BLOCK_MAX_OPS instructions.
+*/
+typedef struct Block {
+	u16 startPC;
+	u16 endPC;
+	u16 bank;
+	u32 baseMCycles;	// without the extra cycles of taken branches
+	std::vector<DecodedOp> ops;
+	u32 execCount;
+	const JitBlock* jit;	// native code for a prefix of ops, if any
+	bool jitRejected;
+	bool idleLoop;		// branches back to startPC and only reads memory, see Cpu::SkipIdleLoop()
+} Block;
+
+typedef struct BlockCacheStats {
+	u64 lookups;
+	u64 hits;
+	u64 builds;
+	u64 invalidations;
+	u64 instructions;	// instructions run from cached blocks
+} BlockCacheStats;
+
+/*
+	Blocks are keyed by (code bank << 16 | PC). Blocks built from RAM register the pages
+	they cover, and any bus write to such a page drops every block on it.
+*/
+class BlockCache {
+private:
+	typedef struct FrontEntry {
+		u32 key;
+		Block* block;
+	} FrontEntry;
+
+	std::unordered_map<u32, Block> blocks;
+	std::array<FrontEntry, BLOCK_FRONT_CACHE_SIZE> front;
+	std::array<std::vector<u32>, 256> pageBlocks;
+	std::array<bool, 256> watchedPages;
+	u32 generation = 0;
+	BlockCacheStats stats;
+
+	void ClearFront();
+public:
+	Block* Lookup(u32 key);
+	Block* Insert(u32 key, Block&& block, bool watchWrites);
+	void InvalidatePage(u8 page);
+	void Clear();
+	bool IsWatched(u8 page) const { return watchedPages[page]; }
+	/* a ROM bank switch: cached blocks stay valid, but a running one must not go on */
+	void Remapped() { generation++; }
+	u32 Generation() const { return generation; }
+	BlockCacheStats& Stats() { return stats; }
+	BlockCache();
+	~BlockCache();
+};
\ No newline at end of file
@@ -1,44 +1,367 @@
 #include "bus.h"
+#include "ppu.h"
+#include "timer.h"
+#include "apu.h"
+#include <algorithm>
+
+#define PAGE_OF(addr)			((addr) >> BUS_PAGE_SHIFT)
+
+#define LY_STUB_VALUE			0x90
+#define BOOT_ROM_DISABLE		0xFF50
 
 /*
-	For now we only think about memory as a plain array.
+	The address space is a table of 256-byte pages. Memory-backed pages are read and
+	written through a host pointer, everything else goes through the page's handlers.
+	Remapping a page is all that test mode, the boot ROM overlay and bank switching do.
 */
 
-void Bus::Write(const u16 addr, const u8 val)
+void Bus::MapMemory(u8 firstPage, u32 count, u8* mem, u16 codeBank)
 {
-	if (cpuInstrTest) {
-		memory[addr] = val;
-	} else {
-		memory[addr] = val;
+	for (u32 i = 0; i < count; i++) {
+		MemPage& page = pages[firstPage + i];
+
+		page.read = page.write = mem + i * BUS_PAGE_SIZE;
+		page.readHandler = nullptr;
+		page.writeHandler = nullptr;
+		page.handlerCtx = nullptr;
+		page.codeBank = codeBank;
+	}
+}
+
+void Bus::MapHandler(u8 firstPage, u32 count, PageReadHandler readHandler, PageWriteHandler writeHandler,
+	void* ctx, u16 codeBank)
+{
+	for (u32 i = 0; i < count; i++) {
+		MemPage& page = pages[firstPage + i];
+
+		page.read = nullptr;
+		page.write = nullptr;
+		page.readHandler = readHandler;
+		page.writeHandler = writeHandler;
+		page.handlerCtx = ctx;
+		page.codeBank = codeBank;
+	}
+}
+
+/* ROM pages are read directly and send writes to the cartridge */
+void Bus::MapRomWindow(u8 window, u32 bank)
+{
+	const u8* base = rom->RomBankData(bank);
+
+	for (u32 i = 0; i < ROM_BANK_PAGES; i++) {
+		MemPage& page = pages[window * ROM_BANK_PAGES + i];
+
+		page.read = base + i * BUS_PAGE_SIZE;
+		page.write = nullptr;
+		page.readHandler = nullptr;
+		page.writeHandler = RomWrite;
+		page.handlerCtx = this;
+		page.codeBank = bank;
+	}
+	if (window == 0 && !rom->IsBootROMUnlocked()) {
+		pages[0].read = rom->BootRomData();
+		pages[0].codeBank = CODE_BANK_BOOT_ROM;
+	}
+	mappedRomBanks[window] = bank;
+}
+
+/*
+	Cartridge RAM is plain memory when the MBC has a window for it, its handlers otherwise.
+	Blocks decoded from the old bank would run stale bytes, so they are dropped.
+*/
+void Bus::MapExtRam()
+{
+	u8* window = rom->GetMbc()->RamWindow();
+
+	for (u8 page = PAGE_OF(0xA000); page < PAGE_OF(0xC000); page++) {
+		if (codeWatch && codeWatch->IsWatched(page))
+			codeWatch->InvalidatePage(page);
+	}
+
+	if (window)
+		MapMemory(PAGE_OF(0xA000), PAGE_OF(EXT_RAM_BANK_SIZE), window, CODE_BANK_RAM);
+	else
+		MapHandler(PAGE_OF(0xA000), PAGE_OF(EXT_RAM_BANK_SIZE), ExtRamRead, ExtRamWrite, rom->GetMbc(), CODE_BANK_RAM);
+	mappedRam = window;
+}
+
+/*
+	Maps the banks the cartridge currently selects. Without a loaded cartridge the ROM and
+	cartridge RAM areas read as open bus.
+*/
+void Bus::MapCartridge()
+{
+	Mbc* mbc = rom->GetMbc();
+
+	if (!mbc) {
+		MapHandler(0x00, 2 * ROM_BANK_PAGES, OpenBusRead, IgnoreWrite, nullptr, CODE_BANK_RAM);
+		MapHandler(PAGE_OF(0xA000), PAGE_OF(EXT_RAM_BANK_SIZE), OpenBusRead, IgnoreWrite, nullptr, CODE_BANK_RAM);
+		return;
+	}
+	MapRomWindow(0, mbc->RomBank0());
+	MapRomWindow(1, mbc->RomBank1());
+	MapExtRam();
+}
+
+/*
+	Only the windows whose bank changed are remapped. Code running from a ROM window that
+	was just switched may sit in a predecoded block, so the block cache is told to stop it.
+*/
+void Bus::RomWrite(void* ctx, u16 addr, u8 val)
+{
+	Bus* bus = static_cast<Bus*>(ctx);
+	Mbc* mbc = bus->rom->GetMbc();
+	bool remapped = false;
+
+	bus->rom->Write(addr, val);
+	for (u8 window = 0; window < 2; window++) {
+		u32 bank = window ? mbc->RomBank1() : mbc->RomBank0();
+
+		if (bank != bus->mappedRomBanks[window]) {
+			bus->MapRomWindow(window, bank);
+			remapped = true;
+		}
 	}
+	if (mbc->RamWindow() != bus->mappedRam)
+		bus->MapExtRam();
+	if (remapped && bus->codeWatch)
+		bus->codeWatch->Remapped();
+}
+
+u8 Bus::ExtRamRead(void* ctx, u16 addr)
+{
+	return static_cast<Mbc*>(ctx)->RamRead(addr);
+}
+
+void Bus::ExtRamWrite(void* ctx, u16 addr, u8 val)
+{
+	static_cast<Mbc*>(ctx)->RamWrite(addr, val);
+}
+
+u8 Bus::OpenBusRead(void* ctx, u16 addr)
+{
+	return 0xFF;
 }
 
-u8 Bus::Read(const u16 addr)
+void Bus::IgnoreWrite(void* ctx, u16 addr, u8 val)
 {
-	u8 ret;
 
-	if (cpuInstrTest) {
-		ret = memory[addr];
+}
+
+/* tile data is plain memory to read, writes also drop the decoded copy the PPU keeps */
+void Bus::TileDataWrite(void* ctx, u16 addr, u8 val)
+{
+	Bus* bus = static_cast<Bus*>(ctx);
+
+	bus->vram[addr & 0x1FFF] = val;
+	bus->ppu->TileWritten(addr);
+}
+
+/* VRAM and OAM while the PPU logs writes for its render thread */
+void Bus::VideoWrite(void* ctx, u16 addr, u8 val)
+{
+	Bus* bus = static_cast<Bus*>(ctx);
+
+	if (addr >= 0xFE00) {
+		bus->oam[addr & BUS_PAGE_MASK] = val;
 	} else {
-		if (addr >= 0x0000 && addr <= 0x7FFF) {
-			ret = rom->Read(addr);
-		} else if (addr == 0xFF44) {
-			ret = 0x90;
-		} else {
-			ret = memory[addr];
+		bus->vram[addr & 0x1FFF] = val;
+		if (addr < TILE_DATA_END)
+			bus->ppu->TileWritten(addr);
+	}
+	bus->ppu->VideoWritten(addr, val);
+}
+
+u8 Bus::IoRead(void* ctx, u16 addr)
+{
+	Bus* bus = static_cast<Bus*>(ctx);
+
+	if (addr == REG_P1)
+		return 0xC0 | (bus->highPage[0] & (P1_SELECT_DPAD | P1_SELECT_BUTTONS)) | bus->JoypadLines();
+	if (bus->timer && IN_RANGE(addr, REG_DIV, REG_TAC))
+		return bus->timer->Read(addr);
+	if (bus->apu && IN_RANGE(addr, REG_NR10, APU_REG_END))
+		return bus->apu->Read(addr);
+	/* without a PPU, report LY as the first VBlank line so boot code can move on */
+	if (!bus->ppu)
+		return addr == REG_LY ? LY_STUB_VALUE : bus->highPage[addr & BUS_PAGE_MASK];
+	if (addr == REG_STAT)
+		return bus->ppu->ReadStat();
+	return bus->highPage[addr & BUS_PAGE_MASK];
+}
+
+void Bus::IoWrite(void* ctx, u16 addr, u8 val)
+{
+	Bus* bus = static_cast<Bus*>(ctx);
+
+	if (addr == BOOT_ROM_DISABLE && val && !bus->rom->IsBootROMUnlocked()) {
+		bus->rom->UnlockBootROM();
+		bus->MapRomWindow(0, bus->mappedRomBanks[0]);
+	}
+	/* LY is the PPU's */
+	if (addr == REG_LY && bus->ppu)
+		return;
+	if (bus->timer && IN_RANGE(addr, REG_DIV, REG_TAC)) {
+		bus->timer->Write(addr, val);
+		return;
+	}
+	if (bus->apu && IN_RANGE(addr, REG_NR10, APU_REG_END)) {
+		bus->apu->Write(addr, val);
+		return;
+	}
+	if (addr == REG_P1) {
+		u8 lines = bus->JoypadLines();
+
+		bus->highPage[0] = val & (P1_SELECT_DPAD | P1_SELECT_BUTTONS);
+		if (lines & ~bus->JoypadLines())
+			bus->interrupts.Request(INT_JOYPAD);
+		return;
+	}
+	if (addr == REG_IF) {
+		bus->interrupts.WriteFlags(val);
+		return;
+	}
+	if (addr == REG_IE) {
+		bus->interrupts.WriteEnable(val);
+		return;
+	}
+	bus->highPage[addr & BUS_PAGE_MASK] = val;
+}
+
+void Bus::SaveState(BusSaveState& save) const
+{
+	save.vram = vram;
+	save.wram = wram;
+	save.oam = oam;
+	save.highPage = highPage;
+	save.bootRomUnlocked = rom->IsBootROMUnlocked();
+	save.ime = interrupts.Ime();
+	save.imeDelayed = interrupts.ImeDelayed();
+	save.haltBug = interrupts.HaltBug();
+	std::fill(std::begin(save.reserved), std::end(save.reserved), 0);
+}
+
+/*
+	Expects the MBC to be restored already: the cartridge is remapped from its banks. Blocks
+	built from RAM may no longer match the restored bytes, so every watched page is dropped.
+*/
+void Bus::LoadState(const BusSaveState& save)
+{
+	vram = save.vram;
+	wram = save.wram;
+	oam = save.oam;
+	highPage = save.highPage;
+	interrupts.SetIme(save.ime);
+	if (save.imeDelayed)
+		interrupts.DelayIme();
+	interrupts.SetHaltBug(save.haltBug);
+	if (save.bootRomUnlocked)
+		rom->UnlockBootROM();
+	else
+		rom->LockBootROM();
+	if (codeWatch) {
+		for (u32 page = 0; page < BUS_PAGE_COUNT; page++) {
+			if (codeWatch->IsWatched(page))
+				codeWatch->InvalidatePage(page);
 		}
+		codeWatch->Remapped();
 	}
-	return ret;
+	MapCartridge();
+}
+
+void Bus::SetCodeWatch(BlockCache* cache)
+{
+	codeWatch = cache;
+}
+
+/* tile data pages keep their direct reads, only writes go through TileDataWrite() */
+void Bus::SetPpu(Ppu* pPpu)
+{
+	ppu = pPpu;
+	for (u8 page = PAGE_OF(0x8000); page < PAGE_OF(TILE_DATA_END); page++) {
+		pages[page].write = nullptr;
+		pages[page].writeHandler = TileDataWrite;
+		pages[page].handlerCtx = this;
+	}
+}
+
+/*
+	All of VRAM and OAM send writes through VideoWrite() while on, reads stay direct. Off,
+	only tile data has a handler again, as SetPpu() left it.
+*/
+void Bus::SetVideoWriteLog(bool enable)
+{
+	for (u8 page = PAGE_OF(0x8000); page < PAGE_OF(0xA000); page++) {
+		bool tileData = page < PAGE_OF(TILE_DATA_END);
+
+		pages[page].write = enable || tileData ? nullptr : vram.data() + (page - PAGE_OF(0x8000)) * BUS_PAGE_SIZE;
+		pages[page].writeHandler = enable ? VideoWrite : tileData ? TileDataWrite : nullptr;
+		pages[page].handlerCtx = enable || tileData ? this : nullptr;
+	}
+	pages[PAGE_OF(0xFE00)].write = enable ? nullptr : oam.data();
+	pages[PAGE_OF(0xFE00)].writeHandler = enable ? VideoWrite : nullptr;
+	pages[PAGE_OF(0xFE00)].handlerCtx = enable ? this : nullptr;
+}
+
+/* DIV to TAC go to the timer from now on */
+void Bus::SetTimer(Timer* pTimer)
+{
+	timer = pTimer;
+}
+
+/* NR10 to the end of wave RAM go to the APU from now on */
+void Bus::SetApu(Apu* pApu)
+{
+	apu = pApu;
+}
+
+/* the low nibble of P1: a line of a selected group reads 0 while its button is held */
+u8 Bus::JoypadLines() const
+{
+	u8 lines = 0x0F;
+
+	if (!(highPage[0] & P1_SELECT_BUTTONS))
+		lines &= ~buttons;
+	if (!(highPage[0] & P1_SELECT_DPAD))
+		lines &= ~(buttons >> 4);
+	return lines & 0x0F;
+}
+
+/*
+	Host input, JOYPAD_* bits, held until changed. A selected line going low raises the
+	joypad interrupt. Not saved, it belongs to the host like the rest of its input.
+*/
+void Bus::SetButtons(u8 held)
+{
+	u8 lines = JoypadLines();
+
+	buttons = held;
+	if (lines & ~JoypadLines())
+		interrupts.Request(INT_JOYPAD);
 }
 
-Bus::Bus()
+/* test mode: 64 KiB of flat RAM, as the single step tests expect. IF and IE are plain memory, so nothing is ever requested */
+Bus::Bus() : flatMemory(std::make_unique<u8[]>(0x10000)),
+	interrupts(&highPage[REG_IF & BUS_PAGE_MASK], &highPage[REG_IE & BUS_PAGE_MASK])
 {
 	cpuInstrTest = true;
+	highPage.fill(0);
+	MapMemory(0x00, BUS_PAGE_COUNT, flatMemory.get(), CODE_BANK_RAM);
 }
 
-Bus::Bus(Rom* pRom) : rom(pRom)
+Bus::Bus(Rom* pRom) : rom(pRom), interrupts(&highPage[REG_IF & BUS_PAGE_MASK], &highPage[REG_IE & BUS_PAGE_MASK])
 {
-	
+	vram.fill(0);
+	wram.fill(0);
+	oam.fill(0);
+	highPage.fill(0);
+	MapCartridge();
+	MapMemory(PAGE_OF(0x8000), PAGE_OF(8 * KiB), vram.data(), CODE_BANK_RAM);
+	MapMemory(PAGE_OF(0xC000), PAGE_OF(8 * KiB), wram.data(), CODE_BANK_RAM);
+	/* echo RAM is the same WRAM pages mapped a second time */
+	MapMemory(PAGE_OF(ECHO_RAM_START), PAGE_OF(ECHO_RAM_END + 1 - ECHO_RAM_START), wram.data(), CODE_BANK_RAM);
+	MapMemory(PAGE_OF(0xFE00), 1, oam.data(), CODE_BANK_RAM);
+	MapHandler(PAGE_OF(0xFF00), 1, IoRead, IoWrite, this, CODE_BANK_RAM);
 }
 
 Bus::~Bus()
@@ -2,16 +2,206 @@
 
 #include "common.h"
 #include "rom.h"
+#include "block_cache.h"
+#include "interrupts.h"
+#include <memory>
+
+#define BUS_PAGE_SHIFT			8
+#define BUS_PAGE_SIZE			(1U << BUS_PAGE_SHIFT)
+#define BUS_PAGE_MASK			(BUS_PAGE_SIZE - 1)
+#define BUS_PAGE_COUNT			(0x10000 >> BUS_PAGE_SHIFT)
+
+#define ROM_BANK_PAGES			(ROM_BANK_SIZE / BUS_PAGE_SIZE)
+
+#define ECHO_RAM_START			0xE000
+#define ECHO_RAM_END			0xFDFF
+#define ECHO_RAM_OFFSET			0x2000		// from the WRAM it mirrors
+
+#define REG_P1					0xFF00
+#define REG_DIV					0xFF04
+#define REG_TIMA				0xFF05
+#define REG_TMA					0xFF06
+#define REG_TAC					0xFF07
+#define REG_IF					0xFF0F
+#define REG_NR10				0xFF10
+#define REG_NR11				0xFF11
+#define REG_NR12				0xFF12
+#define REG_NR13				0xFF13
+#define REG_NR14				0xFF14
+#define REG_NR21				0xFF16
+#define REG_NR22				0xFF17
+#define REG_NR23				0xFF18
+#define REG_NR24				0xFF19
+#define REG_NR30				0xFF1A
+#define REG_NR31				0xFF1B
+#define REG_NR32				0xFF1C
+#define REG_NR33				0xFF1D
+#define REG_NR34				0xFF1E
+#define REG_NR41				0xFF20
+#define REG_NR42				0xFF21
+#define REG_NR43				0xFF22
+#define REG_NR44				0xFF23
+#define REG_NR50				0xFF24
+#define REG_NR51				0xFF25
+#define REG_NR52				0xFF26
+#define REG_WAVE_RAM			0xFF30
+#define REG_LCDC				0xFF40
+#define REG_STAT				0xFF41
+#define REG_SCY					0xFF42
+#define REG_SCX					0xFF43
+#define REG_LY					0xFF44
+#define REG_LYC					0xFF45
+#define REG_BGP					0xFF47
+#define REG_OBP0				0xFF48
+#define REG_OBP1				0xFF49
+#define REG_WY					0xFF4A
+#define REG_WX					0xFF4B
+#define REG_IE					0xFFFF
+#define HRAM_START				0xFF80
+
+#define P1_SELECT_DPAD			(1U << 4)		// 0 selects the direction lines
+#define P1_SELECT_BUTTONS		(1U << 5)
+
+/* buttons held, see Bus::SetButtons() */
+#define JOYPAD_A				(1U << 0)
+#define JOYPAD_B				(1U << 1)
+#define JOYPAD_SELECT			(1U << 2)
+#define JOYPAD_START			(1U << 3)
+#define JOYPAD_RIGHT			(1U << 4)
+#define JOYPAD_LEFT				(1U << 5)
+#define JOYPAD_UP				(1U << 6)
+#define JOYPAD_DOWN				(1U << 7)
+
+class Ppu;
+class Timer;
+class Apu;
+
+typedef u8 (*PageReadHandler)(void*, u16);
+typedef void (*PageWriteHandler)(void*, u16, u8);
+
+/*
+	One 256-byte page of the address space. Plain memory has a host pointer to the start
+	of the page; a null pointer sends the access to the page's handler instead, which is
+	how ROM writes (bank control) and I/O registers are reached. Read-only pages only
+	leave the write pointer null.
+*/
+typedef struct MemPage {
+	const u8* read;
+	u8* write;
+	PageReadHandler readHandler;
+	PageWriteHandler writeHandler;
+	void* handlerCtx;
+	u16 codeBank;		// ROM bank number, CODE_BANK_RAM or CODE_BANK_BOOT_ROM
+} MemPage;
+
+/* savestate block, see savestate.h. Cartridge state is saved by the MBC */
+typedef struct BusSaveState {
+	std::array<u8, 8 * KiB> vram;
+	std::array<u8, 8 * KiB> wram;
+	std::array<u8, BUS_PAGE_SIZE> oam;
+	std::array<u8, BUS_PAGE_SIZE> highPage;
+	u8 bootRomUnlocked;
+	u8 ime;
+	u8 imeDelayed;
+	u8 haltBug;
+	u8 reserved[4];
+} BusSaveState;
 
 class Bus {
 private:
-	Rom* rom;
-	u8 memory[0x10000];
+	Rom* rom = nullptr;
 	bool cpuInstrTest = false;
+	BlockCache* codeWatch = nullptr;
+	Ppu* ppu = nullptr;
+	Timer* timer = nullptr;
+	Apu* apu = nullptr;
+	std::array<MemPage, BUS_PAGE_COUNT> pages;
+	std::unique_ptr<u8[]> flatMemory;		// test mode: the whole address space is RAM
+	std::array<u8, 8 * KiB> vram;
+	std::array<u8, 8 * KiB> wram;
+	std::array<u8, BUS_PAGE_SIZE> oam;		// 0xFE00-0xFEFF, the unusable area included
+	std::array<u8, BUS_PAGE_SIZE> highPage;	// 0xFF00-0xFFFF: I/O registers, HRAM and IE
+	InterruptController interrupts;
+	u8 buttons = 0;							// JOYPAD_* held by the host
+
+	u8 JoypadLines() const;
+	void MapMemory(u8, u32, u8*, u16);
+	void MapHandler(u8, u32, PageReadHandler, PageWriteHandler, void*, u16);
+	u32 mappedRomBanks[2] = { 0, 0 };
+	const u8* mappedRam = nullptr;
+
+	void MapRomWindow(u8, u32);
+	void MapExtRam();
+	static u8 IoRead(void*, u16);
+	static void IoWrite(void*, u16, u8);
+	static u8 OpenBusRead(void*, u16);
+	static void IgnoreWrite(void*, u16, u8);
+	static void RomWrite(void*, u16, u8);
+	static u8 ExtRamRead(void*, u16);
+	static void ExtRamWrite(void*, u16, u8);
+	static void TileDataWrite(void*, u16, u8);
+	static void VideoWrite(void*, u16, u8);
+
+	/*
+		I/O registers share page 0xFF with HRAM but never hold code, writing them keeps its
+		blocks. Echo RAM is WRAM seen a second time, so a write through either address also
+		drops the blocks built from the other.
+	*/
+	inline void InvalidateCode(const u16 addr)
+	{
+		const u8 page = addr >> BUS_PAGE_SHIFT;
+
+		if (codeWatch->IsWatched(page) && (addr < REG_P1 || addr >= HRAM_START || cpuInstrTest))
+			codeWatch->InvalidatePage(page);
+		if (!cpuInstrTest && IN_RANGE(addr, ECHO_RAM_START - ECHO_RAM_OFFSET, ECHO_RAM_END)) {
+			const u8 alias = (addr >= ECHO_RAM_START ? addr - ECHO_RAM_OFFSET : addr + ECHO_RAM_OFFSET) >> BUS_PAGE_SHIFT;
+
+			if (alias <= (ECHO_RAM_END >> BUS_PAGE_SHIFT) && codeWatch->IsWatched(alias))
+				codeWatch->InvalidatePage(alias);
+		}
+	}
 public:
-	void Write(const u16, const u8);
-	u8 Read(const u16);
+	inline void Write(const u16 addr, const u8 val)
+	{
+		const MemPage& page = pages[addr >> BUS_PAGE_SHIFT];
+
+		if (codeWatch)
+			InvalidateCode(addr);
+		if (page.write)
+			page.write[addr & BUS_PAGE_MASK] = val;
+		else
+			page.writeHandler(page.handlerCtx, addr, val);
+	}
+	inline u8 Read(const u16 addr)
+	{
+		const MemPage& page = pages[addr >> BUS_PAGE_SHIFT];
+
+		if (page.read)
+			return page.read[addr & BUS_PAGE_MASK];
+		return page.readHandler(page.handlerCtx, addr);
+	}
+	u16 CodeBank(const u16 addr) const { return pages[addr >> BUS_PAGE_SHIFT].codeBank; }
+	/*
+		Registers whose value moves with the clock rather than on writes or events. A loop
+		polling one of them is not idle, see Cpu::SkipIdleLoop().
+	*/
+	bool IsClockDerived(const u16 addr) const { return addr == REG_DIV || addr == REG_TIMA || addr == REG_STAT || addr == REG_NR52; }
+	const u8* VramData() const { return vram.data(); }
+	const u8* OamData() const { return oam.data(); }
+	u8* IoRegisters() { return highPage.data(); }
+	InterruptController& Interrupts() { return interrupts; }
+	void SetCodeWatch(BlockCache*);
+	void SetPpu(Ppu*);
+	void SetVideoWriteLog(bool);
+	void SetTimer(Timer*);
+	void SetApu(Apu*);
+	void SetButtons(u8);
+	void MapCartridge();
+	void SaveState(BusSaveState&) const;
+	void LoadState(const BusSaveState&);
 	Bus(Rom *);
 	Bus();
+	Bus(const Bus&) = delete;
+	Bus& operator=(const Bus&) = delete;
 	~Bus();
 };
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "cpu.h"
+#include "opcodes.h"
+#include <algorithm>
 #include <array>
+#include <bit>
 #define FMT_HEADER_ONLY
 #include <fmt/core.h>
 #include <spdlog/spdlog.h>
@@ -9,6 +12,10 @@
 
 #define FLAG_NO_SET				2
 
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_THREADED_DISPATCH
+#endif
+
 std::array<u8, 256> mainOpcodeMCycles = {
     // 0x0_
     1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
@@ -64,36 +71,63 @@ std::array<u8, 256> cbOpcodeMCycles = {
     2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2, // Fx 
 };
 
-static enum COND {
-	COND_NZ = 0,
-	COND_Z,
-	COND_NC,
-	COND_C
-};
+/*
+	Folds the pending ALU operation into F. The low nibble of F, and C for INC/DEC, are never
+	pending, so they are taken from regs.F() as they are.
+*/
+void Cpu::MaterializeFlags()
+{
+	const LazyFlags& lazy = lazyFlags;
+	u8 keep = 0x0F, n = 0, h = 0, c = 0;
 
-static enum R16MEM {
-	R16MEM_BC = 0,
-	R16MEM_DE,
-	R16MEM_HLI,
-	R16MEM_HLD,
-};
+	switch (lazy.op) {
+	case LAZY_NONE:
+		return;
+	case LAZY_ADD:
+		h = (lazy.lhs & 0x0F) + (lazy.rhs & 0x0F) + lazy.carry > 0x0F;
+		c = lazy.lhs + lazy.rhs + lazy.carry > 0xFF;
+		break;
+	case LAZY_SUB:
+		n = 1;
+		h = (lazy.lhs & 0x0F) < (lazy.rhs & 0x0F) + lazy.carry;
+		c = lazy.lhs < lazy.rhs + lazy.carry;
+		break;
+	case LAZY_AND:
+		h = 1;
+		break;
+	case LAZY_INC:
+		keep |= FLAG_C;
+		h = (lazy.result & 0x0F) == 0x00;
+		break;
+	case LAZY_DEC:
+		keep |= FLAG_C;
+		n = 1;
+		h = (lazy.result & 0x0F) == 0x0F;
+		break;
+	default:
+		break;
+	}
+	regs.F() = (regs.F() & keep) | (!lazy.result ? FLAG_Z : 0) | (n ? FLAG_N : 0) | (h ? FLAG_H : 0) | (c ? FLAG_C : 0);
+	lazyFlags.op = LAZY_NONE;
+}
 
 void Cpu::SetFlag(CpuFlag flag, bool val)
 {
+	MaterializeFlags();
 	regs.F() = (val) ? (regs.F() | flag) : (regs.F() & ~flag);
 }
 
 bool Cpu::GetFlag(CpuFlag flag)
 {
+	MaterializeFlags();
 	return (regs.F() & flag) != 0;
 }
 
+/* overwrites all four flags, so whatever was pending is simply dropped */
 void Cpu::SetZNHC(bool z, bool n, bool h, bool c)
 {
-	SetFlag(FLAG_Z, z);
-	SetFlag(FLAG_N, n);
-	SetFlag(FLAG_H, h);
-	SetFlag(FLAG_C, c);
+	lazyFlags.op = LAZY_NONE;
+	regs.F() = (regs.F() & 0x0F) | (z ? FLAG_Z : 0) | (n ? FLAG_N : 0) | (h ? FLAG_H : 0) | (c ? FLAG_C : 0);
 }
 
 void Cpu::StackPush(u8 val)
@@ -108,83 +142,80 @@ u8 Cpu::StackPop()
 	return bus->Read(regs.SP());
 }
 
-u16& Cpu::GetR16FromOpcode(u8 opcode)
+template<u8 Index>
+u8& Cpu::R8()
 {
-	switch (opcode >> 4) {
-	case 0x00:
+	static_assert(Index != R8_IHL, "(HL) is a memory operand, use ReadR8/WriteR8");
+
+	if constexpr (Index == R8_B)
+		return regs.B();
+	else if constexpr (Index == R8_C)
+		return regs.C();
+	else if constexpr (Index == R8_D)
+		return regs.D();
+	else if constexpr (Index == R8_E)
+		return regs.E();
+	else if constexpr (Index == R8_H)
+		return regs.H();
+	else if constexpr (Index == R8_L)
+		return regs.L();
+	else
+		return regs.A();
+}
+
+template<u8 Index>
+u8 Cpu::ReadR8()
+{
+	if constexpr (Index == R8_IHL)
+		return bus->Read(regs.HL());
+	else
+		return R8<Index>();
+}
+
+template<u8 Index>
+void Cpu::WriteR8(u8 val)
+{
+	if constexpr (Index == R8_IHL)
+		bus->Write(regs.HL(), val);
+	else
+		R8<Index>() = val;
+}
+
+template<u8 Index>
+u16& Cpu::R16()
+{
+	if constexpr (Index == R16_BC)
 		return regs.BC();
-	case 0x01:
+	else if constexpr (Index == R16_DE)
 		return regs.DE();
-	case 0x02:
+	else if constexpr (Index == R16_HL)
 		return regs.HL();
-	case 0x03:
+	else
 		return regs.SP();
-	default:
-		spdlog::error("GetR16FromOpcode: Invalid opcode {:02X}", opcode);
-		throw std::runtime_error("GetR16FromOpcode: Invalid opcode");
-	}
 }
 
-u16& Cpu::DecodeR16MemBlock0(u8 opcode)
+template<u8 Index>
+u16& Cpu::R16Mem()
 {
-	switch ((opcode >> 4) & 0x03) {
-	case 0x00:
+	if constexpr (Index == R16MEM_BC)
 		return regs.BC();
-	case 0x01:
+	else if constexpr (Index == R16MEM_DE)
 		return regs.DE();
-	case 0x02:
-	case 0x03:
+	else
 		return regs.HL();
-	default:
-		spdlog::error("DecodeR16MemBlock0: Invalid opcode {:02X}", opcode);
-		throw std::runtime_error("DecodeR16MemBlock0: Invalid opcode");
-	}
-}
-
-u8& Cpu::GetR8FromOpcode(u8 opcode)
-{
-	switch ((opcode >> 2) & 0x0F) {
-	case 1:
-		return regs.B();
-	case 3:
-		return regs.C();
-	case 5:
-		return regs.D();
-	case 7:
-		return regs.E();
-	case 9:
-		return regs.H();
-	case 11:
-		return regs.L();
-	case 15:
-		return regs.A();
-	default:
-		spdlog::error("GetR8FromOpcode: Invalid opcode {:02X}", opcode);
-		throw std::runtime_error("GetR8FromOpcode: Invalid opcode");
-	}
 }
 
-u8& Cpu::DecodeR8Block1(u8 byte)
+template<u8 Index>
+bool Cpu::Cond()
 {
-	switch ((byte & 0x07)) {
-	case 0:
-		return regs.B();
-	case 1:
-		return regs.C();
-	case 2:
-		return regs.D();
-	case 3:
-		return regs.E();
-	case 4:
-		return regs.H();
-	case 5:
-		return regs.L();
-	case 7:
-		return regs.A();
-	default:
-		spdlog::error("DecodeR8Block1: Invalid byte {:02X}", byte);
-		throw std::runtime_error("DecodeR8Block1: Invalid byte");
-	}
+	if constexpr (Index == COND_NZ)
+		return !GetFlag(FLAG_Z);
+	else if constexpr (Index == COND_Z)
+		return GetFlag(FLAG_Z);
+	else if constexpr (Index == COND_NC)
+		return !GetFlag(FLAG_C);
+	else
+		return GetFlag(FLAG_C);
 }
 
 CpuState Cpu::GetCpuRegState() const
@@ -196,6 +227,7 @@ CpuState Cpu::GetCpuStateForDebug(const CpuState& state)
 {
 	CpuState cpuState;
 
+	MaterializeFlags();
 	cpuState.PC = regs.PC();
 	cpuState.SP = regs.SP();
 	cpuState.BC = regs.BC();
@@ -216,15 +248,51 @@ void Cpu::SetCpuState(const CpuState& state)
 	regs.DE() = state.DE;
 	regs.HL() = state.HL;
 	regs.AF() = state.AF.val;
+	lazyFlags.op = LAZY_NONE;
 
 	for (auto& i : state.mem)
 		bus->Write(i.first, i.second);
 }
 
+/*
+	Pending flags are worked out first: whether they are still pending depends on the path
+	the code took (JIT or interpreter), and machines in the same state must save the same bytes.
+*/
+void Cpu::SaveState(CpuSaveState& save)
+{
+	MaterializeFlags();
+	save.af = regs.AF();
+	save.bc = regs.BC();
+	save.de = regs.DE();
+	save.hl = regs.HL();
+	save.sp = regs.SP();
+	save.pc = regs.PC();
+	save.invalidOpcode = invalidOpcode;
+	save.halt = halt;
+	std::fill(std::begin(save.reserved), std::end(save.reserved), 0);
+	save.tCycles = tCycles;
+}
+
+void Cpu::LoadState(const CpuSaveState& save)
+{
+	regs.AF() = save.af;
+	regs.BC() = save.bc;
+	regs.DE() = save.de;
+	regs.HL() = save.hl;
+	regs.SP() = save.sp;
+	regs.PC() = save.pc;
+	lazyFlags.op = LAZY_NONE;
+	invalidOpcode = save.invalidOpcode;
+	halt = save.halt;
+	tCycles = save.tCycles;
+	idleLoopEnd = UINT64_MAX;
+}
+
 bool Cpu::CompareCpuState(const CpuState& state)
 {
 	bool ret = true;
 
+	MaterializeFlags();
 	ret = (regs.PC() == state.BC) && (regs.SP() == state.SP) && (regs.BC() == state.BC)
 			&& (regs.DE() == state.DE) && (regs.AF() == state.AF.val) && (regs.HL() == state.HL);
 	for (auto& i : state.mem)
@@ -232,12 +300,16 @@ bool Cpu::CompareCpuState(const CpuState& state)
 	return ret;
 }
 
+/*
+	PC is moved past the whole instruction here, using the length from the opcode table,
+	so handlers see PC pointing at the next instruction and never advance it themselves.
+*/
 void Cpu::FetchInstruction()
 {
 	state.currInstr.opcode = bus->Read(regs.PC());
-	regs.PC() += 1;
-	this->state.currInstr.opr1 = bus->Read(regs.PC());
-	this->state.currInstr.opr2 = bus->Read(regs.PC() + 1);
+	state.currInstr.opr1 = bus->Read(regs.PC() + 1);
+	state.currInstr.opr2 = bus->Read(regs.PC() + 2);
+	regs.PC() += mainOpcodeInfo[state.currInstr.opcode].length;
 }
 
 
@@ -246,153 +318,128 @@ void Cpu::FetchInstruction()
 	Usage:			No operation.
 	Cost:			1 CPU cycle
 */
+template<u8 Opcode>
 void Cpu::NOP()
 {
 
 }
 
+template<u8 Opcode>
 void Cpu::LD_R16_U16()
 {
-	u16& r16 = GetR16FromOpcode(state.currInstr.opcode);
-
-	r16 = U16(this->state.currInstr.opr1, this->state.currInstr.opr2);
-	regs.PC() += 2;
+	R16<mainOpcodeInfo[Opcode].r16>() = U16(state.currInstr.opr1, state.currInstr.opr2);
 }
 
+template<u8 Opcode>
 void Cpu::LD_IR16_A()
 {
-	u16& r16 = DecodeR16MemBlock0(state.currInstr.opcode);
+	constexpr u8 r16 = mainOpcodeInfo[Opcode].r16;
 
-	bus->Write(r16, regs.A());
-	if ((state.currInstr.opcode >> 4) == R16MEM_HLI)
+	bus->Write(R16Mem<r16>(), regs.A());
+	if constexpr (r16 == R16MEM_HLI)
 		regs.HL() += 1;
-	else if ((state.currInstr.opcode >> 4) == R16MEM_HLD)
+	else if constexpr (r16 == R16MEM_HLD)
 		regs.HL() -= 1;
 }
 
+template<u8 Opcode>
 void Cpu::LD_A_IR16()
 {
-	u16& r16 = DecodeR16MemBlock0(state.currInstr.opcode);
+	constexpr u8 r16 = mainOpcodeInfo[Opcode].r16;
 
-	regs.A() = bus->Read(r16);
-	if ((state.currInstr.opcode >> 4) == R16MEM_HLI)
+	regs.A() = bus->Read(R16Mem<r16>());
+	if constexpr (r16 == R16MEM_HLI)
 		regs.HL() += 1;
-	else if ((state.currInstr.opcode >> 4) == R16MEM_HLD)
+	else if constexpr (r16 == R16MEM_HLD)
 		regs.HL() -= 1;
 }
 
+template<u8 Opcode>
 void Cpu::LD_R8_U8()
 {
-	GetR8FromOpcode(state.currInstr.opcode) = this->state.currInstr.opr1;
+	R8<mainOpcodeInfo[Opcode].r8Dst>() = state.currInstr.opr1;
 }
 
+template<u8 Opcode>
 void Cpu::LD_IHL_U8()
 {
-	bus->Write(regs.HL(), this->state.currInstr.opr1);
+	bus->Write(regs.HL(), state.currInstr.opr1);
 }
 
+template<u8 Opcode>
 void Cpu::INC_R16()
 {
-	u16& r16 = GetR16FromOpcode(state.currInstr.opcode);
-
-	r16 += 1;
+	R16<mainOpcodeInfo[Opcode].r16>() += 1;
 }
 
+template<u8 Opcode>
 void Cpu::INC_R8()
 {
-	u8& r8 = GetR8FromOpcode(state.currInstr.opcode);
+	u8& r8 = R8<mainOpcodeInfo[Opcode].r8Dst>();
 
-	SetFlag(FLAG_H, (r8 & 0x0F) + (1U & 0x0F) > 0x0F);
+	MaterializeFlags();
 	r8 += 1;
-	SetZNHC(r8 == 0, false, GetFlag(FLAG_H), GetFlag(FLAG_C));
+	lazyFlags = { LAZY_INC, 0, 0, 0, r8 };
 }
 
+template<u8 Opcode>
 void Cpu::INC_IHL()
-{	
-	u8 val = bus->Read(regs.HL());
+{
+	u8 val = bus->Read(regs.HL()) + 1;
 
-	SetFlag(FLAG_H, (val & 0x0F) + (1U & 0x0F) > 0x0F);
-	val += 1;
+	MaterializeFlags();
 	bus->Write(regs.HL(), val);
-	SetZNHC(val == 0, false, GetFlag(FLAG_H), GetFlag(FLAG_C));
+	lazyFlags = { LAZY_INC, 0, 0, 0, val };
 }
 
+template<u8 Opcode>
 void Cpu::DEC_R8()
 {
-	u8& r8 = GetR8FromOpcode(state.currInstr.opcode);
-	u8 res = r8 - 1, carryPerBit = res ^ r8 ^ 0xFF;
+	u8& r8 = R8<mainOpcodeInfo[Opcode].r8Dst>();
 
+	MaterializeFlags();
 	r8 -= 1;
-	SetZNHC(r8 == 0, true, !NTHBIT(carryPerBit, 4), GetFlag(FLAG_C));
+	lazyFlags = { LAZY_DEC, 0, 0, 0, r8 };
 }
 
+template<u8 Opcode>
 void Cpu::DEC_IHL()
 {
-	u8 val = bus->Read(regs.HL()), res = val - 1, carryPerBit = res ^ val ^ 0xFF;
+	u8 val = bus->Read(regs.HL()) - 1;
 
-	val -= 1;
+	MaterializeFlags();
 	bus->Write(regs.HL(), val);
-	SetZNHC(val == 0, false, !NTHBIT(carryPerBit, 4), GetFlag(FLAG_C));
+	lazyFlags = { LAZY_DEC, 0, 0, 0, val };
 }
 
+template<u8 Opcode>
 void Cpu::LD_R8_R8()
 {
-	u8& destR8 = DecodeR8Block1(state.currInstr.opcode >> 3), 
-		srcR8 = DecodeR8Block1(state.currInstr.opcode);
-	
-	destR8 = srcR8;
+	R8<mainOpcodeInfo[Opcode].r8Dst>() = R8<mainOpcodeInfo[Opcode].r8Src>();
 }
 
+template<u8 Opcode>
 void Cpu::LD_R8_IHL()
 {
-	u8& r8 = DecodeR8Block1(state.currInstr.opcode >> 3);
-
-	r8 = bus->Read(regs.HL());
+	R8<mainOpcodeInfo[Opcode].r8Dst>() = bus->Read(regs.HL());
 }
 
-bool Cpu::CheckSubroutineCond(u8 opcode)
+template<u8 Opcode>
+void Cpu::JR()
 {
-	bool cond = false;
-
-	switch ((opcode >> 3) & 0x03) {
-		case COND_NZ:
-			cond = !GetFlag(FLAG_Z);
-			break;
-		case COND_Z:
-			cond = GetFlag(FLAG_Z);
-			break;
-		case COND_NC:
-			cond = !GetFlag(FLAG_C);
-			break;
-		case COND_C:
-			cond = GetFlag(FLAG_C);
-			break;
-	}
-	return cond;
+	regs.PC() += (i8)state.currInstr.opr1;
 }
 
+template<u8 Opcode>
 void Cpu::JR_COND()
 {
-	bool jump = false;
-
-	if (CheckSubroutineCond(state.currInstr.opcode)) {
+	if (Cond<mainOpcodeInfo[Opcode].cond>()) {
 		mCycles += 1;
 		regs.PC() += (i8)state.currInstr.opr1;
 	}
 }
 
-void Cpu::RET_COND()
-{
-	bool ret = false;
-	u16 pc;
-
-	if (CheckSubroutineCond(state.currInstr.opcode)) {
-		mCycles += 3;
-		pc = PopWord();
-		regs.PC() = pc;
-	}
-}
-
+template<u8 Opcode>
 void Cpu::RLA()
 {
 	u8 flagC = GetFlag(FLAG_C);
@@ -401,12 +448,14 @@ void Cpu::RLA()
 	regs.A() = (regs.A() << 1) | flagC;
 }
 
+template<u8 Opcode>
 void Cpu::RLCA()
 {
 	SetZNHC(0, 0, 0, NTHBIT(regs.A(), 7));
 	regs.A() = (regs.A() << 1) | (NTHBIT(regs.A(), 7));
 }
 
+template<u8 Opcode>
 void Cpu::RRA()
 {
 	u8 flagC = GetFlag(FLAG_C);
@@ -415,72 +464,76 @@ void Cpu::RRA()
 	regs.A() = (regs.A() >> 1) | (flagC << 7);
 }
 
+template<u8 Opcode>
 void Cpu::RRCA()
 {
 	SetZNHC(0, 0, 0, NTHBIT(regs.A(), 0));
 	regs.A() = (regs.A() >> 1) | ((NTHBIT(regs.A(), 0)) << 7);
 }
 
+template<u8 Opcode>
 void Cpu::ADD_A_R8()
 {
-	u8& r8 = DecodeR8Block1(state.currInstr.opcode);
-	u16 res = regs.A() + r8, carryPerBit = regs.A() ^ r8 ^ res;
+	u8 r8 = R8<mainOpcodeInfo[Opcode].r8Src>(), a = regs.A();
 
-	regs.A() = res & 0x00FF;
-	SetZNHC(!regs.A(), 0, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
+	regs.A() = a + r8;
+	lazyFlags = { LAZY_ADD, a, r8, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::ADC_A_R8()
 {
-	u8& r8 = DecodeR8Block1(state.currInstr.opcode);
-	u16 res = regs.A() + r8 + GetFlag(FLAG_C), carryPerBit = regs.A() ^ r8 ^ res;
+	u8 r8 = R8<mainOpcodeInfo[Opcode].r8Src>(), a = regs.A(), carry = GetFlag(FLAG_C);
 
-	regs.A() = res;
-	SetZNHC(!regs.A(), 0, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
+	regs.A() = a + r8 + carry;
+	lazyFlags = { LAZY_ADD, a, r8, carry, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::SUB_A_R8()
 {
-	u8& r8 = DecodeR8Block1(state.currInstr.opcode);
-	u16 res = regs.A() + ~r8 + 1, carryPerBit = regs.A() ^ ~r8 ^ res;
+	u8 r8 = R8<mainOpcodeInfo[Opcode].r8Src>(), a = regs.A();
 
-	regs.A() = res & 0x00FF;
-	SetZNHC(!regs.A(), 1, !NTHBIT(carryPerBit, 4), !NTHBIT(carryPerBit, 8));
+	regs.A() = a - r8;
+	lazyFlags = { LAZY_SUB, a, r8, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::SBC_A_R8()
 {
-	u8& r8 = DecodeR8Block1(state.currInstr.opcode);
-	u16 res = regs.A() + ~r8 + 1 - GetFlag(FLAG_C), carryPerBit = regs.A() ^ ~r8 ^ res;
+	u8 r8 = R8<mainOpcodeInfo[Opcode].r8Src>(), a = regs.A(), carry = GetFlag(FLAG_C);
 
-	regs.A() = res;
-	SetZNHC(!regs.A(), 0, !NTHBIT(carryPerBit, 4), !NTHBIT(carryPerBit, 8));
+	regs.A() = a - r8 - carry;
+	lazyFlags = { LAZY_SUB, a, r8, carry, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::AND_A_R8()
 {
-	regs.A() &= DecodeR8Block1(state.currInstr.opcode);
-	SetZNHC(!regs.A(), 0, 1, 0);
+	regs.A() &= R8<mainOpcodeInfo[Opcode].r8Src>();
+	lazyFlags = { LAZY_AND, 0, 0, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::OR_A_R8()
 {
-	regs.A() |= DecodeR8Block1(state.currInstr.opcode);
-	SetZNHC(!regs.A(), 0, 0, 0);
+	regs.A() |= R8<mainOpcodeInfo[Opcode].r8Src>();
+	lazyFlags = { LAZY_LOGIC, 0, 0, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::XOR_A_R8()
 {
-	regs.A() ^= DecodeR8Block1(state.currInstr.opcode);
-	SetZNHC(!regs.A(), 0, 0, 0);
+	regs.A() ^= R8<mainOpcodeInfo[Opcode].r8Src>();
+	lazyFlags = { LAZY_LOGIC, 0, 0, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::CP_A_R8()
 {
-	u8& r8 = DecodeR8Block1(state.currInstr.opcode);
-	u16 res = regs.A() + ~r8 + 1, carryPerBit = regs.A() ^ ~r8 ^ res;
+	u8 r8 = R8<mainOpcodeInfo[Opcode].r8Src>(), a = regs.A();
 
-	SetZNHC(!res, 1, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
+	lazyFlags = { LAZY_SUB, a, r8, 0, (u8)(a - r8) };
 }
 
 void Cpu::PushWord(u16 word)
@@ -502,45 +555,54 @@ u16 Cpu::PopWord()
 	return U16(lsb, msb);
 }
 
+template<u8 Opcode>
 void Cpu::PUSH_R16()
 {
-	u8 msb, lsb;
+	constexpr u8 r16 = mainOpcodeInfo[Opcode].r16;
 
-	msb = (state.currInstr.opcode == 0xF5) ? regs.A() : MSB(DecodeR16MemBlock0(state.currInstr.opcode));
-	lsb = (state.currInstr.opcode == 0xF5) ? regs.F() : LSB(DecodeR16MemBlock0(state.currInstr.opcode));
-	PushWord(U16(lsb, msb));
+	if constexpr (r16 == R16STK_AF) {
+		MaterializeFlags();
+		PushWord(U16(regs.F(), regs.A()));
+	} else {
+		PushWord(R16<r16>());
+	}
 }
 
+template<u8 Opcode>
 void Cpu::POP_R16()
 {
+	constexpr u8 r16 = mainOpcodeInfo[Opcode].r16;
 	u16 word = PopWord();
 
-	if (state.currInstr.opcode == 0xF1) {
-		regs.AF() = word;
+	if constexpr (r16 == R16STK_AF) {
+		regs.A() = MSB(word);
+		regs.F() = LSB(word);
+		lazyFlags.op = LAZY_NONE;
 	} else {
-		u16& r16 = DecodeR16MemBlock0(state.currInstr.opcode);
-		r16 = word;
+		R16<r16>() = word;
 	}
 }
 
+template<u8 Opcode>
 void Cpu::RST()
 {
 	PushWord(regs.PC());
-	regs.PC() = (state.currInstr.opcode >> 3) & 0x03;
+	regs.PC() = Opcode & 0x38;
 }
 
+template<u8 Opcode>
 void Cpu::LD_IR16_SP()
 {
 	u16 r16 = U16(state.currInstr.opr1, state.currInstr.opr2);
 
 	bus->Write(r16, LSB(regs.SP()));
 	bus->Write(r16 + 1, MSB(regs.SP()));
-	regs.PC() += 2;
 }
 
+template<u8 Opcode>
 void Cpu::ADD_HL_R16()
 {
-	u16 r16 = GetR16FromOpcode(state.currInstr.opcode);
+	u16 r16 = R16<mainOpcodeInfo[Opcode].r16>();
 	u32 res = r16 + regs.HL(), carryPerBit = r16 ^ regs.HL() ^ res;
 
 	regs.HL() = (u16)(res & 0x0000ffff);
@@ -548,23 +610,34 @@ void Cpu::ADD_HL_R16()
 	SetFlag(FLAG_C, NTHBIT(carryPerBit, 15));
 }
 
+template<u8 Opcode>
 void Cpu::DEC_R16()
 {
-	u16& r16 = GetR16FromOpcode(state.currInstr.opcode);
-
-	r16 -= 1;
+	R16<mainOpcodeInfo[Opcode].r16>() -= 1;
 }
 
+/*
+	DMG STOP: the CPU and the screen stop until a button is pressed. PC stays on the
+	instruction, so it runs again every M-cycle until the joypad interrupt is requested.
+*/
+template<u8 Opcode>
 void Cpu::STOP()
 {
+	if (bus->Read(REG_IF) & INT_JOYPAD) {
+		halt = HALT_NONE;
+		return;
+	}
+	halt = HALT_STOPPED;
+	regs.PC() -= mainOpcodeInfo[Opcode].length;
 }
 
+template<u8 Opcode>
 void Cpu::DAA()
 {
 	u8 A = regs.A();
 
 	if (!GetFlag(FLAG_N)) {
-		if (GetFlag(FLAG_H) || regs.A() > 0x09)
+		if (GetFlag(FLAG_H) || (regs.A() & 0x0F) > 0x09)
 			A += 0x06;
 		if (GetFlag(FLAG_C) || regs.A() > 0x99) {
 			A += 0x60;
@@ -581,720 +654,408 @@ void Cpu::DAA()
 	regs.A() = A;
 }
 
+template<u8 Opcode>
 void Cpu::CPL()
 {
 	regs.A() = ~regs.A();
 	SetZNHC(GetFlag(FLAG_Z), 1, 1, GetFlag(FLAG_C));
 }
 
+template<u8 Opcode>
 void Cpu::SCF()
 {
-	SetFlag(FLAG_C, 1);
+	SetZNHC(GetFlag(FLAG_Z), 0, 0, 1);
 }
 
+template<u8 Opcode>
 void Cpu::CCF()
 {
-	SetFlag(FLAG_C, 0);
+	SetZNHC(GetFlag(FLAG_Z), 0, 0, !GetFlag(FLAG_C));
 }
 
+template<u8 Opcode>
 void Cpu::LD_IHL_R8()
 {
-	u8 r8 = DecodeR8Block1(state.currInstr.opcode);
-
-	bus->Write(regs.HL(), r8);
+	bus->Write(regs.HL(), R8<mainOpcodeInfo[Opcode].r8Src>());
 }
 
+/*
+	Stays on the instruction until an enabled interrupt is requested: stepping through it
+	costs one M-cycle per check, and Execute() fast-forwards the clock to the next event
+	instead. With IME set the wake-up is the dispatch, see DispatchInterrupt(). Halting
+	with IME clear while one is already requested does not halt at all and hits the HALT
+	bug instead.
+*/
+template<u8 Opcode>
 void Cpu::HALT()
 {
-	// TODO
+	if (WakeUp()) {
+		if (halt == HALT_NONE && !interrupts->Ime())
+			interrupts->SetHaltBug(true);
+		halt = HALT_NONE;
+		return;
+	}
+	halt = HALT_HALTED;
+	regs.PC() -= mainOpcodeInfo[Opcode].length;
 }
 
+template<u8 Opcode>
 void Cpu::ADD_A_IHL()
 {
-	u8 val = bus->Read(regs.HL());
-	u16 res = regs.A() + val, carryPerBit = regs.A() ^ val ^ res;
+	u8 val = bus->Read(regs.HL()), a = regs.A();
 
-	regs.A() = res & 0x00FF;
-	SetZNHC(!regs.A(), 0, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
+	regs.A() = a + val;
+	lazyFlags = { LAZY_ADD, a, val, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::SUB_A_IHL()
 {
-	u8 val = bus->Read(regs.HL());
-	u16 res = regs.A() + ~val + 1, carryPerBit = regs.A() ^ ~val ^ res;
+	u8 val = bus->Read(regs.HL()), a = regs.A();
 
-	regs.A() = res & 0x00FF;
-	SetZNHC(!regs.A(), 1, !NTHBIT(carryPerBit, 4), !NTHBIT(carryPerBit, 8));
+	regs.A() = a - val;
+	lazyFlags = { LAZY_SUB, a, val, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::AND_A_IHL()
 {
 	regs.A() &= bus->Read(regs.HL());
-	SetZNHC(!regs.A(), 0, 0, 0);
+	lazyFlags = { LAZY_AND, 0, 0, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::OR_A_IHL()
 {
 	regs.A() |= bus->Read(regs.HL());
-	SetZNHC(!regs.A(), 0, 0, 0);
+	lazyFlags = { LAZY_LOGIC, 0, 0, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::ADC_A_IHL()
 {
-	u8 val = bus->Read(regs.HL());
-	u16 res = regs.A() + val + GetFlag(FLAG_C), carryPerBit = regs.A() ^ val ^ res;
+	u8 val = bus->Read(regs.HL()), a = regs.A(), carry = GetFlag(FLAG_C);
 
-	regs.A() = res;
-	SetZNHC(!regs.A(), 0, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
+	regs.A() = a + val + carry;
+	lazyFlags = { LAZY_ADD, a, val, carry, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::SBC_A_IHL()
 {
-	u8 val = bus->Read(regs.HL());
-	u16 res = regs.A() + ~val + 1 - GetFlag(FLAG_C), carryPerBit = regs.A() ^ ~val ^ res;
+	u8 val = bus->Read(regs.HL()), a = regs.A(), carry = GetFlag(FLAG_C);
 
-	regs.A() = res;
-	SetZNHC(!regs.A(), 0, !NTHBIT(carryPerBit, 4), !NTHBIT(carryPerBit, 8));
+	regs.A() = a - val - carry;
+	lazyFlags = { LAZY_SUB, a, val, carry, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::XOR_A_IHL()
 {
 	regs.A() ^= bus->Read(regs.HL());
-	SetZNHC(!regs.A(), 0, 0, 0);
+	lazyFlags = { LAZY_LOGIC, 0, 0, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::CP_A_IHL()
 {
-	u8 val = bus->Read(regs.HL());
-	u16 res = regs.A() + ~val + 1, carryPerBit = regs.A() ^ ~val ^ res;
+	u8 val = bus->Read(regs.HL()), a = regs.A();
 
-	SetZNHC(!res, 1, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
+	lazyFlags = { LAZY_SUB, a, val, 0, (u8)(a - val) };
 }
 
+template<u8 Opcode>
 void Cpu::ADD_A_U8()
 {
-	u8 val = state.currInstr.opr1;
-	u16 res = regs.A() + val, carryPerBit = regs.A() ^ val ^ res;
+	u8 val = state.currInstr.opr1, a = regs.A();
 
-	regs.A() = res & 0x00FF;
-	regs.PC() += 1;
-	SetZNHC(!regs.A(), 0, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
+	regs.A() = a + val;
+	lazyFlags = { LAZY_ADD, a, val, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::SUB_A_U8()
 {
-	u8 val = state.currInstr.opr1;	
-	regs.PC() += 1;
-	u16 res = regs.A() + ~val + 1, carryPerBit = regs.A() ^ ~val ^ res;
+	u8 val = state.currInstr.opr1, a = regs.A();
 
-	regs.A() = res & 0x00FF;
-	SetZNHC(!regs.A(), 1, !NTHBIT(carryPerBit, 4), !NTHBIT(carryPerBit, 8));
+	regs.A() = a - val;
+	lazyFlags = { LAZY_SUB, a, val, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::AND_A_U8()
 {
-	u8 val = state.currInstr.opr1;	
-	regs.PC() += 1;
-	regs.A() &= bus->Read(regs.HL());
-	SetZNHC(!regs.A(), 0, 0, 0);
+	regs.A() &= state.currInstr.opr1;
+	lazyFlags = { LAZY_AND, 0, 0, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::OR_A_U8()
-{	
-	u8 val = state.currInstr.opr1;	
-	regs.PC() += 1;
-	regs.A() |= val;
-	SetZNHC(!regs.A(), 0, 0, 0);
+{
+	regs.A() |= state.currInstr.opr1;
+	lazyFlags = { LAZY_LOGIC, 0, 0, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::ADC_A_U8()
 {
-	u8 val = state.currInstr.opr1;
-	regs.PC() += 1;
-	u16 res = regs.A() + val + GetFlag(FLAG_C), carryPerBit = regs.A() ^ val ^ res;
+	u8 val = state.currInstr.opr1, a = regs.A(), carry = GetFlag(FLAG_C);
 
-	regs.A() = res;
-	SetZNHC(!regs.A(), 0, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
+	regs.A() = a + val + carry;
+	lazyFlags = { LAZY_ADD, a, val, carry, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::SBC_A_U8()
 {
-	u8 val = state.currInstr.opr1;
-	regs.PC() += 1;
-	u16 res = regs.A() + ~val + 1 - GetFlag(FLAG_C), carryPerBit = regs.A() ^ ~val ^ res;
+	u8 val = state.currInstr.opr1, a = regs.A(), carry = GetFlag(FLAG_C);
 
-	regs.A() = res;
-	SetZNHC(!regs.A(), 0, !NTHBIT(carryPerBit, 4), !NTHBIT(carryPerBit, 8));
+	regs.A() = a - val - carry;
+	lazyFlags = { LAZY_SUB, a, val, carry, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::XOR_A_U8()
 {
 	regs.A() ^= state.currInstr.opr1;
-	SetZNHC(!regs.A(), 0, 0, 0);
+	lazyFlags = { LAZY_LOGIC, 0, 0, 0, regs.A() };
 }
 
+template<u8 Opcode>
 void Cpu::CP_A_U8()
 {
-	u8 val = state.currInstr.opr1;
-	u16 res = regs.A() + ~val + 1, carryPerBit = regs.A() ^ ~val ^ res;
+	u8 val = state.currInstr.opr1, a = regs.A();
 
-	SetZNHC(!res, 1, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
+	lazyFlags = { LAZY_SUB, a, val, 0, (u8)(a - val) };
 }
 
+/* RET (0xC9) and RETI (0xD9) are unconditional, the others test their condition bits */
+template<u8 Opcode>
 void Cpu::RET()
 {
-	if (state.currInstr.opcode == 0xC9 || CheckSubroutineCond(state.currInstr.opcode)) {
-		u16 pc = PopWord();
-		regs.PC() = pc;
-		if (state.currInstr.opcode != 0xC9 && state.currInstr.opcode != 0xD9)
-			mCycles += 3;
+	if constexpr (Opcode == 0xC9 || Opcode == 0xD9) {
+		regs.PC() = PopWord();
+	} else if (Cond<mainOpcodeInfo[Opcode].cond>()) {
+		mCycles += 3;
+		regs.PC() = PopWord();
 	}
 }
 
+template<u8 Opcode>
 void Cpu::JP()
 {
-	if (state.currInstr.opcode == 0xC3 || CheckSubroutineCond(state.currInstr.opcode)) {
-		if (state.currInstr.opcode != 0xC3)
-			mCycles += 1;
+	if constexpr (Opcode == 0xC3) {
+		regs.PC() = U16(state.currInstr.opr1, state.currInstr.opr2);
+	} else if (Cond<mainOpcodeInfo[Opcode].cond>()) {
+		mCycles += 1;
 		regs.PC() = U16(state.currInstr.opr1, state.currInstr.opr2);
 	}
 }
 
+template<u8 Opcode>
 void Cpu::CALL()
 {
-	regs.PC() += 2;
-	if (state.currInstr.opcode == 0xCD || CheckSubroutineCond(state.currInstr.opcode)) {
-		if (state.currInstr.opcode != 0xCD)
-			mCycles += 3;
+	if constexpr (Opcode == 0xCD) {
+		PushWord(regs.PC());
+		regs.PC() = U16(state.currInstr.opr1, state.currInstr.opr2);
+	} else if (Cond<mainOpcodeInfo[Opcode].cond>()) {
+		mCycles += 3;
 		PushWord(regs.PC());
 		regs.PC() = U16(state.currInstr.opr1, state.currInstr.opr2);
 	}
 }
 
+template<u8 Opcode>
 void Cpu::RLC()
 {
-	u8 val = (state.currInstr.opr1 == 0x06) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1);
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
+	u8 val = ReadR8<r8>();
 
 	SetFlag(FLAG_C, NTHBIT(val, 7));
 	val = (val << 1) | GetFlag(FLAG_C);
 	SetZNHC(!val, 0, 0, GetFlag(FLAG_C));
-	if (state.currInstr.opr1 != 0x06) {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	} else {
-		bus->Write(regs.HL(), val);
-	}
+	WriteR8<r8>(val);
 }
 
+template<u8 Opcode>
 void Cpu::RRC()
 {
-	u8 val = (state.currInstr.opr1 == 0x0E) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1);
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
+	u8 val = ReadR8<r8>();
 
 	SetFlag(FLAG_C, NTHBIT(val, 0));
 	val = (val >> 1) | ((u8)GetFlag(FLAG_C) << 7);
 	SetZNHC(!val, 0, 0, GetFlag(FLAG_C));
-	if (state.currInstr.opr1 != 0x0E) {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	} else {
-		bus->Write(regs.HL(), val);
-	}
+	WriteR8<r8>(val);
 }
 
+template<u8 Opcode>
 void Cpu::RL()
 {
-	u8 val = (state.currInstr.opr1 == 0x16) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1), newC = NTHBIT(val, 7);
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
+	u8 val = ReadR8<r8>(), newC = NTHBIT(val, 7);
 
 	val = (val << 1) | GetFlag(FLAG_C);
-	if (state.currInstr.opr1 != 0x16) {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	} else {
-		bus->Write(regs.HL(), val);
-	}
+	WriteR8<r8>(val);
 	SetZNHC(!val, 0, 0, newC);
 }
 
+template<u8 Opcode>
 void Cpu::RR()
 {
-	u8 val = (state.currInstr.opr1 == 0x1E) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1), newC = NTHBIT(val, 0);
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
+	u8 val = ReadR8<r8>(), newC = NTHBIT(val, 0);
 
 	val = (val >> 1) | ((u8)GetFlag(FLAG_C) << 7);
-	if (state.currInstr.opr1 != 0x1E) {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	} else {
-		bus->Write(regs.HL(), val);
-	}
+	WriteR8<r8>(val);
 	SetZNHC(!val, 0, 0, newC);
 }
 
+template<u8 Opcode>
 void Cpu::SLA()
 {
-	u8 val = (state.currInstr.opr1 == 0x26) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1);
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
+	u8 val = ReadR8<r8>();
 
 	SetFlag(FLAG_C, NTHBIT(val, 7));
 	val <<= 1;
 	SetZNHC(!val, 0, 0, GetFlag(FLAG_C));
-	if (state.currInstr.opr1 != 0x26) {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	} else {
-		bus->Write(regs.HL(), val);
-	}
+	WriteR8<r8>(val);
 }
 
+template<u8 Opcode>
 void Cpu::SRA()
 {
-	u8 val = (state.currInstr.opr1 == 0x2E) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1);
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
+	u8 val = ReadR8<r8>();
 
 	SetFlag(FLAG_C, NTHBIT(val, 0));
 	val = (val & 0x80) | (val >> 1);
 	SetZNHC(!val, 0, 0, GetFlag(FLAG_C));
-	if (state.currInstr.opr1 != 0x2E) {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	} else {
-		bus->Write(regs.HL(), val);
-	}
+	WriteR8<r8>(val);
 }
 
+template<u8 Opcode>
 void Cpu::SWAP()
 {
-	u8 val = (state.currInstr.opr1 == 0x36) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1);
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
+	u8 val = ReadR8<r8>();
 
 	val = (val >> 4) | (val << 4);
 	SetZNHC(!val, 0, 0, GetFlag(FLAG_C));
-	if (state.currInstr.opr1 != 0x36) {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	} else {
-		bus->Write(regs.HL(), val);
-	}
+	WriteR8<r8>(val);
 }
 
+template<u8 Opcode>
 void Cpu::SRL()
 {
-	u8 val = (state.currInstr.opr1 == 0x3E) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1);
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
+	u8 val = ReadR8<r8>();
 
 	SetFlag(FLAG_C, NTHBIT(val, 0));
 	val >>= 1;
 	SetZNHC(!val, 0, 0, GetFlag(FLAG_C));
-	if (state.currInstr.opr1 != 0x3E) {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	} else {
-		bus->Write(regs.HL(), val);
-	}
+	WriteR8<r8>(val);
 }
 
+template<u8 Opcode>
 void Cpu::BIT()
 {
-	u8 val = (state.currInstr.opr1 == 0x46 || state.currInstr.opr1 == 0x4E
-			|| state.currInstr.opr1 == 0x56 || state.currInstr.opr1 == 0x5E
-			|| state.currInstr.opr1 == 0x66 || state.currInstr.opr1 == 0x6E
-			|| state.currInstr.opr1 == 0x76 || state.currInstr.opr1 == 0x7E) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1), n8 = (state.currInstr.opr1 >> 3) & 0x07;
+	u8 val = ReadR8<cbOpcodeInfo[Opcode].r8Src>();
 
-	SetZNHC(NTHBIT(val, n8), 0, 1, GetFlag(FLAG_C));
-	if (state.currInstr.opr1 == 0x46 || state.currInstr.opr1 == 0x4E
-			|| state.currInstr.opr1 == 0x56 || state.currInstr.opr1 == 0x5E
-			|| state.currInstr.opr1 == 0x66 || state.currInstr.opr1 == 0x6E
-			|| state.currInstr.opr1 == 0x76 || state.currInstr.opr1 == 0x7E) {
-		bus->Write(regs.HL(), val);
-	} else {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	}
+	SetZNHC(!NTHBIT(val, cbOpcodeInfo[Opcode].bit), 0, 1, GetFlag(FLAG_C));
 }
 
+template<u8 Opcode>
 void Cpu::RESET()
 {
-	u8 val = (state.currInstr.opr1 == 0x86 || state.currInstr.opr1 == 0x8E
-			|| state.currInstr.opr1 == 0x96 || state.currInstr.opr1 == 0x9E
-			|| state.currInstr.opr1 == 0xA6 || state.currInstr.opr1 == 0xAE
-			|| state.currInstr.opr1 == 0xB6 || state.currInstr.opr1 == 0xBE) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1), n8 = (state.currInstr.opr1 >> 3) & 0x07;
-	val &= ~(1U << n8);
-	if (state.currInstr.opr1 == 0x86 || state.currInstr.opr1 == 0x8E
-			|| state.currInstr.opr1 == 0x96 || state.currInstr.opr1 == 0x9E
-			|| state.currInstr.opr1 == 0xA6 || state.currInstr.opr1 == 0xAE
-			|| state.currInstr.opr1 == 0xB6 || state.currInstr.opr1 == 0xBE) {
-		bus->Write(regs.HL(), val);
-	} else {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	}
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
+
+	WriteR8<r8>(ReadR8<r8>() & ~(1U << cbOpcodeInfo[Opcode].bit));
 }
 
+template<u8 Opcode>
 void Cpu::SETF()
 {
-	u8 val = (state.currInstr.opr1 == 0xC6 || state.currInstr.opr1 == 0xCE
-			|| state.currInstr.opr1 == 0xD6 || state.currInstr.opr1 == 0xDE
-			|| state.currInstr.opr1 == 0xE6 || state.currInstr.opr1 == 0xEE
-			|| state.currInstr.opr1 == 0xF6 || state.currInstr.opr1 == 0xFE) ? bus->Read(regs.HL()) : DecodeR8Block1(state.currInstr.opr1), n8 = (state.currInstr.opr1 >> 3) & 0x07;
-	val |= (1U << n8);
-	if (state.currInstr.opr1 == 0xC6 || state.currInstr.opr1 == 0xCE
-			|| state.currInstr.opr1 == 0xD6 || state.currInstr.opr1 == 0xDE
-			|| state.currInstr.opr1 == 0xE6 || state.currInstr.opr1 == 0xEE
-			|| state.currInstr.opr1 == 0xF6 || state.currInstr.opr1 == 0xFE) {
-		bus->Write(regs.HL(), val);
-	} else {
-		u8& r8 = DecodeR8Block1(state.currInstr.opr1);
-		r8 = val;
-	}
-}
+	constexpr u8 r8 = cbOpcodeInfo[Opcode].r8Src;
 
-void Cpu::RunCBInstruction(u8 opcode)
-{
-	switch (opcode) {
-	case 0x00:
-	case 0x01:
-	case 0x02:
-	case 0x03:
-	case 0x04:
-	case 0x05:
-	case 0x06:
-	case 0x07:
-		RLC();
-		break;
-	case 0x08:
-	case 0x09:
-	case 0x0a:
-	case 0x0b:
-	case 0x0c:
-	case 0x0d:
-	case 0x0e:
-	case 0x0f:
-		RRC();
-		break;
-	case 0x10:
-	case 0x11:
-	case 0x12:
-	case 0x13:
-	case 0x14:
-	case 0x15:
-	case 0x16:
-	case 0x17:
-		RL();
-		break;
-	case 0x18:
-	case 0x19:
-	case 0x1a:
-	case 0x1b:
-	case 0x1c:
-	case 0x1d:
-	case 0x1e:
-	case 0x1f:
-		RR();
-		break;
-	case 0x20:
-	case 0x21:
-	case 0x22:
-	case 0x23:
-	case 0x24:
-	case 0x25:
-	case 0x26:
-	case 0x27:
-		SLA();
-		break;
-	case 0x28:
-	case 0x29:
-	case 0x2a:
-	case 0x2b:
-	case 0x2c:
-	case 0x2d:
-	case 0x2e:
-	case 0x2f:
-		SRA();
-		break;
-	case 0x30:
-	case 0x31:
-	case 0x32:
-	case 0x33:
-	case 0x34:
-	case 0x35:
-	case 0x36:
-	case 0x37:
-		SWAP();
-		break;
-	case 0x38:
-	case 0x39:
-	case 0x3a:
-	case 0x3b:
-	case 0x3c:
-	case 0x3d:
-	case 0x3e:
-	case 0x3f:
-		SRL();
-		break;
-	case 0x40:
-	case 0x41:
-	case 0x42:
-	case 0x43:
-	case 0x44:
-	case 0x45:
-	case 0x46:
-	case 0x47:
-	case 0x48:
-	case 0x49:
-	case 0x4a:
-	case 0x4b:
-	case 0x4c:
-	case 0x4d:
-	case 0x4e:
-	case 0x4f:
-	case 0x50:
-	case 0x51:
-	case 0x52:
-	case 0x53:
-	case 0x54:
-	case 0x55:
-	case 0x56:
-	case 0x57:
-	case 0x58:
-	case 0x59:
-	case 0x5a:
-	case 0x5b:
-	case 0x5c:
-	case 0x5d:
-	case 0x5e:
-	case 0x5f:
-	case 0x60:
-	case 0x61:
-	case 0x62:
-	case 0x63:
-	case 0x64:
-	case 0x65:
-	case 0x66:
-	case 0x67:
-	case 0x68:
-	case 0x69:
-	case 0x6a:
-	case 0x6b:
-	case 0x6c:
-	case 0x6d:
-	case 0x6e:
-	case 0x6f:
-	case 0x70:
-	case 0x71:
-	case 0x72:
-	case 0x73:
-	case 0x74:
-	case 0x75:
-	case 0x76:
-	case 0x77:
-	case 0x78:
-	case 0x79:
-	case 0x7a:
-	case 0x7b:
-	case 0x7c:
-	case 0x7d:
-	case 0x7e:
-	case 0x7f:
-		BIT();
-		break;
-	case 0x80:
-	case 0x81:
-	case 0x82:
-	case 0x83:
-	case 0x84:
-	case 0x85:
-	case 0x86:
-	case 0x87:
-	case 0x88:
-	case 0x89:
-	case 0x8a:
-	case 0x8b:
-	case 0x8c:
-	case 0x8d:
-	case 0x8e:
-	case 0x8f:
-	case 0x90:
-	case 0x91:
-	case 0x92:
-	case 0x93:
-	case 0x94:
-	case 0x95:
-	case 0x96:
-	case 0x97:
-	case 0x98:
-	case 0x99:
-	case 0x9a:
-	case 0x9b:
-	case 0x9c:
-	case 0x9d:
-	case 0x9e:
-	case 0x9f:
-	case 0xa0:
-	case 0xa1:
-	case 0xa2:
-	case 0xa3:
-	case 0xa4:
-	case 0xa5:
-	case 0xa6:
-	case 0xa7:
-	case 0xa8:
-	case 0xa9:
-	case 0xaa:
-	case 0xab:
-	case 0xac:
-	case 0xad:
-	case 0xae:
-	case 0xaf:
-	case 0xb0:
-	case 0xb1:
-	case 0xb2:
-	case 0xb3:
-	case 0xb4:
-	case 0xb5:
-	case 0xb6:
-	case 0xb7:
-	case 0xb8:
-	case 0xb9:
-	case 0xba:
-	case 0xbb:
-	case 0xbc:
-	case 0xbd:
-	case 0xbe:
-	case 0xbf:
-		RESET();
-		break;
-	case 0xc0:
-	case 0xc1:
-	case 0xc2:
-	case 0xc3:
-	case 0xc4:
-	case 0xc5:
-	case 0xc6:
-	case 0xc7:
-	case 0xc8:
-	case 0xc9:
-	case 0xca:
-	case 0xcb:
-	case 0xcc:
-	case 0xcd:
-	case 0xce:
-	case 0xcf:
-	case 0xd0:
-	case 0xd1:
-	case 0xd2:
-	case 0xd3:
-	case 0xd4:
-	case 0xd5:
-	case 0xd6:
-	case 0xd7:
-	case 0xd8:
-	case 0xd9:
-	case 0xda:
-	case 0xdb:
-	case 0xdc:
-	case 0xdd:
-	case 0xde:
-	case 0xdf:
-	case 0xe0:
-	case 0xe1:
-	case 0xe2:
-	case 0xe3:
-	case 0xe4:
-	case 0xe5:
-	case 0xe6:
-	case 0xe7:
-	case 0xe8:
-	case 0xe9:
-	case 0xea:
-	case 0xeb:
-	case 0xec:
-	case 0xed:
-	case 0xee:
-	case 0xef:
-	case 0xf0:
-	case 0xf1:
-	case 0xf2:
-	case 0xf3:
-	case 0xf4:
-	case 0xf5:
-	case 0xf6:
-	case 0xf7:
-	case 0xf8:
-	case 0xf9:
-	case 0xfa:
-	case 0xfb:
-	case 0xfc:
-	case 0xfd:
-	case 0xfe:
-	case 0xff:
-		SETF();
-		break;
-	default:
-		spdlog::error("Opcode invalid - ${:02X}", state.currInstr.opcode);
-		break;
-	}
+	WriteR8<r8>(ReadR8<r8>() | (1U << cbOpcodeInfo[Opcode].bit));
 }
 
+template<u8 Opcode>
 void Cpu::RETI()
 {
-	RET();
-	// TODO: interrupt
+	RET<Opcode>();
+	interrupts->SetIme(true);
 }
 
+template<u8 Opcode>
 void Cpu::LDH_IA8_A()
 {
-	regs.PC() += 1;
 	bus->Write(0xFF00 + state.currInstr.opr1, regs.A());
 }
 
+template<u8 Opcode>
 void Cpu::LDH_IC_A()
 {
 	bus->Write(0xFF00 + regs.C(), regs.A());
 }
 
+template<u8 Opcode>
 void Cpu::LDH_A_IA8()
 {
-	regs.PC() += 1;
 	regs.A() = bus->Read(0xFF00 + state.currInstr.opr1);
 }
 
+template<u8 Opcode>
 void Cpu::LDH_A_IC()
 {
 	regs.A() = bus->Read(0xFF00 +regs.C());
 }
 
+template<u8 Opcode>
 void Cpu::ADD_SP_E8()
 {
-	regs.PC() += 1;
 	u16 res = regs.SP() + (i8)state.currInstr.opr1, carryPerBit = res ^ regs.SP() ^ state.currInstr.opr1;
 
 	regs.SP() = res;
 	SetZNHC(0, 0, NTHBIT(carryPerBit, 3), NTHBIT(carryPerBit, 7));
 }
 
+template<u8 Opcode>
 void Cpu::JP_HL()
 {
 	regs.PC() = regs.HL();
 }
 
+template<u8 Opcode>
 void Cpu::LD_IA16_A()
 {
 	bus->Write(U16(state.currInstr.opr1, state.currInstr.opr2), regs.A());
-	regs.PC() += 2;
 }
 
+template<u8 Opcode>
 void Cpu::LD_A_IA16()
 {
 	regs.A() = bus->Read(U16(state.currInstr.opr1, state.currInstr.opr2));
-	regs.PC() += 2;
 }
 
+template<u8 Opcode>
 void Cpu::DI()
 {
+	interrupts->SetIme(false);
 }
 
+/* IME goes up after the next instruction, see ServiceInterrupts() */
+template<u8 Opcode>
 void Cpu::EI()
 {
+	interrupts->DelayIme();
 }
 
+template<u8 Opcode>
 void Cpu::LD_HL_SP_i8()
 {
-	regs.PC() += 1;
 	u8 s8 = state.currInstr.opr1;
 	u16 carryPerBit = (regs.SP() + s8) ^ regs.SP() ^ s8;
 
@@ -1302,15 +1063,47 @@ void Cpu::LD_HL_SP_i8()
 	SetZNHC(0, 0, NTHBIT(carryPerBit, 4), NTHBIT(carryPerBit, 8));
 }
 
+template<u8 Opcode>
 void Cpu::LD_SP_HL()
 {
 	regs.SP() = regs.HL();
 }
 
+/*
+	The 0xCB prefix dispatches its second byte through cbOpTable. cbOpcodeMCycles already
+	includes the prefix fetch, so only the difference to mainOpcodeMCycles[0xCB] is added here.
+*/
+template<u8 Opcode>
+void Cpu::PREFIX_CB()
+{
+	(this->*cbOpTable[state.currInstr.opr1])();
+	mCycles += cbOpcodeMCycles[state.currInstr.opr1] - mainOpcodeMCycles[0xCB];
+}
+
+template<u8 Opcode>
+void Cpu::INVALID()
+{
+	spdlog::error("Opcode invalid - ${:02X}", Opcode);
+	invalidOpcode = true;
+}
+
+#define OP_TABLE_ENTRY(op, handler)		&Cpu::handler<op>,
+
+const std::array<OpHandler, OPCODE_TBL_SIZE> Cpu::mainOpTable = { MAIN_OPCODE_LIST(OP_TABLE_ENTRY) };
+const std::array<OpHandler, OPCODE_TBL_SIZE> Cpu::cbOpTable = { CB_OPCODE_LIST(OP_TABLE_ENTRY) };
+
+#undef OP_TABLE_ENTRY
+
+bool Cpu::HitInvalidOpcode() const
+{
+	return invalidOpcode;
+}
+
 int Cpu::Step()
 {
 
 #ifdef LOGGER_ENABLE
+	MaterializeFlags();
 	state.AF.val = regs.AF();
 	state.BC = regs.BC();
 	state.DE = regs.DE();
@@ -1323,412 +1116,606 @@ int Cpu::Step()
 	state.romData[3] = rom.Read(regs.PC() + 3);
 #endif
 
+	invalidOpcode = false;
+	if (interrupts->Pending()) {
+		u64 count = 1, ran = ServiceInterrupts(count);
+
+		if (invalidOpcode)
+			return OPCODE_UNKNOWN;
+		tCycles += ran * T_CYCLES_PER_M_CYCLE;
+		ServiceEvents();
+		return ran;
+	}
+	FetchInstruction();
+	mCycles = 0;
+	(this->*mainOpTable[state.currInstr.opcode])();
+	if (invalidOpcode)
+		return OPCODE_UNKNOWN;
+	mCycles += mainOpcodeMCycles[state.currInstr.opcode];
+	tCycles += mCycles * T_CYCLES_PER_M_CYCLE;
+	ServiceEvents();
+	return mCycles;
+}
+
+/*
+	Reference dispatcher with the handlers behind a plain switch. It is not used by the
+	emulator; it is kept so the dispatch tables can be benchmarked and diffed against it.
+	Interrupts take the same path as everywhere else.
+*/
+int Cpu::StepSwitch()
+{
+	invalidOpcode = false;
+	if (interrupts->Pending()) {
+		u64 count = 1, ran = ServiceInterrupts(count);
+
+		if (invalidOpcode)
+			return OPCODE_UNKNOWN;
+		tCycles += ran * T_CYCLES_PER_M_CYCLE;
+		return ran;
+	}
 	FetchInstruction();
 	mCycles = 0;
 	switch (state.currInstr.opcode) {
-	case 0xF9:
-		LD_SP_HL();
-		break;
-	case 0xF3:
-		DI();
-		break;
-	case 0xFB:
-		EI();
-		break;
-	case 0xF8:
-		LD_HL_SP_i8();
-		break;
-	case 0xEA:
-		LD_IA16_A();
-		break;
-	case 0xFA:
-		LD_A_IA16();
-		break;
-	case 0xE9:
-		JP_HL();
-		break;
-	case 0xE8:
-		ADD_SP_E8();
-		break;
-	case 0xE0:
-		LDH_IA8_A();
-		break;
-	case 0xF0:
-		LDH_A_IA8();
-		break;
-	case 0xE2:
-		LDH_IC_A();
-		break;
-	case 0xF2:
-		LDH_A_IC();
-		break;
-	case 0xD9:
-		RETI();
-		break;
-	case 0xCB:
-		mCycles = 2;
-		regs.PC() += 1;
-		RunCBInstruction(state.currInstr.opr1);
-		return cbOpcodeMCycles[state.currInstr.opr1];
-	case 0xC6:
-		ADD_A_U8();
-		break;
-	case 0xD6:
-		SUB_A_U8();
-		break;
-	case 0xE6:
-		AND_A_U8();
-		break;
-	case 0xF6:
-		OR_A_U8();
-		break;
-	case 0xCE:
-		ADC_A_U8();
-		break;
-	case 0xDE:
-		SBC_A_U8();
-		break;
-	case 0xEE:
-		XOR_A_U8();
-		break;
-	case 0xFE:
-		CP_A_U8();
-		break;
-	case 0xC4:
-	case 0xD4:
-	case 0xCC:
-	case 0xDC:
-	case 0xCD:
-		CALL();
-		break;
-	case 0xC2:
-	case 0xD2:
-	case 0xC3:
-	case 0xCA:
-	case 0xDA:
-		JP();
-		break;
-	case 0xC0:
-	case 0xD0:
-	case 0xC8:
-	case 0xD8:
-	case 0xC9:
-		RET();
-		break;
-	case 0x86:
-		ADD_A_IHL();
-		break;
-	case 0x8E:
-		ADC_A_IHL();
-		break;
-	case 0x96:
-		SUB_A_IHL();
-		break;
-	case 0x9E:
-		SBC_A_IHL();
-		break;
-	case 0xA6:
-		AND_A_IHL();
-		break;
-	case 0xAE:
-		XOR_A_IHL();
-		break;
-	case 0xB6:
-		OR_A_IHL();
-		break;
-	case 0xBE:
-		CP_A_IHL();
-		break;
-	case 0x76:
-		HALT();
-		break;
-	case 0x70:
-	case 0x71:
-	case 0x72:
-	case 0x73:
-	case 0x74:
-	case 0x75:
-	case 0x77:
-		LD_IHL_R8();
-		break;
-	case 0x3F:
-		CCF();
-		break;
-	case 0x37:
-		SCF();
-		break;
-	case 0x2F:
-		CPL();
-		break;
-	case 0x27:
-		DAA();
-		break;
-	case 0x10:
-		STOP();
-		break;
-	case 0x0B:
-	case 0x1B:
-	case 0x2B:
-	case 0x3B:
-		DEC_R16();
-		break;
-	case 0x09:
-	case 0x19:
-	case 0x29:
-	case 0x39:
-		ADD_HL_R16();
-		break;
-	case 0x08:
-		LD_IR16_SP();
-		break;
-	case 0x00:
-		NOP();
-		break;
-	case 0x01:
-	case 0x11:
-	case 0x21:
-	case 0x31:
-		LD_R16_U16();
-		break;
-	case 0x02:
-	case 0x12:
-	case 0x22:
-	case 0x32:
-		LD_IR16_A();
-		break;
-	case 0x03:
-	case 0x13:
-	case 0x23:
-	case 0x33:
-		INC_R16();
-		break;
-	case 0x04:
-	case 0x14:
-	case 0x24:
-	case 0x0C:
-	case 0x1C:
-	case 0x2C:
-	case 0x3C:
-		INC_R8();
-		break;
-	case 0x34:
-		INC_IHL();
-		break;
-	case 0x05:
-	case 0x15:
-	case 0x25:
-	case 0x0D:
-	case 0x1D:
-	case 0x2D:
-	case 0x3D:
-		DEC_R8();
-		break;
-	case 0x35:
-		DEC_IHL();
-		break;
-	case 0x06:
-	case 0x16:
-	case 0x26:
-	case 0x0E:
-	case 0x1E:
-	case 0x2E:
-	case 0x3E:
-		LD_R8_U8();
-		break;
-	case 0x36:
-		LD_IHL_U8();
-		break;
-	case 0x40:
-	case 0x41:
-	case 0x42:
-	case 0x43:
-	case 0x44:
-	case 0x45:
-	case 0x47:
-	case 0x48:
-	case 0x49:
-	case 0x4A:
-	case 0x4B:
-	case 0x4C:
-	case 0x4D:
-	case 0x4F:
-	case 0x50:
-	case 0x51:
-	case 0x52:
-	case 0x53:
-	case 0x54:
-	case 0x55:
-	case 0x57:
-	case 0x58:
-	case 0x59:
-	case 0x5A:
-	case 0x5B:
-	case 0x5C:
-	case 0x5D:
-	case 0x5F:
-	case 0x60:
-	case 0x61:
-	case 0x62:
-	case 0x63:
-	case 0x64:
-	case 0x65:
-	case 0x67:
-	case 0x68:
-	case 0x69:
-	case 0x6A:
-	case 0x6B:
-	case 0x6C:
-	case 0x6D:
-	case 0x6F:
-	case 0x78:
-	case 0x79:
-	case 0x7A:
-	case 0x7B:
-	case 0x7C:
-	case 0x7D:
-	case 0x7F:
-		LD_R8_R8();
-		break;
-	case 0x46:
-	case 0x56:
-	case 0x66:
-	case 0x4e:
-	case 0x5e:
-	case 0x6e:
-	case 0x7e:
-		LD_R8_IHL();
-		break;
-	case 0x0A:
-	case 0x1A:
-	case 0x2A:
-	case 0x3A:
-		LD_A_IR16();
-		break;
-	case 0x18:
-		regs.PC() += (i8)this->state.currInstr.opr1;
-		break;
-	case 0x20:
-	case 0x30:
-	case 0x28:
-	case 0x38:
-		JR_COND();
-		break;
-	case 0x07:
-		RLCA();
-		break;
-	case 0x17:
-		RLA();
-		break;
-	case 0x0F:
-		RRCA();
-		break;
-	case 0x1F:
-		RRA();
-		break;
-	case 0x80:
-	case 0x81:
-	case 0x82:
-	case 0x83:
-	case 0x84:
-	case 0x85:
-	case 0x87:
-		ADD_A_R8();
-		break;
-	case 0x88:
-	case 0x89:
-	case 0x8A:
-	case 0x8B:
-	case 0x8C:
-	case 0x8D:
-	case 0x8F:
-		ADC_A_R8();
-		break;
-	case 0x90:
-	case 0x91:
-	case 0x92:
-	case 0x93:
-	case 0x94:
-	case 0x95:
-	case 0x97:
-		SUB_A_R8();
-		break;
-	case 0x98:
-	case 0x99:
-	case 0x9A:
-	case 0x9B:
-	case 0x9C:
-	case 0x9D:
-	case 0x9F:
-		SBC_A_R8();
-		break;
-	case 0xA0:
-	case 0xA1:
-	case 0xA2:
-	case 0xA3:
-	case 0xA4:
-	case 0xA5:
-	case 0xA7:
-		AND_A_R8();
-		break;
-	case 0xA8:
-	case 0xA9:
-	case 0xAA:
-	case 0xAB:
-	case 0xAC:
-	case 0xAD:
-	case 0xAF:
-		XOR_A_R8();
-		break;
-	case 0xB0:
-	case 0xB1:
-	case 0xB2:
-	case 0xB3:
-	case 0xB4:
-	case 0xB5:
-	case 0xB7:
-		OR_A_R8();
-		break;
-	case 0xB8:
-	case 0xB9:
-	case 0xBA:
-	case 0xBB:
-	case 0xBC:
-	case 0xBD:
-	case 0xBF:
-		CP_A_R8();
-		break;
-	case 0xC1:
-	case 0xD1:
-	case 0xE1:
-	case 0xF1:
-		POP_R16();
-		break;
-	case 0xC5:
-	case 0xD5:
-	case 0xE5:
-	case 0xF5:
-		PUSH_R16();
-		break;
-	case 0xC7:
-	case 0xD7:
-	case 0xE7:
-	case 0xF7:
-	case 0xCF:
-	case 0xDF:
-	case 0xEF:
-	case 0xFF:
-		RST();
-		break;
-	default:
-		spdlog::error("Opcode invalid - ${:02X}", state.currInstr.opcode);
+#define SWITCH_CASE(op, handler)		case op: handler<op>(); break;
+	MAIN_OPCODE_LIST(SWITCH_CASE)
+#undef SWITCH_CASE
+	}
+	if (invalidOpcode)
 		return OPCODE_UNKNOWN;
-	};
 	mCycles += mainOpcodeMCycles[state.currInstr.opcode];
+	tCycles += mCycles * T_CYCLES_PER_M_CYCLE;
 	return mCycles;
 }
 
-Cpu::Cpu(Bus *pBus) : bus(pBus)
+/*
+	Interprets up to count instructions, or until budget M-cycles have passed, and returns
+	the M-cycles they took; count is left with the instructions not run, and a budget of 1
+	runs exactly one. It stops early on an invalid opcode, which is then reported by
+	HitInvalidOpcode(), and after any instruction that leaves an interrupt pending.
+	On GCC/Clang the loop is direct-threaded: every opcode gets its own label that ends in
+	its own indirect jump, so the host predictor sees one branch per opcode rather than the
+	single shared branch of a switch or of a table call.
+*/
+u64 Cpu::Interpret(u64& count, u64 budget)
+{
+	u64 total = 0;
+
+	if (count == 0)
+		return total;
+#ifdef CPU_THREADED_DISPATCH
+#define THREADED_LABEL_ADDR(op, handler)	&&main_##op,
+	static void* const labels[OPCODE_TBL_SIZE] = { MAIN_OPCODE_LIST(THREADED_LABEL_ADDR) };
+#undef THREADED_LABEL_ADDR
+
+#define THREADED_DISPATCH() \
+	do { \
+		FetchInstruction(); \
+		mCycles = 0; \
+		goto *labels[state.currInstr.opcode]; \
+	} while (0)
+
+#define THREADED_LABEL(op, handler) \
+	main_##op: \
+		handler<op>(); \
+		if (invalidOpcode) \
+			return total; \
+		total += mCycles + mainOpcodeMCycles[op]; \
+		if (--count == 0 || total >= budget || interrupts->Pending()) \
+			return total; \
+		THREADED_DISPATCH();
+
+	THREADED_DISPATCH();
+	MAIN_OPCODE_LIST(THREADED_LABEL)
+#undef THREADED_LABEL
+#undef THREADED_DISPATCH
+#else
+	while (count && total < budget) {
+		FetchInstruction();
+		mCycles = 0;
+		(this->*mainOpTable[state.currInstr.opcode])();
+		if (invalidOpcode)
+			break;
+		total += mCycles + mainOpcodeMCycles[state.currInstr.opcode];
+		count--;
+		if (interrupts->Pending())
+			break;
+	}
+#endif
+	return total;
+}
+
+u32 Cpu::CodeKey(u16 pc)
+{
+	return ((u32)bus->CodeBank(pc) << 16) | pc;
+}
+
+/*
+	Decodes a block starting at pc. Invalid opcodes and instructions that would straddle
+	a code bank boundary are left to the interpreter, so this returns nullptr when the
+	very first instruction is one of them.
+*/
+Block* Cpu::BuildBlock(u16 pc, u32 key)
+{
+	Block block;
+	u16 bank = key >> 16, addr = pc;
+
+	block.startPC = pc;
+	block.bank = bank;
+	block.baseMCycles = 0;
+	block.execCount = 0;
+	block.jit = nullptr;
+	block.jitRejected = false;
+	block.idleLoop = false;
+	while (block.ops.size() < BLOCK_MAX_OPS) {
+		DecodedOp op;
+		u8 opcode = bus->Read(addr);
+		const OpcodeInfo& info = mainOpcodeInfo[opcode];
+
+		if ((info.flags & OPF_INVALID) || bus->CodeBank(addr + info.length - 1) != bank)
+			break;
+		op.opcode = opcode;
+		op.opr1 = bus->Read(addr + 1);
+		op.opr2 = bus->Read(addr + 2);
+		op.length = info.length;
+		if (opcode == 0xCB) {
+			op.handler = cbOpTable[op.opr1];
+			op.mCycles = cbOpcodeMCycles[op.opr1];
+		} else {
+			op.handler = mainOpTable[opcode];
+			op.mCycles = mainOpcodeMCycles[opcode];
+		}
+		block.ops.push_back(op);
+		block.baseMCycles += op.mCycles;
+		addr += info.length;
+		if (info.flags & OPF_ENDS_BLOCK)
+			break;
+	}
+	if (block.ops.empty())
+		return nullptr;
+	block.endPC = addr;
+	block.idleLoop = IdleLoopCandidate(block);
+	return blockCache.Insert(key, std::move(block), bank == CODE_BANK_RAM);
+}
+
+/* register-only instructions, which an idle loop may contain besides its memory reads */
+static bool IdleRegisterOp(u8 opcode)
+{
+	if (IN_RANGE(opcode, 0x40, 0xBF))
+		return (opcode & 0x07) != 0x06 && !IN_RANGE(opcode, 0x70, 0x77);
+	switch (opcode) {
+	case 0x00: case 0x07: case 0x0F: case 0x17: case 0x1F:			// NOP, rotates
+	case 0x27: case 0x2F: case 0x37: case 0x3F:						// DAA, CPL, SCF, CCF
+	case 0x03: case 0x0B: case 0x13: case 0x1B:						// INC/DEC r16
+	case 0x23: case 0x2B: case 0x33: case 0x3B:
+	case 0x04: case 0x05: case 0x0C: case 0x0D: case 0x14: case 0x15:	// INC/DEC r8
+	case 0x1C: case 0x1D: case 0x24: case 0x25: case 0x2C: case 0x2D: case 0x3C: case 0x3D:
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:	// LD r8, u8
+	case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:	// ALU A, u8
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+	A block that jumps back to its own start and, besides register operations, only reads
+	memory at fixed addresses that do not move with the clock, like a loop polling LY or a
+	flag in HRAM. Whether it really is idle is decided while it runs, see SkipIdleLoop().
+*/
+bool Cpu::IdleLoopCandidate(const Block& block)
+{
+	const DecodedOp& last = block.ops.back();
+	u16 target;
+
+	switch (last.opcode) {
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+		target = block.endPC + (i8)last.opr1;
+		break;
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:
+		target = U16(last.opr1, last.opr2);
+		break;
+	default:
+		return false;
+	}
+	if (target != block.startPC)
+		return false;
+	for (size_t i = 0; i + 1 < block.ops.size(); i++) {
+		const DecodedOp& op = block.ops[i];
+
+		if (op.opcode == 0xF0) {						// LDH A, (u8)
+			if (bus->IsClockDerived(0xFF00 | op.opr1))
+				return false;
+		} else if (op.opcode == 0xFA) {					// LD A, (u16)
+			if (bus->IsClockDerived(U16(op.opr1, op.opr2)))
+				return false;
+		} else if (op.opcode == 0xCB) {
+			if ((op.opr1 & 0x07) == 0x06)
+				return false;
+		} else if (!IdleRegisterOp(op.opcode)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	Called after a pass of an idle loop candidate of ops instructions that ended back at its
+	start, with the block still cached. When the pass right before it ended at the same
+	place with the same registers, the loop is at a fixed point: it writes nothing, and what
+	it reads cannot change before the next event. The clock then jumps over as many whole
+	passes as fit before the event, the budget or count runs out, and the skipped M-cycles
+	are returned.
+*/
+u64 Cpu::SkipIdleLoop(size_t ops, u64 pass, u64& count, u64 left)
+{
+	std::array<u16, 5> now;
+	u64 passes;
+
+	MaterializeFlags();
+	now = { regs.AF(), regs.BC(), regs.DE(), regs.HL(), regs.SP() };
+	if (idleLoopEnd != tCycles - pass * T_CYCLES_PER_M_CYCLE || now != idleLoopRegs) {
+		idleLoopEnd = tCycles;
+		idleLoopRegs = now;
+		return 0;
+	}
+	passes = std::min(std::min(left, CPU_MAX_SKIP_MCYCLES) / pass, count / ops);
+	count -= passes * ops;
+	tCycles += passes * pass * T_CYCLES_PER_M_CYCLE;
+	idleLoopEnd = tCycles;
+	if (passes) {
+		idleStats.idleLoops++;
+		idleStats.idleLoopTCycles += passes * pass * T_CYCLES_PER_M_CYCLE;
+	}
+	return passes * pass;
+}
+
+/* whether what the CPU halted or stopped on has been requested. Off the hot path, so IF and IE are read as the bus has them */
+bool Cpu::WakeUp()
+{
+	u8 requested = bus->Read(REG_IF);
+
+	if (halt == HALT_STOPPED)
+		return requested & INT_JOYPAD;
+	return requested & bus->Read(REG_IE) & INT_MASK;
+}
+
+/*
+	Taken at an instruction boundary when Interrupts().Pending() is not zero. Either the
+	highest priority interrupt is dispatched, or the one instruction the HALT bug or the EI
+	delay is about runs here, by itself. STOP holds interrupts off, so it is simply run
+	again. Returns the M-cycles taken; count loses the instructions run.
+*/
+u64 Cpu::ServiceInterrupts(u64& count)
+{
+	u8 pending = interrupts->Pending();
+	u64 ran;
+
+	if ((pending & INT_MASK) && halt != HALT_STOPPED)
+		return DispatchInterrupt(pending & INT_MASK);
+	if (pending & INT_PENDING_HALT_BUG) {
+		interrupts->SetHaltBug(false);
+		ran = RunHaltBugInstruction();
+		if (!invalidOpcode)
+			count--;
+		return ran;
+	}
+	ran = Interpret(count, 1);
+	interrupts->CommitIme();
+	return ran;
+}
+
+/*
+	Pushes PC and jumps to the vector of the lowest line, which has priority. A halted CPU
+	returns past its HALT; after EI, HALT with the HALT bug it returns to the HALT itself.
+*/
+u64 Cpu::DispatchInterrupt(u8 requested)
+{
+	u8 line = std::countr_zero(requested);
+
+	if (halt == HALT_HALTED) {
+		halt = HALT_NONE;
+		regs.PC() += mainOpcodeInfo[0x76].length;
+	}
+	if (interrupts->HaltBug()) {
+		interrupts->SetHaltBug(false);
+		regs.PC()--;
+	}
+	interrupts->Acknowledge(1U << line);
+	PushWord(regs.PC());
+	regs.PC() = INT_VECTOR_BASE + line * INT_VECTOR_STRIDE;
+	return INT_DISPATCH_M_CYCLES;
+}
+
+/* after HALT with the bug, PC fails to move past the next opcode, so its byte is also the first operand */
+u64 Cpu::RunHaltBugInstruction()
+{
+	u8 opcode = bus->Read(regs.PC());
+
+	state.currInstr.opcode = opcode;
+	state.currInstr.opr1 = opcode;
+	state.currInstr.opr2 = bus->Read(regs.PC() + 1);
+	regs.PC() += mainOpcodeInfo[opcode].length - 1;
+	mCycles = 0;
+	(this->*mainOpTable[opcode])();
+	if (invalidOpcode)
+		return 0;
+	return mCycles + mainOpcodeMCycles[opcode];
+}
+
+/*
+	Runs a cached block without fetching or decoding. A write into watched RAM drops the
+	block, possibly the one running, so the generation is checked after every instruction
+	and the block is never touched again once it changed. A write to IF or IE that leaves
+	an interrupt pending ends the block too. The clock is kept at the start of each
+	instruction, as the interpreter has it, for the registers worked out from it.
+*/
+u64 Cpu::RunBlock(const Block& block, u64& count)
+{
+	u32 generation = blockCache.Generation();
+	u64 total = 0, start = tCycles;
+
+	mCycles = 0;
+	for (size_t i = 0; i < block.ops.size(); i++) {
+		const DecodedOp op = block.ops[i];
+
+		state.currInstr.opcode = op.opcode;
+		state.currInstr.opr1 = op.opr1;
+		state.currInstr.opr2 = op.opr2;
+		regs.PC() += op.length;
+		tCycles = start + (total + mCycles) * T_CYCLES_PER_M_CYCLE;
+		total += op.mCycles;
+		count--;
+		blockCache.Stats().instructions++;
+		(this->*op.handler)();
+		if (blockCache.Generation() != generation || interrupts->Pending())
+			break;
+	}
+	tCycles = start;
+	return total + mCycles;
+}
+
+/*
+	Runs the native prefix of a block. In lockstep mode the interpreter runs the same
+	instructions right after on the real registers, and the native result is only compared
+	against it; a block that disagrees is logged and never run natively again.
+*/
+u64 Cpu::RunJitBlock(Block& block, u64& count)
+{
+	const JitBlock& native = *block.jit;
+	JitContext& ctx = jit.ctx;
+	JitStats& stats = jit.Stats();
+	u64 total;
+
+	MaterializeFlags();
+	ctx.a = regs.A();
+	ctx.f = regs.F();
+	ctx.b = regs.B();
+	ctx.c = regs.C();
+	ctx.d = regs.D();
+	ctx.e = regs.E();
+	ctx.h = regs.H();
+	ctx.l = regs.L();
+	ctx.sp = regs.SP();
+	native.entry(&ctx);
+	count -= native.ops;
+	stats.runs++;
+	stats.instructions += native.ops;
+	if (jitLockstep) {
+		u64 ops = native.ops;
+
+		total = Interpret(ops, UINT64_MAX);
+		MaterializeFlags();
+		stats.lockstepChecks++;
+		if (ctx.a != regs.A() || ctx.f != regs.F() || ctx.b != regs.B() || ctx.c != regs.C()
+				|| ctx.d != regs.D() || ctx.e != regs.E() || ctx.h != regs.H() || ctx.l != regs.L()
+				|| ctx.sp != regs.SP() || ctx.pc != regs.PC() || ctx.mCycles != total) {
+			spdlog::error("JIT block at {:02X}:{:04X} disagrees with the interpreter, A/F {:02X}/{:02X} vs {:02X}/{:02X}, PC {:04X} vs {:04X}",
+				block.bank, block.startPC, ctx.a, ctx.f, regs.A(), regs.F(), ctx.pc, regs.PC());
+			stats.lockstepMismatches++;
+			block.jit = nullptr;
+			block.jitRejected = true;
+		}
+		return total;
+	}
+	regs.A() = ctx.a;
+	regs.F() = ctx.f;
+	regs.B() = ctx.b;
+	regs.C() = ctx.c;
+	regs.D() = ctx.d;
+	regs.E() = ctx.e;
+	regs.H() = ctx.h;
+	regs.L() = ctx.l;
+	regs.SP() = ctx.sp;
+	regs.PC() = ctx.pc;
+	return ctx.mCycles;
+}
+
+/*
+	Runs up to count instructions, or until budget M-cycles have passed, and returns the
+	M-cycles they took; count is left with the instructions not run. Whole blocks come
+	from the block cache while they fit in what is left of both; everything else goes
+	through the interpreter one instruction at a time, so the budget is never overshot by
+	more than one instruction. ROM blocks that ran JIT_HOT_THRESHOLD times are handed to
+	the JIT, and from then on their native prefix runs instead.
+	The next scheduled event bounds the budget the same way and is checked once per
+	block, so an event armed by an I/O write on the way is still caught in time. Execute
+	stops when one is due and leaves servicing it to the caller.
+	Pending interrupts are checked once per block or interpreted stretch, which both end
+	as soon as one is pending.
+*/
+u64 Cpu::Execute(u64& count, u64 budget)
+{
+	u64 total = 0;
+
+	invalidOpcode = false;
+	if (!blockCacheEnabled && halt == HALT_NONE && !scheduler) {
+		while (count && total < budget && !invalidOpcode) {
+			u64 ran = interrupts->Pending() ? ServiceInterrupts(count) : Interpret(count, budget - total);
+
+			total += ran;
+			tCycles += ran * T_CYCLES_PER_M_CYCLE;
+		}
+		return total;
+	}
+	while (count && total < budget && !invalidOpcode) {
+		u64 left = budget - total, ran;
+		u16 pc = regs.PC();
+		u32 key, generation;
+		Block* block = nullptr;
+		bool idleLoop;
+		size_t blockOps;
+
+		if (scheduler) {
+			u64 next = scheduler->NextEvent();
+
+			if (tCycles >= next)
+				break;
+			left = std::min(left, (next - tCycles + T_CYCLES_PER_M_CYCLE - 1) / T_CYCLES_PER_M_CYCLE);
+		}
+		if (interrupts->Pending()) {
+			ran = ServiceInterrupts(count);
+			total += ran;
+			tCycles += ran * T_CYCLES_PER_M_CYCLE;
+			continue;
+		}
+		/*
+			Halted: the clock goes straight to the next event, which is the only thing that can
+			wake it. The time is counted in whole re-executions of HALT or STOP, exactly what
+			stepping through it one instruction at a time would take.
+		*/
+		if (halt != HALT_NONE && !WakeUp()) {
+			u64 cost = mainOpcodeMCycles[halt == HALT_STOPPED ? 0x10 : 0x76];
+			u64 times = std::min((std::min(left, CPU_MAX_SKIP_MCYCLES) + cost - 1) / cost, count);
+
+			if (times * cost >= CPU_MAX_SKIP_MCYCLES)
+				break;
+			count -= times;
+			total += times * cost;
+			tCycles += times * cost * T_CYCLES_PER_M_CYCLE;
+			idleStats.haltTCycles += times * cost * T_CYCLES_PER_M_CYCLE;
+			continue;
+		}
+		if (blockCacheEnabled) {
+			key = CodeKey(pc);
+			block = blockCache.Lookup(key);
+			if (!block)
+				block = BuildBlock(pc, key);
+		}
+		/* a write the block makes may drop it, so nothing is read from it once it has run */
+		idleLoop = block && block->idleLoop;
+		blockOps = block ? block->ops.size() : 0;
+		generation = blockCache.Generation();
+		if (block && jitEnabled && block->jit && block->jit->ops <= count && block->jit->maxMCycles <= left) {
+			ran = RunJitBlock(*block, count);
+		} else if (block && block->ops.size() <= count && block->baseMCycles + BLOCK_MAX_BRANCH_MCYCLES <= left) {
+			if (jitEnabled && !block->jit && !block->jitRejected && block->bank != CODE_BANK_RAM
+					&& ++block->execCount >= JIT_HOT_THRESHOLD) {
+				block->jit = jit.Compile(*block);
+				block->jitRejected = !block->jit;
+				jitEnabled = !jit.Disabled();
+			}
+			ran = RunBlock(*block, count);
+		} else {
+			ran = Interpret(count, 1);
+		}
+		total += ran;
+		tCycles += ran * T_CYCLES_PER_M_CYCLE;
+		if (idleLoop && regs.PC() == pc && blockCache.Generation() == generation)
+			total += SkipIdleLoop(blockOps, ran, count, left - std::min(left, ran));
+	}
+	return total;
+}
+
+/* events due on the way are serviced between instructions */
+u64 Cpu::RunInstructions(u64 count)
+{
+	u64 total = 0;
+
+	do {
+		ServiceEvents();
+		total += Execute(count, UINT64_MAX);
+	} while (count && !invalidOpcode && !Sleeping());
+	ServiceEvents();
+	return total;
+}
+
+/*
+	Runs at least tCycleBudget T-cycles, stopping at the first instruction boundary past it.
+	The CPU runs in stretches between scheduled events, each event is serviced at the first
+	instruction boundary at or after its deadline.
+*/
+u64 Cpu::RunFor(u64 tCycleBudget)
+{
+	u64 start = tCycles, end = start + tCycleBudget, count = UINT64_MAX;
+
+	do {
+		ServiceEvents();
+		Execute(count, (end - tCycles + T_CYCLES_PER_M_CYCLE - 1) / T_CYCLES_PER_M_CYCLE);
+	} while (tCycles < end && !invalidOpcode && !(Sleeping() && end - tCycles >= CPU_MAX_SKIP_MCYCLES));
+	ServiceEvents();
+	return tCycles - start;
+}
+
+u64 Cpu::GetCycleCount() const
+{
+	return tCycles;
+}
+
+const u64* Cpu::GetCycleCounter() const
+{
+	return &tCycles;
+}
+
+void Cpu::SetScheduler(Scheduler* pScheduler)
+{
+	scheduler = pScheduler;
+}
+
+bool Cpu::IsHalted() const
+{
+	return halt != HALT_NONE;
+}
+
+const IdleStats& Cpu::GetIdleStats() const
+{
+	return idleStats;
+}
+
+void Cpu::SetBlockCacheEnabled(bool enable)
+{
+	blockCacheEnabled = enable;
+	if (!enable)
+		blockCache.Clear();
+}
+
+const BlockCacheStats& Cpu::GetBlockCacheStats()
+{
+	return blockCache.Stats();
+}
+
+/* compiled blocks are dropped together with the blocks pointing at them */
+void Cpu::SetJitEnabled(bool enable)
+{
+	jitEnabled = enable && Jit::Supported() && !jit.Disabled();
+	if (!jitEnabled) {
+		blockCache.Clear();
+		jit.Reset();
+	}
+}
+
+void Cpu::SetJitLockstep(bool enable)
+{
+	jitLockstep = enable;
+}
+
+const JitStats& Cpu::GetJitStats()
+{
+	return jit.Stats();
+}
+
+Cpu::Cpu(Bus *pBus) : bus(pBus), interrupts(&pBus->Interrupts())
 {
+	bus->SetCodeWatch(&blockCache);
 	// DMG's registers start up value. Src:
 	// https://gbdev.io/pandocs/Power_Up_Sequence.html#power-up-sequence
 	//regs.af.a = 0x01;
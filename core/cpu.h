@@ -2,6 +2,9 @@
 
 #include "common.h"
 #include "bus.h"
+#include "block_cache.h"
+#include "jit_x64.h"
+#include "scheduler.h"
 #include <fstream>
 #include <vector>
 
@@ -48,6 +51,56 @@ typedef enum {
 	FLAG_C = (1U << 4),
 } CpuFlag;
 
+#define T_CYCLES_PER_M_CYCLE		4
+#define CPU_MAX_SKIP_MCYCLES		((u64)1 << 48)	// more than this is treated as no bound at all
+
+/* the ALU operation whose flags are still pending, see Cpu::MaterializeFlags() */
+typedef enum {
+	LAZY_NONE,
+	LAZY_ADD,			// ADD, ADC
+	LAZY_SUB,			// SUB, SBC, CP
+	LAZY_AND,
+	LAZY_LOGIC,			// OR, XOR
+	LAZY_INC,
+	LAZY_DEC,
+} LazyFlagOp;
+
+typedef struct LazyFlags {
+	u8 op;
+	u8 lhs;
+	u8 rhs;
+	u8 carry;			// carry into ADC/SBC
+	u8 result;
+} LazyFlags;
+
+/* savestate block, see savestate.h */
+typedef struct CpuSaveState {
+	u16 af;
+	u16 bc;
+	u16 de;
+	u16 hl;
+	u16 sp;
+	u16 pc;
+	u8 invalidOpcode;
+	u8 halt;
+	u8 reserved[10];
+	u64 tCycles;
+} CpuSaveState;
+
+/* why the CPU is not running instructions */
+typedef enum {
+	HALT_NONE,
+	HALT_HALTED,		// until an enabled interrupt is requested
+	HALT_STOPPED,		// until a button press requests the joypad interrupt
+} HaltMode;
+
+/* emulated time that went by without running instructions one by one, in T-cycles */
+typedef struct IdleStats {
+	u64 haltTCycles;
+	u64 idleLoopTCycles;
+	u64 idleLoops;			// times an idle loop was fast-forwarded
+} IdleStats;
+
 typedef struct RegisterPair {
 private:
 	union {
@@ -154,134 +207,216 @@ class Cpu {
 private:
 	CpuState state;
 	int mCycles;
+	u64 tCycles = 0;					// T-cycles run since power on
+	bool invalidOpcode = false;
 	CpuRegs regs;
+	LazyFlags lazyFlags = { LAZY_NONE, 0, 0, 0, 0 };
 	Bus* bus = nullptr;
+	InterruptController* interrupts = nullptr;
+	Scheduler* scheduler = nullptr;
+	BlockCache blockCache;
+	bool blockCacheEnabled = true;
+	Jit jit;
+	bool jitEnabled = Jit::Supported();
+	bool jitLockstep = false;
+	u8 halt = HALT_NONE;
+	u64 idleLoopEnd = UINT64_MAX;		// T-cycle the last recorded idle loop iteration ended at
+	std::array<u16, 5> idleLoopRegs;
+	IdleStats idleStats = {};
 
 	void StackPush(u8);
 	u8 StackPop();
 	void SetZNHC(bool, bool, bool, bool);
-	u16& GetR16FromOpcode(u8);
-	u8& GetR8FromOpcode(u8);
+	void MaterializeFlags();
 	/*
 		The idea of grouping instructions into blocks is based on https://gbdev.io/pandocs/CPU_Instruction_Set.html.
 		Basically all instructions in a block can be decoded the same way, so we can use that feature to reduce LOCs.
+		Handlers are templates on their opcode: operands come from the constexpr tables in opcodes.h,
+		so register selection and (HL) detection are resolved when the handler is instantiated.
 	*/
-	u16& DecodeR16MemBlock0(u8);
-	u8& DecodeR8Block1(u8);
+	template<u8 Index> u8& R8();
+	template<u8 Index> u8 ReadR8();
+	template<u8 Index> void WriteR8(u8);
+	template<u8 Index> u16& R16();
+	template<u8 Index> u16& R16Mem();
+	template<u8 Index> bool Cond();
 	void FetchInstruction();
 
-	void NOP();
+	template<u8 Opcode> void NOP();
 
 	/* load instructions */
-	void LD_R16_U16();
-	void LD_IR16_A();
-	void LD_A_IR16();
-	void LD_R8_U8();
-	void LD_IHL_U8();
-	void LD_R8_R8();
-	void LD_R8_IHL();
-	void LD_IR16_SP();
-	void LD_IHL_R8();
-	void LDH_IA8_A();
-	void LDH_IC_A();
-	void LDH_A_IA8();
-	void LDH_A_IC();
-	void LD_IA16_A();
-	void LD_A_IA16();
-	void LD_HL_SP_i8();
-	void LD_SP_HL();
+	template<u8 Opcode> void LD_R16_U16();
+	template<u8 Opcode> void LD_IR16_A();
+	template<u8 Opcode> void LD_A_IR16();
+	template<u8 Opcode> void LD_R8_U8();
+	template<u8 Opcode> void LD_IHL_U8();
+	template<u8 Opcode> void LD_R8_R8();
+	template<u8 Opcode> void LD_R8_IHL();
+	template<u8 Opcode> void LD_IR16_SP();
+	template<u8 Opcode> void LD_IHL_R8();
+	template<u8 Opcode> void LDH_IA8_A();
+	template<u8 Opcode> void LDH_IC_A();
+	template<u8 Opcode> void LDH_A_IA8();
+	template<u8 Opcode> void LDH_A_IC();
+	template<u8 Opcode> void LD_IA16_A();
+	template<u8 Opcode> void LD_A_IA16();
+	template<u8 Opcode> void LD_HL_SP_i8();
+	template<u8 Opcode> void LD_SP_HL();
 	/* increment/decrement instructions */
-	void INC_R16();
-	void INC_R8();
-	void INC_IHL();
-	void DEC_R8();
-	void DEC_IHL();
+	template<u8 Opcode> void INC_R16();
+	template<u8 Opcode> void INC_R8();
+	template<u8 Opcode> void INC_IHL();
+	template<u8 Opcode> void DEC_R8();
+	template<u8 Opcode> void DEC_IHL();
 	/* bit shift instructions */
 
 	/* jumps and subroutine instructions */
-	bool CheckSubroutineCond(u8);
-	void JR_COND();
-	void JP_HL();
-	void RET_COND();
+	template<u8 Opcode> void JR();
+	template<u8 Opcode> void JR_COND();
+	template<u8 Opcode> void JP_HL();
 	/* 8-bit arithmetic instructions */
-	void ADD_A_R8();
-	void ADC_A_R8();
-	void SUB_A_R8();
-	void SBC_A_R8();
-	void AND_A_R8();
-	void OR_A_R8();
-	void XOR_A_R8();
-	void CP_A_R8();
-	void CPL();
-	void ADD_A_IHL();
-	void SUB_A_IHL();
-	void AND_A_IHL();
-	void OR_A_IHL();
-	void ADC_A_IHL();
-	void SBC_A_IHL();
-	void XOR_A_IHL();
-	void CP_A_IHL();
-	void ADD_A_U8();
-	void SUB_A_U8();
-	void AND_A_U8();
-	void OR_A_U8();
-	void ADC_A_U8();
-	void SBC_A_U8();
-	void XOR_A_U8();
-	void CP_A_U8();
+	template<u8 Opcode> void ADD_A_R8();
+	template<u8 Opcode> void ADC_A_R8();
+	template<u8 Opcode> void SUB_A_R8();
+	template<u8 Opcode> void SBC_A_R8();
+	template<u8 Opcode> void AND_A_R8();
+	template<u8 Opcode> void OR_A_R8();
+	template<u8 Opcode> void XOR_A_R8();
+	template<u8 Opcode> void CP_A_R8();
+	template<u8 Opcode> void CPL();
+	template<u8 Opcode> void ADD_A_IHL();
+	template<u8 Opcode> void SUB_A_IHL();
+	template<u8 Opcode> void AND_A_IHL();
+	template<u8 Opcode> void OR_A_IHL();
+	template<u8 Opcode> void ADC_A_IHL();
+	template<u8 Opcode> void SBC_A_IHL();
+	template<u8 Opcode> void XOR_A_IHL();
+	template<u8 Opcode> void CP_A_IHL();
+	template<u8 Opcode> void ADD_A_U8();
+	template<u8 Opcode> void SUB_A_U8();
+	template<u8 Opcode> void AND_A_U8();
+	template<u8 Opcode> void OR_A_U8();
+	template<u8 Opcode> void ADC_A_U8();
+	template<u8 Opcode> void SBC_A_U8();
+	template<u8 Opcode> void XOR_A_U8();
+	template<u8 Opcode> void CP_A_U8();
 	/* 16-bit arithmetic instructions */
-	void ADD_HL_R16();
-	void DEC_R16();
-	void ADD_SP_E8();
+	template<u8 Opcode> void ADD_HL_R16();
+	template<u8 Opcode> void DEC_R16();
+	template<u8 Opcode> void ADD_SP_E8();
 
 	/* rotate instructions */
-	void RLCA();
-	void RLA();
-	void RRCA();
-	void RRA();
+	template<u8 Opcode> void RLCA();
+	template<u8 Opcode> void RLA();
+	template<u8 Opcode> void RRCA();
+	template<u8 Opcode> void RRA();
 
 	/* miscellanious instructions */
-	void STOP();
-	void DAA();
-	void SCF();
-	void CCF();
-	void HALT();
-	void EI();
-	void DI();
+	template<u8 Opcode> void STOP();
+	template<u8 Opcode> void DAA();
+	template<u8 Opcode> void SCF();
+	template<u8 Opcode> void CCF();
+	template<u8 Opcode> void HALT();
+	template<u8 Opcode> void EI();
+	template<u8 Opcode> void DI();
 
 	/* stack manipulation instructions */
 	void PushWord(u16);
 	u16 PopWord();
-	void PUSH_R16();
-	void POP_R16();
-	void RST();
-	void RET();
-	void RETI();
-	void JP();
-	void CALL();
+	template<u8 Opcode> void PUSH_R16();
+	template<u8 Opcode> void POP_R16();
+	template<u8 Opcode> void RST();
+	template<u8 Opcode> void RET();
+	template<u8 Opcode> void RETI();
+	template<u8 Opcode> void JP();
+	template<u8 Opcode> void CALL();
 
 	/* CB instructions */
-	void RLC();
-	void RRC();
-	void RL();
-	void RR();
-	void SLA();
-	void SRA();
-	void SWAP();
-	void SRL();
-	void BIT();
-	void RESET();
-	void SETF();
-	void RunCBInstruction(u8);
+	template<u8 Opcode> void RLC();
+	template<u8 Opcode> void RRC();
+	template<u8 Opcode> void RL();
+	template<u8 Opcode> void RR();
+	template<u8 Opcode> void SLA();
+	template<u8 Opcode> void SRA();
+	template<u8 Opcode> void SWAP();
+	template<u8 Opcode> void SRL();
+	template<u8 Opcode> void BIT();
+	template<u8 Opcode> void RESET();
+	template<u8 Opcode> void SETF();
+
+	/* dispatch */
+	template<u8 Opcode> void PREFIX_CB();
+	template<u8 Opcode> void INVALID();
+	static const std::array<OpHandler, 256> mainOpTable;
+	static const std::array<OpHandler, 256> cbOpTable;
+	u64 Interpret(u64&, u64);
+
+	/* predecoded blocks */
+	u32 CodeKey(u16);
+	Block* BuildBlock(u16, u32);
+	u64 RunBlock(const Block&, u64&);
+	u64 RunJitBlock(Block&, u64&);
+	u64 Execute(u64&, u64);
+	bool WakeUp();
+	u64 ServiceInterrupts(u64&);
+	u64 DispatchInterrupt(u8);
+	u64 RunHaltBugInstruction();
+	bool IdleLoopCandidate(const Block&);
+	u64 SkipIdleLoop(size_t, u64, u64&, u64);
+	bool Sleeping() const
+	{
+		return halt != HALT_NONE && (!scheduler || scheduler->NextEvent() == EVENT_NONE);
+	}
+	void ServiceEvents()
+	{
+		if (scheduler && tCycles >= scheduler->NextEvent())
+			scheduler->Service(tCycles);
+	}
 protected:
 public:
 	CpuState GetCpuStateForDebug(const CpuState& state);
 	CpuState GetCpuRegState() const;
 	bool CompareCpuState(const CpuState&);
 	void SetCpuState(const CpuState&);
+	void SaveState(CpuSaveState&);
+	void LoadState(const CpuSaveState&);
 	void SetFlag(CpuFlag flag, bool val);
 	bool GetFlag(CpuFlag flag);
+	bool HitInvalidOpcode() const;
 	int Step();
+	int StepSwitch();
+	u64 RunInstructions(u64);
+	u64 RunFor(u64);
+	/*
+		Runs until pred(*this) is true after an instruction, an invalid opcode is hit or
+		tCycleBudget T-cycles have passed, and returns the T-cycles run. The predicate is
+		checked after every instruction and every interrupt dispatch, so this goes through
+		the interpreter only. Events are serviced before the predicate sees the machine.
+	*/
+	template<typename Pred>
+	u64 RunUntil(Pred&& pred, u64 tCycleBudget = UINT64_MAX)
+	{
+		u64 start = tCycles, count = UINT64_MAX;
+
+		invalidOpcode = false;
+		while (tCycles - start < tCycleBudget) {
+			tCycles += (interrupts->Pending() ? ServiceInterrupts(count) : Interpret(count, 1)) * T_CYCLES_PER_M_CYCLE;
+			ServiceEvents();
+			if (invalidOpcode || pred(*this))
+				break;
+		}
+		return tCycles - start;
+	}
+	u64 GetCycleCount() const;
+	const u64* GetCycleCounter() const;
+	void SetScheduler(Scheduler*);
+	bool IsHalted() const;
+	const IdleStats& GetIdleStats() const;
+	void SetBlockCacheEnabled(bool);
+	const BlockCacheStats& GetBlockCacheStats();
+	void SetJitEnabled(bool);
+	void SetJitLockstep(bool);
+	const JitStats& GetJitStats();
 	Cpu(Bus *);
 	~Cpu();
 };
\ No newline at end of file
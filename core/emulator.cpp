@@ -10,9 +10,92 @@
 using json = nlohmann::json;
 
 
+/* the cartridge is mapped and its RTC, if any, follows the CPU clock */
 int Emulator::Load(const char* romPath)
 {
-	return rom.Load(romPath);
+	if (rom.Load(romPath) != STT_SUCCESS)
+		return STT_FAILED;
+	rom.GetMbc()->SetClock(cpu.GetCycleCounter());
+	bus.MapCartridge();
+	return STT_SUCCESS;
+}
+
+size_t Emulator::SaveStateSize()
+{
+	Mbc* mbc = rom.GetMbc();
+
+	return sizeof(SaveStateHeader) + SAVE_BLOCK_SPAN(sizeof(EmulatorSaveState)) + SAVE_BLOCK_SPAN(sizeof(CpuSaveState))
+		+ SAVE_BLOCK_SPAN(sizeof(BusSaveState)) + SAVE_BLOCK_SPAN(sizeof(MbcSaveState))
+		+ SAVE_BLOCK_SPAN(sizeof(SchedulerSaveState)) + SAVE_BLOCK_SPAN(sizeof(PpuSaveState))
+		+ SAVE_BLOCK_SPAN(sizeof(TimerSaveState)) + SAVE_BLOCK_SPAN(sizeof(ApuSaveState))
+		+ (mbc ? SAVE_BLOCK_SPAN(mbc->RamSize()) : 0);
+}
+
+/*
+	Writes the machine into buffer, which should be 8-byte aligned and SaveStateSize() bytes
+	long, and returns the bytes used. If it does not fit, 0 is returned and the buffer is
+	left without a valid header. Only runs between instructions.
+*/
+size_t Emulator::SaveState(u8* buffer, size_t capacity)
+{
+	SaveStateWriter writer(buffer, capacity, rom.ImageHash());
+	Mbc* mbc = rom.GetMbc();
+	EmulatorSaveState* emulatorSave = writer.Reserve<EmulatorSaveState>(SAVE_BLOCK_EMULATOR);
+	CpuSaveState* cpuSave = writer.Reserve<CpuSaveState>(SAVE_BLOCK_CPU);
+	BusSaveState* busSave = writer.Reserve<BusSaveState>(SAVE_BLOCK_BUS);
+	MbcSaveState* mbcSave = writer.Reserve<MbcSaveState>(SAVE_BLOCK_MBC);
+	SchedulerSaveState* schedulerSave = writer.Reserve<SchedulerSaveState>(SAVE_BLOCK_SCHEDULER);
+	PpuSaveState* ppuSave = writer.Reserve<PpuSaveState>(SAVE_BLOCK_PPU);
+	TimerSaveState* timerSave = writer.Reserve<TimerSaveState>(SAVE_BLOCK_TIMER);
+	ApuSaveState* apuSave = writer.Reserve<ApuSaveState>(SAVE_BLOCK_APU);
+	u8* cartRam = mbc ? static_cast<u8*>(writer.Reserve(SAVE_BLOCK_CART_RAM, mbc->RamSize())) : nullptr;
+
+	/* the cartridge RAM block is reserved last, it is only there if everything fit */
+	if (!cartRam)
+		return 0;
+	emulatorSave->frameEnd = frameEnd;
+	cpu.SaveState(*cpuSave);
+	bus.SaveState(*busSave);
+	mbc->SaveState(*mbcSave);
+	scheduler.SaveState(*schedulerSave);
+	ppu.SaveState(*ppuSave);
+	timer.SaveState(*timerSave);
+	apu.SaveState(*apuSave);
+	std::memcpy(cartRam, mbc->RamData(), mbc->RamSize());
+	return writer.Finish();
+}
+
+/* every block is checked before anything is restored, a bad state leaves the machine as it was */
+int Emulator::LoadState(const u8* buffer, size_t size)
+{
+	SaveStateReader reader(buffer, size, rom.ImageHash());
+	Mbc* mbc = rom.GetMbc();
+	const EmulatorSaveState* emulatorSave = reader.Find<EmulatorSaveState>(SAVE_BLOCK_EMULATOR);
+	const CpuSaveState* cpuSave = reader.Find<CpuSaveState>(SAVE_BLOCK_CPU);
+	const BusSaveState* busSave = reader.Find<BusSaveState>(SAVE_BLOCK_BUS);
+	const MbcSaveState* mbcSave = reader.Find<MbcSaveState>(SAVE_BLOCK_MBC);
+	const SchedulerSaveState* schedulerSave = reader.Find<SchedulerSaveState>(SAVE_BLOCK_SCHEDULER);
+	const PpuSaveState* ppuSave = reader.Find<PpuSaveState>(SAVE_BLOCK_PPU);
+	const TimerSaveState* timerSave = reader.Find<TimerSaveState>(SAVE_BLOCK_TIMER);
+	const ApuSaveState* apuSave = reader.Find<ApuSaveState>(SAVE_BLOCK_APU);
+	const u8* cartRam = mbc ? static_cast<const u8*>(reader.Find(SAVE_BLOCK_CART_RAM, mbc->RamSize())) : nullptr;
+
+	if (!emulatorSave || !cpuSave || !busSave || !mbcSave || !schedulerSave || !ppuSave || !timerSave || !apuSave || !cartRam) {
+		spdlog::error("The savestate is incomplete.");
+		return STT_FAILED;
+	}
+	/* sound made up to here is kept, the restored channels carry on from it */
+	apu.Sync();
+	frameEnd = emulatorSave->frameEnd;
+	cpu.LoadState(*cpuSave);
+	mbc->LoadState(*mbcSave);
+	std::memcpy(mbc->RamData(), cartRam, mbc->RamSize());
+	bus.LoadState(*busSave);
+	scheduler.LoadState(*schedulerSave);
+	ppu.LoadState(*ppuSave);
+	timer.LoadState(*timerSave);
+	apu.LoadState(*apuSave);
+	return STT_SUCCESS;
 }
 
 void Emulator::Run()
@@ -47,18 +130,182 @@ void Emulator::Run()
 
     // pretty print with indent of 4 spaces
     std::cout << std::setw(4) << j << '\n';
-	while(1) {
 #ifdef LOGGER_ENABLE
+	while(1) {
 		logger.LogCpuState(cpu.GetCpuState());
-#endif
 		if (cpu.Step() == -1)
 			break;
 	}
+#else
+	while (RunFrame() == STT_SUCCESS)
+		;
+#endif
+	const BlockCacheStats& stats = cpu.GetBlockCacheStats();
+	spdlog::info("Block cache: {} lookups, {:.1f}% hits, {} blocks built, {} invalidations, {} instructions from blocks",
+		stats.lookups, stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0, stats.builds,
+		stats.invalidations, stats.instructions);
+	const JitStats& jitStats = cpu.GetJitStats();
+	spdlog::info("JIT: {} blocks compiled, {} rejected, {} instructions native, {} of {} lockstep checks failed",
+		jitStats.compiled, jitStats.rejected, jitStats.instructions, jitStats.lockstepMismatches, jitStats.lockstepChecks);
+	const TileCacheStats& tileStats = ppu.GetTileCacheStats();
+	spdlog::info("PPU: {} frames, {} tiles decoded, {} decoded tiles dropped by VRAM writes",
+		ppu.FrameCount(), tileStats.decodes, tileStats.invalidations);
+	const IdleStats& idleStats = cpu.GetIdleStats();
+	spdlog::info("Idle: {} T-cycles skipped halted, {} T-cycles skipped in {} idle loops",
+		idleStats.haltTCycles, idleStats.idleLoopTCycles, idleStats.idleLoops);
+	const ApuStats& apuStats = apu.GetStats();
+	spdlog::info("APU: {} waveform steps, {} band-limited steps, {} samples out",
+		apuStats.steps, apuStats.deltas, apuStats.samples);
+}
+
+/*
+	Advances the machine by one video frame. Instructions are never split, so a frame may
+	end a few cycles late; the next one is shortened by the same amount, which keeps frames
+	exactly FRAME_T_CYCLES apart on average.
+*/
+int Emulator::RunFrame()
+{
+	frameEnd += FRAME_T_CYCLES;
+	if (cpu.GetCycleCount() < frameEnd)
+		cpu.RunFor(frameEnd - cpu.GetCycleCount());
+	return cpu.HitInvalidOpcode() ? STT_FAILED : STT_SUCCESS;
+}
+
+/* frames completed since power on */
+u64 Emulator::GetFrameCount() const
+{
+	return frameEnd / FRAME_T_CYCLES;
+}
+
+/*
+	Frames run with output off only advance the machine: video and audio work that nothing
+	will see is skipped. Not part of the savestate, it belongs to the host.
+*/
+void Emulator::SetOutputEnabled(bool enable)
+{
+	outputEnabled = enable;
+	ppu.SetRenderEnabled(enable);
+	apu.SetOutputEnabled(enable);
+}
+
+bool Emulator::IsOutputEnabled() const
+{
+	return outputEnabled;
+}
+
+/*
+	Headless instances still run the PPU for LY, STAT and the interrupts, so games behave
+	the same whatever the mode; only the pixels are skipped. Per instance, not saved.
+*/
+void Emulator::SetRenderMode(RenderMode mode, u32 interval)
+{
+	ppu.SetRenderMode(mode, interval);
+}
+
+/* with RENDER_ON_REQUEST, the next whole frame is drawn */
+void Emulator::RequestFrame()
+{
+	ppu.RequestFrame();
+}
+
+/* the frame number GetFramebuffer() holds, compare with GetFrameCount() to see if it is new */
+u64 Emulator::GetRenderedFrame() const
+{
+	return ppu.RenderedFrame();
+}
+
+/*
+	Has the PPU draw frames straight into the caller's memory: LCD_HEIGHT rows, stride bytes
+	apart, in format. A null pixels pointer goes back to GetFramebuffer(). Not saved.
+*/
+int Emulator::SetFrameTarget(void* pixels, u32 stride, PixelFormat format)
+{
+	FrameTarget target = { pixels, stride, format };
+
+	return ppu.SetFrameTarget(pixels ? &target : nullptr);
 }
 
-Emulator::Emulator(const char *romPath) : rom(), bus(&rom), cpu(&bus), logger()
+/*
+	Pipelined, lines are drawn on a second thread while this one goes on emulating, with
+	the same output byte for byte. GetFramebuffer() is then the newest finished frame, one
+	behind at most; a frame target is written from that thread, SyncVideo() before reading.
+*/
+void Emulator::SetVideoPipelined(bool enable)
 {
+	ppu.SetPipelined(enable);
+}
 
+void Emulator::SyncVideo()
+{
+	ppu.Sync();
+}
+
+/* LCD_WIDTH x LCD_HEIGHT shades, 0 (white) to 3 (black), while no frame target is set */
+const u8* Emulator::GetFramebuffer() const
+{
+	return ppu.Framebuffer();
+}
+
+/*
+	Off, the APU runs headless: registers and NR52 keep working, nothing is synthesized and
+	ReadAudio() has nothing to give. Per instance, not saved.
+*/
+void Emulator::SetAudioEnabled(bool enable)
+{
+	apu.SetHeadless(!enable);
+}
+
+/* samples not read yet are dropped */
+int Emulator::SetAudioSampleRate(u32 rate)
+{
+	return apu.SetSampleRate(rate);
+}
+
+/*
+	Up to count stereo samples made up to the current clock, interleaved left then right,
+	at the audio sample rate; returns how many were written. Call at least once a frame or
+	so, the APU only holds APU_BUFFER_SAMPLES.
+*/
+size_t Emulator::ReadAudio(i16* samples, size_t count)
+{
+	return apu.ReadSamples(samples, count);
+}
+
+/* JOYPAD_* bits, held from now until changed; not saved */
+void Emulator::SetButtons(u8 held)
+{
+	bus.SetButtons(held);
+}
+
+/* a byte as the CPU would read it now, I/O registers included */
+u8 Emulator::ReadMemory(u16 addr)
+{
+	return bus.Read(addr);
+}
+
+/* off runs everything through the block cache and the interpreter */
+void Emulator::SetJitEnabled(bool enable)
+{
+	cpu.SetJitEnabled(enable);
+}
+
+/* every native block is checked against the interpreter, for debugging the JIT */
+void Emulator::SetJitLockstep(bool enable)
+{
+	cpu.SetJitLockstep(enable);
+}
+
+/* holds the pixel kernels below the best set the host supports */
+void Emulator::SetPixelIsa(PixelIsa isa)
+{
+	ppu.SetPixelIsa(isa);
+}
+
+/* powered on with no cartridge, Load() maps one */
+Emulator::Emulator() : scheduler(), rom(), bus(&rom), ppu(&bus, &scheduler), timer(&bus, &scheduler), apu(&bus, &scheduler), cpu(&bus), logger()
+{
+	scheduler.SetClock(cpu.GetCycleCounter());
+	cpu.SetScheduler(&scheduler);
 }
 
 Emulator::~Emulator()
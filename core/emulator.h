@@ -4,17 +4,57 @@
 #include "cpu.h"
 #include "bus.h"
 #include "rom.h"
+#include "scheduler.h"
+#include "ppu.h"
+#include "timer.h"
+#include "apu.h"
 #include "logger.h"
+#include "savestate.h"
+
+#define FRAME_T_CYCLES			70224
+
+/* savestate block, see savestate.h */
+typedef struct EmulatorSaveState {
+	u64 frameEnd;
+} EmulatorSaveState;
 
 class Emulator {
 private:
-	Cpu cpu;
-	Bus bus;
+	Scheduler scheduler;
 	Rom rom;
+	Bus bus;
+	Ppu ppu;
+	Timer timer;
+	Apu apu;
+	Cpu cpu;
 	Logger logger;
+	u64 frameEnd = 0;				// T-cycle timestamp the current frame ends at
+	bool outputEnabled = true;		// video and audio are produced, off for speculative frames
 public:
 	void Run();
+	int RunFrame();
+	u64 GetFrameCount() const;
+	void SetJitEnabled(bool);
+	void SetJitLockstep(bool);
+	void SetPixelIsa(PixelIsa);
+	void SetOutputEnabled(bool);
+	bool IsOutputEnabled() const;
+	void SetRenderMode(RenderMode, u32 = 1);
+	void RequestFrame();
+	u64 GetRenderedFrame() const;
+	int SetFrameTarget(void*, u32, PixelFormat);
+	void SetVideoPipelined(bool);
+	void SyncVideo();
+	const u8* GetFramebuffer() const;
+	void SetAudioEnabled(bool);
+	int SetAudioSampleRate(u32);
+	size_t ReadAudio(i16*, size_t);
+	void SetButtons(u8);
+	u8 ReadMemory(u16);
 	int Load(const char *);
-	Emulator(const char *);
+	size_t SaveStateSize();
+	size_t SaveState(u8*, size_t);
+	int LoadState(const u8*, size_t);
+	Emulator();
 	~Emulator();
 };
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "interrupts.h"
+
+void InterruptController::Update()
+{
+	pending = (ime ? Requested() : 0) | (imeDelayed ? INT_PENDING_EI : 0) | (haltBug ? INT_PENDING_HALT_BUG : 0);
+}
+
+/* a source raises its line */
+void InterruptController::Request(u8 mask)
+{
+	*flags |= mask;
+	Update();
+}
+
+/* dispatch: the handled line is dropped and IME goes down until EI or RETI */
+void InterruptController::Acknowledge(u8 mask)
+{
+	*flags &= ~mask;
+	ime = false;
+	imeDelayed = false;
+	Update();
+}
+
+void InterruptController::WriteFlags(u8 val)
+{
+	*flags = val;
+	Update();
+}
+
+void InterruptController::WriteEnable(u8 val)
+{
+	*enable = val;
+	Update();
+}
+
+/* DI and RETI act at once; DI also cancels an EI still waiting */
+void InterruptController::SetIme(bool enabled)
+{
+	ime = enabled;
+	imeDelayed = false;
+	Update();
+}
+
+void InterruptController::DelayIme()
+{
+	imeDelayed = true;
+	Update();
+}
+
+/* the instruction after EI ran */
+void InterruptController::CommitIme()
+{
+	if (imeDelayed)
+		ime = true;
+	imeDelayed = false;
+	Update();
+}
+
+void InterruptController::SetHaltBug(bool enabled)
+{
+	haltBug = enabled;
+	Update();
+}
+
+InterruptController::InterruptController(u8* pFlags, u8* pEnable) : flags(pFlags), enable(pEnable)
+{
+
+}
+
+InterruptController::~InterruptController()
+{
+
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+
+#define INT_VBLANK				(1U << 0)
+#define INT_STAT				(1U << 1)
+#define INT_TIMER				(1U << 2)
+#define INT_SERIAL				(1U << 3)
+#define INT_JOYPAD				(1U << 4)
+#define INT_MASK				0x1F
+
+/* one-instruction CPU states that share the pending mask with the interrupts, see Pending() */
+#define INT_PENDING_EI			(1U << 5)		// EI ran, IME goes up after the next instruction
+#define INT_PENDING_HALT_BUG	(1U << 6)		// the next opcode byte is read twice
+
+#define INT_VECTOR_BASE			0x40
+#define INT_VECTOR_STRIDE		8
+#define INT_DISPATCH_M_CYCLES	5
+
+/*
+	IME, IF and IE, with IE & IF & IME kept as one cached mask. The mask only changes when
+	IF or IE are written through the bus, when a source raises a line with Request() and
+	when IME changes, so the CPU tests a single byte between instructions instead of
+	reading two registers. The EI delay and the HALT bug are folded into the same byte, so
+	the rare instruction boundary that needs attention costs the common one nothing more.
+	IF and IE themselves stay in the bus I/O page, where they are read and saved.
+*/
+class InterruptController {
+private:
+	u8* flags;					// IF
+	u8* enable;					// IE
+	bool ime = false;
+	bool imeDelayed = false;
+	bool haltBug = false;
+	u8 pending = 0;
+
+	void Update();
+public:
+	/* non-zero when the CPU has to stop before the next instruction */
+	u8 Pending() const { return pending; }
+	u8 Requested() const { return *flags & *enable & INT_MASK; }
+	bool Ime() const { return ime; }
+	void Request(u8);
+	void Acknowledge(u8);
+	void WriteFlags(u8);
+	void WriteEnable(u8);
+	void SetIme(bool);
+	void DelayIme();
+	bool ImeDelayed() const { return imeDelayed; }
+	void CommitIme();
+	void SetHaltBug(bool);
+	bool HaltBug() const { return haltBug; }
+	InterruptController(u8*, u8*);
+	InterruptController(const InterruptController&) = delete;
+	InterruptController& operator=(const InterruptController&) = delete;
+	~InterruptController();
+};
\ No newline at end of file
@@ -0,0 +1,536 @@
+#include "jit_x64.h"
+#include "opcodes.h"
+#include "cpu.h"
+#include <cstddef>
+#include <cstring>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define HOST_RAX				0
+#define HOST_RCX				1
+#define HOST_RDX				2
+#define HOST_RBX				3
+#define HOST_R8					8
+#define HOST_R9					9
+#define HOST_R10				10
+#define HOST_R11				11
+#define HOST_R12				12
+#define HOST_R13				13
+#define HOST_R14				14
+#define HOST_R15				15
+#define HOST_NONE				0xFF
+
+/* x86 group 1 digits */
+#define X86_ADD					0
+#define X86_OR					1
+#define X86_ADC					2
+#define X86_SBB					3
+#define X86_AND					4
+#define X86_SUB					5
+#define X86_XOR					6
+#define X86_CMP					7
+
+#define X86_JZ					0x84
+#define X86_JNZ					0x85
+
+#define CTX_OFFSET(field)		((u8)offsetof(JitContext, field))
+
+/* host register of each R8 operand, (HL) has none */
+static const std::array<u8, 8> hostR8 = {
+	HOST_R9, HOST_R10, HOST_R11, HOST_R12, HOST_R13, HOST_R14, HOST_NONE, HOST_R8
+};
+
+/* the SM83 ALU order (ADD ADC SUB SBC AND XOR OR CP) in x86 terms */
+static const std::array<u8, 8> hostAluOp = {
+	X86_ADD, X86_ADC, X86_SUB, X86_SBB, X86_AND, X86_XOR, X86_OR, X86_CMP
+};
+
+static const std::array<u8, 8> ctxR8Offset = {
+	CTX_OFFSET(b), CTX_OFFSET(c), CTX_OFFSET(d), CTX_OFFSET(e),
+	CTX_OFFSET(h), CTX_OFFSET(l), 0, CTX_OFFSET(a)
+};
+
+void Jit::Emit(u8 byte)
+{
+	code.push_back(byte);
+}
+
+void Jit::Emit16(u16 word)
+{
+	Emit(LSB(word));
+	Emit(MSB(word));
+}
+
+void Jit::Emit32(u32 dword)
+{
+	Emit16(dword & 0xFFFF);
+	Emit16(dword >> 16);
+}
+
+/* always emitted for byte operations so that encodings 4-7 mean spl..dil, never ah..bh */
+void Jit::EmitRex(u8 reg, u8 rm)
+{
+	Emit(0x40 | ((reg >= 8) ? 0x04 : 0) | ((rm >= 8) ? 0x01 : 0));
+}
+
+void Jit::EmitMovR8R8(u8 dst, u8 src)
+{
+	EmitRex(src, dst);
+	Emit(0x88);
+	Emit(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void Jit::EmitMovR8Imm(u8 dst, u8 imm)
+{
+	EmitRex(0, dst);
+	Emit(0xB0 + (dst & 7));
+	Emit(imm);
+}
+
+void Jit::EmitAluR8R8(u8 op, u8 dst, u8 src)
+{
+	EmitRex(src, dst);
+	Emit(op << 3);
+	Emit(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void Jit::EmitAluR8Imm(u8 op, u8 dst, u8 imm)
+{
+	EmitRex(0, dst);
+	Emit(0x80);
+	Emit(0xC0 | (op << 3) | (dst & 7));
+	Emit(imm);
+}
+
+/* single register forms of inc/dec (0xFE), rotate by one (0xD0) and not (0xF6) */
+void Jit::EmitGroupR8(u8 opcode, u8 digit, u8 dst)
+{
+	EmitRex(0, dst);
+	Emit(opcode);
+	Emit(0xC0 | (digit << 3) | (dst & 7));
+}
+
+/* movzx dst32, byte [r15 + offset] */
+void Jit::EmitLoadCtx8(u8 dst, u8 offset)
+{
+	Emit(0x41 | ((dst >= 8) ? 0x04 : 0));
+	Emit(0x0F);
+	Emit(0xB6);
+	Emit(0x40 | ((dst & 7) << 3) | 7);
+	Emit(offset);
+}
+
+/* mov byte [r15 + offset], src8 */
+void Jit::EmitStoreCtx8(u8 offset, u8 src)
+{
+	Emit(0x41 | ((src >= 8) ? 0x04 : 0));
+	Emit(0x88);
+	Emit(0x40 | ((src & 7) << 3) | 7);
+	Emit(offset);
+}
+
+/* bt ebx, 4: guest C into the host carry, for ADC/SBC/RLA/RRA */
+void Jit::EmitCarryToHost()
+{
+	Emit(0x0F);
+	Emit(0xBA);
+	Emit(0xE3);
+	Emit(0x04);
+}
+
+/*
+	Rebuilds F in bl from the host flags of the previous instruction: ZF, AF and CF map
+	one-to-one onto Z, H and C. The low nibble of F is kept as the interpreter keeps it.
+*/
+void Jit::EmitFlagsFromHost(bool keepCarry, u8 clear, u8 set)
+{
+	Emit(0x9F);						// lahf
+	Emit(0x0F);						// movzx eax, ah
+	Emit(0xB6);
+	Emit(0xC4);
+	Emit(0x41);						// movzx edx, byte [r15 + rax + hostFlagsToF]
+	Emit(0x0F);
+	Emit(0xB6);
+	Emit(0x94);
+	Emit(0x07);
+	Emit32(offsetof(JitContext, hostFlagsToF));
+	if (keepCarry) {
+		Emit(0x80);					// and bl, 0x1F
+		Emit(0xE3);
+		Emit(0x0F | FLAG_C);
+		Emit(0x80);					// and dl, ~C
+		Emit(0xE2);
+		Emit((u8)~FLAG_C);
+	} else {
+		Emit(0x80);					// and bl, 0x0F
+		Emit(0xE3);
+		Emit(0x0F);
+	}
+	Emit(0x08);						// or bl, dl
+	Emit(0xD3);
+	if (clear) {
+		Emit(0x80);					// and bl, ~clear
+		Emit(0xE3);
+		Emit((u8)~clear);
+	}
+	if (set) {
+		Emit(0x80);					// or bl, set
+		Emit(0xCB);
+		Emit(set);
+	}
+}
+
+size_t Jit::EmitJcc(u8 cc)
+{
+	Emit(0x0F);
+	Emit(cc);
+	Emit32(0);
+	return code.size() - 4;
+}
+
+void Jit::PatchRel32(size_t at, size_t target)
+{
+	u32 rel = (u32)(target - (at + 4));
+
+	std::memcpy(&code[at], &rel, sizeof(rel));
+}
+
+void Jit::EmitPrologue()
+{
+	Emit(0x53);						// push rbx
+	Emit(0x41); Emit(0x54);			// push r12
+	Emit(0x41); Emit(0x55);			// push r13
+	Emit(0x41); Emit(0x56);			// push r14
+	Emit(0x41); Emit(0x57);			// push r15
+	Emit(0x49);
+	Emit(0x89);
+#ifdef _WIN32
+	Emit(0xCF);						// mov r15, rcx
+#else
+	Emit(0xFF);						// mov r15, rdi
+#endif
+	for (u8 r8 = R8_B; r8 <= R8_A; r8++) {
+		if (r8 != R8_IHL)
+			EmitLoadCtx8(hostR8[r8], ctxR8Offset[r8]);
+	}
+	EmitLoadCtx8(HOST_RBX, CTX_OFFSET(f));
+}
+
+void Jit::EmitEpilogue()
+{
+	for (u8 r8 = R8_B; r8 <= R8_A; r8++) {
+		if (r8 != R8_IHL)
+			EmitStoreCtx8(ctxR8Offset[r8], hostR8[r8]);
+	}
+	EmitStoreCtx8(CTX_OFFSET(f), HOST_RBX);
+	Emit(0x41); Emit(0x5F);			// pop r15
+	Emit(0x41); Emit(0x5E);			// pop r14
+	Emit(0x41); Emit(0x5D);			// pop r13
+	Emit(0x41); Emit(0x5C);			// pop r12
+	Emit(0x5B);						// pop rbx
+	Emit(0xC3);						// ret
+}
+
+/* every exit writes back the guest state, so exits carry their own copy of the epilogue */
+void Jit::EmitExit(u16 pc, u32 mCycles)
+{
+	Emit(0x66);						// mov word [r15 + pc], imm16
+	Emit(0x41);
+	Emit(0xC7);
+	Emit(0x47);
+	Emit(CTX_OFFSET(pc));
+	Emit16(pc);
+	Emit(0x41);						// mov dword [r15 + mCycles], imm32
+	Emit(0xC7);
+	Emit(0x47);
+	Emit(CTX_OFFSET(mCycles));
+	Emit32(mCycles);
+	EmitEpilogue();
+}
+
+/* straight-line instructions; returns false for anything the backend leaves to the interpreter */
+bool Jit::EmitOp(const DecodedOp& op)
+{
+	const OpcodeInfo& info = mainOpcodeInfo[op.opcode];
+	u8 dst = hostR8[info.r8Dst], src = hostR8[info.r8Src];
+
+	if (op.opcode == 0x00)
+		return true;
+	if (IN_RANGE(op.opcode, 0x40, 0x7F)) {						// LD r8, r8
+		if (dst == HOST_NONE || src == HOST_NONE)
+			return false;
+		if (dst != src)
+			EmitMovR8R8(dst, src);
+		return true;
+	}
+	if ((op.opcode & 0xC7) == 0x06 && dst != HOST_NONE) {		// LD r8, u8
+		EmitMovR8Imm(dst, op.opr1);
+		return true;
+	}
+	if ((op.opcode & 0xC6) == 0x04 && dst != HOST_NONE) {		// INC/DEC r8
+		bool dec = op.opcode & 0x01;
+
+		EmitGroupR8(0xFE, dec ? 1 : 0, dst);
+		EmitFlagsFromHost(true, dec ? 0 : FLAG_N, dec ? FLAG_N : 0);
+		return true;
+	}
+	if ((op.opcode & 0xC7) == 0x03) {							// INC/DEC r16
+		bool dec = op.opcode & 0x08;
+
+		if (info.r16 == R16_SP) {
+			Emit(0x66);											// inc/dec word [r15 + sp]
+			Emit(0x41);
+			Emit(0xFF);
+			Emit(dec ? 0x4F : 0x47);
+			Emit(CTX_OFFSET(sp));
+		} else {
+			u8 hi = hostR8[info.r16 * 2], lo = hostR8[info.r16 * 2 + 1];
+
+			EmitAluR8Imm(dec ? X86_SUB : X86_ADD, lo, 1);
+			EmitAluR8Imm(dec ? X86_SBB : X86_ADC, hi, 0);
+		}
+		return true;
+	}
+	if (IN_RANGE(op.opcode, 0x80, 0xBF) || (op.opcode & 0xC7) == 0xC6) {	// ALU A, r8 / ALU A, u8
+		u8 alu = (op.opcode >> 3) & 0x07, hostOp = hostAluOp[alu];
+		bool imm = op.opcode >= 0xC0;
+
+		if (!imm && src == HOST_NONE)
+			return false;
+		if (hostOp == X86_ADC || hostOp == X86_SBB)
+			EmitCarryToHost();
+		if (imm)
+			EmitAluR8Imm(hostOp, HOST_R8, op.opr1);
+		else
+			EmitAluR8R8(hostOp, HOST_R8, src);
+		switch (hostOp) {
+		case X86_ADD:
+		case X86_ADC:
+			EmitFlagsFromHost(false, 0, 0);
+			break;
+		case X86_SUB:
+		case X86_SBB:
+		case X86_CMP:
+			EmitFlagsFromHost(false, 0, FLAG_N);
+			break;
+		case X86_AND:
+			EmitFlagsFromHost(false, FLAG_H | FLAG_C, FLAG_H);
+			break;
+		default:
+			EmitFlagsFromHost(false, FLAG_H | FLAG_C, 0);
+			break;
+		}
+		return true;
+	}
+	switch (op.opcode) {
+	case 0x07:													// RLCA
+	case 0x0F:													// RRCA
+	case 0x17:													// RLA
+	case 0x1F:													// RRA
+		if (op.opcode >= 0x17)
+			EmitCarryToHost();
+		EmitGroupR8(0xD0, (op.opcode >> 3) & 0x03, HOST_R8);	// rol/ror/rcl/rcr r8b, 1
+		EmitFlagsFromHost(false, FLAG_Z | FLAG_N | FLAG_H, 0);
+		return true;
+	case 0x2F:													// CPL
+		EmitGroupR8(0xF6, 2, HOST_R8);
+		Emit(0x80);												// or bl, N | H
+		Emit(0xCB);
+		Emit(FLAG_N | FLAG_H);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* JR/JP terminators; both exits are emitted and the block ends here */
+bool Jit::EmitBranch(const DecodedOp& op, u16 next, u32& mCycles)
+{
+	u16 target;
+	u8 cond = mainOpcodeInfo[op.opcode].cond;
+	size_t taken;
+
+	switch (op.opcode) {
+	case 0x18:
+	case 0x20:
+	case 0x28:
+	case 0x30:
+	case 0x38:
+		target = next + (i8)op.opr1;
+		break;
+	case 0xC2:
+	case 0xC3:
+	case 0xCA:
+	case 0xD2:
+	case 0xDA:
+		target = U16(op.opr1, op.opr2);
+		break;
+	default:
+		return false;
+	}
+	mCycles += op.mCycles;
+	if (op.opcode == 0x18 || op.opcode == 0xC3) {
+		EmitExit(target, mCycles);
+		return true;
+	}
+	Emit(0xF6);													// test bl, Z or C
+	Emit(0xC3);
+	Emit((cond == COND_NZ || cond == COND_Z) ? FLAG_Z : FLAG_C);
+	taken = EmitJcc((cond == COND_NZ || cond == COND_NC) ? X86_JZ : X86_JNZ);
+	EmitExit(next, mCycles);
+	PatchRel32(taken, code.size());
+	mCycles += 1;
+	EmitExit(target, mCycles);
+	return true;
+}
+
+const JitBlock* Jit::Compile(const Block& block)
+{
+	u16 pc = block.startPC;
+	u32 mCycles = 0;
+	u8 ops = 0;
+	bool exited = false;
+
+	if (!Supported() || full || disabled)
+		return nullptr;
+#ifdef JIT_X64_SUPPORTED
+	if (!arena) {
+#ifdef _WIN32
+		arena = static_cast<u8*>(VirtualAlloc(nullptr, JIT_ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+		void* mem = mmap(nullptr, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		arena = (mem == MAP_FAILED) ? nullptr : static_cast<u8*>(mem);
+#endif
+		if (!arena) {
+			Disable("the code arena could not be mapped");
+			return nullptr;
+		}
+	}
+#endif
+
+	code.clear();
+	EmitPrologue();
+	for (const DecodedOp& op : block.ops) {
+		if (EmitOp(op)) {
+			pc += op.length;
+			mCycles += op.mCycles;
+			ops++;
+			continue;
+		}
+		if (EmitBranch(op, pc + op.length, mCycles)) {
+			ops++;
+			exited = true;
+		}
+		break;
+	}
+	if (ops == 0) {
+		stats.rejected++;
+		return nullptr;
+	}
+	if (!exited)
+		EmitExit(pc, mCycles);
+	if (arenaUsed + code.size() > JIT_ARENA_SIZE) {
+		full = true;
+		return nullptr;
+	}
+
+	/* a page shared with earlier blocks is not executable while this one is copied in */
+	if (!SetWritable(arenaUsed, code.size(), true)) {
+		Disable("the code arena could not be made writable");
+		return nullptr;
+	}
+	std::memcpy(arena + arenaUsed, code.data(), code.size());
+	if (!SetWritable(arenaUsed, code.size(), false)) {
+		Disable("the code arena could not be made executable");
+		return nullptr;
+	}
+
+	JitBlock& jitBlock = blocks.emplace_back();
+
+	jitBlock.entry = reinterpret_cast<JitEntry>(arena + arenaUsed);
+	jitBlock.ops = ops;
+	jitBlock.maxMCycles = mCycles;
+	arenaUsed = (arenaUsed + code.size() + 15) & ~(size_t)15;
+	stats.compiled++;
+	return &jitBlock;
+}
+
+/* switches the pages holding [offset, offset + size) between read-write and read-execute */
+bool Jit::SetWritable(size_t offset, size_t size, bool writable)
+{
+	size_t first = offset & ~(size_t)(JIT_PAGE_SIZE - 1);
+	size_t end = (offset + size + JIT_PAGE_SIZE - 1) & ~(size_t)(JIT_PAGE_SIZE - 1);
+
+#if defined(JIT_X64_SUPPORTED) && defined(_WIN32)
+	DWORD old;
+
+	return VirtualProtect(arena + first, end - first, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old);
+#elif defined(JIT_X64_SUPPORTED)
+	return !mprotect(arena + first, end - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+#else
+	return false;
+#endif
+}
+
+/* for good: blocks compiled so far stay executable, but the CPU stops entering them */
+void Jit::Disable(const char* reason)
+{
+	disabled = true;
+	spdlog::warn("JIT disabled: {}.", reason);
+}
+
+/* drops every compiled block; callers must forget the JitBlock pointers they hold */
+void Jit::Reset()
+{
+	blocks.clear();
+	arenaUsed = 0;
+	full = false;
+}
+
+bool Jit::Full() const
+{
+	return full;
+}
+
+JitStats& Jit::Stats()
+{
+	return stats;
+}
+
+bool Jit::Supported()
+{
+#ifdef JIT_X64_SUPPORTED
+	return true;
+#else
+	return false;
+#endif
+}
+
+Jit::Jit() : stats(), ctx()
+{
+	for (int ah = 0; ah < 256; ah++) {
+		ctx.hostFlagsToF[ah] = (NTHBIT(ah, 6) ? FLAG_Z : 0)		// ZF
+			| (NTHBIT(ah, 4) ? FLAG_H : 0)						// AF
+			| (NTHBIT(ah, 0) ? FLAG_C : 0);						// CF
+	}
+}
+
+Jit::~Jit()
+{
+#ifdef JIT_X64_SUPPORTED
+	if (arena) {
+#ifdef _WIN32
+		VirtualFree(arena, 0, MEM_RELEASE);
+#else
+		munmap(arena, JIT_ARENA_SIZE);
+#endif
+	}
+#endif
+}
\ No newline at end of file
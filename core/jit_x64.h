@@ -0,0 +1,105 @@
+#pragma once
+
+#include "common.h"
+#include "block_cache.h"
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X64_SUPPORTED
+#endif
+
+#define JIT_HOT_THRESHOLD			16
+#define JIT_ARENA_SIZE				(4 * MiB)
+#define JIT_PAGE_SIZE				(4 * KiB)
+
+/*
+	Guest state handed to a compiled block. The generated code addresses the fields by
+	their offsets, so the layout is part of the backend.
+*/
+typedef struct JitContext {
+	u8 a;
+	u8 f;
+	u8 b;
+	u8 c;
+	u8 d;
+	u8 e;
+	u8 h;
+	u8 l;
+	u16 sp;
+	u16 pc;
+	u32 mCycles;				// M-cycles taken by the last block
+	u8 hostFlagsToF[256];		// LAHF result -> Z/H/C in SM83 layout
+} JitContext;
+
+typedef void (*JitEntry)(JitContext*);
+
+typedef struct JitBlock {
+	JitEntry entry;
+	u8 ops;						// guest instructions run, a compiled block always runs all of them
+	u32 maxMCycles;				// with every branch taken
+} JitBlock;
+
+typedef struct JitStats {
+	u64 compiled;
+	u64 rejected;
+	u64 runs;
+	u64 instructions;
+	u64 lockstepChecks;
+	u64 lockstepMismatches;
+} JitStats;
+
+/*
+	x86-64 backend for hot ROM blocks. Only register-to-register instructions are compiled,
+	ending in an optional JR/JP; the rest of the block is left to the interpreter. Guest
+	registers live in host registers for the whole block:
+		A:r8 B:r9 C:r10 D:r11 E:r12 H:r13 L:r14 F:bl, JitContext*: r15
+	Blocks never touch guest memory, which keeps them clear of self-modifying code and of
+	any I/O timing. The arena is never writable and executable at once: it is mapped
+	read-write, and the pages a block was copied to go back to read-execute right after.
+	A host that refuses either mapping gets no JIT.
+*/
+class Jit {
+private:
+	u8* arena = nullptr;
+	size_t arenaUsed = 0;
+	bool full = false;
+	bool disabled = false;
+	std::vector<u8> code;
+	std::deque<JitBlock> blocks;
+	JitStats stats;
+
+	void Emit(u8);
+	void Emit16(u16);
+	void Emit32(u32);
+	void EmitRex(u8, u8);
+	void EmitMovR8R8(u8, u8);
+	void EmitMovR8Imm(u8, u8);
+	void EmitAluR8R8(u8, u8, u8);
+	void EmitAluR8Imm(u8, u8, u8);
+	void EmitGroupR8(u8, u8, u8);
+	void EmitLoadCtx8(u8, u8);
+	void EmitStoreCtx8(u8, u8);
+	void EmitCarryToHost();
+	void EmitFlagsFromHost(bool, u8, u8);
+	void EmitExit(u16, u32);
+	size_t EmitJcc(u8);
+	void PatchRel32(size_t, size_t);
+	void EmitPrologue();
+	void EmitEpilogue();
+	bool EmitOp(const DecodedOp&);
+	bool EmitBranch(const DecodedOp&, u16, u32&);
+	bool SetWritable(size_t, size_t, bool);
+	void Disable(const char*);
+public:
+	JitContext ctx;
+	const JitBlock* Compile(const Block&);
+	void Reset();
+	bool Full() const;
+	bool Disabled() const { return disabled; }
+	JitStats& Stats();
+	static bool Supported();
+	Jit();
+	~Jit();
+};
\ No newline at end of file
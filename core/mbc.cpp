@@ -0,0 +1,316 @@
+#include "mbc.h"
+
+#define RAM_ENABLE_VALUE		0x0A
+
+void Mbc::Write(u16 addr, u8 val)
+{
+
+}
+
+u8* Mbc::RamWindow()
+{
+	if (!ramEnabled || ram.size() < EXT_RAM_BANK_SIZE)
+		return nullptr;
+	return ram.data() + (ramBank * EXT_RAM_BANK_SIZE) % ram.size();
+}
+
+/* only reached for disabled RAM and for RAM smaller than one bank, which is mirrored */
+u8 Mbc::RamRead(u16 addr)
+{
+	if (!ramEnabled || ram.empty())
+		return 0xFF;
+	return ram[(ramBank * EXT_RAM_BANK_SIZE + (addr & (EXT_RAM_BANK_SIZE - 1))) % ram.size()];
+}
+
+void Mbc::RamWrite(u16 addr, u8 val)
+{
+	if (ramEnabled && !ram.empty())
+		ram[(ramBank * EXT_RAM_BANK_SIZE + (addr & (EXT_RAM_BANK_SIZE - 1))) % ram.size()] = val;
+}
+
+/* cartridge RAM is saved in a block of its own, see Emulator::SaveState() */
+void Mbc::SaveState(MbcSaveState& save) const
+{
+	save = {};
+	save.romBank0 = romBank0;
+	save.romBank1 = romBank1;
+	save.ramBank = ramBank;
+	save.ramEnabled = ramEnabled;
+}
+
+void Mbc::LoadState(const MbcSaveState& save)
+{
+	romBank0 = save.romBank0 % romBanks;
+	romBank1 = save.romBank1 % romBanks;
+	ramBank = save.ramBank;
+	ramEnabled = save.ramEnabled;
+}
+
+void Mbc::SetClock(const u64* pClock)
+{
+	clock = pClock;
+}
+
+/* a cartridge without a controller has nothing to enable, its RAM is always there */
+Mbc::Mbc(u32 banks, u32 ramSize) : romBanks(banks), ram(ramSize, 0), ramEnabled(true)
+{
+
+}
+
+Mbc::~Mbc()
+{
+
+}
+
+void Mbc1::UpdateBanks()
+{
+	romBank1 = ((bankHigh << 5) | bankLow) % romBanks;
+	romBank0 = advancedMode ? ((bankHigh << 5) % romBanks) : 0;
+	ramBank = advancedMode ? bankHigh : 0;
+}
+
+void Mbc1::Write(u16 addr, u8 val)
+{
+	if (addr < 0x2000) {
+		ramEnabled = (val & 0x0F) == RAM_ENABLE_VALUE;
+	} else if (addr < 0x4000) {
+		bankLow = val & 0x1F;
+		if (!bankLow)
+			bankLow = 1;
+	} else if (addr < 0x6000) {
+		bankHigh = val & 0x03;
+	} else {
+		advancedMode = val & 0x01;
+	}
+	UpdateBanks();
+}
+
+void Mbc1::SaveState(MbcSaveState& save) const
+{
+	Mbc::SaveState(save);
+	save.bankLow = bankLow;
+	save.bankHigh = bankHigh;
+	save.advancedMode = advancedMode;
+}
+
+void Mbc1::LoadState(const MbcSaveState& save)
+{
+	Mbc::LoadState(save);
+	bankLow = save.bankLow;
+	bankHigh = save.bankHigh;
+	advancedMode = save.advancedMode;
+	UpdateBanks();
+}
+
+Mbc1::Mbc1(u32 banks, u32 ramSize) : Mbc(banks, ramSize)
+{
+	ramEnabled = false;
+	UpdateBanks();
+}
+
+Mbc1::~Mbc1()
+{
+
+}
+
+/* bit 8 of the address picks the register, the whole 0x0000-0x3FFF range decodes them */
+void Mbc2::Write(u16 addr, u8 val)
+{
+	if (addr >= 0x4000)
+		return;
+	if (NTHBIT(addr, 8)) {
+		romBank1 = ((val & 0x0F) ? (val & 0x0F) : 1) % romBanks;
+	} else {
+		ramEnabled = (val & 0x0F) == RAM_ENABLE_VALUE;
+	}
+}
+
+/* 512 half-bytes mirrored over the whole window, never plain memory */
+u8* Mbc2::RamWindow()
+{
+	return nullptr;
+}
+
+u8 Mbc2::RamRead(u16 addr)
+{
+	if (!ramEnabled)
+		return 0xFF;
+	return ram[addr & (MBC2_RAM_SIZE - 1)] | 0xF0;
+}
+
+void Mbc2::RamWrite(u16 addr, u8 val)
+{
+	if (ramEnabled)
+		ram[addr & (MBC2_RAM_SIZE - 1)] = val & 0x0F;
+}
+
+Mbc2::Mbc2(u32 banks) : Mbc(banks, MBC2_RAM_SIZE)
+{
+	ramEnabled = false;
+}
+
+Mbc2::~Mbc2()
+{
+
+}
+
+void Mbc3::UpdateRtc()
+{
+	u64 now = clock ? *clock : 0, elapsed, seconds, minutes, hours, days;
+
+	if (NTHBIT(rtc.dayHigh, 6)) {
+		rtcLastCycle = now;
+		return;
+	}
+	elapsed = (now - rtcLastCycle) / RTC_T_CYCLES_PER_SECOND;
+	if (!elapsed)
+		return;
+	rtcLastCycle += elapsed * RTC_T_CYCLES_PER_SECOND;
+	seconds = rtc.seconds + elapsed;
+	minutes = rtc.minutes + seconds / 60;
+	hours = rtc.hours + minutes / 60;
+	days = (((rtc.dayHigh & 0x01) << 8) | rtc.dayLow) + hours / 24;
+	rtc.seconds = seconds % 60;
+	rtc.minutes = minutes % 60;
+	rtc.hours = hours % 24;
+	if (days > 0x1FF)
+		rtc.dayHigh |= 0x80;
+	days &= 0x1FF;
+	rtc.dayLow = days & 0xFF;
+	rtc.dayHigh = (rtc.dayHigh & 0xFE) | (days >> 8);
+}
+
+u8& Mbc3::RtcRegister(RtcRegs& regs, u8 select)
+{
+	switch (select) {
+	case 0x08:
+		return regs.seconds;
+	case 0x09:
+		return regs.minutes;
+	case 0x0A:
+		return regs.hours;
+	case 0x0B:
+		return regs.dayLow;
+	default:
+		return regs.dayHigh;
+	}
+}
+
+void Mbc3::Write(u16 addr, u8 val)
+{
+	if (addr < 0x2000) {
+		ramEnabled = (val & 0x0F) == RAM_ENABLE_VALUE;
+	} else if (addr < 0x4000) {
+		romBank1 = ((val & 0x7F) ? (val & 0x7F) : 1) % romBanks;
+	} else if (addr < 0x6000) {
+		if (val <= 0x03) {
+			ramBank = val;
+			rtcSelect = 0;
+		} else if (hasRtc && IN_RANGE(val, 0x08, 0x0C)) {
+			rtcSelect = val;
+		}
+	} else {
+		if (hasRtc && lastLatchWrite == 0x00 && val == 0x01) {
+			UpdateRtc();
+			latched = rtc;
+		}
+		lastLatchWrite = val;
+	}
+}
+
+u8* Mbc3::RamWindow()
+{
+	return rtcSelect ? nullptr : Mbc::RamWindow();
+}
+
+u8 Mbc3::RamRead(u16 addr)
+{
+	if (!rtcSelect)
+		return Mbc::RamRead(addr);
+	return ramEnabled ? RtcRegister(latched, rtcSelect) : 0xFF;
+}
+
+void Mbc3::RamWrite(u16 addr, u8 val)
+{
+	static const std::array<u8, 5> rtcMasks = { 0x3F, 0x3F, 0x1F, 0xFF, 0xC1 };
+
+	if (!rtcSelect) {
+		Mbc::RamWrite(addr, val);
+		return;
+	}
+	if (!ramEnabled)
+		return;
+	UpdateRtc();
+	RtcRegister(rtc, rtcSelect) = val & rtcMasks[rtcSelect - 0x08];
+	/* writing the seconds restarts the current second */
+	if (rtcSelect == 0x08)
+		rtcLastCycle = clock ? *clock : 0;
+}
+
+void Mbc3::SaveState(MbcSaveState& save) const
+{
+	Mbc::SaveState(save);
+	save.rtcSelect = rtcSelect;
+	save.lastLatchWrite = lastLatchWrite;
+	save.rtc = rtc;
+	save.latched = latched;
+	save.rtcLastCycle = rtcLastCycle;
+}
+
+void Mbc3::LoadState(const MbcSaveState& save)
+{
+	Mbc::LoadState(save);
+	rtcSelect = hasRtc ? save.rtcSelect : 0;
+	lastLatchWrite = save.lastLatchWrite;
+	rtc = save.rtc;
+	latched = save.latched;
+	rtcLastCycle = save.rtcLastCycle;
+}
+
+Mbc3::Mbc3(u32 banks, u32 ramSize, bool rtcPresent) : Mbc(banks, ramSize), hasRtc(rtcPresent), rtc(), latched()
+{
+	ramEnabled = false;
+}
+
+Mbc3::~Mbc3()
+{
+
+}
+
+void Mbc5::Write(u16 addr, u8 val)
+{
+	if (addr < 0x2000) {
+		ramEnabled = (val & 0x0F) == RAM_ENABLE_VALUE;
+	} else if (addr < 0x3000) {
+		romBankSelect = (romBankSelect & 0x100) | val;
+	} else if (addr < 0x4000) {
+		romBankSelect = (romBankSelect & 0xFF) | ((val & 0x01) << 8);
+	} else if (addr < 0x6000) {
+		ramBank = val & 0x0F;
+	}
+	romBank1 = romBankSelect % romBanks;
+}
+
+void Mbc5::SaveState(MbcSaveState& save) const
+{
+	Mbc::SaveState(save);
+	save.romBankSelect = romBankSelect;
+}
+
+void Mbc5::LoadState(const MbcSaveState& save)
+{
+	Mbc::LoadState(save);
+	romBankSelect = save.romBankSelect;
+	romBank1 = romBankSelect % romBanks;
+}
+
+Mbc5::Mbc5(u32 banks, u32 ramSize) : Mbc(banks, ramSize)
+{
+	ramEnabled = false;
+	romBank1 = romBankSelect % romBanks;
+}
+
+Mbc5::~Mbc5()
+{
+
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "common.h"
+#include <vector>
+
+#define ROM_BANK_SIZE			(16 * KiB)
+#define EXT_RAM_BANK_SIZE		(8 * KiB)
+#define MBC2_RAM_SIZE			512
+#define RTC_T_CYCLES_PER_SECOND	4194304ULL
+
+typedef struct RtcRegs {
+	u8 seconds;
+	u8 minutes;
+	u8 hours;
+	u8 dayLow;
+	u8 dayHigh;		// bit 0: day bit 8, bit 6: halt, bit 7: day counter carry
+} RtcRegs;
+
+/* savestate block, see savestate.h. One layout for every controller, unused fields are 0 */
+typedef struct MbcSaveState {
+	u32 romBank0;
+	u32 romBank1;
+	u32 ramBank;
+	u8 ramEnabled;
+	u8 bankLow;				// MBC1
+	u8 bankHigh;
+	u8 advancedMode;
+	u8 rtcSelect;			// MBC3
+	u8 lastLatchWrite;
+	u16 romBankSelect;		// MBC5
+	RtcRegs rtc;
+	RtcRegs latched;
+	u8 reserved[2];
+	u64 rtcLastCycle;
+} MbcSaveState;
+
+/*
+	Cartridge bank controllers. An MBC only keeps its registers and works out which banks
+	are visible; the bus asks for RomBank0()/RomBank1()/RamWindow() after every write to
+	the ROM area and remaps its pages when they changed, so reads never do bank arithmetic.
+	Cartridge RAM that is not plain memory (disabled RAM, MBC2 nibbles, MBC3 RTC registers)
+	has no window and goes through RamRead()/RamWrite() instead.
+	The base class is the plain cartridge without a controller, optionally with 8 KiB RAM.
+*/
+class Mbc {
+protected:
+	u32 romBanks;
+	std::vector<u8> ram;
+	u32 romBank0 = 0;
+	u32 romBank1 = 1;
+	u32 ramBank = 0;
+	bool ramEnabled = false;
+	const u64* clock = nullptr;
+public:
+	u32 RomBank0() const { return romBank0; }
+	u32 RomBank1() const { return romBank1; }
+	virtual void Write(u16, u8);
+	virtual u8* RamWindow();
+	virtual u8 RamRead(u16);
+	virtual void RamWrite(u16, u8);
+	void SetClock(const u64*);
+	u8* RamData() { return ram.data(); }
+	u32 RamSize() const { return ram.size(); }
+	virtual void SaveState(MbcSaveState&) const;
+	virtual void LoadState(const MbcSaveState&);
+	Mbc(u32, u32);
+	virtual ~Mbc();
+};
+
+class Mbc1 : public Mbc {
+private:
+	u8 bankLow = 1;
+	u8 bankHigh = 0;
+	bool advancedMode = false;
+	void UpdateBanks();
+public:
+	void Write(u16, u8) override;
+	void SaveState(MbcSaveState&) const override;
+	void LoadState(const MbcSaveState&) override;
+	Mbc1(u32, u32);
+	~Mbc1();
+};
+
+class Mbc2 : public Mbc {
+public:
+	void Write(u16, u8) override;
+	u8* RamWindow() override;
+	u8 RamRead(u16) override;
+	void RamWrite(u16, u8) override;
+	Mbc2(u32);
+	~Mbc2();
+};
+
+/*
+	The RTC runs on emulated time, taken from the clock set with SetClock(), so runs stay
+	deterministic. It is only brought up to date when it is latched or written.
+*/
+class Mbc3 : public Mbc {
+private:
+	bool hasRtc;
+	RtcRegs rtc;
+	RtcRegs latched;
+	u64 rtcLastCycle = 0;
+	u8 rtcSelect = 0;			// 0x08-0x0C when an RTC register is mapped
+	u8 lastLatchWrite = 0xFF;
+	void UpdateRtc();
+	u8& RtcRegister(RtcRegs&, u8);
+public:
+	void Write(u16, u8) override;
+	u8* RamWindow() override;
+	u8 RamRead(u16) override;
+	void RamWrite(u16, u8) override;
+	void SaveState(MbcSaveState&) const override;
+	void LoadState(const MbcSaveState&) override;
+	Mbc3(u32, u32, bool);
+	~Mbc3();
+};
+
+class Mbc5 : public Mbc {
+private:
+	u16 romBankSelect = 1;
+public:
+	void Write(u16, u8) override;
+	void SaveState(MbcSaveState&) const override;
+	void LoadState(const MbcSaveState&) override;
+	Mbc5(u32, u32);
+	~Mbc5();
+};
\ No newline at end of file
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "common.h"
+#include <array>
+
+/*
+	Opcode -> handler mapping for the SM83 instruction set, one entry per opcode.
+	The lists are X-macros so the function pointer tables, the threaded dispatch
+	labels and the reference switch in cpu.cpp are all generated from the same source.
+	Every handler is a template instantiated with its own opcode, so operands are
+	looked up in the description tables below at compile time.
+	Opcode grouping follows https://gbdev.io/pandocs/CPU_Instruction_Set.html.
+*/
+
+#define MAIN_OPCODE_LIST(X) \
+	X(0x00, NOP)          X(0x01, LD_R16_U16)   X(0x02, LD_IR16_A)    X(0x03, INC_R16) \
+	X(0x04, INC_R8)       X(0x05, DEC_R8)       X(0x06, LD_R8_U8)     X(0x07, RLCA) \
+	X(0x08, LD_IR16_SP)   X(0x09, ADD_HL_R16)   X(0x0A, LD_A_IR16)    X(0x0B, DEC_R16) \
+	X(0x0C, INC_R8)       X(0x0D, DEC_R8)       X(0x0E, LD_R8_U8)     X(0x0F, RRCA) \
+	X(0x10, STOP)         X(0x11, LD_R16_U16)   X(0x12, LD_IR16_A)    X(0x13, INC_R16) \
+	X(0x14, INC_R8)       X(0x15, DEC_R8)       X(0x16, LD_R8_U8)     X(0x17, RLA) \
+	X(0x18, JR)           X(0x19, ADD_HL_R16)   X(0x1A, LD_A_IR16)    X(0x1B, DEC_R16) \
+	X(0x1C, INC_R8)       X(0x1D, DEC_R8)       X(0x1E, LD_R8_U8)     X(0x1F, RRA) \
+	X(0x20, JR_COND)      X(0x21, LD_R16_U16)   X(0x22, LD_IR16_A)    X(0x23, INC_R16) \
+	X(0x24, INC_R8)       X(0x25, DEC_R8)       X(0x26, LD_R8_U8)     X(0x27, DAA) \
+	X(0x28, JR_COND)      X(0x29, ADD_HL_R16)   X(0x2A, LD_A_IR16)    X(0x2B, DEC_R16) \
+	X(0x2C, INC_R8)       X(0x2D, DEC_R8)       X(0x2E, LD_R8_U8)     X(0x2F, CPL) \
+	X(0x30, JR_COND)      X(0x31, LD_R16_U16)   X(0x32, LD_IR16_A)    X(0x33, INC_R16) \
+	X(0x34, INC_IHL)      X(0x35, DEC_IHL)      X(0x36, LD_IHL_U8)    X(0x37, SCF) \
+	X(0x38, JR_COND)      X(0x39, ADD_HL_R16)   X(0x3A, LD_A_IR16)    X(0x3B, DEC_R16) \
+	X(0x3C, INC_R8)       X(0x3D, DEC_R8)       X(0x3E, LD_R8_U8)     X(0x3F, CCF) \
+	X(0x40, LD_R8_R8)     X(0x41, LD_R8_R8)     X(0x42, LD_R8_R8)     X(0x43, LD_R8_R8) \
+	X(0x44, LD_R8_R8)     X(0x45, LD_R8_R8)     X(0x46, LD_R8_IHL)    X(0x47, LD_R8_R8) \
+	X(0x48, LD_R8_R8)     X(0x49, LD_R8_R8)     X(0x4A, LD_R8_R8)     X(0x4B, LD_R8_R8) \
+	X(0x4C, LD_R8_R8)     X(0x4D, LD_R8_R8)     X(0x4E, LD_R8_IHL)    X(0x4F, LD_R8_R8) \
+	X(0x50, LD_R8_R8)     X(0x51, LD_R8_R8)     X(0x52, LD_R8_R8)     X(0x53, LD_R8_R8) \
+	X(0x54, LD_R8_R8)     X(0x55, LD_R8_R8)     X(0x56, LD_R8_IHL)    X(0x57, LD_R8_R8) \
+	X(0x58, LD_R8_R8)     X(0x59, LD_R8_R8)     X(0x5A, LD_R8_R8)     X(0x5B, LD_R8_R8) \
+	X(0x5C, LD_R8_R8)     X(0x5D, LD_R8_R8)     X(0x5E, LD_R8_IHL)    X(0x5F, LD_R8_R8) \
+	X(0x60, LD_R8_R8)     X(0x61, LD_R8_R8)     X(0x62, LD_R8_R8)     X(0x63, LD_R8_R8) \
+	X(0x64, LD_R8_R8)     X(0x65, LD_R8_R8)     X(0x66, LD_R8_IHL)    X(0x67, LD_R8_R8) \
+	X(0x68, LD_R8_R8)     X(0x69, LD_R8_R8)     X(0x6A, LD_R8_R8)     X(0x6B, LD_R8_R8) \
+	X(0x6C, LD_R8_R8)     X(0x6D, LD_R8_R8)     X(0x6E, LD_R8_IHL)    X(0x6F, LD_R8_R8) \
+	X(0x70, LD_IHL_R8)    X(0x71, LD_IHL_R8)    X(0x72, LD_IHL_R8)    X(0x73, LD_IHL_R8) \
+	X(0x74, LD_IHL_R8)    X(0x75, LD_IHL_R8)    X(0x76, HALT)         X(0x77, LD_IHL_R8) \
+	X(0x78, LD_R8_R8)     X(0x79, LD_R8_R8)     X(0x7A, LD_R8_R8)     X(0x7B, LD_R8_R8) \
+	X(0x7C, LD_R8_R8)     X(0x7D, LD_R8_R8)     X(0x7E, LD_R8_IHL)    X(0x7F, LD_R8_R8) \
+	X(0x80, ADD_A_R8)     X(0x81, ADD_A_R8)     X(0x82, ADD_A_R8)     X(0x83, ADD_A_R8) \
+	X(0x84, ADD_A_R8)     X(0x85, ADD_A_R8)     X(0x86, ADD_A_IHL)    X(0x87, ADD_A_R8) \
+	X(0x88, ADC_A_R8)     X(0x89, ADC_A_R8)     X(0x8A, ADC_A_R8)     X(0x8B, ADC_A_R8) \
+	X(0x8C, ADC_A_R8)     X(0x8D, ADC_A_R8)     X(0x8E, ADC_A_IHL)    X(0x8F, ADC_A_R8) \
+	X(0x90, SUB_A_R8)     X(0x91, SUB_A_R8)     X(0x92, SUB_A_R8)     X(0x93, SUB_A_R8) \
+	X(0x94, SUB_A_R8)     X(0x95, SUB_A_R8)     X(0x96, SUB_A_IHL)    X(0x97, SUB_A_R8) \
+	X(0x98, SBC_A_R8)     X(0x99, SBC_A_R8)     X(0x9A, SBC_A_R8)     X(0x9B, SBC_A_R8) \
+	X(0x9C, SBC_A_R8)     X(0x9D, SBC_A_R8)     X(0x9E, SBC_A_IHL)    X(0x9F, SBC_A_R8) \
+	X(0xA0, AND_A_R8)     X(0xA1, AND_A_R8)     X(0xA2, AND_A_R8)     X(0xA3, AND_A_R8) \
+	X(0xA4, AND_A_R8)     X(0xA5, AND_A_R8)     X(0xA6, AND_A_IHL)    X(0xA7, AND_A_R8) \
+	X(0xA8, XOR_A_R8)     X(0xA9, XOR_A_R8)     X(0xAA, XOR_A_R8)     X(0xAB, XOR_A_R8) \
+	X(0xAC, XOR_A_R8)     X(0xAD, XOR_A_R8)     X(0xAE, XOR_A_IHL)    X(0xAF, XOR_A_R8) \
+	X(0xB0, OR_A_R8)      X(0xB1, OR_A_R8)      X(0xB2, OR_A_R8)      X(0xB3, OR_A_R8) \
+	X(0xB4, OR_A_R8)      X(0xB5, OR_A_R8)      X(0xB6, OR_A_IHL)     X(0xB7, OR_A_R8) \
+	X(0xB8, CP_A_R8)      X(0xB9, CP_A_R8)      X(0xBA, CP_A_R8)      X(0xBB, CP_A_R8) \
+	X(0xBC, CP_A_R8)      X(0xBD, CP_A_R8)      X(0xBE, CP_A_IHL)     X(0xBF, CP_A_R8) \
+	X(0xC0, RET)          X(0xC1, POP_R16)      X(0xC2, JP)           X(0xC3, JP) \
+	X(0xC4, CALL)         X(0xC5, PUSH_R16)     X(0xC6, ADD_A_U8)     X(0xC7, RST) \
+	X(0xC8, RET)          X(0xC9, RET)          X(0xCA, JP)           X(0xCB, PREFIX_CB) \
+	X(0xCC, CALL)         X(0xCD, CALL)         X(0xCE, ADC_A_U8)     X(0xCF, RST) \
+	X(0xD0, RET)          X(0xD1, POP_R16)      X(0xD2, JP)           X(0xD3, INVALID) \
+	X(0xD4, CALL)         X(0xD5, PUSH_R16)     X(0xD6, SUB_A_U8)     X(0xD7, RST) \
+	X(0xD8, RET)          X(0xD9, RETI)         X(0xDA, JP)           X(0xDB, INVALID) \
+	X(0xDC, CALL)         X(0xDD, INVALID)      X(0xDE, SBC_A_U8)     X(0xDF, RST) \
+	X(0xE0, LDH_IA8_A)    X(0xE1, POP_R16)      X(0xE2, LDH_IC_A)     X(0xE3, INVALID) \
+	X(0xE4, INVALID)      X(0xE5, PUSH_R16)     X(0xE6, AND_A_U8)     X(0xE7, RST) \
+	X(0xE8, ADD_SP_E8)    X(0xE9, JP_HL)        X(0xEA, LD_IA16_A)    X(0xEB, INVALID) \
+	X(0xEC, INVALID)      X(0xED, INVALID)      X(0xEE, XOR_A_U8)     X(0xEF, RST) \
+	X(0xF0, LDH_A_IA8)    X(0xF1, POP_R16)      X(0xF2, LDH_A_IC)     X(0xF3, DI) \
+	X(0xF4, INVALID)      X(0xF5, PUSH_R16)     X(0xF6, OR_A_U8)      X(0xF7, RST) \
+	X(0xF8, LD_HL_SP_i8)  X(0xF9, LD_SP_HL)     X(0xFA, LD_A_IA16)    X(0xFB, EI) \
+	X(0xFC, INVALID)      X(0xFD, INVALID)      X(0xFE, CP_A_U8)      X(0xFF, RST)
+
+#define CB_OPCODE_LIST(X) \
+	X(0x00, RLC)          X(0x01, RLC)          X(0x02, RLC)          X(0x03, RLC) \
+	X(0x04, RLC)          X(0x05, RLC)          X(0x06, RLC)          X(0x07, RLC) \
+	X(0x08, RRC)          X(0x09, RRC)          X(0x0A, RRC)          X(0x0B, RRC) \
+	X(0x0C, RRC)          X(0x0D, RRC)          X(0x0E, RRC)          X(0x0F, RRC) \
+	X(0x10, RL)           X(0x11, RL)           X(0x12, RL)           X(0x13, RL) \
+	X(0x14, RL)           X(0x15, RL)           X(0x16, RL)           X(0x17, RL) \
+	X(0x18, RR)           X(0x19, RR)           X(0x1A, RR)           X(0x1B, RR) \
+	X(0x1C, RR)           X(0x1D, RR)           X(0x1E, RR)           X(0x1F, RR) \
+	X(0x20, SLA)          X(0x21, SLA)          X(0x22, SLA)          X(0x23, SLA) \
+	X(0x24, SLA)          X(0x25, SLA)          X(0x26, SLA)          X(0x27, SLA) \
+	X(0x28, SRA)          X(0x29, SRA)          X(0x2A, SRA)          X(0x2B, SRA) \
+	X(0x2C, SRA)          X(0x2D, SRA)          X(0x2E, SRA)          X(0x2F, SRA) \
+	X(0x30, SWAP)         X(0x31, SWAP)         X(0x32, SWAP)         X(0x33, SWAP) \
+	X(0x34, SWAP)         X(0x35, SWAP)         X(0x36, SWAP)         X(0x37, SWAP) \
+	X(0x38, SRL)          X(0x39, SRL)          X(0x3A, SRL)          X(0x3B, SRL) \
+	X(0x3C, SRL)          X(0x3D, SRL)          X(0x3E, SRL)          X(0x3F, SRL) \
+	X(0x40, BIT)          X(0x41, BIT)          X(0x42, BIT)          X(0x43, BIT) \
+	X(0x44, BIT)          X(0x45, BIT)          X(0x46, BIT)          X(0x47, BIT) \
+	X(0x48, BIT)          X(0x49, BIT)          X(0x4A, BIT)          X(0x4B, BIT) \
+	X(0x4C, BIT)          X(0x4D, BIT)          X(0x4E, BIT)          X(0x4F, BIT) \
+	X(0x50, BIT)          X(0x51, BIT)          X(0x52, BIT)          X(0x53, BIT) \
+	X(0x54, BIT)          X(0x55, BIT)          X(0x56, BIT)          X(0x57, BIT) \
+	X(0x58, BIT)          X(0x59, BIT)          X(0x5A, BIT)          X(0x5B, BIT) \
+	X(0x5C, BIT)          X(0x5D, BIT)          X(0x5E, BIT)          X(0x5F, BIT) \
+	X(0x60, BIT)          X(0x61, BIT)          X(0x62, BIT)          X(0x63, BIT) \
+	X(0x64, BIT)          X(0x65, BIT)          X(0x66, BIT)          X(0x67, BIT) \
+	X(0x68, BIT)          X(0x69, BIT)          X(0x6A, BIT)          X(0x6B, BIT) \
+	X(0x6C, BIT)          X(0x6D, BIT)          X(0x6E, BIT)          X(0x6F, BIT) \
+	X(0x70, BIT)          X(0x71, BIT)          X(0x72, BIT)          X(0x73, BIT) \
+	X(0x74, BIT)          X(0x75, BIT)          X(0x76, BIT)          X(0x77, BIT) \
+	X(0x78, BIT)          X(0x79, BIT)          X(0x7A, BIT)          X(0x7B, BIT) \
+	X(0x7C, BIT)          X(0x7D, BIT)          X(0x7E, BIT)          X(0x7F, BIT) \
+	X(0x80, RESET)        X(0x81, RESET)        X(0x82, RESET)        X(0x83, RESET) \
+	X(0x84, RESET)        X(0x85, RESET)        X(0x86, RESET)        X(0x87, RESET) \
+	X(0x88, RESET)        X(0x89, RESET)        X(0x8A, RESET)        X(0x8B, RESET) \
+	X(0x8C, RESET)        X(0x8D, RESET)        X(0x8E, RESET)        X(0x8F, RESET) \
+	X(0x90, RESET)        X(0x91, RESET)        X(0x92, RESET)        X(0x93, RESET) \
+	X(0x94, RESET)        X(0x95, RESET)        X(0x96, RESET)        X(0x97, RESET) \
+	X(0x98, RESET)        X(0x99, RESET)        X(0x9A, RESET)        X(0x9B, RESET) \
+	X(0x9C, RESET)        X(0x9D, RESET)        X(0x9E, RESET)        X(0x9F, RESET) \
+	X(0xA0, RESET)        X(0xA1, RESET)        X(0xA2, RESET)        X(0xA3, RESET) \
+	X(0xA4, RESET)        X(0xA5, RESET)        X(0xA6, RESET)        X(0xA7, RESET) \
+	X(0xA8, RESET)        X(0xA9, RESET)        X(0xAA, RESET)        X(0xAB, RESET) \
+	X(0xAC, RESET)        X(0xAD, RESET)        X(0xAE, RESET)        X(0xAF, RESET) \
+	X(0xB0, RESET)        X(0xB1, RESET)        X(0xB2, RESET)        X(0xB3, RESET) \
+	X(0xB4, RESET)        X(0xB5, RESET)        X(0xB6, RESET)        X(0xB7, RESET) \
+	X(0xB8, RESET)        X(0xB9, RESET)        X(0xBA, RESET)        X(0xBB, RESET) \
+	X(0xBC, RESET)        X(0xBD, RESET)        X(0xBE, RESET)        X(0xBF, RESET) \
+	X(0xC0, SETF)         X(0xC1, SETF)         X(0xC2, SETF)         X(0xC3, SETF) \
+	X(0xC4, SETF)         X(0xC5, SETF)         X(0xC6, SETF)         X(0xC7, SETF) \
+	X(0xC8, SETF)         X(0xC9, SETF)         X(0xCA, SETF)         X(0xCB, SETF) \
+	X(0xCC, SETF)         X(0xCD, SETF)         X(0xCE, SETF)         X(0xCF, SETF) \
+	X(0xD0, SETF)         X(0xD1, SETF)         X(0xD2, SETF)         X(0xD3, SETF) \
+	X(0xD4, SETF)         X(0xD5, SETF)         X(0xD6, SETF)         X(0xD7, SETF) \
+	X(0xD8, SETF)         X(0xD9, SETF)         X(0xDA, SETF)         X(0xDB, SETF) \
+	X(0xDC, SETF)         X(0xDD, SETF)         X(0xDE, SETF)         X(0xDF, SETF) \
+	X(0xE0, SETF)         X(0xE1, SETF)         X(0xE2, SETF)         X(0xE3, SETF) \
+	X(0xE4, SETF)         X(0xE5, SETF)         X(0xE6, SETF)         X(0xE7, SETF) \
+	X(0xE8, SETF)         X(0xE9, SETF)         X(0xEA, SETF)         X(0xEB, SETF) \
+	X(0xEC, SETF)         X(0xED, SETF)         X(0xEE, SETF)         X(0xEF, SETF) \
+	X(0xF0, SETF)         X(0xF1, SETF)         X(0xF2, SETF)         X(0xF3, SETF) \
+	X(0xF4, SETF)         X(0xF5, SETF)         X(0xF6, SETF)         X(0xF7, SETF) \
+	X(0xF8, SETF)         X(0xF9, SETF)         X(0xFA, SETF)         X(0xFB, SETF) \
+	X(0xFC, SETF)         X(0xFD, SETF)         X(0xFE, SETF)         X(0xFF, SETF)
+
+
+/* operand encodings, as laid out in the opcode bits */
+enum R8 {
+	R8_B = 0,
+	R8_C,
+	R8_D,
+	R8_E,
+	R8_H,
+	R8_L,
+	R8_IHL,
+	R8_A
+};
+
+enum R16 {
+	R16_BC = 0,
+	R16_DE,
+	R16_HL,
+	R16_SP
+};
+
+enum R16STK {
+	R16STK_BC = 0,
+	R16STK_DE,
+	R16STK_HL,
+	R16STK_AF
+};
+
+enum R16MEM {
+	R16MEM_BC = 0,
+	R16MEM_DE,
+	R16MEM_HLI,
+	R16MEM_HLD,
+};
+
+enum COND {
+	COND_NZ = 0,
+	COND_Z,
+	COND_NC,
+	COND_C
+};
+
+/* OpcodeInfo::flags */
+#define OPF_ENDS_BLOCK			(1U << 0)	// control flow or interrupt state changes after it
+#define OPF_INVALID				(1U << 1)
+
+typedef struct OpcodeInfo {
+	u8 length;		// instruction length in bytes, prefix included
+	u8 flags;		// OPF_*
+	u8 r8Dst;		// bits 5-3, R8
+	u8 r8Src;		// bits 2-0, R8
+	u8 r16;			// bits 5-4, R16/R16STK/R16MEM depending on the instruction
+	u8 cond;		// bits 4-3, COND
+	u8 bit;			// bits 5-3, bit index of BIT/RES/SET
+} OpcodeInfo;
+
+constexpr u8 MainOpcodeLength(u8 opcode)
+{
+	switch (opcode) {
+	case 0x01: case 0x11: case 0x21: case 0x31:		// LD r16, u16
+	case 0x08:										// LD (u16), SP
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:	// JP
+	case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:	// CALL
+	case 0xEA: case 0xFA:							// LD (u16), A / LD A, (u16)
+		return 3;
+	case 0x06: case 0x0E: case 0x16: case 0x1E:		// LD r8, u8
+	case 0x26: case 0x2E: case 0x36: case 0x3E:
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:	// JR
+	case 0xC6: case 0xCE: case 0xD6: case 0xDE:		// ALU A, u8
+	case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+	case 0xE0: case 0xF0:							// LDH
+	case 0xE8: case 0xF8:							// ADD SP, e8 / LD HL, SP + e8
+	case 0xCB:										// prefix
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+constexpr u8 MainOpcodeFlags(u8 opcode)
+{
+	switch (opcode) {
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:	// JR
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:	// JP
+	case 0xE9:												// JP HL
+	case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:	// CALL
+	case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8:	// RET
+	case 0xD9:												// RETI
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF:				// RST
+	case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+	case 0x10: case 0x76:									// STOP, HALT
+	case 0xF3: case 0xFB:									// DI, EI
+		return OPF_ENDS_BLOCK;
+	case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB:
+	case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+		return OPF_INVALID;
+	default:
+		return 0;
+	}
+}
+
+constexpr std::array<OpcodeInfo, 256> MakeOpcodeInfo(bool cbTable)
+{
+	std::array<OpcodeInfo, 256> table = {};
+
+	for (int i = 0; i < 256; i++) {
+		u8 opcode = static_cast<u8>(i);
+
+		table[i].length = cbTable ? 2 : MainOpcodeLength(opcode);
+		table[i].flags = cbTable ? 0 : MainOpcodeFlags(opcode);
+		table[i].r8Dst = (opcode >> 3) & 0x07;
+		table[i].r8Src = opcode & 0x07;
+		table[i].r16 = (opcode >> 4) & 0x03;
+		table[i].cond = (opcode >> 3) & 0x03;
+		table[i].bit = (opcode >> 3) & 0x07;
+	}
+	return table;
+}
+
+inline constexpr std::array<OpcodeInfo, 256> mainOpcodeInfo = MakeOpcodeInfo(false);
+inline constexpr std::array<OpcodeInfo, 256> cbOpcodeInfo = MakeOpcodeInfo(true);
\ No newline at end of file
@@ -0,0 +1,315 @@
+#include "pixel_kernels.h"
+#include <cstring>
+
+#ifdef PIXEL_X64_SUPPORTED
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_AVX2				__attribute__((target("avx2")))
+#endif
+#endif
+
+static void DecodeTilesScalar(const u8* data, u8* indices, u32 tiles)
+{
+	for (u32 row = 0; row < tiles * 8; row++, data += 2, indices += 8) {
+		u8 low = data[0], high = data[1];
+
+		for (u32 x = 0; x < 8; x++)
+			indices[x] = ((low >> (7 - x)) & 1) | (((high >> (7 - x)) & 1) << 1);
+	}
+}
+
+/* palette mapping and gray conversion are both a 4-entry byte table */
+static void ToGray8Scalar(const u8* shades, u8* out, u32 count, const u8* colors)
+{
+	for (u32 i = 0; i < count; i++)
+		out[i] = colors[shades[i] & 3];
+}
+
+static void MapPaletteScalar(const u8* indices, u8* shades, u32 count, u8 palette)
+{
+	const u8 lut[4] = { (u8)(palette & 3), (u8)((palette >> 2) & 3), (u8)((palette >> 4) & 3), (u8)(palette >> 6) };
+
+	ToGray8Scalar(indices, shades, count, lut);
+}
+
+static void ToRgba8888Scalar(const u8* shades, u32* out, u32 count, const u32* colors)
+{
+	for (u32 i = 0; i < count; i++)
+		out[i] = colors[shades[i] & 3];
+}
+
+static void ToRgb565Scalar(const u8* shades, u16* out, u32 count, const u16* colors)
+{
+	for (u32 i = 0; i < count; i++)
+		out[i] = colors[shades[i] & 3];
+}
+
+#ifdef PIXEL_X64_SUPPORTED
+
+/*
+	SSE2 has no byte shuffle, so bits are spread with unpacks: each plane byte is repeated
+	8 times, masked with one bit per lane and compared, giving 0 or 1 (low plane) and 0 or
+	2 (high plane) per lane. Table lookups become a compare and select per entry.
+*/
+static void DecodeTilesSse2(const u8* data, u8* indices, u32 tiles)
+{
+	const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+	const __m128i weights = _mm_set_epi8(2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1);
+
+	for (u32 pair = 0; pair < tiles * 4; pair++, data += 4, indices += 16) {
+		int pairBytes;
+
+		std::memcpy(&pairBytes, data, sizeof(pairBytes));
+		__m128i planes = _mm_cvtsi32_si128(pairBytes);		// lo0 hi0 lo1 hi1
+		__m128i spread = _mm_unpacklo_epi16(_mm_unpacklo_epi8(planes, planes), _mm_unpacklo_epi8(planes, planes));
+		__m128i rows[2] = { _mm_unpacklo_epi32(spread, spread), _mm_unpackhi_epi32(spread, spread) };
+
+		for (int r = 0; r < 2; r++) {
+			/* lanes 0-7 hold the low plane, 8-15 the high plane */
+			__m128i set = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(rows[r], bits), bits), weights);
+
+			rows[r] = _mm_add_epi8(set, _mm_srli_si128(set, 8));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(indices), _mm_unpacklo_epi64(rows[0], rows[1]));
+	}
+}
+
+static void ToGray8Sse2(const u8* shades, u8* out, u32 count, const u8* colors)
+{
+	const __m128i three = _mm_set1_epi8(3);
+	__m128i entries[4];
+	u32 i = 0;
+
+	for (int e = 0; e < 4; e++)
+		entries[e] = _mm_set1_epi8(colors[e]);
+	for (; i + 16 <= count; i += 16) {
+		__m128i shade = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(shades + i)), three);
+		__m128i pixel = _mm_setzero_si128();
+
+		for (int e = 0; e < 4; e++)
+			pixel = _mm_or_si128(pixel, _mm_and_si128(_mm_cmpeq_epi8(shade, _mm_set1_epi8(e)), entries[e]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), pixel);
+	}
+	ToGray8Scalar(shades + i, out + i, count - i, colors);
+}
+
+static void MapPaletteSse2(const u8* indices, u8* shades, u32 count, u8 palette)
+{
+	const u8 lut[4] = { (u8)(palette & 3), (u8)((palette >> 2) & 3), (u8)((palette >> 4) & 3), (u8)(palette >> 6) };
+
+	ToGray8Sse2(indices, shades, count, lut);
+}
+
+static void ToRgba8888Sse2(const u8* shades, u32* out, u32 count, const u32* colors)
+{
+	const __m128i three = _mm_set1_epi8(3);
+	__m128i entries[4];
+	u32 i = 0;
+
+	for (int e = 0; e < 4; e++)
+		entries[e] = _mm_set1_epi32(colors[e]);
+	for (; i + 16 <= count; i += 16) {
+		__m128i shade8 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(shades + i)), three);
+		__m128i shade16[2] = { _mm_unpacklo_epi8(shade8, _mm_setzero_si128()), _mm_unpackhi_epi8(shade8, _mm_setzero_si128()) };
+
+		for (int q = 0; q < 4; q++) {
+			__m128i half = shade16[q / 2];
+			__m128i shade = (q & 1) ? _mm_unpackhi_epi16(half, _mm_setzero_si128()) : _mm_unpacklo_epi16(half, _mm_setzero_si128());
+			__m128i pixel = _mm_setzero_si128();
+
+			for (int e = 0; e < 4; e++)
+				pixel = _mm_or_si128(pixel, _mm_and_si128(_mm_cmpeq_epi32(shade, _mm_set1_epi32(e)), entries[e]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + q * 4), pixel);
+		}
+	}
+	ToRgba8888Scalar(shades + i, out + i, count - i, colors);
+}
+
+static void ToRgb565Sse2(const u8* shades, u16* out, u32 count, const u16* colors)
+{
+	const __m128i three = _mm_set1_epi8(3);
+	__m128i entries[4];
+	u32 i = 0;
+
+	for (int e = 0; e < 4; e++)
+		entries[e] = _mm_set1_epi16(colors[e]);
+	for (; i + 16 <= count; i += 16) {
+		__m128i shade8 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(shades + i)), three);
+
+		for (int h = 0; h < 2; h++) {
+			__m128i shade = h ? _mm_unpackhi_epi8(shade8, _mm_setzero_si128()) : _mm_unpacklo_epi8(shade8, _mm_setzero_si128());
+			__m128i pixel = _mm_setzero_si128();
+
+			for (int e = 0; e < 4; e++)
+				pixel = _mm_or_si128(pixel, _mm_and_si128(_mm_cmpeq_epi16(shade, _mm_set1_epi16(e)), entries[e]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + h * 8), pixel);
+		}
+	}
+	ToRgb565Scalar(shades + i, out + i, count - i, colors);
+}
+
+/*
+	AVX2 does the spreading with one in-lane byte shuffle and the lookups with shuffles or
+	a cross-lane permute, 32 pixels at a time. Built with a function target attribute, so
+	the rest of the build does not need -mavx2; only called after CPUID said yes.
+*/
+TARGET_AVX2 static void DecodeTilesAvx2(const u8* data, u8* indices, u32 tiles)
+{
+	const __m256i bits = _mm256_set1_epi64x(0x0102040810204080LL);
+	const __m256i weights = _mm256_set_epi64x(0x0202020202020202LL, 0x0101010101010101LL, 0x0202020202020202LL, 0x0101010101010101LL);
+	/* lane 0 spreads row 2n (low plane x8, high plane x8), lane 1 row 2n+1 */
+	const __m256i spread[4] = {
+		_mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3),
+		_mm256_setr_epi8(4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7),
+		_mm256_setr_epi8(8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9, 10, 10, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 11),
+		_mm256_setr_epi8(12, 12, 12, 12, 12, 12, 12, 12, 13, 13, 13, 13, 13, 13, 13, 13,
+			14, 14, 14, 14, 14, 14, 14, 14, 15, 15, 15, 15, 15, 15, 15, 15),
+	};
+
+	for (u32 tile = 0; tile < tiles; tile++, data += TILE_BYTES, indices += TILE_PIXELS) {
+		__m256i planes = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+		__m256i rows[4];
+
+		for (int r = 0; r < 4; r++) {
+			__m256i set = _mm256_shuffle_epi8(planes, spread[r]);
+
+			set = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(set, bits), bits), weights);
+			rows[r] = _mm256_add_epi8(set, _mm256_srli_si256(set, 8));
+		}
+		/* the low 8 bytes of each lane are one row; put rows 0-3 and 4-7 back in order */
+		for (int half = 0; half < 2; half++) {
+			__m256i packed = _mm256_unpacklo_epi64(rows[half * 2], rows[half * 2 + 1]);
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(indices + half * 32), _mm256_permute4x64_epi64(packed, 0xD8));
+		}
+	}
+}
+
+TARGET_AVX2 static void ToGray8Avx2(const u8* shades, u8* out, u32 count, const u8* colors)
+{
+	const __m256i three = _mm256_set1_epi8(3);
+	const __m256i lut = _mm256_broadcastsi128_si256(_mm_setr_epi8(colors[0], colors[1], colors[2], colors[3],
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+	u32 i = 0;
+
+	for (; i + 32 <= count; i += 32) {
+		__m256i shade = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(shades + i)), three);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_shuffle_epi8(lut, shade));
+	}
+	ToGray8Scalar(shades + i, out + i, count - i, colors);
+}
+
+TARGET_AVX2 static void MapPaletteAvx2(const u8* indices, u8* shades, u32 count, u8 palette)
+{
+	const u8 lut[4] = { (u8)(palette & 3), (u8)((palette >> 2) & 3), (u8)((palette >> 4) & 3), (u8)(palette >> 6) };
+
+	ToGray8Avx2(indices, shades, count, lut);
+}
+
+TARGET_AVX2 static void ToRgba8888Avx2(const u8* shades, u32* out, u32 count, const u32* colors)
+{
+	const __m256i three = _mm256_set1_epi32(3);
+	const __m256i lut = _mm256_setr_epi32(colors[0], colors[1], colors[2], colors[3], colors[0], colors[1], colors[2], colors[3]);
+	u32 i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i shade = _mm256_and_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(shades + i))), three);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permutevar8x32_epi32(lut, shade));
+	}
+	ToRgba8888Scalar(shades + i, out + i, count - i, colors);
+}
+
+TARGET_AVX2 static void ToRgb565Avx2(const u8* shades, u16* out, u32 count, const u16* colors)
+{
+	const __m256i three = _mm256_set1_epi8(3);
+	const __m256i lutLow = _mm256_broadcastsi128_si256(_mm_setr_epi8(colors[0] & 0xFF, colors[1] & 0xFF, colors[2] & 0xFF, colors[3] & 0xFF,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+	const __m256i lutHigh = _mm256_broadcastsi128_si256(_mm_setr_epi8(colors[0] >> 8, colors[1] >> 8, colors[2] >> 8, colors[3] >> 8,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+	u32 i = 0;
+
+	for (; i + 32 <= count; i += 32) {
+		__m256i shade = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(shades + i)), three);
+		__m256i low = _mm256_shuffle_epi8(lutLow, shade), high = _mm256_shuffle_epi8(lutHigh, shade);
+		/* unpacking works per lane: pixels 0-7 and 16-23, then 8-15 and 24-31 */
+		__m256i first = _mm256_unpacklo_epi8(low, high), second = _mm256_unpackhi_epi8(low, high);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute2x128_si256(first, second, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_permute2x128_si256(first, second, 0x31));
+	}
+	ToRgb565Scalar(shades + i, out + i, count - i, colors);
+}
+
+/* AVX2 needs both the CPU feature and the OS saving YMM registers (XCR0 bits 1-2) */
+static bool CpuHasAvx2()
+{
+#ifdef _MSC_VER
+	int regs[4];
+
+	__cpuid(regs, 0);
+	if (regs[0] < 7)
+		return false;
+	__cpuid(regs, 1);
+	if (!(regs[2] & (1 << 27)) || (_xgetbv(0) & 0x06) != 0x06)
+		return false;
+	__cpuidex(regs, 7, 0);
+	return regs[1] & (1 << 5);
+#else
+	unsigned int eax, ebx, ecx, edx, xcr0Low, xcr0High;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE))
+		return false;
+	__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	if ((xcr0Low & 0x06) != 0x06)
+		return false;
+	return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2);
+#endif
+}
+
+#endif
+
+static const PixelKernels kernels[PIXEL_ISA_COUNT] = {
+	{ PIXEL_ISA_SCALAR, "scalar", DecodeTilesScalar, MapPaletteScalar, ToGray8Scalar, ToRgba8888Scalar, ToRgb565Scalar },
+#ifdef PIXEL_X64_SUPPORTED
+	{ PIXEL_ISA_SSE2, "sse2", DecodeTilesSse2, MapPaletteSse2, ToGray8Sse2, ToRgba8888Sse2, ToRgb565Sse2 },
+	{ PIXEL_ISA_AVX2, "avx2", DecodeTilesAvx2, MapPaletteAvx2, ToGray8Avx2, ToRgba8888Avx2, ToRgb565Avx2 },
+#else
+	{ PIXEL_ISA_SSE2, "sse2", DecodeTilesScalar, MapPaletteScalar, ToGray8Scalar, ToRgba8888Scalar, ToRgb565Scalar },
+	{ PIXEL_ISA_AVX2, "avx2", DecodeTilesScalar, MapPaletteScalar, ToGray8Scalar, ToRgba8888Scalar, ToRgb565Scalar },
+#endif
+};
+
+/* SSE2 is part of x86-64, AVX2 is asked of the CPU once */
+bool PixelIsaSupported(PixelIsa isa)
+{
+#ifdef PIXEL_X64_SUPPORTED
+	static const bool avx2 = CpuHasAvx2();
+
+	return isa == PIXEL_ISA_AVX2 ? avx2 : isa < PIXEL_ISA_COUNT;
+#else
+	return isa == PIXEL_ISA_SCALAR;
+#endif
+}
+
+PixelIsa BestPixelIsa()
+{
+	for (int isa = PIXEL_ISA_COUNT - 1; isa > PIXEL_ISA_SCALAR; isa--) {
+		if (PixelIsaSupported(static_cast<PixelIsa>(isa)))
+			return static_cast<PixelIsa>(isa);
+	}
+	return PIXEL_ISA_SCALAR;
+}
+
+/* a set the CPU cannot run falls back to the best one below it */
+const PixelKernels& GetPixelKernels(PixelIsa isa)
+{
+	while (isa > PIXEL_ISA_SCALAR && !PixelIsaSupported(isa))
+		isa = static_cast<PixelIsa>(isa - 1);
+	return kernels[isa];
+}
\ No newline at end of file
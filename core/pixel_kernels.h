@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PIXEL_X64_SUPPORTED
+#endif
+
+#define TILE_BYTES				16
+#define TILE_PIXELS				64
+
+/* instruction sets the kernels are built for, in order of preference */
+typedef enum {
+	PIXEL_ISA_SCALAR,
+	PIXEL_ISA_SSE2,
+	PIXEL_ISA_AVX2,
+	PIXEL_ISA_COUNT,
+} PixelIsa;
+
+/*
+	Pixel kernels behind one table per instruction set, so callers pick a set once and pay
+	one indirect call per line or tile rather than per pixel. Every set gives the same
+	results byte for byte; SIMD versions do their leftovers with the scalar code.
+	- decodeTiles: 16 bytes of interleaved bitplanes per tile to 64 palette indices.
+	- mapPalette: palette indices (0-3) to shades through a BGP/OBP-style palette byte.
+	- toGray8/toRgba8888/toRgb565: shades (0-3) to host pixels through a 4-entry color table.
+*/
+typedef struct PixelKernels {
+	PixelIsa isa;
+	const char* name;
+	void (*decodeTiles)(const u8*, u8*, u32);
+	void (*mapPalette)(const u8*, u8*, u32, u8);
+	void (*toGray8)(const u8*, u8*, u32, const u8*);
+	void (*toRgba8888)(const u8*, u32*, u32, const u32*);
+	void (*toRgb565)(const u8*, u16*, u32, const u16*);
+} PixelKernels;
+
+bool PixelIsaSupported(PixelIsa);
+PixelIsa BestPixelIsa();
+const PixelKernels& GetPixelKernels(PixelIsa);
\ No newline at end of file
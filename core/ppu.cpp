@@ -0,0 +1,299 @@
+#include "ppu.h"
+#include "bus.h"
+#include "ppu_pipeline.h"
+#include <algorithm>
+#include <cstring>
+
+#define IO(reg)					io[(reg) & BUS_PAGE_MASK]
+
+bool Ppu::OwnTarget() const
+{
+	return target.pixels == framebuffer.data();
+}
+
+/*
+	The line is drawn from the registers as they are now. The window row moves on whether
+	or not the line is drawn, so a skipped frame leaves it where drawing would have.
+*/
+void Ppu::RenderLine(u8 ly)
+{
+	LineRegisters regs = { ly, IO(REG_LCDC), IO(REG_SCY), IO(REG_SCX), IO(REG_BGP), IO(REG_OBP0), IO(REG_OBP1),
+		IO(REG_WY), IO(REG_WX), windowLine };
+
+	if (drawFrame && renderEnabled) {
+		if (pipeline)
+			pipeline->RecordLine(regs, OwnTarget() ? nullptr : &target, renderer.Kernels());
+		else
+			renderer.RenderLine(regs, target);
+	}
+	if (WindowVisible(regs))
+		windowLine++;
+}
+
+/* a frame asked for stays asked for until one is really drawn, output off does not count */
+void Ppu::StartFrame()
+{
+	switch (renderMode) {
+	case RENDER_ALL:
+		drawFrame = true;
+		break;
+	case RENDER_EVERY_NTH:
+		drawFrame = frames % renderInterval == 0;
+		break;
+	case RENDER_ON_REQUEST:
+		drawFrame = frameRequested;
+		break;
+	case RENDER_NONE:
+		drawFrame = false;
+		break;
+	}
+}
+
+void Ppu::RequestInterrupt(u8 mask)
+{
+	bus->Interrupts().Request(mask);
+}
+
+/*
+	A new line begins. With the LCD off, LY stays at 0 and nothing is raised, but the
+	line clock keeps going so turning it back on starts on a line boundary.
+*/
+void Ppu::LineEvent(void* ctx, u64 when)
+{
+	Ppu* ppu = static_cast<Ppu*>(ctx);
+	u8* io = ppu->io;
+	u8 ly = (IO(REG_LY) + 1) % LINES_PER_FRAME, stat = IO(REG_STAT);
+
+	ppu->lineStart = when;
+	ppu->scheduler->Schedule(EVENT_PPU_LINE, when + LINE_T_CYCLES);
+	if (!(IO(REG_LCDC) & LCDC_LCD_ENABLE)) {
+		IO(REG_LY) = 0;
+		ppu->windowLine = 0;
+		return;
+	}
+	IO(REG_LY) = ly;
+	if (ly == 0) {
+		ppu->windowLine = 0;
+		ppu->StartFrame();
+	}
+	if (ly == IO(REG_LYC) && (stat & STAT_LYC_INT))
+		ppu->RequestInterrupt(INT_STAT);
+	if (ly == LCD_HEIGHT) {
+		ppu->frames++;
+		if (ppu->drawFrame && ppu->renderEnabled) {
+			ppu->renderedFrame = ppu->frames;
+			ppu->frameRequested = false;
+		}
+		if (ppu->pipeline)
+			ppu->pipeline->EndFrame(ppu->frames, ppu->drawFrame && ppu->renderEnabled, ppu->OwnTarget() ? nullptr : &ppu->target);
+		ppu->RequestInterrupt(INT_VBLANK | ((stat & STAT_VBLANK_INT) ? INT_STAT : 0));
+	} else if (ly < LCD_HEIGHT) {
+		if (stat & STAT_OAM_INT)
+			ppu->RequestInterrupt(INT_STAT);
+		ppu->scheduler->Schedule(EVENT_PPU_HBLANK, when + HBLANK_START_T_CYCLES);
+	}
+}
+
+void Ppu::HBlankEvent(void* ctx, u64 when)
+{
+	Ppu* ppu = static_cast<Ppu*>(ctx);
+	u8* io = ppu->io;
+
+	if (!(IO(REG_LCDC) & LCDC_LCD_ENABLE))
+		return;
+	ppu->RenderLine(IO(REG_LY));
+	if (IO(REG_STAT) & STAT_HBLANK_INT)
+		ppu->RequestInterrupt(INT_STAT);
+}
+
+/* bus side of the pipeline's log: every VRAM and OAM write while it runs */
+void Ppu::VideoWritten(u16 addr, u8 val)
+{
+	if (pipeline)
+		pipeline->LogWrite(addr, val);
+}
+
+void Ppu::InvalidateTiles()
+{
+	renderer.InvalidateTiles();
+}
+
+PpuMode Ppu::Mode() const
+{
+	u64 dot = scheduler->Now() - lineStart;
+
+	if (!(IO(REG_LCDC) & LCDC_LCD_ENABLE))
+		return PPU_MODE_HBLANK;
+	if (IO(REG_LY) >= LCD_HEIGHT)
+		return PPU_MODE_VBLANK;
+	if (dot < OAM_SCAN_T_CYCLES)
+		return PPU_MODE_OAM_SCAN;
+	return dot < HBLANK_START_T_CYCLES ? PPU_MODE_DRAWING : PPU_MODE_HBLANK;
+}
+
+/* the mode and the LYC flag are not stored, they are worked out on every read */
+u8 Ppu::ReadStat() const
+{
+	u8 stat = 0x80 | (IO(REG_STAT) & 0x78) | Mode();
+
+	if (IO(REG_LY) == IO(REG_LYC))
+		stat |= STAT_LYC_EQUAL;
+	return stat;
+}
+
+void Ppu::SetPixelIsa(PixelIsa isa)
+{
+	renderer.SetKernels(&GetPixelKernels(isa));
+}
+
+/* frames nobody will see are not drawn, timing and interrupts are unchanged */
+void Ppu::SetRenderEnabled(bool enable)
+{
+	renderEnabled = enable;
+}
+
+/*
+	Takes effect from the next frame. An interval of 0 is taken as 1; RENDER_EVERY_NTH
+	counts frames from power on, so instances in step draw the same frames.
+*/
+void Ppu::SetRenderMode(RenderMode mode, u32 interval)
+{
+	renderMode = mode;
+	renderInterval = std::max(interval, 1U);
+}
+
+void Ppu::RequestFrame()
+{
+	frameRequested = true;
+}
+
+/*
+	The FrameCount() the framebuffer was finished at, 0 if nothing was drawn yet. Pipelined,
+	that is the frame Framebuffer() returns, which may be one behind.
+*/
+u64 Ppu::RenderedFrame() const
+{
+	u64 frame = renderedFrame;
+
+	if (pipeline && OwnTarget())
+		pipeline->Present(frame);
+	return frame;
+}
+
+/*
+	Frames are drawn into target from the next line on; nullptr goes back to the PPU's own
+	framebuffer. A stride too short for a row of the format is refused. Pipelined, target
+	is written from the render thread, Sync() before reading it.
+*/
+int Ppu::SetFrameTarget(const FrameTarget* frameTarget)
+{
+	if (!frameTarget) {
+		target = { framebuffer.data(), LCD_WIDTH, PIXEL_FORMAT_INDEXED2 };
+		return STT_SUCCESS;
+	}
+	if (!frameTarget->pixels || frameTarget->format >= PIXEL_FORMAT_COUNT
+		|| frameTarget->stride < LCD_WIDTH * PixelFormatBytes(frameTarget->format))
+		return STT_FAILED;
+	target = *frameTarget;
+	return STT_SUCCESS;
+}
+
+const FrameTarget& Ppu::GetFrameTarget() const
+{
+	return target;
+}
+
+/*
+	Starting keeps the frame as it is and goes on from the next line. Stopping waits for the
+	render thread and leaves the framebuffer as it would be without it.
+*/
+void Ppu::SetPipelined(bool enable)
+{
+	if (enable == IsPipelined())
+		return;
+	if (enable) {
+		pipeline = std::make_unique<PpuPipeline>(vram, oam, framebuffer.data(), renderedFrame);
+		bus->SetVideoWriteLog(true);
+		return;
+	}
+	pipeline->Finish(framebuffer.data());
+	pipelineStats.decodes += pipeline->GetTileCacheStats().decodes;
+	pipelineStats.invalidations += pipeline->GetTileCacheStats().invalidations;
+	pipeline.reset();
+	bus->SetVideoWriteLog(false);
+}
+
+bool Ppu::IsPipelined() const
+{
+	return pipeline != nullptr;
+}
+
+/* waits until every line so far is drawn, a no-op unless pipelined */
+void Ppu::Sync()
+{
+	if (pipeline)
+		pipeline->Sync();
+}
+
+/*
+	Only holds frames while no frame target is set. Pipelined, it is the newest finished
+	frame, never one being drawn; the pointer is good until the next call.
+*/
+const u8* Ppu::Framebuffer() const
+{
+	u64 frame;
+
+	if (pipeline)
+		return pipeline->Present(frame);
+	return framebuffer.data();
+}
+
+/* VBlanks since power on */
+u64 Ppu::FrameCount() const
+{
+	return frames;
+}
+
+/* the render thread's counts join in when it stops */
+TileCacheStats Ppu::GetTileCacheStats() const
+{
+	const TileCacheStats& stats = renderer.GetTileCacheStats();
+
+	return { stats.decodes + pipelineStats.decodes, stats.invalidations + pipelineStats.invalidations };
+}
+
+void Ppu::SaveState(PpuSaveState& save) const
+{
+	save.lineStart = lineStart;
+	save.windowLine = windowLine;
+	std::fill(std::begin(save.reserved), std::end(save.reserved), 0);
+}
+
+/* VRAM came back with the bus, so no decoded tile can be trusted, nor the pipeline's copy */
+void Ppu::LoadState(const PpuSaveState& save)
+{
+	lineStart = save.lineStart;
+	windowLine = save.windowLine;
+	InvalidateTiles();
+	if (pipeline)
+		pipeline->Resync();
+}
+
+/* the first line starts at power on */
+Ppu::Ppu(Bus* pBus, Scheduler* pScheduler) : bus(pBus), scheduler(pScheduler), io(pBus->IoRegisters()),
+	vram(pBus->VramData()), oam(pBus->OamData()), renderer(vram, oam)
+{
+	framebuffer.fill(0);
+	SetFrameTarget(nullptr);
+	bus->SetPpu(this);
+	scheduler->SetHandler(EVENT_PPU_LINE, LineEvent, this);
+	scheduler->SetHandler(EVENT_PPU_HBLANK, HBlankEvent, this);
+	scheduler->Schedule(EVENT_PPU_LINE, LINE_T_CYCLES);
+	scheduler->Schedule(EVENT_PPU_HBLANK, HBLANK_START_T_CYCLES);
+}
+
+/* the pipeline's destructor waits for the render thread */
+Ppu::~Ppu()
+{
+
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "common.h"
+#include "scheduler.h"
+#include "renderer.h"
+#include <array>
+#include <memory>
+
+class Bus;
+class PpuPipeline;
+
+#define LINE_T_CYCLES			456
+#define LINES_PER_FRAME			154
+#define OAM_SCAN_T_CYCLES		80
+#define HBLANK_START_T_CYCLES	252			// mode 3 is taken at its shortest, 172 T-cycles
+
+#define STAT_LYC_EQUAL			(1U << 2)
+#define STAT_HBLANK_INT			(1U << 3)
+#define STAT_VBLANK_INT			(1U << 4)
+#define STAT_OAM_INT			(1U << 5)
+#define STAT_LYC_INT			(1U << 6)
+
+typedef enum {
+	PPU_MODE_HBLANK,
+	PPU_MODE_VBLANK,
+	PPU_MODE_OAM_SCAN,
+	PPU_MODE_DRAWING,
+} PpuMode;
+
+/* which frames get drawn; all of them keep their timing and interrupts */
+typedef enum {
+	RENDER_ALL,
+	RENDER_EVERY_NTH,			// frames whose number is a multiple of the interval
+	RENDER_ON_REQUEST,			// the next whole frame after each RequestFrame()
+	RENDER_NONE,				// headless
+} RenderMode;
+
+/* savestate block, see savestate.h. LY and the other registers are saved with the bus I/O page */
+typedef struct PpuSaveState {
+	u64 lineStart;
+	u8 windowLine;
+	u8 reserved[7];
+} PpuSaveState;
+
+/*
+	Scanline PPU. Every line starts with EVENT_PPU_LINE, which moves LY on and raises the
+	VBlank and STAT interrupts; EVENT_PPU_HBLANK ends mode 3 and is where the whole line is
+	drawn, with the registers as they are at that point. The STAT mode is worked out from
+	the clock when it is read, so nothing runs in between.
+	The drawing itself, with its decoded tile cache, is the Renderer's, see renderer.h.
+	Lines are drawn as shades (0-3, after BGP/OBP0/OBP1) and land in the frame target in
+	its pixel format, with no copy in between; without a target they go to the PPU's own
+	framebuffer, one shade per pixel.
+	Whether a frame is drawn is settled when it starts, on line 0, so a frame is either
+	drawn whole or left as it was; skipped frames cost the two line events and nothing else.
+	Pipelined, lines are drawn by a second thread from a log of VRAM and OAM writes, see
+	ppu_pipeline.h; the CPU thread then only copies the line registers at HBlank.
+*/
+class Ppu {
+private:
+	Bus* bus;
+	Scheduler* scheduler;
+	u8* io;						// the bus I/O page, registers are read from it in place
+	const u8* vram;
+	const u8* oam;
+	Renderer renderer;
+	std::unique_ptr<PpuPipeline> pipeline;
+	TileCacheStats pipelineStats = {};
+	u64 lineStart = 0;			// T-cycle the current line began at
+	u8 windowLine = 0;			// window row to draw next, it only moves on lines showing the window
+	bool renderEnabled = true;
+	RenderMode renderMode = RENDER_ALL;
+	u32 renderInterval = 1;
+	bool frameRequested = false;
+	bool drawFrame = true;		// the frame in progress is being drawn
+	u64 renderedFrame = 0;		// VBlank the framebuffer was completed at
+	u64 frames = 0;
+	std::array<u8, LCD_WIDTH * LCD_HEIGHT> framebuffer;
+	FrameTarget target;
+
+	bool OwnTarget() const;
+	void RenderLine(u8);
+	void StartFrame();
+	void RequestInterrupt(u8);
+	static void LineEvent(void*, u64);
+	static void HBlankEvent(void*, u64);
+public:
+	void TileWritten(const u16 addr)
+	{
+		renderer.TileWritten(addr);
+	}
+	void VideoWritten(u16, u8);
+	void InvalidateTiles();
+	u8 ReadStat() const;
+	PpuMode Mode() const;
+	void SetRenderEnabled(bool);
+	void SetRenderMode(RenderMode, u32 = 1);
+	void RequestFrame();
+	u64 RenderedFrame() const;
+	void SetPixelIsa(PixelIsa);
+	int SetFrameTarget(const FrameTarget*);
+	const FrameTarget& GetFrameTarget() const;
+	void SetPipelined(bool);
+	bool IsPipelined() const;
+	void Sync();
+	const u8* Framebuffer() const;
+	u64 FrameCount() const;
+	TileCacheStats GetTileCacheStats() const;
+	void SaveState(PpuSaveState&) const;
+	void LoadState(const PpuSaveState&);
+	Ppu(Bus*, Scheduler*);
+	Ppu(const Ppu&) = delete;
+	Ppu& operator=(const Ppu&) = delete;
+	~Ppu();
+};
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include "ppu_pipeline.h"
+#include <cstring>
+
+static FrameTarget JobTarget(const FrameTarget* target)
+{
+	return target ? *target : FrameTarget{ nullptr, LCD_WIDTH, PIXEL_FORMAT_INDEXED2 };
+}
+
+/*
+	CPU thread. A line is added to the job being filled; a job that would mix targets or
+	kernel sets, or has no room left, is sent off first. The first line after the log was
+	broken off copies VRAM and OAM as they are now and turns the log back on.
+*/
+void PpuPipeline::RecordLine(const LineRegisters& regs, const FrameTarget* target, const PixelKernels* kernels)
+{
+	FrameTarget lineTarget = JobTarget(target);
+
+	if (job->lineCount && (job->kernels != kernels || job->target.pixels != lineTarget.pixels
+		|| job->target.stride != lineTarget.stride || job->target.format != lineTarget.format))
+		Publish(false, 0);
+	if (job->lineCount == LCD_HEIGHT)
+		Publish(false, 0);
+	if (!logging) {
+		std::memcpy(job->vram.data(), busVram, VRAM_SIZE);
+		std::memcpy(job->oam.data(), busOam, OAM_SIZE);
+		job->snapshot = true;
+		logging = true;
+	}
+	job->target = lineTarget;
+	job->kernels = kernels;
+	job->lines[job->lineCount++] = { regs, static_cast<u32>(job->writes.size()) };
+}
+
+/*
+	CPU thread, at VBlank. A frame with nothing drawn and nothing to show is not sent; the
+	log is dropped instead, so frames that are skipped cost nothing here either.
+*/
+void PpuPipeline::EndFrame(u64 frame, bool present, const FrameTarget* target)
+{
+	if (!job->lineCount)
+		job->target = JobTarget(target);
+	if (job->lineCount || present) {
+		Publish(present, frame);
+		return;
+	}
+	job->writes.clear();
+	logging = false;
+}
+
+/* CPU thread: VRAM or OAM changed without going through the log, as on loading a state */
+void PpuPipeline::Resync()
+{
+	Flush();
+	job->writes.clear();
+	logging = false;
+}
+
+/* CPU thread: sends the lines recorded so far, the frame goes on in the next job */
+void PpuPipeline::Flush()
+{
+	if (job->lineCount)
+		Publish(false, 0);
+}
+
+/* CPU thread: returns once everything recorded has been drawn */
+void PpuPipeline::Sync()
+{
+	u32 target, done;
+
+	Flush();
+	target = produced.load(std::memory_order_relaxed);
+	done = consumed.load(std::memory_order_acquire);
+	while (done != target) {
+		consumed.wait(done, std::memory_order_acquire);
+		done = consumed.load(std::memory_order_acquire);
+	}
+}
+
+/* hands the job over and waits, if it has to, for the next slot to be free */
+void PpuPipeline::Publish(bool present, u64 frame)
+{
+	u32 next, done;
+
+	job->present = present;
+	job->frame = frame;
+	next = produced.fetch_add(1, std::memory_order_release) + 1;
+	produced.notify_one();
+	done = consumed.load(std::memory_order_acquire);
+	while (next - done >= PIPELINE_JOBS) {
+		consumed.wait(done, std::memory_order_acquire);
+		done = consumed.load(std::memory_order_acquire);
+	}
+	job = &jobs[next % PIPELINE_JOBS];
+	job->writes.clear();
+	job->lineCount = 0;
+	job->snapshot = false;
+}
+
+void PpuPipeline::Apply(const VideoWrite& write)
+{
+	if (write.addr >= 0xFE00) {
+		oam[write.addr & 0xFF] = write.val;
+		return;
+	}
+	vram[write.addr & 0x1FFF] = write.val;
+	if (write.addr < TILE_DATA_END)
+		renderer.TileWritten(write.addr);
+}
+
+/* render thread: rows left out of the frame keep what the last frame had, as they would in place */
+void PpuPipeline::PresentFrame(u64 frame)
+{
+	for (u32 row = 0; row < LCD_HEIGHT; row++) {
+		if (!rowsDrawn[row])
+			std::memcpy(frames[back].data() + row * LCD_WIDTH, frames[lastPresented].data() + row * LCD_WIDTH, LCD_WIDTH);
+	}
+	frameNumbers[back] = frame;
+	lastPresented = back;
+	back = ready.exchange(back | PIPELINE_FRAME_NEW, std::memory_order_acq_rel) & ~PIPELINE_FRAME_NEW;
+	rowsDrawn.reset();
+}
+
+/* render thread. A snapshot only drops the decoded tiles whose bytes differ */
+void PpuPipeline::RunJob(const PipelineJob& work)
+{
+	FrameTarget target = work.target;
+	u32 applied = 0;
+
+	if (work.snapshot) {
+		for (u32 tile = 0; tile < TILE_COUNT; tile++) {
+			if (std::memcmp(vram.data() + tile * TILE_BYTES, work.vram.data() + tile * TILE_BYTES, TILE_BYTES))
+				renderer.TileWritten(0x8000 + tile * TILE_BYTES);
+		}
+		vram = work.vram;
+		oam = work.oam;
+	}
+	if (!target.pixels)
+		target.pixels = frames[back].data();
+	if (work.lineCount)
+		renderer.SetKernels(work.kernels);
+	for (u32 i = 0; i < work.lineCount; i++) {
+		const PipelineLine& line = work.lines[i];
+
+		for (; applied < line.writesEnd; applied++)
+			Apply(work.writes[applied]);
+		renderer.RenderLine(line.regs, target);
+		if (!work.target.pixels)
+			rowsDrawn.set(line.regs.ly);
+	}
+	for (; applied < work.writes.size(); applied++)
+		Apply(work.writes[applied]);
+	if (work.present && !work.target.pixels)
+		PresentFrame(work.frame);
+}
+
+void PpuPipeline::Work()
+{
+	u32 done = 0;
+
+	for (;;) {
+		u32 available = produced.load(std::memory_order_acquire);
+
+		while (available == done) {
+			produced.wait(available, std::memory_order_acquire);
+			available = produced.load(std::memory_order_acquire);
+		}
+		if (stopping.load(std::memory_order_acquire))
+			return;
+		RunJob(jobs[done % PIPELINE_JOBS]);
+		consumed.store(++done, std::memory_order_release);
+		consumed.notify_one();
+	}
+}
+
+/* reader side: takes the newest finished frame if there is one, and returns the front frame */
+const u8* PpuPipeline::Present(u64& frame)
+{
+	if (ready.load(std::memory_order_relaxed) & PIPELINE_FRAME_NEW)
+		front = ready.exchange(front, std::memory_order_acq_rel) & ~PIPELINE_FRAME_NEW;
+	frame = frameNumbers[front];
+	return frames[front].data();
+}
+
+/*
+	CPU thread, before the pipeline goes away: writes out the frame as the synchronous PPU
+	would have it, the last finished frame with the lines drawn since on top.
+*/
+void PpuPipeline::Finish(u8* framebuffer)
+{
+	Sync();
+	for (u32 row = 0; row < LCD_HEIGHT; row++) {
+		const u8* src = rowsDrawn[row] ? frames[back].data() : frames[lastPresented].data();
+
+		std::memcpy(framebuffer + row * LCD_WIDTH, src + row * LCD_WIDTH, LCD_WIDTH);
+	}
+}
+
+/* only settled after Sync() */
+const TileCacheStats& PpuPipeline::GetTileCacheStats() const
+{
+	return renderer.GetTileCacheStats();
+}
+
+/* every frame starts as the PPU's framebuffer, so rows never drawn match it */
+PpuPipeline::PpuPipeline(const u8* pVram, const u8* pOam, const u8* framebuffer, u64 frame)
+	: busVram(pVram), busOam(pOam), renderer(vram.data(), oam.data())
+{
+	vram.fill(0);
+	oam.fill(0);
+	for (PipelineJob& slot : jobs) {
+		slot.writes.reserve(PIPELINE_WRITE_RESERVE);
+		slot.lineCount = 0;
+		slot.snapshot = false;
+	}
+	for (u32 i = 0; i < PIPELINE_FRAMES; i++) {
+		std::memcpy(frames[i].data(), framebuffer, LCD_WIDTH * LCD_HEIGHT);
+		frameNumbers[i] = frame;
+	}
+	job = &jobs[0];
+	front = lastPresented = 0;
+	ready.store(1);
+	back = 2;
+	worker = std::thread(&PpuPipeline::Work, this);
+}
+
+PpuPipeline::~PpuPipeline()
+{
+	Sync();
+	stopping.store(true, std::memory_order_release);
+	produced.fetch_add(1, std::memory_order_release);
+	produced.notify_one();
+	worker.join();
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "common.h"
+#include "renderer.h"
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <thread>
+#include <vector>
+
+#define PIPELINE_JOBS			3			// one being filled, up to two queued or being drawn
+#define PIPELINE_FRAMES			3			// front, ready and back
+#define PIPELINE_FRAME_NEW		0x80000000U
+#define PIPELINE_WRITE_RESERVE	4096
+#define VRAM_SIZE				(8 * KiB)
+#define OAM_SIZE				256
+
+typedef struct VideoWrite {
+	u16 addr;
+	u8 val;
+} VideoWrite;
+
+/* a line to draw once the writes before it have been applied */
+typedef struct PipelineLine {
+	LineRegisters regs;
+	u32 writesEnd;
+} PipelineLine;
+
+/*
+	What the render thread needs to repeat a stretch of frame: the VRAM and OAM writes in
+	the order they happened and, between them, the lines with their registers. A job that
+	starts after the log was broken off carries a copy of VRAM and OAM to start from.
+*/
+typedef struct PipelineJob {
+	std::vector<VideoWrite> writes;
+	std::array<PipelineLine, LCD_HEIGHT> lines;
+	u32 lineCount;
+	bool snapshot;
+	std::array<u8, VRAM_SIZE> vram;
+	std::array<u8, OAM_SIZE> oam;
+	FrameTarget target;				// null pixels: the pipeline's own frames
+	const PixelKernels* kernels;
+	bool present;					// the frame is finished with this job
+	u64 frame;
+} PipelineJob;
+
+/*
+	Draws lines on a thread of its own while the CPU thread goes on emulating. The CPU side
+	logs every VRAM and OAM write and takes the registers of each line at HBlank, as the
+	synchronous PPU would draw it; the render thread replays the log into its own copy of
+	VRAM and OAM and draws each line at the same point in it, so frames come out the same
+	byte for byte. Jobs go over a ring of PIPELINE_JOBS slots with two counters, and the
+	CPU thread only waits when the render thread is a whole ring behind.
+	Finished frames go back through a lock-free triple buffer: the render thread swaps its
+	back frame into the ready slot, and the reader swaps the ready slot with its front
+	frame when it has something new, so a frame being read is never written to. Frames
+	drawn into a caller's FrameTarget skip this; Sync() before reading those.
+*/
+class PpuPipeline {
+private:
+	const u8* busVram;
+	const u8* busOam;
+	std::array<u8, VRAM_SIZE> vram;		// the render thread's copies
+	std::array<u8, OAM_SIZE> oam;
+	Renderer renderer;
+	std::array<PipelineJob, PIPELINE_JOBS> jobs;
+	std::atomic<u32> produced = 0;
+	std::atomic<u32> consumed = 0;
+	std::atomic<bool> stopping = false;
+	PipelineJob* job;					// being filled by the CPU thread
+	bool logging = false;				// off until the next line takes a snapshot
+	std::array<std::array<u8, LCD_WIDTH * LCD_HEIGHT>, PIPELINE_FRAMES> frames;
+	std::array<u64, PIPELINE_FRAMES> frameNumbers;
+	std::atomic<u32> ready;				// frame index, with PIPELINE_FRAME_NEW until taken
+	u32 front;							// reader side
+	u32 back;							// render thread side from here on
+	u32 lastPresented;
+	std::bitset<LCD_HEIGHT> rowsDrawn;
+	std::thread worker;
+
+	void Publish(bool, u64);
+	void Work();
+	void RunJob(const PipelineJob&);
+	void Apply(const VideoWrite&);
+	void PresentFrame(u64);
+public:
+	void LogWrite(const u16 addr, const u8 val)
+	{
+		if (logging)
+			job->writes.push_back({ addr, val });
+	}
+	void RecordLine(const LineRegisters&, const FrameTarget*, const PixelKernels*);
+	void EndFrame(u64, bool, const FrameTarget*);
+	void Resync();
+	void Flush();
+	void Sync();
+	const u8* Present(u64&);
+	void Finish(u8*);
+	const TileCacheStats& GetTileCacheStats() const;
+	PpuPipeline(const u8*, const u8*, const u8*, u64);
+	PpuPipeline(const PpuPipeline&) = delete;
+	PpuPipeline& operator=(const PpuPipeline&) = delete;
+	~PpuPipeline();
+};
\ No newline at end of file
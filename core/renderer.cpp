@@ -0,0 +1,174 @@
+#include "renderer.h"
+#include <algorithm>
+#include <cstring>
+
+#define TILE_MAP_LOW			0x1800
+#define TILE_MAP_HIGH			0x1C00
+#define LINE_MARGIN				8		// room for the first tile scrolled off to the left
+
+static const u32 formatBytes[PIXEL_FORMAT_COUNT] = { 1, 1, 2, 4 };
+static const u8 grayColors[4] = { 0xFF, 0xAA, 0x55, 0x00 };
+static const u16 rgb565Colors[4] = { 0xFFFF, 0xAD55, 0x52AA, 0x0000 };
+static const u32 rgba8888Colors[4] = { 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 };
+
+u32 PixelFormatBytes(PixelFormat format)
+{
+	return formatBytes[format];
+}
+
+/* the window needs the background on, as on DMG */
+bool WindowVisible(const LineRegisters& regs)
+{
+	return (regs.lcdc & LCDC_BG_ENABLE) && (regs.lcdc & LCDC_WINDOW_ENABLE) && regs.ly >= regs.wy && regs.wx < LCD_WIDTH + 7;
+}
+
+void Renderer::DecodeTile(u32 tile)
+{
+	kernels->decodeTiles(vram + tile * TILE_BYTES, tiles[tile].data(), 1);
+	tileValid[tile] = true;
+	tileStats.decodes++;
+}
+
+const u8* Renderer::TileRow(u32 tile, u32 row)
+{
+	if (!tileValid[tile])
+		DecodeTile(tile);
+	return tiles[tile].data() + row * 8;
+}
+
+/*
+	Background and window are copied a tile row at a time into a line of palette indices,
+	which also decides sprite priority; sprites are then drawn over it, first in priority
+	order. The shades come out of BGP/OBP0/OBP1 last.
+*/
+void Renderer::DrawLine(const LineRegisters& regs, u8* out)
+{
+	std::array<u8, LINE_MARGIN + LCD_WIDTH + 16> buffer;
+	std::array<bool, LCD_WIDTH> claimed;
+	std::array<u8, SPRITES_PER_LINE> sprites;
+	u8* line = buffer.data() + LINE_MARGIN;
+	u8 lcdc = regs.lcdc, ly = regs.ly;
+	u32 count = 0;
+
+	buffer.fill(0);
+	if (lcdc & LCDC_BG_ENABLE) {
+		u8 y = ly + regs.scy, scx = regs.scx;
+		const u8* map = vram + ((lcdc & LCDC_BG_MAP_HIGH) ? TILE_MAP_HIGH : TILE_MAP_LOW) + (y >> 3) * 32;
+		u8* dst = line - (scx & 7);
+
+		for (u32 i = 0; i <= LCD_WIDTH / 8; i++, dst += 8) {
+			u8 index = map[((scx >> 3) + i) & 31];
+			u32 tile = (lcdc & LCDC_TILES_UNSIGNED) ? index : 256 + (i8)index;
+
+			std::memcpy(dst, TileRow(tile, y & 7), 8);
+		}
+		if (WindowVisible(regs)) {
+			const u8* windowMap = vram + ((lcdc & LCDC_WINDOW_MAP_HIGH) ? TILE_MAP_HIGH : TILE_MAP_LOW) + (regs.windowLine >> 3) * 32;
+			u8* windowDst = buffer.data() + regs.wx + 1;			// LINE_MARGIN + WX - 7
+
+			for (u32 i = 0; windowDst < line + LCD_WIDTH; i++, windowDst += 8) {
+				u8 index = windowMap[i];
+				u32 tile = (lcdc & LCDC_TILES_UNSIGNED) ? index : 256 + (i8)index;
+
+				std::memcpy(windowDst, TileRow(tile, regs.windowLine & 7), 8);
+			}
+		}
+	}
+	/* with the background off it is white whatever BGP says, and index 0 under sprites */
+	if (lcdc & LCDC_BG_ENABLE)
+		kernels->mapPalette(line, out, LCD_WIDTH, regs.bgp);
+	else
+		std::memset(out, 0, LCD_WIDTH);
+
+	if (!(lcdc & LCDC_OBJ_ENABLE))
+		return;
+	u32 height = (lcdc & LCDC_OBJ_TALL) ? 16 : 8;
+
+	for (u32 i = 0; i < OAM_SPRITES && count < SPRITES_PER_LINE; i++) {
+		u32 row = ly + 16 - oam[i * 4];
+
+		if (row < height)
+			sprites[count++] = i;
+	}
+	/* on DMG the sprite further left wins, and OAM order breaks ties */
+	std::stable_sort(sprites.begin(), sprites.begin() + count, [this](u8 a, u8 b) { return oam[a * 4 + 1] < oam[b * 4 + 1]; });
+	claimed.fill(false);
+	for (u32 i = 0; i < count; i++) {
+		const u8* entry = oam + sprites[i] * 4;
+		u8 attr = entry[3], palette = (attr & OBJ_PALETTE1) ? regs.obp1 : regs.obp0;
+		u32 row = ly + 16 - entry[0], tile = entry[2];
+		int left = entry[1] - 8;
+		const u8* pixels;
+
+		if (attr & OBJ_FLIP_Y)
+			row = height - 1 - row;
+		if (height == 16)
+			tile = (tile & 0xFE) | (row >> 3);
+		pixels = TileRow(tile, row & 7);
+		for (int x = std::max(left, 0); x < std::min(left + 8, LCD_WIDTH); x++) {
+			u8 color = pixels[(attr & OBJ_FLIP_X) ? 7 - (x - left) : x - left];
+
+			if (!color || claimed[x])
+				continue;
+			claimed[x] = true;
+			if (!(attr & OBJ_BEHIND_BG) || !line[x])
+				out[x] = (palette >> (color * 2)) & 3;
+		}
+	}
+}
+
+/* indexed targets are drawn into directly, the others get the line converted on the way */
+void Renderer::RenderLine(const LineRegisters& regs, const FrameTarget& target)
+{
+	u8* row = static_cast<u8*>(target.pixels) + regs.ly * target.stride;
+	std::array<u8, LCD_WIDTH> shades;
+
+	if (target.format == PIXEL_FORMAT_INDEXED2) {
+		DrawLine(regs, row);
+		return;
+	}
+	DrawLine(regs, shades.data());
+	switch (target.format) {
+	case PIXEL_FORMAT_GRAY8:
+		kernels->toGray8(shades.data(), row, LCD_WIDTH, grayColors);
+		break;
+	case PIXEL_FORMAT_RGB565:
+		kernels->toRgb565(shades.data(), reinterpret_cast<u16*>(row), LCD_WIDTH, rgb565Colors);
+		break;
+	default:
+		kernels->toRgba8888(shades.data(), reinterpret_cast<u32*>(row), LCD_WIDTH, rgba8888Colors);
+		break;
+	}
+}
+
+void Renderer::InvalidateTiles()
+{
+	tileValid.fill(false);
+}
+
+/* the decoded tiles are the same whatever the set, so they are kept */
+void Renderer::SetKernels(const PixelKernels* pKernels)
+{
+	kernels = pKernels;
+}
+
+const PixelKernels* Renderer::Kernels() const
+{
+	return kernels;
+}
+
+const TileCacheStats& Renderer::GetTileCacheStats() const
+{
+	return tileStats;
+}
+
+Renderer::Renderer(const u8* pVram, const u8* pOam) : vram(pVram), oam(pOam)
+{
+	kernels = &GetPixelKernels(BestPixelIsa());
+	InvalidateTiles();
+}
+
+Renderer::~Renderer()
+{
+
+}
\ No newline at end of file
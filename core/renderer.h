@@ -0,0 +1,110 @@
+#pragma once
+
+#include "common.h"
+#include "pixel_kernels.h"
+#include <array>
+
+#define LCD_WIDTH				160
+#define LCD_HEIGHT				144
+
+#define TILE_COUNT				384			// 0x8000-0x97FF, 16 bytes each
+#define TILE_DATA_END			0x9800
+#define OAM_SPRITES				40
+#define SPRITES_PER_LINE		10
+
+#define LCDC_BG_ENABLE			(1U << 0)
+#define LCDC_OBJ_ENABLE			(1U << 1)
+#define LCDC_OBJ_TALL			(1U << 2)
+#define LCDC_BG_MAP_HIGH		(1U << 3)
+#define LCDC_TILES_UNSIGNED		(1U << 4)
+#define LCDC_WINDOW_ENABLE		(1U << 5)
+#define LCDC_WINDOW_MAP_HIGH	(1U << 6)
+#define LCDC_LCD_ENABLE			(1U << 7)
+
+#define OBJ_PALETTE1			(1U << 4)
+#define OBJ_FLIP_X				(1U << 5)
+#define OBJ_FLIP_Y				(1U << 6)
+#define OBJ_BEHIND_BG			(1U << 7)
+
+/* host pixel formats a frame can be drawn in, see FrameTarget */
+typedef enum {
+	PIXEL_FORMAT_INDEXED2,		// one byte per pixel, the shade 0 (white) to 3 (black)
+	PIXEL_FORMAT_GRAY8,			// 0xFF, 0xAA, 0x55, 0x00
+	PIXEL_FORMAT_RGB565,		// native-endian u16
+	PIXEL_FORMAT_RGBA8888,		// R, G, B, A bytes in memory
+	PIXEL_FORMAT_COUNT,
+} PixelFormat;
+
+/*
+	Memory the frame is drawn straight into: LCD_HEIGHT rows of LCD_WIDTH pixels, stride
+	bytes apart. pixels must stay valid while it is set and be aligned to the pixel size.
+*/
+typedef struct FrameTarget {
+	void* pixels;
+	u32 stride;
+	PixelFormat format;
+} FrameTarget;
+
+/* everything a line is drawn from besides VRAM and OAM, as it was when the line was drawn */
+typedef struct LineRegisters {
+	u8 ly;
+	u8 lcdc;
+	u8 scy;
+	u8 scx;
+	u8 bgp;
+	u8 obp0;
+	u8 obp1;
+	u8 wy;
+	u8 wx;
+	u8 windowLine;
+} LineRegisters;
+
+typedef struct TileCacheStats {
+	u64 decodes;			// tiles expanded to palette indices
+	u64 invalidations;		// VRAM writes that dropped a decoded tile
+} TileCacheStats;
+
+/*
+	Draws whole lines from VRAM, OAM and a set of line registers. Tiles are kept decoded:
+	each row of 8 pixels is stored as 8 palette indices, so drawing a line copies rows
+	instead of pulling bits out of two bitplanes per pixel. A write to tile data drops only
+	the tile it hits, which is decoded again the next time it is used. Decoding and the
+	palettes go through the pixel kernels of the set it is given, see pixel_kernels.h.
+	It only reads the memory it was given, so the PPU can run one on the bus and another
+	on a copy in a different thread.
+*/
+class Renderer {
+private:
+	const u8* vram;
+	const u8* oam;
+	const PixelKernels* kernels;
+	std::array<std::array<u8, TILE_PIXELS>, TILE_COUNT> tiles;
+	std::array<bool, TILE_COUNT> tileValid;
+	TileCacheStats tileStats = {};
+
+	const u8* TileRow(u32, u32);
+	void DecodeTile(u32);
+	void DrawLine(const LineRegisters&, u8*);
+public:
+	void TileWritten(const u16 addr)
+	{
+		u32 tile = (addr & 0x1FFF) >> 4;
+
+		if (tileValid[tile]) {
+			tileValid[tile] = false;
+			tileStats.invalidations++;
+		}
+	}
+	void InvalidateTiles();
+	void RenderLine(const LineRegisters&, const FrameTarget&);
+	void SetKernels(const PixelKernels*);
+	const PixelKernels* Kernels() const;
+	const TileCacheStats& GetTileCacheStats() const;
+	Renderer(const u8*, const u8*);
+	Renderer(const Renderer&) = delete;
+	Renderer& operator=(const Renderer&) = delete;
+	~Renderer();
+};
+
+u32 PixelFormatBytes(PixelFormat);
+bool WindowVisible(const LineRegisters&);
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "rewind.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#define FRAMES_PER_SECOND		((double)RTC_T_CYCLES_PER_SECOND / FRAME_T_CYCLES)
+#define NO_SPACE				SIZE_MAX
+
+static u8* PutVarint(u8* out, size_t val)
+{
+	while (val >= 0x80) {
+		*out++ = (val & 0x7F) | 0x80;
+		val >>= 7;
+	}
+	*out++ = val;
+	return out;
+}
+
+static bool GetVarint(const u8*& in, const u8* end, size_t& val)
+{
+	val = 0;
+	for (int shift = 0; in < end && shift < 64; shift += 7) {
+		u8 byte = *in++;
+
+		val |= (size_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static inline u64 Load64(const u8* p)
+{
+	u64 val;
+
+	std::memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+/* writes the delta between base and cur to out, which holds at least 3/2 of a state */
+size_t Rewinder::Encode(const u8* base, const u8* cur, u8* out)
+{
+	u8* p = out;
+	size_t i = 0;
+
+	while (i < stateSize) {
+		size_t zeroStart = i, literalEnd, run = 0;
+
+		while (i + 8 <= stateSize && Load64(base + i) == Load64(cur + i))
+			i += 8;
+		while (i < stateSize && base[i] == cur[i])
+			i++;
+		literalEnd = i;
+		for (size_t j = i; j < stateSize && run < REWIND_MIN_ZERO_RUN; j++) {
+			if (base[j] == cur[j]) {
+				run++;
+			} else {
+				run = 0;
+				literalEnd = j + 1;
+			}
+		}
+		if (literalEnd == i)
+			break;
+		p = PutVarint(p, i - zeroStart);
+		p = PutVarint(p, literalEnd - i);
+		for (; i < literalEnd; i++)
+			*p++ = base[i] ^ cur[i];
+	}
+	return p - out;
+}
+
+bool Rewinder::Decode(const u8* in, size_t size, const u8* base, u8* out)
+{
+	const u8* end = in + size;
+	size_t pos = 0, zeros, length;
+
+	std::memcpy(out, base, stateSize);
+	while (in < end) {
+		if (!GetVarint(in, end, zeros) || !GetVarint(in, end, length))
+			return false;
+		pos += zeros;
+		if (pos + length > stateSize || length > (size_t)(end - in))
+			return false;
+		for (size_t i = 0; i < length; i++)
+			out[pos + i] ^= in[i];
+		in += length;
+		pos += length;
+	}
+	return true;
+}
+
+void Rewinder::EvictGroup()
+{
+	do {
+		stats.bytesUsed -= entries.front().size;
+		stats.keyframes -= entries.front().keyframe;
+		stats.snapshots--;
+		entries.pop_front();
+	} while (!entries.empty() && !entries.front().keyframe);
+}
+
+/*
+	Finds size free bytes after the newest entry, wrapping around the ring and evicting the
+	oldest groups as needed. The newest group is only given up for a new keyframe.
+*/
+size_t Rewinder::Allocate(size_t size, bool keyframe)
+{
+	if (size > ring.size())
+		return NO_SPACE;
+	for (;;) {
+		if (entries.empty())
+			return 0;
+
+		size_t tail = entries.front().offset;
+		size_t head = entries.back().offset + entries.back().size;
+
+		if (head > tail) {
+			if (ring.size() - head >= size)
+				return head;
+			if (tail >= size)
+				return 0;
+		} else if (tail - head >= size) {
+			return head;
+		}
+		if (!keyframe && stats.keyframes <= 1)
+			return NO_SPACE;
+		EvictGroup();
+	}
+}
+
+/* call once per frame, after Emulator::RunFrame() */
+void Rewinder::Record()
+{
+	u64 frame = emulator->GetFrameCount();
+	u8* cur;
+	size_t size, offset;
+	bool keyframe;
+
+	if (frame % interval)
+		return;
+	if (stateSize != emulator->SaveStateSize())
+		Reset();
+	if (!entries.empty() && entries.back().frame >= frame)
+		return;
+	cur = reinterpret_cast<u8*>(state.data());
+	if (!emulator->SaveState(cur, stateSize))
+		return;
+
+	keyframe = entries.empty() || sinceKeyframe >= keyframeInterval;
+	size = Encode(reinterpret_cast<const u8*>(keyframe ? zeroState.data() : keyState.data()), cur, scratch.data());
+	offset = Allocate(std::max<size_t>(size, 1), keyframe);
+	if (offset == NO_SPACE && !keyframe) {
+		/* the newest group alone fills the ring: start over from a keyframe */
+		Clear();
+		keyframe = true;
+		size = Encode(reinterpret_cast<const u8*>(zeroState.data()), cur, scratch.data());
+		offset = Allocate(std::max<size_t>(size, 1), keyframe);
+	}
+	if (offset == NO_SPACE) {
+		stats.dropped++;
+		return;
+	}
+
+	std::memcpy(ring.data() + offset, scratch.data(), size);
+	entries.push_back({ frame, offset, std::max<size_t>(size, 1), keyframe });
+	stats.bytesUsed += entries.back().size;
+	stats.snapshots++;
+	if (keyframe) {
+		std::memcpy(keyState.data(), cur, stateSize);
+		stats.keyframes++;
+		sinceKeyframe = 0;
+	} else {
+		sinceKeyframe++;
+	}
+}
+
+/*
+	Goes back frames frames: the newest snapshot at or before the target is decoded and
+	loaded, then the machine runs forward to the target. Snapshots after it are dropped,
+	the history from there on is recorded again.
+*/
+int Rewinder::StepBack(u64 frames)
+{
+	auto start = std::chrono::steady_clock::now();
+	u64 now = emulator->GetFrameCount(), target;
+	size_t index, key;
+	u8* cur = reinterpret_cast<u8*>(state.data());
+	u8* keyBytes = reinterpret_cast<u8*>(keyState.data());
+
+	if (entries.empty() || frames > now || now - frames < entries.front().frame)
+		return STT_FAILED;
+	target = now - frames;
+	for (index = entries.size() - 1; entries[index].frame > target; index--)
+		;
+	for (key = index; !entries[key].keyframe; key--)
+		;
+
+	const Entry& keyEntry = entries[key];
+	const Entry& entry = entries[index];
+
+	if (!Decode(ring.data() + keyEntry.offset, keyEntry.size, reinterpret_cast<const u8*>(zeroState.data()), keyBytes))
+		return STT_FAILED;
+	if (index == key)
+		std::memcpy(cur, keyBytes, stateSize);
+	else if (!Decode(ring.data() + entry.offset, entry.size, keyBytes, cur))
+		return STT_FAILED;
+	if (emulator->LoadState(cur, stateSize) != STT_SUCCESS)
+		return STT_FAILED;
+
+	while (entries.size() > index + 1) {
+		stats.bytesUsed -= entries.back().size;
+		stats.keyframes -= entries.back().keyframe;
+		stats.snapshots--;
+		entries.pop_back();
+	}
+	sinceKeyframe = index - key;
+	while (emulator->GetFrameCount() < target) {
+		if (emulator->RunFrame() != STT_SUCCESS)
+			break;
+	}
+
+	stats.rewinds++;
+	stats.lastRewindMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	stats.rewindMicrosPerSecond += (stats.lastRewindMicros * FRAMES_PER_SECOND / std::max<u64>(frames, 1)
+		- stats.rewindMicrosPerSecond) / stats.rewinds;
+	return STT_SUCCESS;
+}
+
+void Rewinder::Clear()
+{
+	entries.clear();
+	sinceKeyframe = 0;
+	stats.snapshots = 0;
+	stats.keyframes = 0;
+	stats.bytesUsed = 0;
+}
+
+RewindStats Rewinder::Stats() const
+{
+	RewindStats ret = stats;
+
+	ret.capacity = ring.size();
+	ret.secondsOfHistory = entries.empty() ? 0.0
+		: (entries.back().frame - entries.front().frame + interval) / FRAMES_PER_SECOND;
+	ret.bytesPerSecond = ret.secondsOfHistory > 0.0 ? ret.bytesUsed / ret.secondsOfHistory : 0.0;
+	return ret;
+}
+
+/* the state size only changes with the cartridge */
+void Rewinder::Reset()
+{
+	stateSize = emulator->SaveStateSize();
+	state.assign((stateSize + 7) / 8, 0);
+	keyState.assign(state.size(), 0);
+	zeroState.assign(state.size(), 0);
+	scratch.assign(stateSize * 3 / 2 + 32, 0);
+	Clear();
+}
+
+Rewinder::Rewinder(Emulator* pEmulator, size_t capacity, u32 pInterval, u32 pKeyframeInterval)
+	: emulator(pEmulator), interval(std::max<u32>(pInterval, 1)), keyframeInterval(pKeyframeInterval),
+	ring(capacity), stats()
+{
+
+}
+
+Rewinder::~Rewinder()
+{
+
+}
\ No newline at end of file
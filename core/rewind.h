@@ -0,0 +1,70 @@
+#pragma once
+
+#include "common.h"
+#include "emulator.h"
+#include <deque>
+#include <vector>
+
+#define REWIND_DEFAULT_CAPACITY		(4 * MiB)
+#define REWIND_DEFAULT_INTERVAL		4		// frames between snapshots
+#define REWIND_DEFAULT_KEYFRAMES	32		// snapshots per keyframe
+#define REWIND_MIN_ZERO_RUN			4		// shorter zero runs are folded into literals
+
+typedef struct RewindStats {
+	u64 snapshots;					// in the ring now
+	u64 keyframes;
+	u64 dropped;					// snapshots larger than the whole ring
+	size_t bytesUsed;
+	size_t capacity;
+	double secondsOfHistory;
+	double bytesPerSecond;			// ring bytes per second of history
+	u64 rewinds;
+	double lastRewindMicros;		// decode, restore and re-simulate
+	double rewindMicrosPerSecond;	// average latency per second stepped back
+} RewindStats;
+
+/*
+	Rewind history kept in a fixed-size byte ring. Every interval frames the machine is
+	saved and stored as the XOR of the state with the last keyframe, run-length coded:
+		varint zero run, varint literal length, literal bytes, ...
+	so only the bytes that changed cost space. Keyframes use the same coding against an
+	all-zero state. A keyframe and the deltas after it form a group, and the oldest group
+	is evicted as a whole when the ring is full.
+	Stepping back restores the newest snapshot at or before the target frame and runs
+	forward to it, so the target does not need to sit on a snapshot.
+*/
+class Rewinder {
+private:
+	typedef struct Entry {
+		u64 frame;
+		size_t offset;
+		size_t size;
+		bool keyframe;
+	} Entry;
+
+	Emulator* emulator;
+	u32 interval;
+	u32 keyframeInterval;
+	std::vector<u8> ring;
+	std::deque<Entry> entries;
+	size_t stateSize = 0;
+	std::vector<u64> state;			// u64 storage keeps the states 8-byte aligned
+	std::vector<u64> keyState;		// decoded keyframe the newest group is coded against
+	std::vector<u64> zeroState;
+	std::vector<u8> scratch;
+	u32 sinceKeyframe = 0;
+	RewindStats stats;
+
+	void Reset();
+	size_t Encode(const u8*, const u8*, u8*);
+	bool Decode(const u8*, size_t, const u8*, u8*);
+	size_t Allocate(size_t, bool);
+	void EvictGroup();
+public:
+	void Record();
+	int StepBack(u64);
+	void Clear();
+	RewindStats Stats() const;
+	Rewinder(Emulator*, size_t = REWIND_DEFAULT_CAPACITY, u32 = REWIND_DEFAULT_INTERVAL, u32 = REWIND_DEFAULT_KEYFRAMES);
+	~Rewinder();
+};
\ No newline at end of file
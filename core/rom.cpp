@@ -1,4 +1,6 @@
 #include "rom.h"
+#include "rom_cache.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -36,6 +38,11 @@ static std::array<u8, DMG_BOOT_ROM_SIZE> dmgBootRom = {
 	0x3e, 0x01, 0xe0, 0x50
 };
 
+/* indexed by the RAM size byte of the header, 0x01 is an unofficial 2 KiB */
+static const std::array<u32, 6> extRamSizes = {
+	0, 2 * KiB, 8 * KiB, 32 * KiB, 128 * KiB, 64 * KiB
+};
+
 static std::array<u8, 48> nintendoLogo = {
 	0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B,
 	0x03, 0x73, 0x00, 0x83, 0x00, 0x0C, 0x00, 0x0D,
@@ -45,12 +52,8 @@ static std::array<u8, 48> nintendoLogo = {
 	0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E
 };
 
-bool IsGbFile(const std::string& romPath)
-{
-	return std::filesystem::path(romPath).extension() == ".gb";
-}
-
-int Rom::ParseHeader()
+/* checks the logo and the header checksum and fills header, once per distinct image */
+int ParseRomHeader(const u8* data, u64 size, RomHeader& header)
 {
 	for (int i = 0; i < 48; i++) {
 		if (data[0x0104 + i] != nintendoLogo[i]) {
@@ -74,6 +77,53 @@ int Rom::ParseHeader()
 		return STT_FAILED;
 	}
 
+	header.romType = data[0x0147];
+	header.ramSize = (data[0x0149] < extRamSizes.size()) ? extRamSizes[data[0x0149]] : 0;
+	return STT_SUCCESS;
+}
+
+/* the image was validated by the ROM cache, only the controller is per instance */
+int Rom::ParseHeader()
+{
+	u32 banks = image->size / ROM_BANK_SIZE;
+
+	header = image->header;
+	switch (header.romType) {
+	case 0x00:
+	case 0x08:
+	case 0x09:
+		mbc = std::make_unique<Mbc>(banks, header.ramSize);
+		break;
+	case 0x01:
+	case 0x02:
+	case 0x03:
+		mbc = std::make_unique<Mbc1>(banks, header.ramSize);
+		break;
+	case 0x05:
+	case 0x06:
+		mbc = std::make_unique<Mbc2>(banks);
+		break;
+	case 0x0F:
+	case 0x10:
+	case 0x11:
+	case 0x12:
+	case 0x13:
+		mbc = std::make_unique<Mbc3>(banks, header.ramSize, header.romType <= 0x10);
+		break;
+	case 0x19:
+	case 0x1A:
+	case 0x1B:
+	case 0x1C:
+	case 0x1D:
+	case 0x1E:
+		mbc = std::make_unique<Mbc5>(banks, header.ramSize);
+		break;
+	default:
+		spdlog::error("Cartridge type {:02X} is not supported.", header.romType);
+		return STT_FAILED;
+	}
+	spdlog::info("Cartridge type: {:02X}, RAM size: {} KiB", header.romType, header.ramSize / KiB);
+
 	return STT_SUCCESS;
 }
 
@@ -89,15 +139,35 @@ u8 Rom::Read(u16 addr)
 	if (!disableBootROM && addr < 0x0100) {
 		ret = BootRomRead(addr);
 	} else {
-		ret = data[addr];
+		u32 bank = (addr < ROM_BANK_SIZE) ? mbc->RomBank0() : mbc->RomBank1();
+
+		ret = RomBankData(bank)[addr & (ROM_BANK_SIZE - 1)];
 	}
 		
 	return ret;
 }
 
+/* the 16 KiB bank, wrapped around the image size */
+const u8* Rom::RomBankData(u32 bank) const
+{
+	return image->data + ((u64)bank * ROM_BANK_SIZE) % image->size;
+}
+
+const u8* Rom::BootRomData() const
+{
+	return dmgBootRom.data();
+}
+
+/* writes to the ROM area are bank controller commands */
 void Rom::Write(u16 addr, u8 data)
 {
+	if (mbc)
+		mbc->Write(addr, data);
+}
 
+Mbc* Rom::GetMbc() const
+{
+	return mbc.get();
 }
 
 void Rom::UnlockBootROM()
@@ -105,6 +175,16 @@ void Rom::UnlockBootROM()
 	disableBootROM = true;
 }
 
+void Rom::LockBootROM()
+{
+	disableBootROM = false;
+}
+
+u64 Rom::ImageHash() const
+{
+	return image ? image->hash : 0;
+}
+
 bool Rom::IsBootROMUnlocked() const
 {
 	return disableBootROM;
@@ -112,21 +192,10 @@ bool Rom::IsBootROMUnlocked() const
 
 int Rom::Load(const char* romPath)
 {
-	std::ifstream fs(romPath);
-
-	if (!fs.is_open() && !IsGbFile(romPath)) {
-		spdlog::error("Can't open the ROM file.");
-	} else {
-		fs.seekg(0, std::ios::end);
-		u64 fileSize = fs.tellg();
-		fs.seekg(0, std::ios::beg);
-
-		data = std::make_unique<u8[]>(fileSize);
-        fs.read(reinterpret_cast<char*>(data.get()), fileSize);
-        fs.close();
-        return ParseHeader();
-	}
-	return STT_FAILED;
+	image = RomCache::Instance().Acquire(romPath);
+	if (!image)
+		return STT_FAILED;
+	return ParseHeader();
 }
 
 Rom::Rom() : disableBootROM(false)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "mbc.h"
 #include <array>
 #include <memory>
 #include <string>
@@ -12,19 +13,29 @@ typedef struct RomHeader {
 	u32 ramSize;
 } RomHeader;
 
+struct RomImage;
+
+int ParseRomHeader(const u8*, u64, RomHeader&);
+
 class Rom {
 private:
 	RomHeader header;
-	std::unique_ptr<u8[]> data = nullptr;
+	std::shared_ptr<const RomImage> image = nullptr;
 	bool disableBootROM = false;
+	std::unique_ptr<Mbc> mbc = nullptr;
 	u8 BootRomRead(u16);
 public:
 	int Load(const char*);
 	int ParseHeader();
 	void UnlockBootROM();
+	void LockBootROM();
+	u64 ImageHash() const;
 	bool IsBootROMUnlocked() const;
 	u8 Read(u16);
+	const u8* RomBankData(u32) const;
+	const u8* BootRomData() const;
 	void Write(u16, u8);
+	Mbc* GetMbc() const;
 	Rom();
 	~Rom();
 };
\ No newline at end of file
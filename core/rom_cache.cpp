@@ -0,0 +1,180 @@
+#include "rom_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+/* FNV-1a, only used to find images with the same content */
+static u64 HashImage(const u8* data, u64 size)
+{
+	u64 hash = 0xCBF29CE484222325ULL;
+
+	for (u64 i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+RomImage::~RomImage()
+{
+#ifndef _WIN32
+	if (mapping)
+		munmap(mapping, mappingSize);
+#endif
+}
+
+std::shared_ptr<RomImage> RomCache::MapFile(const std::string& path)
+{
+	auto image = std::make_shared<RomImage>();
+
+#ifndef _WIN32
+	struct stat st;
+	int fd = open(path.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return nullptr;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return nullptr;
+	}
+	if ((u64)st.st_size >= ROM_MIN_IMAGE_SIZE) {
+		void* mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		close(fd);
+		if (mem == MAP_FAILED)
+			return nullptr;
+		image->mapping = mem;
+		image->mappingSize = st.st_size;
+		image->data = static_cast<const u8*>(mem);
+		image->size = st.st_size;
+		return image;
+	}
+	image->buffer = std::make_unique<u8[]>(ROM_MIN_IMAGE_SIZE);
+	std::memset(image->buffer.get(), 0, ROM_MIN_IMAGE_SIZE);
+	for (ssize_t done = 0, n; done < st.st_size; done += n) {
+		n = read(fd, image->buffer.get() + done, st.st_size - done);
+		if (n <= 0) {
+			close(fd);
+			return nullptr;
+		}
+	}
+	close(fd);
+#else
+	std::ifstream fs(path, std::ios::binary | std::ios::ate);
+	u64 fileSize;
+
+	if (!fs.is_open())
+		return nullptr;
+	fileSize = fs.tellg();
+	fs.seekg(0, std::ios::beg);
+	image->buffer = std::make_unique<u8[]>(std::max<u64>(fileSize, ROM_MIN_IMAGE_SIZE));
+	std::memset(image->buffer.get(), 0, std::max<u64>(fileSize, ROM_MIN_IMAGE_SIZE));
+	if (!fs.read(reinterpret_cast<char*>(image->buffer.get()), fileSize))
+		return nullptr;
+	if (fileSize >= ROM_MIN_IMAGE_SIZE) {
+		image->data = image->buffer.get();
+		image->size = fileSize;
+		return image;
+	}
+#endif
+	image->data = image->buffer.get();
+	image->size = ROM_MIN_IMAGE_SIZE;
+	return image;
+}
+
+RomCache& RomCache::Instance()
+{
+	static RomCache cache;
+
+	return cache;
+}
+
+std::shared_ptr<const RomImage> RomCache::Acquire(const char* romPath)
+{
+	std::error_code ec;
+	std::string key = std::filesystem::absolute(romPath, ec).lexically_normal().string();
+	std::lock_guard<std::mutex> guard(lock);
+	std::shared_ptr<RomImage> image;
+
+	if (ec)
+		key = romPath;
+	auto it = byPath.find(key);
+	if (it != byPath.end()) {
+		stats.hits++;
+		return it->second;
+	}
+
+	image = MapFile(key);
+	if (!image) {
+		spdlog::error("Can't open the ROM file.");
+		return nullptr;
+	}
+	image->hash = HashImage(image->data, image->size);
+	auto range = byHash.equal_range(image->hash);
+	for (auto entry = range.first; entry != range.second; entry++) {
+		std::shared_ptr<const RomImage> cached = entry->second.lock();
+
+		if (cached && cached->size == image->size && !std::memcmp(cached->data, image->data, image->size)) {
+			stats.shared++;
+			byPath.emplace(key, cached);
+			return cached;
+		}
+	}
+
+	if (ParseRomHeader(image->data, image->size, image->header) != STT_SUCCESS)
+		return nullptr;
+	stats.loaded++;
+	byHash.emplace(image->hash, image);
+	byPath.emplace(key, image);
+	return image;
+}
+
+/* drops the images no Rom refers to anymore */
+void RomCache::Purge()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	std::unordered_map<const RomImage*, long> pathRefs, useCount;
+
+	for (auto& entry : byPath) {
+		pathRefs[entry.second.get()]++;
+		useCount[entry.second.get()] = entry.second.use_count();
+	}
+	for (auto it = byPath.begin(); it != byPath.end();) {
+		if (useCount[it->second.get()] == pathRefs[it->second.get()])
+			it = byPath.erase(it);
+		else
+			it++;
+	}
+	for (auto it = byHash.begin(); it != byHash.end();) {
+		if (it->second.expired())
+			it = byHash.erase(it);
+		else
+			it++;
+	}
+}
+
+size_t RomCache::Size()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return byPath.size();
+}
+
+RomCacheStats RomCache::Stats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	return stats;
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+#include "rom.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define ROM_MIN_IMAGE_SIZE			(32 * KiB)
+
+/*
+	A cartridge image shared by every Rom loaded from the same content. Files of at least
+	32 KiB are mapped read-only, smaller ones are copied into a padded buffer. The header
+	is parsed and checked once, when the image enters the cache.
+*/
+typedef struct RomImage {
+	const u8* data = nullptr;
+	u64 size = 0;
+	u64 hash = 0;
+	RomHeader header;
+	void* mapping = nullptr;
+	u64 mappingSize = 0;
+	std::unique_ptr<u8[]> buffer = nullptr;
+	~RomImage();
+} RomImage;
+
+typedef struct RomCacheStats {
+	u64 hits;					// served from the path table, no disk access
+	u64 shared;					// new path, content already cached
+	u64 loaded;
+} RomCacheStats;
+
+/*
+	Process-wide cache of ROM images. Paths are resolved once; after that, loading the same
+	path again only takes a reference. A different path with the same content reuses the
+	cached image as well. A file changed on disk under a cached path is not seen until the
+	entry is purged.
+*/
+class RomCache {
+private:
+	std::mutex lock;
+	std::unordered_map<std::string, std::shared_ptr<const RomImage>> byPath;
+	std::unordered_multimap<u64, std::weak_ptr<const RomImage>> byHash;
+	RomCacheStats stats = {};
+
+	std::shared_ptr<RomImage> MapFile(const std::string&);
+public:
+	static RomCache& Instance();
+	std::shared_ptr<const RomImage> Acquire(const char*);
+	void Purge();
+	size_t Size();
+	RomCacheStats Stats();
+};
\ No newline at end of file
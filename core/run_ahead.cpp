@@ -0,0 +1,65 @@
+#include "run_ahead.h"
+#include <chrono>
+
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+int RunAhead::RunFrame()
+{
+	auto start = std::chrono::steady_clock::now();
+	size_t size = emulator->SaveStateSize();
+	int ret;
+
+	if (!frames)
+		return emulator->RunFrame();
+	if (state.size() * sizeof(u64) < size)
+		state.resize((size + 7) / 8);
+
+	emulator->SetOutputEnabled(false);
+	ret = emulator->RunFrame();
+	auto real = std::chrono::steady_clock::now();
+	if (ret != STT_SUCCESS || !emulator->SaveState(reinterpret_cast<u8*>(state.data()), size)) {
+		emulator->SetOutputEnabled(true);
+		return ret;
+	}
+	for (u32 i = 1; i < frames; i++)
+		emulator->RunFrame();
+	emulator->SetOutputEnabled(true);
+	emulator->RunFrame();
+	ret = emulator->LoadState(reinterpret_cast<u8*>(state.data()), size);
+
+	auto end = std::chrono::steady_clock::now();
+	double frameMicros = std::chrono::duration<double, std::micro>(real - start).count();
+
+	stats.frames++;
+	stats.lastAddedMicros = std::chrono::duration<double, std::micro>(end - real).count();
+	stats.addedMicros += (stats.lastAddedMicros - stats.addedMicros) / stats.frames;
+	stats.frameMicros += (frameMicros - stats.frameMicros) / stats.frames;
+	return ret;
+}
+
+void RunAhead::SetFrames(u32 pFrames)
+{
+	frames = pFrames;
+}
+
+u32 RunAhead::Frames() const
+{
+	return frames;
+}
+
+const RunAheadStats& RunAhead::Stats() const
+{
+	return stats;
+}
+
+RunAhead::RunAhead(Emulator* pEmulator, u32 pFrames) : emulator(pEmulator), frames(pFrames), stats()
+{
+
+}
+
+RunAhead::~RunAhead()
+{
+
+}
\ No newline at end of file
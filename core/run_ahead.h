@@ -0,0 +1,34 @@
+#pragma once
+
+#include "common.h"
+#include "emulator.h"
+#include <vector>
+
+typedef struct RunAheadStats {
+	u64 frames;
+	double lastAddedMicros;			// save, speculative frames and restore of the last frame
+	double addedMicros;				// average of the above
+	double frameMicros;				// average of the real frame alone
+} RunAheadStats;
+
+/*
+	Run-ahead hides the input lag a game builds in itself. Every host frame the real frame
+	is run without output and saved, then the machine runs frames - 1 more frames without
+	output and one last frame with output, so what gets presented is the future with the
+	current input held. The saved state is loaded back before the next host frame.
+	With frames == 0 it is a plain Emulator::RunFrame().
+*/
+class RunAhead {
+private:
+	Emulator* emulator;
+	u32 frames;
+	std::vector<u64> state;			// u64 storage keeps the state 8-byte aligned
+	RunAheadStats stats;
+public:
+	int RunFrame();
+	void SetFrames(u32);
+	u32 Frames() const;
+	const RunAheadStats& Stats() const;
+	RunAhead(Emulator*, u32);
+	~RunAhead();
+};
\ No newline at end of file
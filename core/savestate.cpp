@@ -0,0 +1,98 @@
+#include "savestate.h"
+#include <cstring>
+
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+/* space for a block of size bytes, or nullptr once the buffer is too small */
+void* SaveStateWriter::Reserve(u32 id, u32 size)
+{
+	SaveBlockHeader* block = reinterpret_cast<SaveBlockHeader*>(buffer + used);
+	size_t span = SAVE_BLOCK_SPAN(size);
+
+	if (overflow || used + span > capacity) {
+		overflow = true;
+		return nullptr;
+	}
+	block->id = id;
+	block->size = size;
+	/* only the padding after the payload is cleared, the caller overwrites the payload */
+	std::memset(reinterpret_cast<u8*>(block + 1) + size, 0, span - sizeof(SaveBlockHeader) - size);
+	used += span;
+	blocks++;
+	return block + 1;
+}
+
+/* the size of the finished state, 0 if it did not fit */
+size_t SaveStateWriter::Finish()
+{
+	SaveStateHeader* header = reinterpret_cast<SaveStateHeader*>(buffer);
+
+	if (overflow)
+		return 0;
+	header->magic = SAVESTATE_MAGIC;
+	header->version = SAVESTATE_VERSION;
+	header->romHash = romHash;
+	header->size = used;
+	header->blocks = blocks;
+	return used;
+}
+
+SaveStateWriter::SaveStateWriter(u8* pBuffer, size_t pCapacity, u64 pRomHash)
+	: buffer(pBuffer), capacity(pCapacity), used(sizeof(SaveStateHeader)), romHash(pRomHash)
+{
+	overflow = capacity < sizeof(SaveStateHeader);
+}
+
+SaveStateWriter::~SaveStateWriter()
+{
+
+}
+
+/*
+	Blocks are stored in the order the emulator writes them, so a lookup is a short walk.
+	Unknown blocks are skipped; a known block with the wrong size fails the lookup.
+*/
+const void* SaveStateReader::Find(u32 id, u32 blockSize) const
+{
+	const SaveStateHeader* header = reinterpret_cast<const SaveStateHeader*>(buffer);
+	size_t offset = sizeof(SaveStateHeader);
+
+	if (!valid)
+		return nullptr;
+	while (offset + sizeof(SaveBlockHeader) <= header->size) {
+		const SaveBlockHeader* block = reinterpret_cast<const SaveBlockHeader*>(buffer + offset);
+
+		if (offset + SAVE_BLOCK_SPAN(block->size) > header->size)
+			break;
+		if (block->id == id)
+			return (block->size == blockSize) ? block + 1 : nullptr;
+		offset += SAVE_BLOCK_SPAN(block->size);
+	}
+	return nullptr;
+}
+
+SaveStateReader::SaveStateReader(const u8* pBuffer, size_t pSize, u64 romHash) : buffer(pBuffer), size(pSize)
+{
+	const SaveStateHeader* header = reinterpret_cast<const SaveStateHeader*>(buffer);
+
+	if (size < sizeof(SaveStateHeader) || header->magic != SAVESTATE_MAGIC) {
+		spdlog::error("Not a savestate.");
+		return;
+	}
+	if (header->version != SAVESTATE_VERSION) {
+		spdlog::error("Savestate version {} is not supported, expected {}.", header->version, SAVESTATE_VERSION);
+		return;
+	}
+	if (header->romHash != romHash) {
+		spdlog::error("The savestate was made with another cartridge.");
+		return;
+	}
+	valid = header->size <= size;
+}
+
+SaveStateReader::~SaveStateReader()
+{
+
+}
\ No newline at end of file
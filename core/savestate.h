@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common.h"
+#include <cstddef>
+#include <type_traits>
+
+#define SAVESTATE_MAGIC				0x53534755U		// "UGSS"
+#define SAVESTATE_VERSION			6
+#define SAVESTATE_ALIGN				8
+
+/* block ids are never reused; a new component gets a new id */
+typedef enum {
+	SAVE_BLOCK_EMULATOR = 1,
+	SAVE_BLOCK_CPU,
+	SAVE_BLOCK_BUS,
+	SAVE_BLOCK_MBC,
+	SAVE_BLOCK_CART_RAM,
+	SAVE_BLOCK_SCHEDULER,
+	SAVE_BLOCK_PPU,
+	SAVE_BLOCK_TIMER,
+	SAVE_BLOCK_APU,
+} SaveBlockId;
+
+typedef struct SaveStateHeader {
+	u32 magic;
+	u32 version;
+	u64 romHash;				// a state only loads into the cartridge it was saved from
+	u32 size;					// header and blocks
+	u32 blocks;
+} SaveStateHeader;
+
+typedef struct SaveBlockHeader {
+	u32 id;
+	u32 size;					// payload, without the padding to SAVESTATE_ALIGN
+} SaveBlockHeader;
+
+#define SAVE_BLOCK_SPAN(size)		(sizeof(SaveBlockHeader) + (((size) + SAVESTATE_ALIGN - 1) & ~(size_t)(SAVESTATE_ALIGN - 1)))
+
+/*
+	A savestate is a header followed by blocks, each one a POD struct (or a raw byte range)
+	copied as is. Components fill their block in place, so saving is a handful of memcpy()
+	calls into the caller's buffer and loading is the same in reverse, with no allocation.
+	Block structs must not have padding bytes, which keeps states byte-for-byte
+	reproducible; explicit reserved fields take the place of padding.
+*/
+class SaveStateWriter {
+private:
+	u8* buffer;
+	size_t capacity;
+	size_t used;
+	u64 romHash;
+	u32 blocks = 0;
+	bool overflow = false;
+public:
+	void* Reserve(u32, u32);
+	template<typename T>
+	T* Reserve(u32 id)
+	{
+		static_assert(std::has_unique_object_representations_v<T>, "savestate blocks must not have padding");
+		return static_cast<T*>(Reserve(id, sizeof(T)));
+	}
+	size_t Finish();
+	SaveStateWriter(u8*, size_t, u64);
+	~SaveStateWriter();
+};
+
+class SaveStateReader {
+private:
+	const u8* buffer;
+	size_t size;
+	bool valid = false;
+public:
+	bool Valid() const { return valid; }
+	const void* Find(u32, u32) const;
+	template<typename T>
+	const T* Find(u32 id) const
+	{
+		static_assert(std::has_unique_object_representations_v<T>, "savestate blocks must not have padding");
+		return static_cast<const T*>(Find(id, sizeof(T)));
+	}
+	SaveStateReader(const u8*, size_t, u64);
+	~SaveStateReader();
+};
\ No newline at end of file
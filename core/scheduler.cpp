@@ -0,0 +1,161 @@
+#include "scheduler.h"
+#include <utility>
+
+bool Scheduler::Before(u8 lhs, u8 rhs) const
+{
+	return deadlines[lhs] < deadlines[rhs] || (deadlines[lhs] == deadlines[rhs] && lhs < rhs);
+}
+
+void Scheduler::Swap(u32 i, u32 j)
+{
+	std::swap(heap[i], heap[j]);
+	position[heap[i]] = i;
+	position[heap[j]] = j;
+}
+
+void Scheduler::SiftUp(u32 i)
+{
+	while (i && Before(heap[i], heap[(i - 1) / 2])) {
+		Swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+void Scheduler::SiftDown(u32 i)
+{
+	for (;;) {
+		u32 smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+
+		if (left < heapSize && Before(heap[left], heap[smallest]))
+			smallest = left;
+		if (right < heapSize && Before(heap[right], heap[smallest]))
+			smallest = right;
+		if (smallest == i)
+			return;
+		Swap(i, smallest);
+		i = smallest;
+	}
+}
+
+void Scheduler::Remove(u8 type)
+{
+	u32 i = position[type];
+
+	Swap(i, --heapSize);
+	deadlines[type] = EVENT_NONE;
+	if (i < heapSize) {
+		u8 moved = heap[i];
+
+		SiftUp(i);
+		SiftDown(position[moved]);
+	}
+}
+
+void Scheduler::SetHandler(u8 type, EventHandler handler, void* ctx)
+{
+	handlers[type] = handler;
+	contexts[type] = ctx;
+}
+
+/* the clock ScheduleIn() counts from, the CPU's T-cycle counter */
+void Scheduler::SetClock(const u64* pClock)
+{
+	clock = pClock;
+}
+
+u64 Scheduler::Now() const
+{
+	return clock ? *clock : 0;
+}
+
+/* replaces the pending deadline of type, if any */
+void Scheduler::Schedule(u8 type, u64 when)
+{
+	if (deadlines[type] != EVENT_NONE) {
+		bool earlier = when < deadlines[type];
+
+		deadlines[type] = when;
+		if (earlier)
+			SiftUp(position[type]);
+		else
+			SiftDown(position[type]);
+		return;
+	}
+	deadlines[type] = when;
+	heap[heapSize] = type;
+	position[type] = heapSize;
+	SiftUp(heapSize++);
+}
+
+void Scheduler::ScheduleIn(u8 type, u64 delay)
+{
+	Schedule(type, Now() + delay);
+}
+
+void Scheduler::Cancel(u8 type)
+{
+	if (deadlines[type] != EVENT_NONE)
+		Remove(type);
+}
+
+bool Scheduler::IsScheduled(u8 type) const
+{
+	return deadlines[type] != EVENT_NONE;
+}
+
+u64 Scheduler::Deadline(u8 type) const
+{
+	return deadlines[type];
+}
+
+/* runs every event due at or before now, in deadline order, including ones armed on the way */
+void Scheduler::Service(u64 now)
+{
+	while (heapSize && deadlines[heap[0]] <= now) {
+		u8 type = heap[0];
+		u64 when = deadlines[type];
+
+		Remove(type);
+		serviced++;
+		if (handlers[type])
+			handlers[type](contexts[type], when);
+	}
+}
+
+u64 Scheduler::Serviced() const
+{
+	return serviced;
+}
+
+void Scheduler::Reset()
+{
+	deadlines.fill(EVENT_NONE);
+	heapSize = 0;
+}
+
+void Scheduler::SaveState(SchedulerSaveState& save) const
+{
+	for (u32 type = 0; type < EVENT_TYPE_COUNT; type++)
+		save.deadlines[type] = deadlines[type];
+}
+
+void Scheduler::LoadState(const SchedulerSaveState& save)
+{
+	Reset();
+	for (u32 type = 0; type < EVENT_TYPE_COUNT; type++) {
+		if (save.deadlines[type] != EVENT_NONE)
+			Schedule(type, save.deadlines[type]);
+	}
+}
+
+Scheduler::Scheduler()
+{
+	deadlines.fill(EVENT_NONE);
+	handlers.fill(nullptr);
+	contexts.fill(nullptr);
+}
+
+Scheduler::~Scheduler()
+{
+
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "common.h"
+#include <array>
+
+#define EVENT_NONE					UINT64_MAX
+
+/* one pending deadline per type at most; ties are serviced in this order */
+typedef enum {
+	EVENT_PPU_LINE,
+	EVENT_PPU_HBLANK,
+	EVENT_TIMER_OVERFLOW,
+	EVENT_SERIAL_BIT,
+	EVENT_APU_FRAME_SEQUENCER,
+	EVENT_TYPE_COUNT,
+} EventType;
+
+/* called with the timestamp the event was due at, which may be a few T-cycles ago */
+typedef void (*EventHandler)(void*, u64);
+
+/* savestate block, see savestate.h. Handlers belong to the components, only deadlines are saved */
+typedef struct SchedulerSaveState {
+	u64 deadlines[EVENT_TYPE_COUNT];
+} SchedulerSaveState;
+
+/*
+	Timed hardware runs off deadlines on the global T-cycle clock instead of being ticked
+	every instruction. The CPU runs straight up to NextEvent(), then Service() calls the
+	handlers of everything due, and each handler arms its own next deadline, usually from
+	the timestamp it was given so periodic events do not drift. Pending events live in a
+	binary min-heap of event types with a position index, so rescheduling or cancelling
+	is O(log n) without a search and nothing is ever allocated.
+*/
+class Scheduler {
+private:
+	std::array<u64, EVENT_TYPE_COUNT> deadlines;
+	std::array<u8, EVENT_TYPE_COUNT> heap;
+	std::array<u8, EVENT_TYPE_COUNT> position;
+	u32 heapSize = 0;
+	std::array<EventHandler, EVENT_TYPE_COUNT> handlers;
+	std::array<void*, EVENT_TYPE_COUNT> contexts;
+	const u64* clock = nullptr;
+	u64 serviced = 0;
+
+	bool Before(u8, u8) const;
+	void Swap(u32, u32);
+	void SiftUp(u32);
+	void SiftDown(u32);
+	void Remove(u8);
+public:
+	u64 NextEvent() const { return heapSize ? deadlines[heap[0]] : EVENT_NONE; }
+	void SetHandler(u8, EventHandler, void*);
+	void SetClock(const u64*);
+	u64 Now() const;
+	void Schedule(u8, u64);
+	void ScheduleIn(u8, u64);
+	void Cancel(u8);
+	bool IsScheduled(u8) const;
+	u64 Deadline(u8) const;
+	void Service(u64);
+	u64 Serviced() const;
+	void Reset();
+	void SaveState(SchedulerSaveState&) const;
+	void LoadState(const SchedulerSaveState&);
+	Scheduler();
+	~Scheduler();
+};
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "timer.h"
+#include "bus.h"
+
+#define IO(reg)					io[(reg) & BUS_PAGE_MASK]
+
+/* system counter bit whose falling edge clocks TIMA, for each TAC clock select */
+static const u32 clockBits[4] = { 9, 3, 5, 7 };
+
+/* the low 16 bits are the hardware counter; it wraps on a multiple of every period, so edges are not lost */
+u64 Timer::Counter(u64 when) const
+{
+	return when - divBase;
+}
+
+/* the input to TIMA's edge detector: the selected counter bit, gated by the enable bit */
+bool Timer::Signal(u64 counter, u8 tac) const
+{
+	return (tac & TAC_ENABLE) && ((counter >> clockBits[tac & TAC_CLOCK_MASK]) & 1);
+}
+
+/*
+	Moves TIMA on to when. Past an overflow TIMA counts from TMA, and once round every
+	further cycle of 0x100 - TMA edges; the interrupt is raised however many there were.
+*/
+void Timer::Sync(u64 when)
+{
+	u8 tac = IO(REG_TAC);
+
+	if (when <= syncTime)
+		return;
+	if (tac & TAC_ENABLE) {
+		u32 shift = clockBits[tac & TAC_CLOCK_MASK] + 1;
+		u64 edges = (Counter(when) >> shift) - (Counter(syncTime) >> shift);
+		u64 left = 0x100 - IO(REG_TIMA);
+
+		if (edges < left) {
+			IO(REG_TIMA) += edges;
+		} else {
+			IO(REG_TIMA) = IO(REG_TMA) + (edges - left) % (0x100 - IO(REG_TMA));
+			bus->Interrupts().Request(INT_TIMER);
+		}
+	}
+	syncTime = when;
+}
+
+/* TIMA must be in sync; the deadline is the counter value of its (0x100 - TIMA)th edge from here */
+void Timer::ScheduleOverflow()
+{
+	u8 tac = IO(REG_TAC);
+	u32 shift = clockBits[tac & TAC_CLOCK_MASK] + 1;
+
+	if (!(tac & TAC_ENABLE)) {
+		scheduler->Cancel(EVENT_TIMER_OVERFLOW);
+		return;
+	}
+	scheduler->Schedule(EVENT_TIMER_OVERFLOW, divBase + (((Counter(syncTime) >> shift) + 0x100 - IO(REG_TIMA)) << shift));
+}
+
+void Timer::OverflowEvent(void* ctx, u64 when)
+{
+	Timer* timer = static_cast<Timer*>(ctx);
+
+	timer->Sync(when);
+	timer->ScheduleOverflow();
+}
+
+u8 Timer::Read(u16 addr)
+{
+	switch (addr) {
+	case REG_DIV:
+		return (Counter(scheduler->Now()) >> 8) & 0xFF;
+	case REG_TIMA:
+		Sync(scheduler->Now());
+		return IO(REG_TIMA);
+	case REG_TAC:
+		return IO(REG_TAC) | 0xF8;
+	default:
+		return IO(addr);
+	}
+}
+
+/*
+	Resetting DIV or changing TAC can take the edge detector's input from 1 to 0 without
+	the counter getting there, which clocks TIMA once like a real edge.
+*/
+void Timer::Write(u16 addr, u8 val)
+{
+	u64 now = scheduler->Now();
+	bool before = Signal(Counter(now), IO(REG_TAC)), after;
+
+	Sync(now);
+	switch (addr) {
+	case REG_DIV:
+		divBase = now;
+		after = false;
+		break;
+	case REG_TAC:
+		IO(REG_TAC) = val & (TAC_ENABLE | TAC_CLOCK_MASK);
+		after = Signal(Counter(now), IO(REG_TAC));
+		break;
+	default:
+		IO(addr) = val;
+		after = before;
+		break;
+	}
+	if (before && !after) {
+		if (IO(REG_TIMA) == 0xFF) {
+			IO(REG_TIMA) = IO(REG_TMA);
+			bus->Interrupts().Request(INT_TIMER);
+		} else {
+			IO(REG_TIMA)++;
+		}
+	}
+	ScheduleOverflow();
+}
+
+void Timer::SaveState(TimerSaveState& save) const
+{
+	save.divBase = divBase;
+	save.syncTime = syncTime;
+}
+
+/* the scheduler brings the overflow deadline back with it */
+void Timer::LoadState(const TimerSaveState& save)
+{
+	divBase = save.divBase;
+	syncTime = save.syncTime;
+}
+
+/* the counter starts at 0 with the clock, and the timer starts off */
+Timer::Timer(Bus* pBus, Scheduler* pScheduler) : bus(pBus), scheduler(pScheduler)
+{
+	io = bus->IoRegisters();
+	bus->SetTimer(this);
+	scheduler->SetHandler(EVENT_TIMER_OVERFLOW, OverflowEvent, this);
+}
+
+Timer::~Timer()
+{
+
+}
\ No newline at end of file
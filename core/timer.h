@@ -0,0 +1,50 @@
+#pragma once
+
+#include "common.h"
+#include "scheduler.h"
+
+class Bus;
+
+#define TAC_ENABLE				(1U << 2)
+#define TAC_CLOCK_MASK			0x03
+
+/* savestate block, see savestate.h. TIMA, TMA and TAC are saved with the bus I/O page */
+typedef struct TimerSaveState {
+	u64 divBase;
+	u64 syncTime;
+} TimerSaveState;
+
+/*
+	DIV, TIMA, TMA and TAC without ticking. The 16-bit system counter is the T-cycles since
+	divBase, the last DIV reset, and DIV is its upper byte. TIMA counts falling edges of
+	the counter bit TAC selects, so between two points it moved by how many multiples of
+	that bit's period the counter crossed; it is brought up to date, in the I/O page, only
+	when it is read or written, when TAC or DIV change, and at overflow. The overflow is
+	one EVENT_TIMER_OVERFLOW deadline worked out in advance, which reloads TMA and raises
+	the interrupt, so a game that leaves the timer alone costs nothing.
+	Writes to DIV and TAC that pull the selected bit from 1 to 0 count as an edge, as on
+	DMG. TMA is reloaded on the overflow cycle itself rather than 4 T-cycles later.
+*/
+class Timer {
+private:
+	Bus* bus;
+	Scheduler* scheduler;
+	u8* io;
+	u64 divBase = 0;			// T-cycle the system counter was last 0 at
+	u64 syncTime = 0;			// T-cycle TIMA in the I/O page is right for
+
+	u64 Counter(u64) const;
+	bool Signal(u64, u8) const;
+	void Sync(u64);
+	void ScheduleOverflow();
+	static void OverflowEvent(void*, u64);
+public:
+	u8 Read(u16);
+	void Write(u16, u8);
+	void SaveState(TimerSaveState&) const;
+	void LoadState(const TimerSaveState&);
+	Timer(Bus*, Scheduler*);
+	Timer(const Timer&) = delete;
+	Timer& operator=(const Timer&) = delete;
+	~Timer();
+};
\ No newline at end of file
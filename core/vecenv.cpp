@@ -0,0 +1,242 @@
+#include "vecenv.h"
+#include "common.h"
+#include "emulator.h"
+#include "work_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+static_assert(VECENV_FRAME_WIDTH == LCD_WIDTH && VECENV_FRAME_HEIGHT == LCD_HEIGHT);
+static_assert(VECENV_BUTTON_A == JOYPAD_A && VECENV_BUTTON_START == JOYPAD_START
+	&& VECENV_BUTTON_RIGHT == JOYPAD_RIGHT && VECENV_BUTTON_DOWN == JOYPAD_DOWN);
+static_assert(VECENV_SUCCESS == STT_SUCCESS && VECENV_FAILED == STT_FAILED);
+
+#define VECENV_FRAME_BYTES		(VECENV_FRAME_WIDTH * VECENV_FRAME_HEIGHT)
+
+/*
+	Instances are created, reset and stepped by their home worker in the pool, so each one
+	and its row of the buffer stay with one thread. The per-round tasks are made once and
+	read their arguments from members, which keeps std::function from allocating per call.
+*/
+struct VecEnv {
+private:
+	VecEnvConfig config;
+	std::vector<u16> ramAddresses;
+	WorkPool pool;
+	std::vector<std::unique_ptr<Emulator>> instances;
+	std::vector<u8> stopped;
+	std::vector<u64> snapshot;			// 8-byte aligned, as savestates want
+	size_t snapshotSize = 0;
+	std::array<u8, VECENV_FRAME_BYTES> resetFrame;
+	VecEnvLayout layout = {};
+	const u8* buttons = nullptr;		// this step's
+	const u8* resetMask = nullptr;		// this reset's
+	std::function<void(u32, u32)> stepTask;
+	std::function<void(u32, u32)> resetTask;
+
+	u8* Row(u32 index) { return layout.observations + index * layout.rowStride; }
+	void Create(u32);
+	void Observe(u32);
+	void Step(u32);
+	void Reset(u32);
+	int TakeSnapshot();
+public:
+	int Init();
+	int StepAll(const u8*);
+	int ResetSome(const u8*);
+	const VecEnvLayout& Layout() const { return layout; }
+	const u8* Stopped() const { return stopped.data(); }
+	VecEnv(const VecEnvConfig&);
+	VecEnv(const VecEnv&) = delete;
+	VecEnv& operator=(const VecEnv&) = delete;
+	~VecEnv();
+};
+
+/* home worker: frames are drawn only when they are observed, and never on another thread */
+void VecEnv::Create(u32 index)
+{
+	std::unique_ptr<Emulator> instance = std::make_unique<Emulator>();
+
+	std::memset(Row(index), 0, layout.rowStride);
+	if (instance->Load(config.rom) != STT_SUCCESS) {
+		stopped[index] = 1;
+		return;
+	}
+	instance->SetAudioEnabled(false);
+	instance->SetVideoPipelined(false);
+	instance->SetRenderMode(layout.frameBytes ? RENDER_ALL : RENDER_NONE);
+	if (layout.frameBytes)
+		instance->SetFrameTarget(Row(index) + layout.frameOffset, VECENV_FRAME_WIDTH,
+			config.pixels == VECENV_PIXELS_GRAY8 ? PIXEL_FORMAT_GRAY8 : PIXEL_FORMAT_INDEXED2);
+	instances[index] = std::move(instance);
+}
+
+void VecEnv::Observe(u32 index)
+{
+	u8* ram = Row(index) + layout.ramOffset;
+
+	for (size_t i = 0; i < ramAddresses.size(); i++)
+		ram[i] = instances[index]->ReadMemory(ramAddresses[i]);
+}
+
+/* only the last frame of the step is drawn, the others run with output off */
+void VecEnv::Step(u32 index)
+{
+	Emulator* instance = instances[index].get();
+
+	if (stopped[index])
+		return;
+	instance->SetButtons(buttons[index]);
+	for (u32 frame = 0; frame < config.frameSkip; frame++) {
+		instance->SetOutputEnabled(frame + 1 == config.frameSkip);
+		if (instance->RunFrame() != STT_SUCCESS) {
+			stopped[index] = 1;
+			break;
+		}
+	}
+	instance->SetOutputEnabled(true);
+	Observe(index);
+}
+
+/* the frame is not in the savestate, the one drawn when the snapshot was taken goes with it */
+void VecEnv::Reset(u32 index)
+{
+	Emulator* instance = instances[index].get();
+
+	if (resetMask && !resetMask[index])
+		return;
+	instance->LoadState(reinterpret_cast<const u8*>(snapshot.data()), snapshotSize);
+	instance->SetButtons(0);
+	stopped[index] = 0;
+	if (layout.frameBytes)
+		std::memcpy(Row(index) + layout.frameOffset, resetFrame.data(), VECENV_FRAME_BYTES);
+	Observe(index);
+}
+
+/* instance 0 runs from power on, drawing the last frame, and its state becomes every reset's */
+int VecEnv::TakeSnapshot()
+{
+	Emulator* first = instances[0].get();
+
+	if (layout.frameBytes)
+		std::memset(Row(0) + layout.frameOffset, config.pixels == VECENV_PIXELS_GRAY8 ? 0xFF : 0, VECENV_FRAME_BYTES);
+	for (u32 frame = 0; frame < config.resetFrames; frame++) {
+		first->SetOutputEnabled(frame + 1 == config.resetFrames);
+		if (first->RunFrame() != STT_SUCCESS)
+			return STT_FAILED;
+	}
+	first->SetOutputEnabled(true);
+	snapshotSize = first->SaveStateSize();
+	snapshot.resize((snapshotSize + sizeof(u64) - 1) / sizeof(u64));
+	if (!first->SaveState(reinterpret_cast<u8*>(snapshot.data()), snapshotSize))
+		return STT_FAILED;
+	if (layout.frameBytes)
+		std::memcpy(resetFrame.data(), Row(0) + layout.frameOffset, VECENV_FRAME_BYTES);
+	return STT_SUCCESS;
+}
+
+int VecEnv::Init()
+{
+	u32 count = static_cast<u32>(instances.size());
+
+	layout.observations = static_cast<u8*>(std::aligned_alloc(VECENV_ALIGN, layout.rowStride * count));
+	if (!layout.observations)
+		return STT_FAILED;
+	pool.Run(count, [this](u32 index, u32) { Create(index); });
+	for (u32 i = 0; i < count; i++) {
+		if (stopped[i])
+			return STT_FAILED;
+	}
+	if (TakeSnapshot() != STT_SUCCESS)
+		return STT_FAILED;
+	stepTask = [this](u32 index, u32) { Step(index); };
+	resetTask = [this](u32 index, u32) { Reset(index); };
+	return ResetSome(nullptr);
+}
+
+int VecEnv::StepAll(const u8* held)
+{
+	buttons = held;
+	pool.Run(static_cast<u32>(instances.size()), stepTask);
+	buttons = nullptr;
+	for (u8 instanceStopped : stopped) {
+		if (instanceStopped)
+			return STT_FAILED;
+	}
+	return STT_SUCCESS;
+}
+
+int VecEnv::ResetSome(const u8* mask)
+{
+	resetMask = mask;
+	pool.Run(static_cast<u32>(instances.size()), resetTask);
+	resetMask = nullptr;
+	return STT_SUCCESS;
+}
+
+VecEnv::VecEnv(const VecEnvConfig& pConfig) : config(pConfig),
+	ramAddresses(pConfig.ramAddresses, pConfig.ramAddresses + ((pConfig.observations & VECENV_OBS_RAM) ? pConfig.ramCount : 0)),
+	pool(pConfig.threads), instances(pConfig.instances), stopped(pConfig.instances, 0)
+{
+	config.frameSkip = std::max(config.frameSkip, 1U);
+	config.ramAddresses = nullptr;
+	layout.instances = config.instances;
+	layout.frameOffset = 0;
+	layout.frameBytes = (config.observations & VECENV_OBS_FRAME) ? VECENV_FRAME_BYTES : 0;
+	layout.ramOffset = layout.frameBytes;
+	layout.ramBytes = ramAddresses.size();
+	layout.rowStride = std::max<size_t>((layout.ramOffset + layout.ramBytes + VECENV_ALIGN - 1) & ~static_cast<size_t>(VECENV_ALIGN - 1), VECENV_ALIGN);
+}
+
+VecEnv::~VecEnv()
+{
+	/* the instances draw into the buffer, they go first */
+	instances.clear();
+	std::free(layout.observations);
+}
+
+VecEnv* vecenv_create(const VecEnvConfig* config)
+{
+	std::unique_ptr<VecEnv> env;
+
+	if (!config || !config->rom || !config->instances || config->pixels > VECENV_PIXELS_GRAY8
+		|| (config->observations & ~(VECENV_OBS_FRAME | VECENV_OBS_RAM))
+		|| ((config->observations & VECENV_OBS_RAM) && config->ramCount && !config->ramAddresses)) {
+		spdlog::error("The vector environment configuration is not valid.");
+		return nullptr;
+	}
+	env = std::make_unique<VecEnv>(*config);
+	if (env->Init() != STT_SUCCESS) {
+		spdlog::error("The vector environment could not start {}.", config->rom);
+		return nullptr;
+	}
+	return env.release();
+}
+
+void vecenv_destroy(VecEnv* env)
+{
+	delete env;
+}
+
+void vecenv_layout(const VecEnv* env, VecEnvLayout* layout)
+{
+	*layout = env->Layout();
+}
+
+int vecenv_step(VecEnv* env, const uint8_t* buttons)
+{
+	return env->StepAll(buttons);
+}
+
+int vecenv_reset(VecEnv* env, const uint8_t* mask)
+{
+	return env->ResetSome(mask);
+}
+
+const uint8_t* vecenv_stopped(const VecEnv* env)
+{
+	return env->Stopped();
+}
\ No newline at end of file
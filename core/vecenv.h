@@ -0,0 +1,83 @@
+#pragma once
+
+/*
+	C interface for stepping many emulators as one batch, for reinforcement learning. Every
+	instance runs the same cartridge. A step takes one byte of held buttons per instance,
+	runs frameSkip frames on all of them in parallel and leaves their observations in one
+	buffer: a row per instance, each VECENV_ALIGN-aligned and rowStride bytes apart, with
+	the frame and then the chosen RAM bytes. Frames are drawn straight into their rows.
+	Reset loads a snapshot taken once at creation, so a reset costs a state load, not a
+	boot. After vecenv_create() returns, steps and resets allocate nothing.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VECENV_SUCCESS			1
+#define VECENV_FAILED			0
+
+#define VECENV_ALIGN			64
+#define VECENV_FRAME_WIDTH		160
+#define VECENV_FRAME_HEIGHT		144
+
+#define VECENV_OBS_FRAME		(1U << 0)
+#define VECENV_OBS_RAM			(1U << 1)
+
+/* buttons, as held for a whole step */
+#define VECENV_BUTTON_A			(1U << 0)
+#define VECENV_BUTTON_B			(1U << 1)
+#define VECENV_BUTTON_SELECT	(1U << 2)
+#define VECENV_BUTTON_START		(1U << 3)
+#define VECENV_BUTTON_RIGHT		(1U << 4)
+#define VECENV_BUTTON_LEFT		(1U << 5)
+#define VECENV_BUTTON_UP		(1U << 6)
+#define VECENV_BUTTON_DOWN		(1U << 7)
+
+typedef enum {
+	VECENV_PIXELS_SHADES,		// 0 (white) to 3 (black)
+	VECENV_PIXELS_GRAY8,		// 0xFF (white) to 0x00 (black)
+} VecEnvPixels;
+
+typedef struct VecEnvConfig {
+	const char* rom;
+	uint32_t instances;
+	uint32_t threads;			// 0: one per hardware thread
+	uint32_t frameSkip;			// frames per step, only the last is drawn; 0 is taken as 1
+	uint32_t observations;		// VECENV_OBS_*
+	VecEnvPixels pixels;
+	const uint16_t* ramAddresses;	// read through the bus after each step, copied at creation
+	uint32_t ramCount;
+	uint32_t resetFrames;		// run from power on before the reset snapshot is taken
+} VecEnvConfig;
+
+/* where things are in the observation buffer, which lives as long as the VecEnv */
+typedef struct VecEnvLayout {
+	uint8_t* observations;
+	uint32_t instances;
+	size_t rowStride;			// a multiple of VECENV_ALIGN
+	size_t frameOffset;			// VECENV_FRAME_HEIGHT rows of VECENV_FRAME_WIDTH bytes
+	size_t frameBytes;			// 0 without VECENV_OBS_FRAME
+	size_t ramOffset;
+	size_t ramBytes;
+} VecEnvLayout;
+
+typedef struct VecEnv VecEnv;
+
+/* NULL if the configuration or the cartridge is bad; every instance starts reset */
+VecEnv* vecenv_create(const VecEnvConfig* config);
+void vecenv_destroy(VecEnv* env);
+void vecenv_layout(const VecEnv* env, VecEnvLayout* layout);
+/* buttons holds one VECENV_BUTTON_* mask per instance; VECENV_FAILED if any instance has stopped */
+int vecenv_step(VecEnv* env, const uint8_t* buttons);
+/* instances whose mask byte is not 0, or all of them with a NULL mask */
+int vecenv_reset(VecEnv* env, const uint8_t* mask);
+/* one byte per instance, not 0 once it hit an invalid opcode; it sits still until reset */
+const uint8_t* vecenv_stopped(const VecEnv* env);
+
+#ifdef __cplusplus
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "work_pool.h"
+#include <algorithm>
+
+static u64 PackBlock(u32 first, u32 end)
+{
+	return static_cast<u64>(end) << 32 | first;
+}
+
+/* the front of the worker's own block */
+bool WorkPool::TakeOwn(u32 index, u32& item)
+{
+	std::atomic<u64>& block = workers[index].block;
+	u64 current = block.load(std::memory_order_acquire);
+
+	for (;;) {
+		u32 first = static_cast<u32>(current), end = static_cast<u32>(current >> 32);
+
+		if (first >= end)
+			return false;
+		if (block.compare_exchange_weak(current, PackBlock(first + 1, end), std::memory_order_acq_rel)) {
+			item = first;
+			return true;
+		}
+	}
+}
+
+/* the back of someone else's, furthest from where its owner is working */
+bool WorkPool::Steal(u32 victim, u32& item)
+{
+	std::atomic<u64>& block = workers[victim].block;
+	u64 current = block.load(std::memory_order_acquire);
+
+	for (;;) {
+		u32 first = static_cast<u32>(current), end = static_cast<u32>(current >> 32);
+
+		if (first >= end)
+			return false;
+		if (block.compare_exchange_weak(current, PackBlock(first, end - 1), std::memory_order_acq_rel)) {
+			item = end - 1;
+			return true;
+		}
+	}
+}
+
+/* blocks only shrink during a round, so one pass over the others finds everything left */
+void WorkPool::Drain(u32 index)
+{
+	u32 count = static_cast<u32>(workers.size());
+	u32 item;
+
+	while (TakeOwn(index, item))
+		(*task)(item, index);
+	for (u32 i = 1; i < count; i++) {
+		while (Steal((index + i) % count, item)) {
+			(*task)(item, index);
+			workers[index].steals++;
+		}
+	}
+}
+
+void WorkPool::Work(u32 index)
+{
+	u32 seen = 0;
+
+	for (;;) {
+		u32 current = round.load(std::memory_order_acquire);
+
+		while (current == seen) {
+			round.wait(current, std::memory_order_acquire);
+			current = round.load(std::memory_order_acquire);
+		}
+		if (stopping.load(std::memory_order_acquire))
+			return;
+		seen = current;
+		Drain(index);
+		if (running.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			running.notify_one();
+	}
+}
+
+/*
+	Calls task(item, worker) for every item below count and returns once all of them have
+	finished. An item runs on one thread, but not always its home worker's; the worker
+	index is there for per-thread scratch. Only one round runs at a time.
+*/
+void WorkPool::Run(u32 count, const std::function<void(u32, u32)>& work)
+{
+	u32 workerCount = static_cast<u32>(workers.size());
+	u32 left;
+
+	for (u32 i = 0; i < workerCount; i++) {
+		u32 first = static_cast<u32>(static_cast<u64>(count) * i / workerCount);
+		u32 end = static_cast<u32>(static_cast<u64>(count) * (i + 1) / workerCount);
+
+		workers[i].block.store(PackBlock(first, end), std::memory_order_relaxed);
+	}
+	task = &work;
+	running.store(workerCount - 1, std::memory_order_relaxed);
+	round.fetch_add(1, std::memory_order_release);
+	round.notify_all();
+	Drain(0);
+	left = running.load(std::memory_order_acquire);
+	while (left) {
+		running.wait(left, std::memory_order_acquire);
+		left = running.load(std::memory_order_acquire);
+	}
+	task = nullptr;
+	stats.rounds++;
+	stats.items += count;
+}
+
+u32 WorkPool::Workers() const
+{
+	return static_cast<u32>(workers.size());
+}
+
+/* between rounds */
+WorkPoolStats WorkPool::Stats() const
+{
+	WorkPoolStats total = stats;
+
+	for (const Worker& worker : workers)
+		total.steals += worker.steals;
+	return total;
+}
+
+/* 0 workers is one per hardware thread */
+WorkPool::WorkPool(u32 count) : workers(count ? count : std::max(1U, std::thread::hardware_concurrency()))
+{
+	for (u32 i = 1; i < workers.size(); i++)
+		threads.emplace_back(&WorkPool::Work, this, i);
+}
+
+WorkPool::~WorkPool()
+{
+	stopping.store(true, std::memory_order_release);
+	round.fetch_add(1, std::memory_order_release);
+	round.notify_all();
+	for (std::thread& thread : threads)
+		thread.join();
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#define POOL_CACHE_LINE			64
+
+typedef struct WorkPoolStats {
+	u64 rounds;					// Run() calls
+	u64 items;
+	u64 steals;					// items run away from their home worker
+} WorkPoolStats;
+
+/*
+	Runs a round of items over a fixed set of workers, the calling thread being worker 0.
+	Every round gives each worker the same contiguous block of items, so item i comes back
+	to the same thread round after round and whatever it touches stays in that thread's
+	caches. A worker takes its own items from the front of its block; once it has run out
+	it steals from the back of the others', one item at a time, so a block that turns out
+	slow is shared out. A block is one u64, first and end item, that both its owner and
+	thieves take from with a compare and swap: an item is run exactly once with no lock.
+	Items are meant to be coarse, a frame or so each; for ones much shorter than waking a
+	thread, run fewer workers.
+*/
+class WorkPool {
+private:
+	typedef struct alignas(POOL_CACHE_LINE) Worker {
+		std::atomic<u64> block = 0;	// first item in the low half, end in the high half
+		u64 steals = 0;
+	} Worker;
+
+	std::vector<Worker> workers;
+	std::vector<std::thread> threads;
+	const std::function<void(u32, u32)>* task = nullptr;
+	alignas(POOL_CACHE_LINE) std::atomic<u32> round = 0;
+	std::atomic<u32> running = 0;	// helpers still in the round
+	std::atomic<bool> stopping = false;
+	WorkPoolStats stats = {};
+
+	bool TakeOwn(u32, u32&);
+	bool Steal(u32, u32&);
+	void Drain(u32);
+	void Work(u32);
+public:
+	void Run(u32, const std::function<void(u32, u32)>&);
+	u32 Workers() const;
+	WorkPoolStats Stats() const;
+	WorkPool(u32 = 0);
+	WorkPool(const WorkPool&) = delete;
+	WorkPool& operator=(const WorkPool&) = delete;
+	~WorkPool();
+};
\ No newline at end of file
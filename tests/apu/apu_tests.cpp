@@ -0,0 +1,229 @@
+#include <cstdlib>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <bus.h>
+#include <rom.h>
+#include <scheduler.h>
+#include <apu.h>
+
+/*
+	Checks the register read masks and power off, that length and sweep stop channels at
+	the frame sequencer step they should with and without synthesis, and then listens: a
+	1 kHz square has the right pitch and level and comes out the same however often it is
+	synced, a tone above the Nyquist frequency settles to a flat level, and neither that
+	tone nor the fastest noise costs more than a few band-limited steps per output sample.
+	Noise with its clock stopped is caught up without a step.
+*/
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			spdlog::error("{}:{}: {} failed", __FILE__, __LINE__, #cond); \
+			return EXIT_FAILURE; \
+		} \
+	} while (0)
+
+#define SECOND_T_CYCLES			APU_CLOCK_HZ
+#define FRAME_T_CYCLES			70224
+#define SETTLE_SAMPLES			4800			// the high-pass settles in well under 100 ms
+
+typedef struct Machine {
+	Rom rom;
+	Bus bus;
+	Scheduler scheduler;
+	Apu apu;
+	u64 now = 0;
+
+	Machine() : bus(&rom), apu(&bus, &scheduler)
+	{
+		scheduler.SetClock(&now);
+		bus.Write(REG_NR52, NR52_POWER);
+	}
+	/* runs for length T-cycles, syncing every interval, and keeps the left side */
+	std::vector<i16> Record(u64 length, u64 interval)
+	{
+		std::vector<i16> left;
+		std::array<i16, 2 * 4096> samples;
+		u64 end = now + length;
+
+		while (now < end) {
+			size_t count;
+
+			now = std::min(end, now + interval);
+			count = apu.ReadSamples(samples.data(), samples.size() / 2);
+			for (size_t i = 0; i < count; i++)
+				left.push_back(samples[i * 2]);
+		}
+		return left;
+	}
+	/* square 2 at frequency, 50% duty, full volume, both sides */
+	void PlaySquare(u16 frequency)
+	{
+		bus.Write(REG_NR50, 0x77);
+		bus.Write(REG_NR51, 0xFF);
+		bus.Write(REG_NR21, 0x80);
+		bus.Write(REG_NR22, 0xF0);
+		bus.Write(REG_NR23, frequency & 0xFF);
+		bus.Write(REG_NR24, NRX4_TRIGGER | (frequency >> 8));
+	}
+} Machine;
+
+int TestRegisters()
+{
+	Machine m;
+
+	CHECK(m.bus.Read(REG_NR52) == 0xF0);
+	m.bus.Write(REG_NR21, 0x80);
+	CHECK(m.bus.Read(REG_NR21) == 0xBF);
+	CHECK(m.bus.Read(REG_NR23) == 0xFF);
+	CHECK(m.bus.Read(REG_NR10) == 0x80);
+	m.bus.Write(REG_NR50, 0x35);
+	m.bus.Write(REG_NR52, 0);
+	CHECK(m.bus.Read(REG_NR52) == 0x70);
+	CHECK(m.bus.Read(REG_NR50) == 0);
+	CHECK(m.bus.Read(REG_NR21) == 0x3F);
+	m.bus.Write(REG_NR50, 0x35);
+	CHECK(m.bus.Read(REG_NR50) == 0);
+	m.bus.Write(REG_WAVE_RAM + 3, 0xA5);
+	CHECK(m.bus.Read(REG_WAVE_RAM + 3) == 0xA5);
+	CHECK(m.bus.Read(0xFF27) == 0xFF);
+	return 0;
+}
+
+/* the sequencer clocks length at 1, 3, 5... x 8192 T-cycles from power on, and sweep at 3, 7... */
+int TestLengthAndSweep(bool headless)
+{
+	Machine m;
+
+	m.apu.SetHeadless(headless);
+	m.bus.Write(REG_NR22, 0xF0);
+	m.bus.Write(REG_NR21, 0x3F);
+	m.bus.Write(REG_NR24, NRX4_TRIGGER | NRX4_LENGTH_ENABLE);
+	m.bus.Write(REG_NR30, 0x80);
+	m.bus.Write(REG_NR31, 0xFD);
+	m.bus.Write(REG_NR34, NRX4_TRIGGER | NRX4_LENGTH_ENABLE);
+	m.bus.Write(REG_NR10, 0x11);
+	m.bus.Write(REG_NR12, 0xF0);
+	m.bus.Write(REG_NR13, 0x00);
+	m.bus.Write(REG_NR14, NRX4_TRIGGER | 0x04);
+	CHECK((m.bus.Read(REG_NR52) & 0x0F) == 0x07);
+	m.now = APU_SEQUENCER_T_CYCLES - 1;
+	CHECK((m.bus.Read(REG_NR52) & 0x0F) == 0x07);
+	m.now = APU_SEQUENCER_T_CYCLES;
+	CHECK((m.bus.Read(REG_NR52) & 0x0F) == 0x05);
+	/* 0x400 sweeps to 0x600, whose next step would be past 2047 */
+	m.now = 3 * APU_SEQUENCER_T_CYCLES - 1;
+	CHECK((m.bus.Read(REG_NR52) & 0x0F) == 0x05);
+	m.now = 3 * APU_SEQUENCER_T_CYCLES;
+	CHECK((m.bus.Read(REG_NR52) & 0x0F) == 0x04);
+	/* a long way on in one go */
+	m.now = 5 * APU_SEQUENCER_T_CYCLES - 1;
+	CHECK((m.bus.Read(REG_NR52) & 0x0F) == 0x04);
+	m.now = 100 * APU_SEQUENCER_T_CYCLES;
+	CHECK((m.bus.Read(REG_NR52) & 0x0F) == 0x00);
+	/* overflow on the trigger itself */
+	m.bus.Write(REG_NR10, 0x01);
+	m.bus.Write(REG_NR13, 0xFF);
+	m.bus.Write(REG_NR14, NRX4_TRIGGER | 0x07);
+	CHECK((m.bus.Read(REG_NR52) & 0x0F) == 0x00);
+	if (headless) {
+		CHECK(m.apu.ReadSamples(nullptr, 0) == 0);
+		CHECK(m.apu.GetStats().steps == 0 && m.apu.GetStats().deltas == 0);
+	}
+	return 0;
+}
+
+/* 131072 / (2048 - 1920) = 1024 Hz */
+int TestTone()
+{
+	Machine frames, often;
+	std::vector<i16> left, reference;
+	u32 crossings = 0;
+	i16 peak = 0;
+
+	frames.PlaySquare(1920);
+	often.PlaySquare(1920);
+	left = frames.Record(SECOND_T_CYCLES, FRAME_T_CYCLES);
+	reference = often.Record(SECOND_T_CYCLES, 997);
+	CHECK(left.size() == APU_DEFAULT_SAMPLE_RATE);
+	CHECK(left == reference);
+	for (size_t i = SETTLE_SAMPLES; i < left.size(); i++) {
+		crossings += (left[i] < 0) != (left[i - 1] < 0);
+		peak = std::max<i16>(peak, std::abs(left[i]));
+	}
+	CHECK(std::abs(static_cast<int>(crossings) - 2 * 1024 * (APU_DEFAULT_SAMPLE_RATE - SETTLE_SAMPLES) / APU_DEFAULT_SAMPLE_RATE) <= 4);
+	CHECK(peak > 7000 && peak < 10000);
+	CHECK(frames.apu.GetStats().deltas <= 2 * 2 * 1024 + 16);
+	return 0;
+}
+
+/* 131072 Hz: only the average is left, and it costs nothing after the trigger */
+int TestUltrasonic()
+{
+	Machine m;
+	std::vector<i16> left;
+
+	m.PlaySquare(2047);
+	left = m.Record(SECOND_T_CYCLES, FRAME_T_CYCLES);
+	for (size_t i = SETTLE_SAMPLES; i < left.size(); i++)
+		CHECK(std::abs(left[i] - left[i - 1]) <= 2);
+	CHECK(m.apu.GetStats().deltas <= 4);
+	CHECK(m.apu.GetStats().steps == SECOND_T_CYCLES / 4 - 1);
+	return 0;
+}
+
+/* noise clocked at 524288 Hz: every step is taken, but at most one per side reaches the buffer per sample */
+int TestNoiseCost()
+{
+	Machine m;
+	std::vector<i16> left;
+	bool varies = false;
+
+	m.bus.Write(REG_NR50, 0x77);
+	m.bus.Write(REG_NR51, 0xFF);
+	m.bus.Write(REG_NR42, 0xF0);
+	m.bus.Write(REG_NR43, 0x00);
+	m.bus.Write(REG_NR44, NRX4_TRIGGER);
+	left = m.Record(SECOND_T_CYCLES, FRAME_T_CYCLES);
+	for (size_t i = SETTLE_SAMPLES; i < left.size(); i++)
+		varies |= left[i] != left[i - 1];
+	CHECK(varies);
+	CHECK(m.apu.GetStats().steps == SECOND_T_CYCLES / 8 - 1);
+	CHECK(m.apu.GetStats().deltas <= 2 * (APU_DEFAULT_SAMPLE_RATE + 16));
+	return 0;
+}
+
+/* clock shifts 14 and 15 stop the noise: idle or triggered, catching up takes no step */
+int TestStoppedNoise()
+{
+	Machine m;
+	std::array<i16, 2 * 64> samples;
+	std::vector<i16> left;
+
+	m.bus.Write(REG_NR43, 0xF0);
+	m.now += 1000;
+	m.apu.ReadSamples(samples.data(), samples.size() / 2);
+	m.bus.Write(REG_NR50, 0x77);
+	m.bus.Write(REG_NR51, 0xFF);
+	m.bus.Write(REG_NR42, 0xF0);
+	m.bus.Write(REG_NR43, 0xE7);
+	m.bus.Write(REG_NR44, NRX4_TRIGGER);
+	left = m.Record(SECOND_T_CYCLES / 4, FRAME_T_CYCLES);
+	CHECK(m.bus.Read(REG_NR52) & 0x08);
+	CHECK(m.apu.GetStats().steps == 0);
+	for (size_t i = SETTLE_SAMPLES; i < left.size(); i++)
+		CHECK(std::abs(left[i] - left[i - 1]) <= 2);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (TestRegisters() || TestLengthAndSweep(false) || TestLengthAndSweep(true) || TestTone() || TestUltrasonic() || TestNoiseCost()
+		|| TestStoppedNoise())
+		return EXIT_FAILURE;
+	spdlog::info("APU test passed");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <emulator.h>
+#include <audio_output.h>
+#include <test_cartridge.h>
+
+/*
+	Passes numbered frames through the ring between two threads. Then plays a cartridge
+	holding a tone on a simulated 60 Hz host into a 48 kHz device, which the emulator's
+	59.73 Hz frames never match: with rate control the fill settles near the target with
+	no under- or overrun and under 40 ms of latency, without it the ring runs over. Last,
+	the .wav sink writes a file of the right size and the audio thread plays in real time.
+*/
+
+#define RING_TEST_FRAMES		200000
+#define SAMPLE_RATE				48000
+#define HOST_RATE				60
+#define HOST_FRAMES				(HOST_RATE * 16)
+#define SETTLED_FRAMES			(HOST_RATE * 8)		// the second half is checked
+#define MAX_LATENCY_MS			40
+
+/*
+	0150: LD A, 80 / LDH (26), A / LD A, 77 / LDH (24), A / LD A, FF / LDH (25), A
+	015C: LD A, 80 / LDH (16), A / LD A, F0 / LDH (17), A / LD A, D6 / LDH (18), A
+	0168: LD A, 86 / LDH (19), A / JR 016C						square 2 at 440 Hz
+*/
+static const std::vector<u8> program = {
+	0x3E, 0x80, 0xE0, 0x26, 0x3E, 0x77, 0xE0, 0x24, 0x3E, 0xFF, 0xE0, 0x25,
+	0x3E, 0x80, 0xE0, 0x16, 0x3E, 0xF0, 0xE0, 0x17, 0x3E, 0xD6, 0xE0, 0x18,
+	0x3E, 0x86, 0xE0, 0x19, 0x18, 0xFE,
+};
+
+/* frame n is (n, ~n) in 16 bits; odd chunk sizes on both sides keep the wrap moving */
+int TestRing()
+{
+	AudioRing ring(1000);
+	std::thread producer([&ring] {
+		std::array<i16, 2 * 97> chunk;
+		u32 next = 0;
+
+		while (next < RING_TEST_FRAMES) {
+			size_t count = std::min<size_t>(97, RING_TEST_FRAMES - next);
+
+			for (size_t i = 0; i < count; i++) {
+				chunk[i * 2] = static_cast<i16>(next + i);
+				chunk[i * 2 + 1] = static_cast<i16>(~(next + i));
+			}
+			for (size_t done = 0; done < count; )
+				done += ring.Write(chunk.data() + done * 2, count - done);
+			next += count;
+		}
+	});
+	std::array<i16, 2 * 61> chunk;
+	u32 expected = 0;
+	bool ordered = true;
+
+	while (expected < RING_TEST_FRAMES) {
+		size_t count = ring.Read(chunk.data(), 61);
+
+		for (size_t i = 0; i < count; i++, expected++)
+			ordered &= chunk[i * 2] == static_cast<i16>(expected) && chunk[i * 2 + 1] == static_cast<i16>(~expected);
+	}
+	producer.join();
+	CHECK(ring.Capacity() == 1024);
+	CHECK(ordered);
+	CHECK(ring.Fill() == 0);
+	return 0;
+}
+
+/*
+	Host frames come every SAMPLE_RATE / HOST_RATE device frames and the device pulls a
+	period at a time, in the order the two clocks put them, with no real time involved.
+*/
+int RunHost(const char* romPath, double maxRateDelta, AudioStats& stats, double& maxLatencyMs, u64& settledGlitches)
+{
+	Emulator emulator;
+	NullAudioSink sink(SAMPLE_RATE);
+	AudioOutput output(&emulator, &sink, AUDIO_DEFAULT_LATENCY_MS, maxRateDelta);
+	std::vector<i16> period(sink.PeriodFrames() * 2);
+	u64 hostFrame = 0, devicePeriod = 0, glitches = 0;
+
+	CHECK(emulator.Load(romPath) == STT_SUCCESS);
+	emulator.SetAudioEnabled(true);
+	maxLatencyMs = 0;
+	while (hostFrame < HOST_FRAMES) {
+		if (hostFrame * (SAMPLE_RATE / HOST_RATE) <= devicePeriod * sink.PeriodFrames()) {
+			CHECK(emulator.RunFrame() == STT_SUCCESS);
+			output.Produce();
+			stats = output.Stats();
+			if (++hostFrame == SETTLED_FRAMES)
+				glitches = stats.underrunFrames + stats.overrunFrames;
+			if (hostFrame > SETTLED_FRAMES)
+				maxLatencyMs = std::max(maxLatencyMs, stats.latencyMs);
+		} else {
+			output.Pull(period.data(), sink.PeriodFrames());
+			devicePeriod++;
+		}
+	}
+	settledGlitches = stats.underrunFrames + stats.overrunFrames - glitches;
+	return 0;
+}
+
+int TestRateControl(const char* romPath)
+{
+	AudioStats stats, fixed;
+	double maxLatencyMs, fixedLatencyMs;
+	u64 glitches, fixedGlitches;
+
+	CHECK(!RunHost(romPath, AUDIO_MAX_RATE_DELTA, stats, maxLatencyMs, glitches));
+	CHECK(!glitches);
+	CHECK(maxLatencyMs < MAX_LATENCY_MS);
+	CHECK(stats.ratio < 1.0 && stats.ratio >= 1.0 - AUDIO_MAX_RATE_DELTA);
+	CHECK(stats.fill > SAMPLE_RATE * AUDIO_DEFAULT_LATENCY_MS / 1000 / 2);
+	CHECK(!RunHost(romPath, 0, fixed, fixedLatencyMs, fixedGlitches));
+	CHECK(fixedGlitches > 0);
+	spdlog::info("Rate control: {:.1f} ms at most once settled, ratio {:.5f}; without it {} frames dropped",
+		maxLatencyMs, stats.ratio, fixedGlitches);
+	return 0;
+}
+
+/* the audio thread keeps to real time whatever the emulation thread does; the file gets every frame played */
+int TestSinks(const char* romPath)
+{
+	std::filesystem::path wavPath = std::filesystem::temp_directory_path() / "usagbi_audio_output_test.wav";
+	Emulator emulator;
+	u64 frames;
+
+	CHECK(emulator.Load(romPath) == STT_SUCCESS);
+	emulator.SetAudioEnabled(true);
+	{
+		WavFileSink sink(wavPath.string().c_str(), SAMPLE_RATE);
+		AudioOutput output(&emulator, &sink);
+		auto start = std::chrono::steady_clock::now();
+
+		CHECK(sink.IsOpen());
+		output.Start();
+		for (int i = 0; i < HOST_RATE / 4; i++) {
+			CHECK(emulator.RunFrame() == STT_SUCCESS);
+			output.Produce();
+			std::this_thread::sleep_until(start + std::chrono::microseconds(1000000 * (i + 1) / HOST_RATE));
+		}
+		output.Stop();
+		frames = sink.Frames();
+		CHECK(frames % sink.PeriodFrames() == 0);
+		CHECK(frames > SAMPLE_RATE / 8 && frames < SAMPLE_RATE / 2);
+		CHECK(output.Stats().played > 0);
+	}
+	CHECK(std::filesystem::file_size(wavPath) == 44 + frames * 4);
+	std::filesystem::remove(wavPath);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	std::filesystem::path romPath = WriteProgramCartridge("usagbi_audio_output_test.gb", program);
+	int failed = TestRing() || TestRateControl(romPath.string().c_str()) || TestSinks(romPath.string().c_str());
+
+	std::filesystem::remove(romPath);
+	if (failed)
+		return EXIT_FAILURE;
+	spdlog::info("Audio output test passed");
+	return 0;
+}
\ No newline at end of file
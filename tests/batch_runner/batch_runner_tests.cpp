@@ -0,0 +1,129 @@
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <emulator.h>
+#include <batch_runner.h>
+#include <test_cartridge.h>
+
+/*
+	Runs rounds through the work pool and checks that every item ran once a round and that
+	a slow block is stolen from. Then runs a batch of instances in quanta that do not divide
+	the frame count, and checks each one ends in exactly the state of the same cartridge
+	run on its own; a missing ROM fails only its own instances.
+*/
+
+#define POOL_WORKERS			4
+#define POOL_ITEMS				1000
+#define POOL_ROUNDS				20
+#define BATCH_INSTANCES			6
+#define BATCH_FRAMES			20
+#define BATCH_QUANTUM			3
+
+/*
+	0150: LD HL, C000
+	0153: INC (HL) / LD A, (HL) / ADD A, B / LD B, A / JR 0153		a sum the frames must agree on
+*/
+static const std::vector<u8> program = {
+	0x21, 0x00, 0xC0,
+	0x34, 0x7E, 0x80, 0x47, 0x18, 0xFA,
+};
+
+int TestPool()
+{
+	WorkPool pool(POOL_WORKERS);
+	std::vector<std::atomic<u32>> runs(POOL_ITEMS);
+	std::vector<u32> ranOn(POOL_ITEMS);
+	u32 away = 0;
+
+	CHECK(pool.Workers() == POOL_WORKERS);
+	for (u32 round = 0; round < POOL_ROUNDS; round++)
+		pool.Run(POOL_ITEMS, [&runs](u32 item, u32) { runs[item].fetch_add(1, std::memory_order_relaxed); });
+	for (u32 item = 0; item < POOL_ITEMS; item++)
+		CHECK(runs[item].load() == POOL_ROUNDS);
+	CHECK(pool.Stats().rounds == POOL_ROUNDS);
+	CHECK(pool.Stats().items == POOL_ROUNDS * POOL_ITEMS);
+
+	/* worker 0's block sleeps, the others' cost nothing: they finish and help */
+	pool.Run(POOL_ITEMS / 10, [&ranOn](u32 item, u32 worker) {
+		if (item < POOL_ITEMS / 10 / POOL_WORKERS)
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		ranOn[item] = worker;
+	});
+	for (u32 item = 0; item < POOL_ITEMS / 10 / POOL_WORKERS; item++)
+		away += ranOn[item] != 0;
+	CHECK(away > 0);
+	CHECK(pool.Stats().steals >= away);
+	pool.Run(0, [](u32, u32) {});
+	return 0;
+}
+
+/* every instance against one run alone, byte for byte, and a second Run() carries on */
+int TestBatch(const char* romPath)
+{
+	BatchConfig config;
+	BatchReport report;
+	std::vector<u8> reference, state;
+
+	config.roms = { romPath, "usagbi_batch_runner_missing.gb" };
+	config.instances = BATCH_INSTANCES;
+	config.frames = BATCH_FRAMES;
+	config.threads = 3;
+	config.quantumFrames = BATCH_QUANTUM;
+
+	BatchRunner runner(config);
+
+	report = runner.Run();
+	CHECK(report.instances == BATCH_INSTANCES);
+	CHECK(report.threads == 3);
+	CHECK(report.failed == BATCH_INSTANCES / 2);
+	CHECK(report.frames == BATCH_INSTANCES / 2 * BATCH_FRAMES);
+	CHECK(report.pool.rounds == (BATCH_FRAMES + BATCH_QUANTUM - 1) / BATCH_QUANTUM);
+	CHECK(report.framesPerSecond > 0);
+	CHECK(report.p50Us > 0 && report.p50Us <= report.p90Us && report.p90Us <= report.p99Us && report.p99Us <= report.maxUs);
+	CHECK(report.slowestInstance % 2 == 0);
+
+	/* made after the batch, whose workers created the first emulators in the process together */
+	Emulator alone;
+
+	CHECK(alone.Load(romPath) == STT_SUCCESS);
+	alone.SetRenderMode(RENDER_NONE);
+	alone.SetAudioEnabled(false);
+	for (u32 i = 0; i < BATCH_FRAMES; i++)
+		CHECK(alone.RunFrame() == STT_SUCCESS);
+	reference.resize(alone.SaveStateSize());
+	CHECK(alone.SaveState(reference.data(), reference.size()));
+	for (u32 i = 0; i < BATCH_INSTANCES; i += 2) {
+		Emulator* instance = runner.Instance(i);
+
+		CHECK(!report.perInstance[i].failed && report.perInstance[i].frames == BATCH_FRAMES);
+		CHECK(report.perInstance[i + 1].failed && !report.perInstance[i + 1].frames);
+		state.assign(instance->SaveStateSize(), 0);
+		CHECK(instance->SaveState(state.data(), state.size()));
+		CHECK(state == reference);
+	}
+
+	report = runner.Run();
+	CHECK(report.frames == BATCH_INSTANCES / 2 * BATCH_FRAMES);
+	CHECK(runner.Instance(0)->GetFrameCount() == 2 * BATCH_FRAMES);
+	spdlog::info("Batch: {:.0f} frames/s, p50 {:.0f} us, p99 {:.0f} us, {} quanta stolen",
+		report.framesPerSecond, report.p50Us, report.p99Us, report.pool.steals);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	std::filesystem::path romPath = WriteProgramCartridge("usagbi_batch_runner_test.gb", program);
+	int failed = TestPool() || TestBatch(romPath.string().c_str());
+
+	std::filesystem::remove(romPath);
+	if (failed)
+		return EXIT_FAILURE;
+	spdlog::info("Batch runner test passed");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include <chrono>
+#include <random>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <cpu.h>
+#include <common.h>
+#include <bus.h>
+
+/*
+	Measures instructions per second of the opcode dispatchers on a 64 KiB program made of
+	register-only instructions, so execution wraps around the address space forever without
+	ever writing memory or leaving the instruction stream.
+*/
+
+#define DEFAULT_INSTRUCTIONS		50000000ULL
+
+static const std::vector<u8> mainOps = {
+	0x00, 0x03, 0x04, 0x05, 0x07, 0x09, 0x0B, 0x0C, 0x0D, 0x0F,
+	0x13, 0x14, 0x15, 0x17, 0x19, 0x1B, 0x1C, 0x1D, 0x1F,
+	0x23, 0x24, 0x25, 0x27, 0x29, 0x2B, 0x2C, 0x2D, 0x2F,
+	0x33, 0x37, 0x39, 0x3B, 0x3C, 0x3D, 0x3F,
+};
+
+void FillProgram(Bus& bus)
+{
+	std::mt19937 rng(0xC0FFEE);
+	std::vector<u8> ops = mainOps;
+
+	for (int op = 0x40; op <= 0xBF; op++) {
+		if ((op & 0x07) != 0x06 && op != 0x76 && !IN_RANGE(op, 0x70, 0x77))
+			ops.push_back(op);
+	}
+	for (u32 addr = 0; addr < 0x10000;) {
+		/* one in eight instructions is a CB-prefixed register op */
+		if ((rng() & 0x07) == 0 && addr < 0xFFFF) {
+			u8 cbOp;
+
+			do {
+				cbOp = rng() & 0xFF;
+			} while ((cbOp & 0x07) == 0x06);
+			bus.Write(addr++, 0xCB);
+			bus.Write(addr++, cbOp);
+		} else {
+			bus.Write(addr++, ops[rng() % ops.size()]);
+		}
+	}
+}
+
+void ResetCpu(Cpu& cpu)
+{
+	CpuState state;
+
+	state.PC = 0x0000;
+	state.SP = 0xFFFE;
+	state.BC = state.DE = state.HL = 0;
+	state.AF.val = 0;
+	cpu.SetCpuState(state);
+}
+
+template<typename Fn>
+void Measure(const char* name, u64 instructions, Fn&& run)
+{
+	auto start = std::chrono::steady_clock::now();
+	u64 cycles = run();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	spdlog::info("{:<10} {:>8.2f} M instr/s  ({} M-cycles in {:.3f} s)", name,
+		instructions / elapsed.count() / 1e6, cycles, elapsed.count());
+}
+
+int main(int argc, char* argv[])
+{
+	u64 instructions = (argc > 1) ? std::stoull(argv[1]) : DEFAULT_INSTRUCTIONS;
+	Bus bus;
+	Cpu cpu(&bus);
+
+	FillProgram(bus);
+
+	ResetCpu(cpu);
+	Measure("switch", instructions, [&] {
+		u64 cycles = 0;
+		for (u64 i = 0; i < instructions; i++)
+			cycles += cpu.StepSwitch();
+		return cycles;
+	});
+
+	ResetCpu(cpu);
+	Measure("table", instructions, [&] {
+		u64 cycles = 0;
+		for (u64 i = 0; i < instructions; i++)
+			cycles += cpu.Step();
+		return cycles;
+	});
+
+	ResetCpu(cpu);
+	cpu.SetBlockCacheEnabled(false);
+	Measure("threaded", instructions, [&] {
+		return cpu.RunInstructions(instructions);
+	});
+
+	ResetCpu(cpu);
+	cpu.SetBlockCacheEnabled(true);
+	Measure("blocks", instructions, [&] {
+		return cpu.RunInstructions(instructions);
+	});
+
+	const BlockCacheStats& stats = cpu.GetBlockCacheStats();
+	spdlog::info("block cache: {} lookups, {:.2f}% hits, {} blocks built", stats.lookups,
+		stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0, stats.builds);
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include <chrono>
+#include <random>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <pixel_kernels.h>
+
+/*
+	Measures the pixel kernels of every instruction set the CPU has on their own, on frame
+	sized buffers: all 384 tiles of VRAM for decoding and a 160x144 frame for the rest.
+	Results are in M pixels/s, so the rows can be compared with each other.
+*/
+
+#define DEFAULT_FRAMES				20000ULL
+#define FRAME_PIXELS				(160 * 144)
+#define VRAM_TILES					384
+
+template<typename Fn>
+void Measure(const char* isa, const char* kernel, u64 pixels, Fn&& run)
+{
+	auto start = std::chrono::steady_clock::now();
+	run();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	spdlog::info("{:<7} {:<11} {:>9.1f} M pixels/s", isa, kernel, pixels / elapsed.count() / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+	u64 frames = (argc > 1) ? std::stoull(argv[1]) : DEFAULT_FRAMES;
+	std::mt19937 rng(0xF00D);
+	std::vector<u8> vram(VRAM_TILES * TILE_BYTES), tiles(VRAM_TILES * TILE_PIXELS), frame(FRAME_PIXELS), shades(FRAME_PIXELS), gray(FRAME_PIXELS);
+	std::vector<u32> rgba(FRAME_PIXELS);
+	std::vector<u16> rgb565(FRAME_PIXELS);
+	const u8 grayColors[4] = { 0xFF, 0xAA, 0x55, 0x00 };
+	const u32 rgbaColors[4] = { 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 };
+	const u16 rgb565Colors[4] = { 0xFFFF, 0xAD55, 0x52AA, 0x0000 };
+
+	for (u8& byte : vram)
+		byte = rng();
+	for (u8& index : frame)
+		index = rng() & 3;
+	for (int isa = PIXEL_ISA_SCALAR; isa < PIXEL_ISA_COUNT; isa++) {
+		const PixelKernels& kernels = GetPixelKernels(static_cast<PixelIsa>(isa));
+
+		if (kernels.isa != isa)
+			continue;
+		Measure(kernels.name, "decode", frames * VRAM_TILES * TILE_PIXELS, [&] {
+			for (u64 i = 0; i < frames; i++)
+				kernels.decodeTiles(vram.data(), tiles.data(), VRAM_TILES);
+		});
+		Measure(kernels.name, "palette", frames * FRAME_PIXELS, [&] {
+			for (u64 i = 0; i < frames; i++)
+				kernels.mapPalette(frame.data(), shades.data(), FRAME_PIXELS, (u8)(0xE4 + i));
+		});
+		Measure(kernels.name, "gray8", frames * FRAME_PIXELS, [&] {
+			for (u64 i = 0; i < frames; i++)
+				kernels.toGray8(shades.data(), gray.data(), FRAME_PIXELS, grayColors);
+		});
+		Measure(kernels.name, "rgba8888", frames * FRAME_PIXELS, [&] {
+			for (u64 i = 0; i < frames; i++)
+				kernels.toRgba8888(shades.data(), rgba.data(), FRAME_PIXELS, rgbaColors);
+		});
+		Measure(kernels.name, "rgb565", frames * FRAME_PIXELS, [&] {
+			for (u64 i = 0; i < frames; i++)
+				kernels.toRgb565(shades.data(), rgb565.data(), FRAME_PIXELS, rgb565Colors);
+		});
+	}
+	/* keeps the stores from being thrown away */
+	spdlog::info("checksum {}", tiles[rng() % tiles.size()] + shades[rng() % shades.size()] + gray[rng() % gray.size()] + rgba[rng() % rgba.size()] + rgb565[rng() % rgb565.size()]);
+	return 0;
+}
\ No newline at end of file
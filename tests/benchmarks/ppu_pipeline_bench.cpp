@@ -0,0 +1,113 @@
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <emulator.h>
+#include <test_cartridge.h>
+
+/*
+	Times whole frames with lines drawn on the emulating thread and on the render thread,
+	after the boot ROM has handed over. Besides wall time, the CPU time of the emulating
+	thread and of the rest of the process is taken: on two cores a pipelined frame takes
+	about the larger of the two, which is what the last row projects on hosts with one.
+*/
+
+#define DEFAULT_FRAMES				3000ULL
+#define BOOT_FRAMES					340
+
+/* LCDC F3: BG, window at WY 40 / WX 07 and sprites on; the program that follows is appended */
+static const std::vector<u8> lcdSetup = {
+	0x3E, 0xF3, 0xE0, 0x40, 0x3E, 0x40, 0xE0, 0x4A, 0x3E, 0x07, 0xE0, 0x4B,
+};
+
+/* 015C: JR 015C, nothing changes and the idle loop is skipped: all the frame is drawing */
+static const std::vector<u8> idleProgram = { 0x18, 0xFE };
+
+/*
+	015C: LD HL, 8000 / INC (HL) / INC HL / LD A, H / CP A0 / JR NZ, 015F
+	0166: LD HL, FE00 / INC (HL) / INC L / LD A, L / CP A0 / JR NZ, 0169 / JR 015C
+	every VRAM and OAM byte changes all the time, the most the write log ever carries
+*/
+static const std::vector<u8> writeProgram = {
+	0x21, 0x00, 0x80, 0x34, 0x23, 0x7C, 0xFE, 0xA0, 0x20, 0xF9,
+	0x21, 0x00, 0xFE, 0x34, 0x2C, 0x7D, 0xFE, 0xA0, 0x20, 0xF9, 0x18, 0xEA,
+};
+
+typedef struct FrameTimes {
+	double wall;					// ms per frame
+	double emulation;				// CPU ms per frame of the thread calling RunFrame()
+	double others;					// CPU ms per frame of every other thread
+} FrameTimes;
+
+double CpuMilliseconds(clockid_t clock)
+{
+	timespec now;
+
+	clock_gettime(clock, &now);
+	return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+int Measure(const std::string& romPath, bool pipelined, u64 frames, FrameTimes& times)
+{
+	Emulator emu;
+	double thread, process;
+
+	if (emu.Load(romPath.c_str()) != STT_SUCCESS)
+		return STT_FAILED;
+	emu.SetAudioEnabled(false);
+	emu.SetVideoPipelined(pipelined);
+	for (u32 frame = 0; frame < BOOT_FRAMES; frame++)
+		emu.RunFrame();
+	emu.SyncVideo();
+
+	auto start = std::chrono::steady_clock::now();
+	thread = CpuMilliseconds(CLOCK_THREAD_CPUTIME_ID);
+	process = CpuMilliseconds(CLOCK_PROCESS_CPUTIME_ID);
+	for (u64 frame = 0; frame < frames; frame++)
+		emu.RunFrame();
+	emu.SyncVideo();
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	thread = CpuMilliseconds(CLOCK_THREAD_CPUTIME_ID) - thread;
+	process = CpuMilliseconds(CLOCK_PROCESS_CPUTIME_ID) - process;
+
+	times.wall = elapsed.count() / frames;
+	times.emulation = thread / frames;
+	times.others = (process - thread) / frames;
+	return STT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+	u64 frames = (argc > 1) ? std::stoull(argv[1]) : DEFAULT_FRAMES;
+	const std::pair<const char*, const std::vector<u8>*> workloads[] = {
+		{ "idle", &idleProgram }, { "writes", &writeProgram },
+	};
+
+	for (auto& [name, body] : workloads) {
+		std::vector<u8> program = lcdSetup;
+		FrameTimes synchronous, pipelined;
+
+		program.insert(program.end(), body->begin(), body->end());
+		std::filesystem::path romPath = WriteProgramCartridge(fmt::format("usagbi_ppu_pipeline_bench_{}.gb", name), program);
+		int status = Measure(romPath.string(), false, frames, synchronous);
+
+		if (status == STT_SUCCESS)
+			status = Measure(romPath.string(), true, frames, pipelined);
+		std::filesystem::remove(romPath);
+		if (status != STT_SUCCESS) {
+			spdlog::error("Could not load the {} cartridge.", name);
+			return EXIT_FAILURE;
+		}
+		spdlog::info("{:<6} synchronous  {:.4f} ms/frame, {:.4f} ms emulating", name, synchronous.wall, synchronous.emulation);
+		spdlog::info("{:<6} pipelined    {:.4f} ms/frame, {:.4f} ms emulating, {:.4f} ms on other threads",
+			name, pipelined.wall, pipelined.emulation, pipelined.others);
+		spdlog::info("{:<6} two cores    {:.4f} ms/frame projected, {:.2f}x", name, std::max(pipelined.emulation, pipelined.others),
+			synchronous.wall / std::max(pipelined.emulation, pipelined.others));
+	}
+	return 0;
+}
\ No newline at end of file
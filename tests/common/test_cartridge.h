@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <mbc.h>
+
+/*
+	What the tests that run generated cartridges share: a CHECK that logs the failed
+	condition and fails the test function, a header the boot ROM accepts, and the
+	cartridges more than one test runs.
+*/
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			spdlog::error("{}:{}: {} failed", __FILE__, __LINE__, #cond); \
+			return EXIT_FAILURE; \
+		} \
+	} while (0)
+
+#define CART_ENTRY				0x0100
+#define CART_PROGRAM			0x0150
+
+static const std::array<u8, 48> nintendoLogo = {
+	0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B,
+	0x03, 0x73, 0x00, 0x83, 0x00, 0x0C, 0x00, 0x0D,
+	0x00, 0x08, 0x11, 0x1F, 0x88, 0x89, 0x00, 0x0E,
+	0xDC, 0xCC, 0x6E, 0xE6, 0xDD, 0xDD, 0xD9, 0x99,
+	0xBB, 0xBB, 0x67, 0x63, 0x6E, 0x0E, 0xEC, 0xCC,
+	0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E
+};
+
+/*
+	0150: LD A, 0x0A / LD (0x0000), A / LD HL, 0xC000 / LD DE, 0xA000
+	015B: LD A, B / ADD A, (HL) / LD (HL+), A / LD (DE), A / INC DE / INC B / LD (0x2000), A
+	      LD A, H / CP 0xE0 / JR NZ, 015B / LD HL, 0xC000
+	      LD A, D / CP 0xC0 / JR NZ, 015B / LD DE, 0xA000 / JR 015B
+*/
+static const std::vector<u8> bankingProgram = {
+	0x3E, 0x0A, 0xEA, 0x00, 0x00, 0x21, 0x00, 0xC0, 0x11, 0x00, 0xA0,
+	0x78, 0x86, 0x22, 0x12, 0x13, 0x04, 0xEA, 0x00, 0x20,
+	0x7C, 0xFE, 0xE0, 0x20, 0xF2, 0x21, 0x00, 0xC0,
+	0x7A, 0xFE, 0xC0, 0x20, 0xEA, 0x11, 0x00, 0xA0, 0x18, 0xE5,
+};
+
+/* the logo, the cartridge type and sizes and the header checksum; the rest of 0134-014F is zeroed */
+inline void WriteHeader(std::vector<u8>& image, u8 type, u8 romSizeCode, u8 ramSizeCode)
+{
+	u8 checksum = 0;
+
+	std::copy(nintendoLogo.begin(), nintendoLogo.end(), image.begin() + 0x0104);
+	std::fill(image.begin() + 0x0134, image.begin() + 0x0150, 0);
+	image[0x0147] = type;
+	image[0x0148] = romSizeCode;
+	image[0x0149] = ramSizeCode;
+	for (u16 i = 0x0134; i <= 0x014C; i++)
+		checksum = checksum - image[i] - 1;
+	image[0x014D] = checksum;
+}
+
+/* NOP / JP 0150 at the entry point, and the program at 0150 */
+inline void WriteProgram(std::vector<u8>& image, const std::vector<u8>& program)
+{
+	image[CART_ENTRY] = 0x00;
+	image[CART_ENTRY + 1] = 0xC3;
+	image[CART_ENTRY + 2] = LSB(CART_PROGRAM);
+	image[CART_ENTRY + 3] = MSB(CART_PROGRAM);
+	std::copy(program.begin(), program.end(), image.begin() + CART_PROGRAM);
+}
+
+/* writes the image to the temporary directory; the caller removes it */
+inline std::filesystem::path SaveCartridge(const std::vector<u8>& image, const std::string& name)
+{
+	std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+	std::ofstream fs(path, std::ios::binary);
+
+	fs.write(reinterpret_cast<const char*>(image.data()), image.size());
+	return path;
+}
+
+/* 32 KiB, no controller and no cartridge RAM */
+inline std::filesystem::path WriteProgramCartridge(const std::string& name, const std::vector<u8>& program)
+{
+	std::vector<u8> image(32 * KiB, 0);
+
+	WriteHeader(image, 0x00, 0x00, 0x00);
+	WriteProgram(image, program);
+	return SaveCartridge(image, name);
+}
+
+/*
+	MBC1 with 128 KiB of ROM, each bank filled with its own number, and 8 KiB of battery
+	RAM, running bankingProgram: WRAM, cartridge RAM and the ROM bank change all the time.
+*/
+inline std::filesystem::path WriteBankingCartridge(const std::string& name)
+{
+	std::vector<u8> image(128 * KiB);
+
+	for (size_t i = 0; i < image.size(); i++)
+		image[i] = i / ROM_BANK_SIZE;
+	WriteHeader(image, 0x03, 0x02, 0x02);
+	WriteProgram(image, bankingProgram);
+	return SaveCartridge(image, name);
+}
\ No newline at end of file
@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <cpu.h>
+#include <common.h>
+#include <bus.h>
+#include <rom.h>
+#include <test_cartridge.h>
+
+/*
+	Runs the same random memory image through the reference switch, the table dispatch
+	of Cpu::Step(), the threaded interpreter and the block cache behind Cpu::RunInstructions(),
+	and checks that all of them end up with the same registers, memory and M-cycle count.
+	Memory is all RAM in test mode, so the block cache also sees plenty of invalidations.
+	RunFor() in odd-sized slices and RunUntil() on an instruction counter must stop on the
+	same instruction boundary. BIT, SCF, CCF and DAA are checked against known flag results
+	on every dispatcher. On a cartridge bus, writes to the code drop its block through
+	either of its WRAM and echo addresses, and I/O writes next to HRAM code do not.
+*/
+
+#define INSTRUCTIONS_PER_RUN		20000
+#define RUN_FOR_SLICE				997
+#define LOOP_INSTRUCTIONS			10000
+
+static const std::array<u8, 11> invalidOpcodes = {
+	0xD3, 0xDB, 0xDD, 0xE3, 0xE4, 0xEB, 0xEC, 0xED, 0xF4, 0xFC, 0xFD
+};
+
+/* FF80: LD A, C0 / LDH (46), A / LDH (47), A / INC B / JR FF80, as an OAM DMA routine writes I/O on its own page */
+static const std::vector<u8> hramLoop = { 0x3E, 0xC0, 0xE0, 0x46, 0xE0, 0x47, 0x04, 0x18, 0xF7 };
+
+/* INC B / JR back to it */
+static const std::vector<u8> incLoop = { 0x04, 0x18, 0xFD };
+
+/* one instruction from a known state, as in the sm83 single step tests: only A and F are checked */
+typedef struct FlagCase {
+	const char* name;
+	std::vector<u8> code;
+	u8 a, f, b;
+	u8 finalA, finalF;
+} FlagCase;
+
+static const std::vector<FlagCase> flagCases = {
+	{ "BIT 0, B clear",		{ 0xCB, 0x40 }, 0x00, 0x00, 0x00, 0x00, 0xA0 },
+	{ "BIT 0, B set",		{ 0xCB, 0x40 }, 0x00, 0x10, 0x01, 0x00, 0x30 },
+	{ "BIT 7, A set",		{ 0xCB, 0x7F }, 0x80, 0xC0, 0x00, 0x80, 0x20 },
+	{ "SCF",				{ 0x37 }, 0x00, 0xE0, 0x00, 0x00, 0x90 },
+	{ "CCF carry",			{ 0x3F }, 0x00, 0x70, 0x00, 0x00, 0x00 },
+	{ "CCF no carry",		{ 0x3F }, 0x00, 0x80, 0x00, 0x00, 0x90 },
+	{ "DAA 0A",				{ 0x27 }, 0x0A, 0x00, 0x00, 0x10, 0x00 },
+	{ "DAA 12",				{ 0x27 }, 0x12, 0x00, 0x00, 0x12, 0x00 },
+	{ "DAA 9A",				{ 0x27 }, 0x9A, 0x00, 0x00, 0x00, 0x90 },
+	{ "DAA 00 carry",		{ 0x27 }, 0x00, 0x10, 0x00, 0x60, 0x10 },
+	{ "DAA 0F after SUB",	{ 0x27 }, 0x0F, 0x60, 0x00, 0x09, 0x40 },
+};
+
+/* invalid opcodes are left out so a run is not cut short after a few dozen instructions */
+void FillMemory(Bus& bus, u32 seed)
+{
+	std::mt19937 rng(seed);
+
+	for (u32 addr = 0; addr < 0x10000; addr++) {
+		u8 byte = rng() & 0xFF;
+
+		if (std::find(invalidOpcodes.begin(), invalidOpcodes.end(), byte) != invalidOpcodes.end())
+			byte = 0x00;
+		bus.Write(addr, byte);
+	}
+}
+
+CpuState InitialState(u32 seed)
+{
+	std::mt19937 rng(seed ^ 0x5A5A5A5A);
+	CpuState state;
+
+	state.PC = rng() & 0xFFFF;
+	state.SP = rng() & 0xFFFF;
+	state.BC = rng() & 0xFFFF;
+	state.DE = rng() & 0xFFFF;
+	state.HL = rng() & 0xFFFF;
+	state.AF.val = rng() & 0xFFF0;
+	return state;
+}
+
+bool SameState(Cpu& lhs, Bus& lhsBus, Cpu& rhs, Bus& rhsBus)
+{
+	CpuState empty, l = lhs.GetCpuStateForDebug(empty), r = rhs.GetCpuStateForDebug(empty);
+
+	if (l.PC != r.PC || l.SP != r.SP || l.BC != r.BC || l.DE != r.DE || l.HL != r.HL || l.AF.val != r.AF.val)
+		return false;
+	for (u32 addr = 0; addr < 0x10000; addr++) {
+		if (lhsBus.Read(addr) != rhsBus.Read(addr))
+			return false;
+	}
+	return true;
+}
+
+/* every case through the reference switch, the table dispatch and the block cache */
+int TestFlagCases()
+{
+	for (const FlagCase& test : flagCases) {
+		for (int dispatch = 0; dispatch < 3; dispatch++) {
+			Bus bus;
+			Cpu cpu(&bus);
+			CpuState state = {}, empty, result;
+
+			for (size_t i = 0; i < test.code.size(); i++)
+				bus.Write(0x0100 + i, test.code[i]);
+			state.PC = 0x0100;
+			state.SP = 0xDFFE;
+			state.BC = test.b << 8;
+			state.AF.A = test.a;
+			state.AF.F = test.f;
+			cpu.SetCpuState(state);
+			if (dispatch == 0)
+				cpu.StepSwitch();
+			else if (dispatch == 1)
+				cpu.Step();
+			else
+				cpu.RunInstructions(1);
+			result = cpu.GetCpuStateForDebug(empty);
+			if (result.AF.A != test.finalA || result.AF.F != test.finalF) {
+				spdlog::error("{} via dispatcher {}: A {:02X} F {:02X}, expected {:02X} {:02X}",
+					test.name, dispatch, result.AF.A, result.AF.F, test.finalA, test.finalF);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	return 0;
+}
+
+/* the I/O writes keep the HRAM block; turning INC B into INC C drops it */
+int TestHighPageWrites(Rom& rom)
+{
+	Bus bus(&rom);
+	Cpu cpu(&bus);
+	CpuState state = {}, empty;
+	u8 loops = static_cast<u8>(LOOP_INSTRUCTIONS / 5);		// B and C wrap
+
+	bus.Write(0xFF50, 1);
+	for (size_t i = 0; i < hramLoop.size(); i++)
+		bus.Write(HRAM_START + i, hramLoop[i]);
+	state.PC = HRAM_START;
+	state.SP = 0xDFFE;
+	cpu.SetCpuState(state);
+	cpu.RunInstructions(LOOP_INSTRUCTIONS);
+	CHECK(cpu.GetBlockCacheStats().builds == 1);
+	CHECK(cpu.GetBlockCacheStats().invalidations == 0);
+	CHECK(cpu.GetCpuStateForDebug(empty).BC == loops << 8);
+	bus.Write(HRAM_START + 6, 0x0C);
+	cpu.RunInstructions(LOOP_INSTRUCTIONS);
+	CHECK(cpu.GetBlockCacheStats().invalidations == 1);
+	CHECK(cpu.GetCpuStateForDebug(empty).BC == (loops << 8 | loops));
+	return 0;
+}
+
+/* a loop in WRAM patched through echo RAM, and one run from echo RAM patched through WRAM */
+int TestEchoWrites(Rom& rom)
+{
+	for (u16 run : { 0xC000, 0xE000 }) {
+		Bus bus(&rom);
+		Cpu cpu(&bus);
+		CpuState state = {}, empty;
+		u16 patch = run ^ ECHO_RAM_OFFSET;
+
+		bus.Write(0xFF50, 1);
+		for (size_t i = 0; i < incLoop.size(); i++)
+			bus.Write(run + i, incLoop[i]);
+		state.PC = run;
+		state.SP = 0xDFFE;
+		cpu.SetCpuState(state);
+		cpu.RunInstructions(2);
+		bus.Write(patch, 0x0C);								// INC C
+		cpu.RunInstructions(2);
+		CHECK(cpu.GetBlockCacheStats().invalidations == 1);
+		CHECK(cpu.GetCpuStateForDebug(empty).BC == 0x0101);
+	}
+	return 0;
+}
+
+int CartridgeTests()
+{
+	std::filesystem::path romPath = WriteProgramCartridge("usagbi_cpu_dispatch_test.gb", {});
+	Rom rom;
+	int status = rom.Load(romPath.string().c_str());
+
+	std::filesystem::remove(romPath);
+	CHECK(status == STT_SUCCESS);
+	return TestHighPageWrites(rom) || TestEchoWrites(rom);
+}
+
+int main(int argc, char* argv[])
+{
+	for (u32 seed = 1; seed <= 16; seed++) {
+		Bus switchBus, tableBus, threadedBus, blockBus, sliceBus, untilBus;
+		Cpu switchCpu(&switchBus), tableCpu(&tableBus), threadedCpu(&threadedBus), blockCpu(&blockBus);
+		Cpu sliceCpu(&sliceBus), untilCpu(&untilBus);
+		u64 switchCycles = 0, tableCycles = 0, threadedCycles, blockCycles;
+		int executed = 0, untilExecuted = 0;
+
+		FillMemory(switchBus, seed);
+		FillMemory(tableBus, seed);
+		FillMemory(threadedBus, seed);
+		FillMemory(blockBus, seed);
+		FillMemory(sliceBus, seed);
+		FillMemory(untilBus, seed);
+		switchCpu.SetCpuState(InitialState(seed));
+		tableCpu.SetCpuState(InitialState(seed));
+		threadedCpu.SetCpuState(InitialState(seed));
+		blockCpu.SetCpuState(InitialState(seed));
+		sliceCpu.SetCpuState(InitialState(seed));
+		untilCpu.SetCpuState(InitialState(seed));
+		threadedCpu.SetBlockCacheEnabled(false);
+
+		for (; executed < INSTRUCTIONS_PER_RUN; executed++) {
+			int switchStep = switchCpu.StepSwitch(), tableStep = tableCpu.Step();
+
+			if (switchStep != tableStep) {
+				spdlog::error("Seed {}: instruction {} took {} M-cycles via switch, {} via table.", seed, executed, switchStep, tableStep);
+				return EXIT_FAILURE;
+			}
+			if (tableStep == -1)
+				break;
+			switchCycles += switchStep;
+			tableCycles += tableStep;
+		}
+		threadedCycles = threadedCpu.RunInstructions(INSTRUCTIONS_PER_RUN);
+		blockCycles = blockCpu.RunInstructions(INSTRUCTIONS_PER_RUN);
+		while (sliceCpu.GetCycleCount() < tableCycles * 4 && !sliceCpu.HitInvalidOpcode())
+			sliceCpu.RunFor(std::min<u64>(RUN_FOR_SLICE, tableCycles * 4 - sliceCpu.GetCycleCount()));
+		/* an invalid opcode takes no cycles, so the budget runs out right in front of it */
+		if (executed < INSTRUCTIONS_PER_RUN)
+			sliceCpu.RunFor(1);
+		untilCpu.RunUntil([&](Cpu&) { return ++untilExecuted == INSTRUCTIONS_PER_RUN; });
+
+		if (tableCycles != threadedCycles || tableCycles != blockCycles || tableCycles * 4 != sliceCpu.GetCycleCount()
+				|| tableCycles * 4 != untilCpu.GetCycleCount()) {
+			spdlog::error("Seed {}: {} M-cycles via table, {} via threaded loop, {} via block cache, {}/{} T-cycles via RunFor/RunUntil.",
+				seed, tableCycles, threadedCycles, blockCycles, sliceCpu.GetCycleCount(), untilCpu.GetCycleCount());
+			return EXIT_FAILURE;
+		}
+		if (!SameState(switchCpu, switchBus, tableCpu, tableBus) || !SameState(tableCpu, tableBus, threadedCpu, threadedBus)
+				|| !SameState(tableCpu, tableBus, blockCpu, blockBus) || !SameState(tableCpu, tableBus, sliceCpu, sliceBus)
+				|| !SameState(tableCpu, tableBus, untilCpu, untilBus)) {
+			spdlog::error("Seed {}: dispatchers disagree after {} instructions.", seed, executed);
+			return EXIT_FAILURE;
+		}
+	}
+	if (TestFlagCases() || CartridgeTests())
+		return EXIT_FAILURE;
+	spdlog::info("Dispatch test passed");
+	return 0;
+}
\ No newline at end of file
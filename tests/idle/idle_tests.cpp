@@ -0,0 +1,154 @@
+#include <cstring>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <bus.h>
+#include <cpu.h>
+#include <scheduler.h>
+
+/*
+	Runs programs that sit in HALT, in STOP or in a loop polling HRAM while a periodic
+	event sets IF or the polled byte. Fast-forwarding must not change anything: every mode
+	(JIT, blocks, interpreter) must end in exactly the state an instruction-by-instruction
+	reference run ends in, and most of the time must have been skipped rather than run.
+*/
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			spdlog::error("{}:{}: {} failed", __FILE__, __LINE__, #cond); \
+			return EXIT_FAILURE; \
+		} \
+	} while (0)
+
+#define EVENT_PERIOD			1234
+#define RUN_T_CYCLES			(70224 * 8)
+#define POLLED_ADDR				0xFF80
+
+/* the event sets IF bits or writes the polled byte, then rearms */
+typedef struct Waker {
+	Scheduler* scheduler;
+	Bus* bus;
+	u16 addr;
+	u8 value;
+} Waker;
+
+void Wake(void* ctx, u64 when)
+{
+	Waker* waker = static_cast<Waker*>(ctx);
+
+	waker->bus->Write(waker->addr, waker->bus->Read(waker->addr) | waker->value);
+	waker->scheduler->Schedule(EVENT_TIMER_OVERFLOW, when + EVENT_PERIOD);
+}
+
+/* 0000: HALT / XOR A / LDH (0x0F), A / INC B / JR 0000 */
+static const std::vector<u8> haltProgram = { 0x76, 0xAF, 0xE0, 0x0F, 0x04, 0x18, 0xF9 };
+/* 0000: STOP / XOR A / LDH (0x0F), A / INC B / JR 0000 */
+static const std::vector<u8> stopProgram = { 0x10, 0xAF, 0xE0, 0x0F, 0x04, 0x18, 0xF9 };
+/* 0000: LDH A, (0x80) / AND A / JR Z, 0000 / XOR A / LDH (0x80), A / INC B / JR 0000 */
+static const std::vector<u8> pollProgram = { 0xF0, 0x80, 0xA7, 0x28, 0xFB, 0xAF, 0xE0, 0x80, 0x04, 0x18, 0xF4 };
+
+typedef enum RunMode {
+	MODE_JIT,
+	MODE_BLOCKS,
+	MODE_INTERPRETER,
+	MODE_REFERENCE,		// one instruction at a time, nothing is skipped
+} RunMode;
+
+/* runs program for RUN_T_CYCLES and returns the final CPU state */
+CpuSaveState Run(const std::vector<u8>& program, u16 wakeAddr, u8 wakeValue, u8 ie, RunMode mode, IdleStats& stats)
+{
+	Bus bus;
+	Cpu cpu(&bus);
+	Scheduler scheduler;
+	Waker waker = { &scheduler, &bus, wakeAddr, wakeValue };
+	CpuSaveState save = {};
+
+	for (size_t i = 0; i < program.size(); i++)
+		bus.Write(i, program[i]);
+	bus.Write(REG_IF, 0);
+	bus.Write(REG_IE, ie);
+	bus.Write(POLLED_ADDR, 0);
+	cpu.LoadState(save);
+	cpu.SetBlockCacheEnabled(mode == MODE_JIT || mode == MODE_BLOCKS);
+	cpu.SetJitEnabled(mode == MODE_JIT);
+	scheduler.SetClock(cpu.GetCycleCounter());
+	scheduler.SetHandler(EVENT_TIMER_OVERFLOW, Wake, &waker);
+	scheduler.Schedule(EVENT_TIMER_OVERFLOW, EVENT_PERIOD);
+	cpu.SetScheduler(&scheduler);
+	if (mode == MODE_REFERENCE)
+		cpu.RunUntil([](Cpu&) { return false; }, RUN_T_CYCLES);
+	else
+		cpu.RunFor(RUN_T_CYCLES);
+	cpu.SaveState(save);
+	stats = cpu.GetIdleStats();
+	return save;
+}
+
+int TestProgram(const char* name, const std::vector<u8>& program, u16 wakeAddr, u8 wakeValue, u8 ie, bool halts)
+{
+	IdleStats stats;
+	CpuSaveState reference = Run(program, wakeAddr, wakeValue, ie, MODE_REFERENCE, stats);
+
+	/* B counts wake-ups; the last event may not have been acted on yet */
+	CHECK((u8)(RUN_T_CYCLES / EVENT_PERIOD - (reference.bc >> 8)) <= 1);
+	for (RunMode mode : { MODE_JIT, MODE_BLOCKS, MODE_INTERPRETER }) {
+		CpuSaveState save = Run(program, wakeAddr, wakeValue, ie, mode, stats);
+		u64 skipped = halts ? stats.haltTCycles : stats.idleLoopTCycles;
+
+		CHECK(!std::memcmp(&save, &reference, sizeof(save)));
+		/* with the block cache off there are no blocks to recognise a loop by */
+		spdlog::info("{}, mode {}: {} of {} T-cycles skipped", name, (int)mode, skipped, save.tCycles);
+		if (halts || mode != MODE_INTERPRETER)
+			CHECK(skipped > RUN_T_CYCLES * 3 / 4);
+	}
+	return 0;
+}
+
+/*
+	A HALT nothing can end, IE masks the request. Each instruction asked for is one more
+	pass over HALT, as many as a CPU stepping through it gets.
+*/
+int TestNoWake()
+{
+	Bus bus, stepBus;
+	Cpu cpu(&bus), stepCpu(&stepBus);
+	Scheduler scheduler;
+	CpuSaveState start = {};
+	int stepped = 0;
+
+	for (size_t i = 0; i < haltProgram.size(); i++) {
+		bus.Write(i, haltProgram[i]);
+		stepBus.Write(i, haltProgram[i]);
+	}
+	bus.Write(REG_IF, 0x04);
+	bus.Write(REG_IE, 0x01);
+	stepBus.Write(REG_IF, 0x04);
+	stepBus.Write(REG_IE, 0x01);
+	cpu.LoadState(start);
+	stepCpu.LoadState(start);
+	scheduler.SetClock(cpu.GetCycleCounter());
+	cpu.SetScheduler(&scheduler);
+	cpu.RunInstructions(1000);
+	stepCpu.RunUntil([&](Cpu&) { return ++stepped == 1000; });
+	CHECK(cpu.IsHalted());
+	CHECK(cpu.GetCycleCount() == stepCpu.GetCycleCount());
+	CHECK(cpu.GetIdleStats().haltTCycles > 0);
+	bus.Write(REG_IF, 0x05);
+	cpu.RunInstructions(4);
+	CHECK(!cpu.IsHalted());
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (TestProgram("HALT", haltProgram, REG_IF, 0x04, 0x04, true)
+			|| TestProgram("STOP", stopProgram, REG_IF, INT_JOYPAD, 0x00, true)
+			|| TestProgram("Polling loop", pollProgram, POLLED_ADDR, 0x01, 0x00, false)
+			|| TestNoWake())
+		return EXIT_FAILURE;
+	spdlog::info("Idle test passed");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,293 @@
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <bus.h>
+#include <cpu.h>
+#include <rom.h>
+#include <scheduler.h>
+#include <timer.h>
+#include <test_cartridge.h>
+
+/*
+	Steps short programs in WRAM through dispatch, priority, RETI, the EI delay, DI right
+	after EI, waking from HALT and the HALT bug, with a cartridge whose vectors count the
+	interrupts taken, and checks the joypad lines in P1 and the interrupt they raise. Then
+	runs a program that takes timer interrupts both in HALT and in the middle of a busy
+	loop, and checks that the JIT, the block cache and the interpreter end in exactly the
+	state of an instruction-by-instruction reference run.
+*/
+
+#define CODE_ADDR				0xC000
+#define STACK_TOP				0xDFFE
+#define RUN_T_CYCLES			(70224 * 8)
+#define TIMER_PERIOD			(0x100 * 16)
+
+/*
+	0150: LD SP, DFFE / LD A, 05 / LDH (07), A / LD A, 04 / LDH (FF), A / EI
+	015C: INC E / HALT / NOP / DI / INC L / EI
+	0162: LD A, 80 / DEC A / JR NZ, 0164 / JR 015C
+*/
+static const std::vector<u8> timerProgram = {
+	0x31, 0xFE, 0xDF, 0x3E, 0x05, 0xE0, 0x07, 0x3E, 0x04, 0xE0, 0xFF, 0xFB,
+	0x1C, 0x76, 0x00, 0xF3, 0x2C, 0xFB,
+	0x3E, 0x80, 0x3D, 0x20, 0xFD, 0x18, 0xF3
+};
+
+/* VBlank, STAT and timer handlers count in B, C and D: INC r / RETI */
+bool LoadCartridge(Rom& rom)
+{
+	std::filesystem::path path;
+	std::vector<u8> image(32 * KiB, 0);
+	int status;
+
+	image[0x0040] = 0x04;
+	image[0x0041] = 0xD9;
+	image[0x0048] = 0x0C;
+	image[0x0049] = 0xD9;
+	image[0x0050] = 0x14;
+	image[0x0051] = 0xD9;
+	WriteHeader(image, 0x00, 0x00, 0x00);
+	WriteProgram(image, timerProgram);
+	path = SaveCartridge(image, "usagbi_interrupts.gb");
+	status = rom.Load(path.string().c_str());
+	std::filesystem::remove(path);
+	return status == STT_SUCCESS;
+}
+
+typedef struct Machine {
+	Bus bus;
+	Cpu cpu;
+	Scheduler scheduler;
+	Timer timer;
+
+	Machine(Rom* rom) : bus(rom), cpu(&bus), timer(&bus, &scheduler)
+	{
+		scheduler.SetClock(cpu.GetCycleCounter());
+		cpu.SetScheduler(&scheduler);
+		bus.Write(0xFF50, 1);									// boot ROM off, the vectors are the cartridge's
+	}
+	/* program at CODE_ADDR, all registers 0 */
+	void Load(const std::vector<u8>& program)
+	{
+		CpuState state = {};
+
+		for (size_t i = 0; i < program.size(); i++)
+			bus.Write(CODE_ADDR + i, program[i]);
+		state.PC = CODE_ADDR;
+		state.SP = STACK_TOP;
+		cpu.SetCpuState(state);
+	}
+	CpuState Regs()
+	{
+		CpuState empty;
+
+		return cpu.GetCpuStateForDebug(empty);
+	}
+	u16 Pushed() { return U16(bus.Read(Regs().SP), bus.Read(Regs().SP + 1)); }
+} Machine;
+
+/* EI / INC A / INC A: one more instruction runs before the dispatch, RETI comes back after it */
+int TestEiDelay(Rom& rom)
+{
+	Machine m(&rom);
+
+	m.Load({ 0xFB, 0x3C, 0x3C });
+	m.bus.Write(REG_IE, INT_VBLANK);
+	m.bus.Write(REG_IF, INT_VBLANK);
+	CHECK(m.cpu.Step() == 1);
+	CHECK(m.cpu.Step() == 1);
+	CHECK(m.Regs().AF.A == 1);
+	CHECK(m.cpu.Step() == INT_DISPATCH_M_CYCLES);
+	CHECK(m.Regs().PC == 0x0040);
+	CHECK(m.Pushed() == CODE_ADDR + 2);
+	CHECK(!(m.bus.Read(REG_IF) & INT_VBLANK));
+	m.cpu.Step();
+	m.cpu.Step();
+	CHECK(m.Regs().PC == CODE_ADDR + 2);
+	CHECK(m.Regs().BC >> 8 == 1);
+	CHECK(m.bus.Interrupts().Ime());
+	return 0;
+}
+
+/* EI / DI / INC A: IME never goes up */
+int TestDiAfterEi(Rom& rom)
+{
+	Machine m(&rom);
+
+	m.Load({ 0xFB, 0xF3, 0x3C, 0x3C });
+	m.bus.Write(REG_IE, INT_VBLANK);
+	m.bus.Write(REG_IF, INT_VBLANK);
+	for (int i = 0; i < 3; i++)
+		m.cpu.Step();
+	CHECK(m.Regs().PC == CODE_ADDR + 3);
+	CHECK(!m.bus.Interrupts().Ime());
+	CHECK(!m.bus.Interrupts().Pending());
+	CHECK(m.bus.Read(REG_IF) & INT_VBLANK);
+	return 0;
+}
+
+/* STAT goes before the timer; RETI raises IME at once, so the timer is taken straight after */
+int TestPriority(Rom& rom)
+{
+	Machine m(&rom);
+
+	m.Load({ 0xFB, 0x00, 0x00 });
+	m.bus.Write(REG_IE, INT_MASK);
+	m.bus.Write(REG_IF, INT_TIMER | INT_STAT);
+	m.cpu.Step();
+	m.cpu.Step();
+	m.cpu.Step();
+	CHECK(m.Regs().PC == 0x0048);
+	CHECK(m.bus.Read(REG_IF) == INT_TIMER);
+	m.cpu.Step();
+	m.cpu.Step();
+	CHECK(m.Regs().PC == CODE_ADDR + 2);
+	CHECK(m.cpu.Step() == INT_DISPATCH_M_CYCLES);
+	CHECK(m.Regs().PC == 0x0050);
+	CHECK(m.Pushed() == CODE_ADDR + 2);
+	CHECK(!m.bus.Read(REG_IF));
+	return 0;
+}
+
+/* EI / HALT / INC A: the dispatch wakes the CPU and returns past the HALT; with IME off it just goes on */
+int TestHaltWake(Rom& rom)
+{
+	for (bool ime : { true, false }) {
+		Machine m(&rom);
+
+		m.Load({ static_cast<u8>(ime ? 0xFB : 0xF3), 0x76, 0x3C });
+		m.bus.Write(REG_IE, INT_TIMER);
+		m.cpu.Step();
+		m.cpu.Step();
+		m.cpu.Step();
+		CHECK(m.cpu.IsHalted());
+		CHECK(m.Regs().PC == CODE_ADDR + 1);
+		m.bus.Write(REG_IF, INT_TIMER);
+		m.cpu.Step();
+		CHECK(!m.cpu.IsHalted());
+		if (ime) {
+			CHECK(m.Regs().PC == 0x0050);
+			CHECK(m.Pushed() == CODE_ADDR + 2);
+		} else {
+			CHECK(m.Regs().PC == CODE_ADDR + 2);
+			m.cpu.Step();
+			CHECK(m.Regs().AF.A == 1);
+		}
+	}
+	return 0;
+}
+
+/*
+	HALT with IME off and an interrupt requested: the next opcode byte is read twice, so
+	INC A runs twice and LD A, u8 loads its own opcode. After EI, HALT the handler returns
+	to the HALT instead.
+*/
+int TestHaltBug(Rom& rom)
+{
+	Machine m(&rom), operand(&rom), ei(&rom);
+
+	m.Load({ 0x76, 0x3C, 0x00 });
+	m.bus.Write(REG_IE, INT_TIMER);
+	m.bus.Write(REG_IF, INT_TIMER);
+	m.cpu.Step();
+	CHECK(!m.cpu.IsHalted());
+	m.cpu.Step();
+	CHECK(m.Regs().PC == CODE_ADDR + 1);
+	m.cpu.Step();
+	CHECK(m.Regs().PC == CODE_ADDR + 2);
+	CHECK(m.Regs().AF.A == 2);
+
+	operand.Load({ 0x76, 0x3E, 0x12 });
+	operand.bus.Write(REG_IE, INT_TIMER);
+	operand.bus.Write(REG_IF, INT_TIMER);
+	operand.cpu.Step();
+	operand.cpu.Step();
+	CHECK(operand.Regs().AF.A == 0x3E);
+	CHECK(operand.Regs().PC == CODE_ADDR + 2);
+
+	ei.Load({ 0xFB, 0x76, 0x3C });
+	ei.bus.Write(REG_IE, INT_TIMER);
+	ei.bus.Write(REG_IF, INT_TIMER);
+	ei.cpu.Step();
+	ei.cpu.Step();
+	CHECK(ei.cpu.Step() == INT_DISPATCH_M_CYCLES);
+	CHECK(ei.Regs().PC == 0x0050);
+	CHECK(ei.Pushed() == CODE_ADDR + 1);
+	return 0;
+}
+
+/* a selected line going low raises the interrupt, whether the button or the selection moved */
+int TestJoypad(Rom& rom)
+{
+	Machine m(&rom);
+
+	m.bus.Write(REG_P1, P1_SELECT_DPAD);
+	CHECK(m.bus.Read(REG_P1) == 0xDF);
+	m.bus.SetButtons(JOYPAD_START | JOYPAD_LEFT);
+	CHECK(m.bus.Read(REG_P1) == 0xD7);
+	CHECK(m.bus.Read(REG_IF) & INT_JOYPAD);
+	m.bus.Write(REG_IF, 0);
+	m.bus.Write(REG_P1, P1_SELECT_BUTTONS);
+	CHECK(m.bus.Read(REG_P1) == 0xED);
+	CHECK(m.bus.Read(REG_IF) & INT_JOYPAD);
+	m.bus.Write(REG_IF, 0);
+	m.bus.SetButtons(JOYPAD_LEFT);
+	CHECK(!(m.bus.Read(REG_IF) & INT_JOYPAD));
+	m.bus.Write(REG_P1, P1_SELECT_DPAD | P1_SELECT_BUTTONS);
+	CHECK(m.bus.Read(REG_P1) == 0xFF);
+	return 0;
+}
+
+typedef enum RunMode {
+	MODE_JIT,
+	MODE_BLOCKS,
+	MODE_INTERPRETER,
+	MODE_REFERENCE,		// one instruction at a time
+} RunMode;
+
+CpuSaveState RunTimerProgram(Rom& rom, RunMode mode)
+{
+	Machine m(&rom);
+	CpuSaveState save = {};
+
+	save.pc = 0x0100;
+	m.cpu.LoadState(save);
+	m.cpu.SetBlockCacheEnabled(mode == MODE_JIT || mode == MODE_BLOCKS);
+	m.cpu.SetJitEnabled(mode == MODE_JIT);
+	if (mode == MODE_REFERENCE)
+		m.cpu.RunUntil([](Cpu&) { return false; }, RUN_T_CYCLES);
+	else
+		m.cpu.RunFor(RUN_T_CYCLES);
+	m.cpu.SaveState(save);
+	return save;
+}
+
+int TestModes(Rom& rom)
+{
+	CpuSaveState reference = RunTimerProgram(rom, MODE_REFERENCE);
+
+	/* D counts timer interrupts, E HALTs; the last overflow may not have been taken yet */
+	CHECK((u8)(RUN_T_CYCLES / TIMER_PERIOD - (reference.de >> 8)) <= 1);
+	CHECK((reference.de & 0xFF) > 0);
+	for (RunMode mode : { MODE_JIT, MODE_BLOCKS, MODE_INTERPRETER }) {
+		CpuSaveState save = RunTimerProgram(rom, mode);
+
+		CHECK(!std::memcmp(&save, &reference, sizeof(save)));
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	Rom rom;
+
+	CHECK(LoadCartridge(rom));
+	if (TestEiDelay(rom) || TestDiAfterEi(rom) || TestPriority(rom) || TestHaltWake(rom) || TestHaltBug(rom) || TestJoypad(rom) || TestModes(rom))
+		return EXIT_FAILURE;
+	spdlog::info("Interrupts test passed");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <cpu.h>
+#include <common.h>
+#include <bus.h>
+#include <rom.h>
+#include <test_cartridge.h>
+
+/*
+	Builds a 32 KiB ROM whose code is a random mix of register-only instructions, most of
+	which the JIT compiles, with conditional branches to the next instruction, so both exits
+	of a block get taken, and a jump back to the start. A JIT
+	CPU, a lockstep JIT CPU and a CPU that never compiles run it side by side and must agree
+	on registers and M-cycles after every chunk. On Linux, no mapping of the process may
+	then be writable and executable at once.
+*/
+
+#define ROM_SIZE				(32 * KiB)
+#define PROGRAM_START			0x0150
+#define PROGRAM_END				0x3F00
+#define CHUNK_INSTRUCTIONS		4096
+#define CHUNKS					256
+
+/* interpreter-only register instructions: DAA, SCF, CCF and ADD HL, r16 */
+static const std::array<u8, 7> slowOps = { 0x27, 0x37, 0x3F, 0x09, 0x19, 0x29, 0x39 };
+
+std::vector<u8> BuildRom()
+{
+	std::mt19937 rng(0x4A17);
+	std::vector<u8> rom(ROM_SIZE, 0x00), fastOps;
+	u16 addr = PROGRAM_START;
+
+	for (int op = 0x40; op <= 0xBF; op++) {
+		if ((op & 0x07) != 0x06 && !IN_RANGE(op, 0x70, 0x77))
+			fastOps.push_back(op);
+	}
+	for (u8 op : { 0x00, 0x03, 0x04, 0x05, 0x07, 0x0B, 0x0C, 0x0D, 0x0F, 0x13, 0x14, 0x15, 0x17, 0x1B, 0x1C,
+			0x1D, 0x1F, 0x23, 0x24, 0x25, 0x2B, 0x2C, 0x2D, 0x2F, 0x33, 0x3B, 0x3C, 0x3D })
+		fastOps.push_back(op);
+
+	rom[0x0100] = 0x00;
+	rom[0x0101] = 0xC3;
+	rom[0x0102] = LSB(PROGRAM_START);
+	rom[0x0103] = MSB(PROGRAM_START);
+	WriteHeader(rom, 0x00, 0x00, 0x00);
+
+	while (addr < PROGRAM_END) {
+		u32 roll = rng() % 64;
+
+		if (roll < 4) {											// JR cc to the next instruction
+			rom[addr++] = 0x20 | ((rng() & 0x03) << 3);
+			rom[addr++] = 0x00;
+		} else if (roll < 6) {									// JP cc to the next instruction
+			rom[addr] = 0xC2 | ((rng() & 0x03) << 3);
+			rom[addr + 1] = LSB(addr + 3);
+			rom[addr + 2] = MSB(addr + 3);
+			addr += 3;
+		} else if (roll < 10) {									// ALU A, u8 and LD r8, u8
+			rom[addr++] = (roll < 8) ? (0xC6 | ((rng() & 0x07) << 3)) : (0x06 | ((rng() % 4) << 3));
+			rom[addr++] = rng() & 0xFF;
+		} else if (roll < 12) {
+			rom[addr++] = slowOps[rng() % slowOps.size()];
+		} else if (roll < 13) {									// CB register op
+			u8 cbOp;
+
+			do {
+				cbOp = rng() & 0xFF;
+			} while ((cbOp & 0x07) == 0x06);
+			rom[addr++] = 0xCB;
+			rom[addr++] = cbOp;
+		} else {
+			rom[addr++] = fastOps[rng() % fastOps.size()];
+		}
+	}
+	rom[addr++] = 0xC3;
+	rom[addr++] = LSB(PROGRAM_START);
+	rom[addr++] = MSB(PROGRAM_START);
+	return rom;
+}
+
+/* the permissions column of /proc/self/maps; hosts without it pass */
+bool HasWritableCode()
+{
+	std::ifstream maps("/proc/self/maps");
+	std::string line;
+
+	while (std::getline(maps, line)) {
+		if (line.find(" rwx") != std::string::npos)
+			return true;
+	}
+	return false;
+}
+
+bool SameRegs(Cpu& lhs, Cpu& rhs)
+{
+	CpuState empty, l = lhs.GetCpuStateForDebug(empty), r = rhs.GetCpuStateForDebug(empty);
+
+	return l.PC == r.PC && l.SP == r.SP && l.BC == r.BC && l.DE == r.DE && l.HL == r.HL && l.AF.val == r.AF.val;
+}
+
+int main(int argc, char* argv[])
+{
+	std::filesystem::path romPath;
+	Rom jitRom, lockstepRom, interpRom;
+	CpuState start;
+
+	if (!Jit::Supported()) {
+		spdlog::info("No JIT backend for this host, skipping");
+		return 0;
+	}
+	romPath = SaveCartridge(BuildRom(), "usagbi_jit_test.gb");
+	if (jitRom.Load(romPath.string().c_str()) != STT_SUCCESS || lockstepRom.Load(romPath.string().c_str()) != STT_SUCCESS
+			|| interpRom.Load(romPath.string().c_str()) != STT_SUCCESS) {
+		spdlog::error("Can't load the generated ROM.");
+		return EXIT_FAILURE;
+	}
+	std::filesystem::remove(romPath);
+
+	Bus jitBus(&jitRom), lockstepBus(&lockstepRom), interpBus(&interpRom);
+	Cpu jitCpu(&jitBus), lockstepCpu(&lockstepBus), interpCpu(&interpBus);
+
+	start.PC = PROGRAM_START;
+	start.SP = 0xFFFE;
+	start.BC = 0x0013;
+	start.DE = 0x00D8;
+	start.HL = 0x014D;
+	start.AF.val = 0x01B0;
+	jitCpu.SetCpuState(start);
+	lockstepCpu.SetCpuState(start);
+	interpCpu.SetCpuState(start);
+	lockstepCpu.SetJitLockstep(true);
+	interpCpu.SetJitEnabled(false);
+
+	for (int chunk = 0; chunk < CHUNKS; chunk++) {
+		u64 jitCycles = jitCpu.RunInstructions(CHUNK_INSTRUCTIONS);
+		u64 lockstepCycles = lockstepCpu.RunInstructions(CHUNK_INSTRUCTIONS);
+		u64 interpCycles = interpCpu.RunInstructions(CHUNK_INSTRUCTIONS);
+
+		if (jitCycles != interpCycles || lockstepCycles != interpCycles) {
+			spdlog::error("Chunk {}: {} M-cycles with the JIT, {} in lockstep, {} interpreted.", chunk,
+				jitCycles, lockstepCycles, interpCycles);
+			return EXIT_FAILURE;
+		}
+		if (!SameRegs(jitCpu, interpCpu) || !SameRegs(lockstepCpu, interpCpu)) {
+			spdlog::error("Chunk {}: registers differ.", chunk);
+			return EXIT_FAILURE;
+		}
+	}
+
+	const JitStats& stats = jitCpu.GetJitStats();
+	const JitStats& lockstep = lockstepCpu.GetJitStats();
+
+	if (stats.compiled == 0 || stats.instructions == 0) {
+		spdlog::error("Nothing was compiled.");
+		return EXIT_FAILURE;
+	}
+	if (lockstep.lockstepChecks == 0 || lockstep.lockstepMismatches) {
+		spdlog::error("{} of {} lockstep checks failed.", lockstep.lockstepMismatches, lockstep.lockstepChecks);
+		return EXIT_FAILURE;
+	}
+	if (HasWritableCode()) {
+		spdlog::error("The JIT left code writable.");
+		return EXIT_FAILURE;
+	}
+	spdlog::info("JIT test passed: {} blocks compiled, {} of {} instructions native", stats.compiled,
+		stats.instructions, CHUNKS * CHUNK_INSTRUCTIONS);
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include <filesystem>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <bus.h>
+#include <rom.h>
+#include <test_cartridge.h>
+
+/*
+	Generates a cartridge per controller where every ROM bank is filled with its own bank
+	number, then checks through the bus that bank switching, cartridge RAM banking and
+	enabling, the MBC3 clock and the fixed parts of the memory map behave.
+*/
+
+/* even bytes hold the low byte of the bank number, odd bytes the high byte */
+bool LoadCartridge(Rom& rom, u8 type, u8 romSizeCode, u8 ramSizeCode)
+{
+	std::filesystem::path path;
+	std::vector<u8> image((32 * KiB) << romSizeCode);
+	int status;
+
+	for (size_t i = 0; i < image.size(); i++) {
+		u32 bank = i / ROM_BANK_SIZE;
+
+		image[i] = (i & 1) ? MSB(bank) : LSB(bank);
+	}
+	WriteHeader(image, type, romSizeCode, ramSizeCode);
+	path = SaveCartridge(image, fmt::format("usagbi_mbc_{:02X}.gb", type));
+	status = rom.Load(path.string().c_str());
+	std::filesystem::remove(path);
+	return status == STT_SUCCESS;
+}
+
+u16 BankAt(Bus& bus, u16 addr)
+{
+	return U16(bus.Read(addr), bus.Read(addr + 1));
+}
+
+int TestPlainCartridge()
+{
+	Rom rom;
+
+	CHECK(LoadCartridge(rom, 0x00, 0, 0));
+	Bus bus(&rom);
+
+	CHECK(bus.Read(0x0000) == 0x31);						// boot ROM overlay
+	CHECK(bus.CodeBank(0x0000) == CODE_BANK_BOOT_ROM);
+	CHECK(BankAt(bus, 0x4000) == 1);
+	bus.Write(0x2000, 0x00);
+	CHECK(BankAt(bus, 0x4000) == 1);
+	bus.Write(0xFF50, 0x01);
+	CHECK(BankAt(bus, 0x0000) == 0);
+	CHECK(bus.CodeBank(0x0000) == 0);
+	bus.Write(0xC123, 0x5A);
+	CHECK(bus.Read(0xE123) == 0x5A);						// echo RAM
+	bus.Write(0xFDFF, 0xA5);
+	CHECK(bus.Read(0xDDFF) == 0xA5);
+	CHECK(bus.Read(0xA000) == 0xFF);						// no cartridge RAM
+	return 0;
+}
+
+int TestMbc1()
+{
+	Rom rom;
+
+	CHECK(LoadCartridge(rom, 0x03, 6, 3));					// 2 MiB ROM, 32 KiB RAM
+	Bus bus(&rom);
+
+	bus.Write(0x2000, 0x00);
+	CHECK(BankAt(bus, 0x4000) == 1);
+	bus.Write(0x2000, 0x05);
+	CHECK(BankAt(bus, 0x4000) == 5);
+	CHECK(bus.CodeBank(0x4000) == 5);
+	bus.Write(0x4000, 0x01);
+	CHECK(BankAt(bus, 0x4000) == 0x25);
+	CHECK(BankAt(bus, 0x3FFE) == 0);
+	bus.Write(0x6000, 0x01);
+	CHECK(BankAt(bus, 0x3FFE) == 0x20);
+	CHECK(bus.Read(0xA000) == 0xFF);
+	bus.Write(0x0000, 0x0A);
+	bus.Write(0xA000, 0x42);								// RAM bank 1
+	bus.Write(0x4000, 0x00);
+	bus.Write(0xA000, 0x24);								// RAM bank 0
+	bus.Write(0x4000, 0x01);
+	CHECK(bus.Read(0xA000) == 0x42);
+	bus.Write(0x0000, 0x00);
+	CHECK(bus.Read(0xA000) == 0xFF);
+	return 0;
+}
+
+int TestMbc2()
+{
+	Rom rom;
+
+	CHECK(LoadCartridge(rom, 0x06, 3, 0));					// 256 KiB ROM
+	Bus bus(&rom);
+
+	bus.Write(0x2100, 0x07);
+	CHECK(BankAt(bus, 0x4000) == 7);
+	bus.Write(0x2100, 0x00);
+	CHECK(BankAt(bus, 0x4000) == 1);
+	bus.Write(0x0000, 0x0A);
+	bus.Write(0xA000, 0xAB);
+	CHECK(bus.Read(0xA000) == 0xFB);
+	CHECK(bus.Read(0xA200) == 0xFB);						// 512 half-bytes, mirrored
+	return 0;
+}
+
+int TestMbc3()
+{
+	Rom rom;
+	u64 clock = 0;
+
+	CHECK(LoadCartridge(rom, 0x10, 6, 3));					// RTC, 2 MiB ROM, 32 KiB RAM
+	rom.GetMbc()->SetClock(&clock);
+	Bus bus(&rom);
+
+	bus.Write(0x2000, 0x7F);
+	CHECK(BankAt(bus, 0x4000) == 0x7F);
+	bus.Write(0x0000, 0x0A);
+	bus.Write(0x4000, 0x03);
+	bus.Write(0xA000, 0x33);
+	bus.Write(0x4000, 0x00);
+	CHECK(bus.Read(0xA000) != 0x33);
+	bus.Write(0x4000, 0x03);
+	CHECK(bus.Read(0xA000) == 0x33);
+
+	clock += RTC_T_CYCLES_PER_SECOND * (3600 + 61);
+	bus.Write(0x6000, 0x00);
+	bus.Write(0x6000, 0x01);
+	bus.Write(0x4000, 0x08);
+	CHECK(bus.Read(0xA000) == 1);
+	bus.Write(0x4000, 0x09);
+	CHECK(bus.Read(0xA000) == 1);
+	bus.Write(0x4000, 0x0A);
+	CHECK(bus.Read(0xA000) == 1);
+	clock += RTC_T_CYCLES_PER_SECOND * 60;
+	CHECK(bus.Read(0xA000) == 1);							// latched until the next 0 -> 1 write
+
+	bus.Write(0x4000, 0x0C);
+	bus.Write(0xA000, 0x40);								// halt
+	clock += RTC_T_CYCLES_PER_SECOND * 86400 * 600;
+	bus.Write(0xA000, 0x00);
+	clock += RTC_T_CYCLES_PER_SECOND * 86400 * 512;
+	bus.Write(0x6000, 0x00);
+	bus.Write(0x6000, 0x01);
+	CHECK(bus.Read(0xA000) == 0x80);						// day counter carry, day 0 again
+	return 0;
+}
+
+int TestMbc5()
+{
+	Rom rom;
+
+	CHECK(LoadCartridge(rom, 0x1B, 8, 4));					// 8 MiB ROM, 128 KiB RAM
+	Bus bus(&rom);
+
+	bus.Write(0x2000, 0xFF);
+	bus.Write(0x3000, 0x01);
+	CHECK(BankAt(bus, 0x4000) == 0x1FF);
+	CHECK(bus.CodeBank(0x7FFF) == 0x1FF);
+	bus.Write(0x2000, 0x00);
+	bus.Write(0x3000, 0x00);
+	CHECK(BankAt(bus, 0x4000) == 0);
+	bus.Write(0x0000, 0x0A);
+	for (u8 bank = 0; bank < 16; bank++) {
+		bus.Write(0x4000, bank);
+		bus.Write(0xBFFF, bank ^ 0x5A);
+	}
+	for (u8 bank = 0; bank < 16; bank++) {
+		bus.Write(0x4000, bank);
+		CHECK(bus.Read(0xBFFF) == (bank ^ 0x5A));
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (TestPlainCartridge() || TestMbc1() || TestMbc2() || TestMbc3() || TestMbc5())
+		return EXIT_FAILURE;
+	spdlog::info("MBC test passed");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <pixel_kernels.h>
+
+/*
+	Runs every kernel of every instruction set the CPU has on random input and checks it
+	against the scalar set, byte for byte. Lengths go from 0 up past a few SIMD widths and
+	buffers start at odd offsets, so the leftover paths and unaligned access are covered.
+*/
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			spdlog::error("{}:{}: {} failed", __FILE__, __LINE__, #cond); \
+			return EXIT_FAILURE; \
+		} \
+	} while (0)
+
+#define MAX_COUNT				200
+#define MAX_TILES				12
+#define ROUNDS					20
+
+int TestIsa(const PixelKernels& simd, const PixelKernels& scalar, std::mt19937& rng)
+{
+	std::vector<u8> input(std::max(MAX_TILES * TILE_BYTES, MAX_COUNT) + 1), expected8(MAX_TILES * TILE_PIXELS + 1), actual8(expected8.size());
+	std::vector<u32> expected32(MAX_COUNT + 1), actual32(expected32.size());
+	std::vector<u16> expected16(MAX_COUNT + 1), actual16(expected16.size());
+	const u8 gray[4] = { 0xFF, 0xAA, 0x55, 0x00 };
+	const u32 rgba[4] = { 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 };
+	const u16 rgb565[4] = { 0xFFFF, 0xAD55, 0x52AA, 0x0000 };
+
+	for (int round = 0; round < ROUNDS; round++) {
+		u32 offset = round & 1;
+		u8 palette = rng();
+
+		for (u8& byte : input)
+			byte = rng();
+		for (u32 tiles = 0; tiles <= MAX_TILES; tiles++) {
+			scalar.decodeTiles(input.data() + offset, expected8.data() + offset, tiles);
+			simd.decodeTiles(input.data() + offset, actual8.data() + offset, tiles);
+			CHECK(std::equal(expected8.begin() + offset, expected8.begin() + offset + tiles * TILE_PIXELS, actual8.begin() + offset));
+		}
+		/* indices and shades above 3 must be masked the same way */
+		for (u32 count = 0; count <= MAX_COUNT; count++) {
+			scalar.mapPalette(input.data() + offset, expected8.data() + offset, count, palette);
+			simd.mapPalette(input.data() + offset, actual8.data() + offset, count, palette);
+			CHECK(std::equal(expected8.begin() + offset, expected8.begin() + offset + count, actual8.begin() + offset));
+			scalar.toGray8(input.data() + offset, expected8.data() + offset, count, gray);
+			simd.toGray8(input.data() + offset, actual8.data() + offset, count, gray);
+			CHECK(std::equal(expected8.begin() + offset, expected8.begin() + offset + count, actual8.begin() + offset));
+			scalar.toRgba8888(input.data() + offset, expected32.data() + offset, count, rgba);
+			simd.toRgba8888(input.data() + offset, actual32.data() + offset, count, rgba);
+			CHECK(std::equal(expected32.begin() + offset, expected32.begin() + offset + count, actual32.begin() + offset));
+			scalar.toRgb565(input.data() + offset, expected16.data() + offset, count, rgb565);
+			simd.toRgb565(input.data() + offset, actual16.data() + offset, count, rgb565);
+			CHECK(std::equal(expected16.begin() + offset, expected16.begin() + offset + count, actual16.begin() + offset));
+		}
+	}
+	return 0;
+}
+
+/* one tile by hand: row 0 is 0x3C/0x7E, the usual top of a rounded box */
+int TestKnownTile()
+{
+	u8 tile[TILE_BYTES] = { 0x3C, 0x7E };
+	u8 pixels[TILE_PIXELS];
+	const u8 row0[8] = { 0, 2, 3, 3, 3, 3, 2, 0 };
+
+	GetPixelKernels(PIXEL_ISA_SCALAR).decodeTiles(tile, pixels, 1);
+	CHECK(std::equal(row0, row0 + 8, pixels));
+	CHECK(std::all_of(pixels + 8, pixels + TILE_PIXELS, [](u8 pixel) { return pixel == 0; }));
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	std::mt19937 rng(0x2BB2);
+	const PixelKernels& scalar = GetPixelKernels(PIXEL_ISA_SCALAR);
+
+	if (TestKnownTile())
+		return EXIT_FAILURE;
+	CHECK(PixelIsaSupported(PIXEL_ISA_SCALAR));
+	CHECK(GetPixelKernels(BestPixelIsa()).isa == BestPixelIsa());
+	for (int isa = PIXEL_ISA_SCALAR + 1; isa < PIXEL_ISA_COUNT; isa++) {
+		const PixelKernels& kernels = GetPixelKernels(static_cast<PixelIsa>(isa));
+
+		/* sets the CPU lacks fall back to one it has */
+		CHECK(PixelIsaSupported(kernels.isa) && kernels.isa <= isa);
+		if (kernels.isa != isa) {
+			spdlog::info("Instruction set {} not on this CPU, skipped", isa);
+			continue;
+		}
+		if (TestIsa(kernels, scalar, rng))
+			return EXIT_FAILURE;
+		spdlog::info("{} kernels match scalar", kernels.name);
+	}
+	spdlog::info("Pixel kernels test passed, best set: {}", GetPixelKernels(BestPixelIsa()).name);
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,462 @@
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <bus.h>
+#include <ppu.h>
+#include <rom.h>
+#include <scheduler.h>
+
+/*
+	Fills VRAM, OAM and the PPU registers with random values, runs whole frames and checks
+	every pixel against a reference that decodes each one straight from VRAM. Between
+	frames random tile bytes are rewritten through the bus, so frames only match if the
+	tile cache dropped exactly the tiles that changed. Also checks LY, the STAT mode and
+	the VBlank interrupt against the line timing, that the render modes only change which
+	frames are drawn, and that frame targets get the same frame in every pixel format.
+	A background turned off shows white whatever BGP holds.
+*/
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			spdlog::error("{}:{}: {} failed", __FILE__, __LINE__, #cond); \
+			return EXIT_FAILURE; \
+		} \
+	} while (0)
+
+#define FRAME_T_CYCLES			(LINE_T_CYCLES * LINES_PER_FRAME)
+#define ROUNDS					40
+#define TILE_WRITES				64
+
+static u64 now;
+
+/* services every event up to end, as the CPU would between instructions */
+void RunTo(Scheduler& scheduler, u64 end)
+{
+	while (scheduler.NextEvent() <= end) {
+		now = scheduler.NextEvent();
+		scheduler.Service(now);
+	}
+	now = end;
+}
+
+u8 TilePixel(const u8* vram, u32 addr, u32 row, u32 x)
+{
+	u8 low = vram[addr + row * 2], high = vram[addr + row * 2 + 1];
+
+	return ((low >> (7 - x)) & 1) | (((high >> (7 - x)) & 1) << 1);
+}
+
+/* one pixel at a time, straight from VRAM and OAM */
+void ReferenceLine(Bus& bus, u8 ly, u32& windowLine, u8* out)
+{
+	const u8* vram = bus.VramData();
+	const u8* oam = bus.OamData();
+	const u8* io = bus.IoRegisters();
+	u8 lcdc = io[0x40], wx = io[0x4B];
+	u32 height = (lcdc & LCDC_OBJ_TALL) ? 16 : 8, count = 0;
+	bool windowUsed = false;
+	int sprites[SPRITES_PER_LINE];
+
+	for (int i = 0; i < OAM_SPRITES && count < SPRITES_PER_LINE; i++) {
+		int row = ly + 16 - oam[i * 4];
+
+		if (row >= 0 && row < (int)height)
+			sprites[count++] = i;
+	}
+	for (u32 x = 0; x < LCD_WIDTH; x++) {
+		u8 index = 0;
+		int best = -1, bestColor = 0;
+
+		if (lcdc & LCDC_BG_ENABLE) {
+			bool window = (lcdc & LCDC_WINDOW_ENABLE) && ly >= io[0x4A] && wx < LCD_WIDTH + 7 && x + 7 >= wx;
+			u32 px = window ? x + 7 - wx : (x + io[0x43]) & 0xFF;
+			u32 py = window ? windowLine : (ly + io[0x42]) & 0xFF;
+			u32 map = (lcdc & (window ? LCDC_WINDOW_MAP_HIGH : LCDC_BG_MAP_HIGH)) ? 0x1C00 : 0x1800;
+			u8 tile = vram[map + (py / 8) * 32 + px / 8];
+			u32 addr = (lcdc & LCDC_TILES_UNSIGNED) ? tile * 16 : 0x1000 + (i8)tile * 16;
+
+			index = TilePixel(vram, addr, py % 8, px % 8);
+			windowUsed |= window;
+		}
+		out[x] = (lcdc & LCDC_BG_ENABLE) ? (io[0x47] >> (index * 2)) & 3 : 0;
+		if (!(lcdc & LCDC_OBJ_ENABLE))
+			continue;
+		for (u32 i = 0; i < count; i++) {
+			const u8* entry = oam + sprites[i] * 4;
+			int sx = x - (entry[1] - 8);
+			u32 row = ly + 16 - entry[0], tile = entry[2];
+			int color;
+
+			if (sx < 0 || sx >= 8 || (best >= 0 && entry[1] >= oam[best * 4 + 1]))
+				continue;
+			if (entry[3] & OBJ_FLIP_Y)
+				row = height - 1 - row;
+			if (height == 16)
+				tile = (tile & 0xFE) + row / 8;
+			color = TilePixel(vram, tile * 16, row % 8, (entry[3] & OBJ_FLIP_X) ? 7 - sx : sx);
+			if (color) {
+				best = sprites[i];
+				bestColor = color;
+			}
+		}
+		if (best >= 0 && (!(oam[best * 4 + 3] & OBJ_BEHIND_BG) || !index))
+			out[x] = (io[(oam[best * 4 + 3] & OBJ_PALETTE1) ? 0x49 : 0x48] >> (bestColor * 2)) & 3;
+	}
+	if (windowUsed)
+		windowLine++;
+}
+
+void Randomize(Bus& bus, std::mt19937& rng)
+{
+	for (u16 addr = 0x8000; addr < 0xA000; addr++)
+		bus.Write(addr, rng());
+	/* Y values bunched around the screen so most lines have sprites, some more than 10 */
+	for (u16 addr = 0xFE00; addr < 0xFEA0; addr++)
+		bus.Write(addr, (addr & 3) == 0 ? 8 + rng() % 160 : (addr & 3) == 1 ? rng() % 176 : rng());
+	for (u16 reg : { REG_SCY, REG_SCX, REG_BGP, REG_OBP0, REG_OBP1 })
+		bus.Write(reg, rng());
+	bus.Write(REG_WY, rng() % 160);
+	bus.Write(REG_WX, rng() % 176);
+	bus.Write(REG_LCDC, rng() | LCDC_LCD_ENABLE);
+}
+
+int TestFrames(PixelIsa isa)
+{
+	std::mt19937 rng(0xB6B6);
+	Rom rom;
+	Bus bus(&rom);
+	Scheduler scheduler;
+	Ppu ppu(&bus, &scheduler);
+	std::array<u8, LCD_WIDTH> reference;
+	u64 frameStart = 0;
+
+	now = 0;
+	scheduler.SetClock(&now);
+	ppu.SetPixelIsa(isa);
+	Randomize(bus, rng);
+	for (int round = 0; round < ROUNDS; round++) {
+		u32 windowLine = 0;
+
+		RunTo(scheduler, frameStart + FRAME_T_CYCLES);
+		frameStart += FRAME_T_CYCLES;
+		for (u8 ly = 0; ly < LCD_HEIGHT; ly++) {
+			ReferenceLine(bus, ly, windowLine, reference.data());
+			CHECK(!std::memcmp(ppu.Framebuffer() + ly * LCD_WIDTH, reference.data(), LCD_WIDTH));
+		}
+		if (round % 8 == 7) {
+			Randomize(bus, rng);
+			continue;
+		}
+		for (int i = 0; i < TILE_WRITES; i++)
+			bus.Write(0x8000 + rng() % (TILE_DATA_END - 0x8000), rng());
+		bus.Write(REG_SCX, rng());
+	}
+
+	const TileCacheStats& stats = ppu.GetTileCacheStats();
+	CHECK(stats.invalidations > 0);
+	CHECK(stats.decodes <= TILE_COUNT + stats.invalidations);
+	CHECK(ppu.FrameCount() == ROUNDS);
+	spdlog::info("PPU frames match with {} kernels: {} tiles decoded, {} dropped by VRAM writes",
+		GetPixelKernels(isa).name, stats.decodes, stats.invalidations);
+
+	/* with rendering off the frame is left alone */
+	std::vector<u8> before(ppu.Framebuffer(), ppu.Framebuffer() + LCD_WIDTH * LCD_HEIGHT);
+	Randomize(bus, rng);
+	ppu.SetRenderEnabled(false);
+	RunTo(scheduler, frameStart + FRAME_T_CYCLES);
+	CHECK(!std::memcmp(before.data(), ppu.Framebuffer(), before.size()));
+	CHECK(ppu.FrameCount() == ROUNDS + 1);
+	return 0;
+}
+
+/* DMG shows white with the background off, even with a BGP that maps index 0 to black */
+int TestBackgroundOff()
+{
+	std::mt19937 rng(0x0B0B);
+	Rom rom;
+	Bus bus(&rom);
+	Scheduler scheduler;
+	Ppu ppu(&bus, &scheduler);
+	const u8* frame = ppu.Framebuffer();
+
+	now = 0;
+	scheduler.SetClock(&now);
+	Randomize(bus, rng);
+	bus.Write(REG_LCDC, LCDC_LCD_ENABLE | LCDC_TILES_UNSIGNED);
+	bus.Write(REG_BGP, 0xFF);
+	RunTo(scheduler, FRAME_T_CYCLES * 2);
+	CHECK(std::all_of(frame, frame + LCD_WIDTH * LCD_HEIGHT, [](u8 shade) { return shade == 0; }));
+	return 0;
+}
+
+int TestTiming()
+{
+	Rom rom;
+	Bus bus(&rom);
+	Scheduler scheduler;
+	Ppu ppu(&bus, &scheduler);
+
+	now = 0;
+	scheduler.SetClock(&now);
+	bus.Write(REG_LCDC, LCDC_LCD_ENABLE);
+	bus.Write(REG_LYC, 10);
+	bus.Write(REG_LY, 77);
+	CHECK(bus.Read(REG_LY) == 0);
+	CHECK((bus.Read(REG_STAT) & 3) == PPU_MODE_OAM_SCAN);
+	RunTo(scheduler, OAM_SCAN_T_CYCLES);
+	CHECK((bus.Read(REG_STAT) & 3) == PPU_MODE_DRAWING);
+	RunTo(scheduler, HBLANK_START_T_CYCLES);
+	CHECK((bus.Read(REG_STAT) & 3) == PPU_MODE_HBLANK);
+	RunTo(scheduler, 10 * LINE_T_CYCLES + 4);
+	CHECK(bus.Read(REG_LY) == 10);
+	CHECK(bus.Read(REG_STAT) & STAT_LYC_EQUAL);
+	CHECK(!(bus.Read(REG_IF) & INT_VBLANK));
+	RunTo(scheduler, LCD_HEIGHT * LINE_T_CYCLES - 1);
+	CHECK(!(bus.Read(REG_IF) & INT_VBLANK));
+	RunTo(scheduler, LCD_HEIGHT * LINE_T_CYCLES);
+	CHECK(bus.Read(REG_IF) & INT_VBLANK);
+	CHECK((bus.Read(REG_STAT) & 3) == PPU_MODE_VBLANK);
+	RunTo(scheduler, FRAME_T_CYCLES);
+	CHECK(bus.Read(REG_LY) == 0);
+	return 0;
+}
+
+/* a headless PPU must look the same from the bus, line by line, as one that draws */
+int TestHeadless()
+{
+	std::mt19937 rngDrawn(0x5EED), rngHeadless(0x5EED);
+	Rom romDrawn, romHeadless;
+	Bus drawn(&romDrawn), headless(&romHeadless);
+	Scheduler schedulerDrawn, schedulerHeadless;
+	Ppu ppuDrawn(&drawn, &schedulerDrawn), ppuHeadless(&headless, &schedulerHeadless);
+
+	now = 0;
+	schedulerDrawn.SetClock(&now);
+	schedulerHeadless.SetClock(&now);
+	ppuHeadless.SetRenderMode(RENDER_NONE);
+	Randomize(drawn, rngDrawn);
+	Randomize(headless, rngHeadless);
+	for (u64 cycle = 0; cycle < 3 * FRAME_T_CYCLES; cycle += 76) {
+		RunTo(schedulerDrawn, cycle);
+		RunTo(schedulerHeadless, cycle);
+		for (u16 reg : { REG_LY, REG_STAT, REG_IF })
+			CHECK(drawn.Read(reg) == headless.Read(reg));
+	}
+	/* frame 0 was already under way when the mode was set */
+	CHECK(ppuDrawn.RenderedFrame() == 3 && ppuHeadless.RenderedFrame() == 1);
+	return 0;
+}
+
+/* runs frame after frame and returns the frames that were drawn, as their FrameCount() */
+std::vector<u64> DrawnFrames(RenderMode mode, u32 interval, u32 frames, const std::vector<u32>& requests)
+{
+	std::mt19937 rng(0x7A7A);
+	Rom rom;
+	Bus bus(&rom);
+	Scheduler scheduler;
+	Ppu ppu(&bus, &scheduler);
+	std::vector<u64> drawn;
+	std::array<u8, LCD_WIDTH> reference;
+
+	now = 0;
+	scheduler.SetClock(&now);
+	ppu.SetRenderMode(mode, interval);
+	Randomize(bus, rng);
+	for (u32 frame = 0; frame < frames; frame++) {
+		u32 windowLine = 0;
+
+		/* a request in the middle of a frame is for the next one */
+		RunTo(scheduler, frame * FRAME_T_CYCLES + FRAME_T_CYCLES / 2);
+		if (std::find(requests.begin(), requests.end(), frame) != requests.end())
+			ppu.RequestFrame();
+		RunTo(scheduler, (frame + 1) * FRAME_T_CYCLES);
+		if (ppu.RenderedFrame() != frame + 1)
+			continue;
+		for (u8 ly = 0; ly < LCD_HEIGHT; ly++) {
+			ReferenceLine(bus, ly, windowLine, reference.data());
+			if (std::memcmp(ppu.Framebuffer() + ly * LCD_WIDTH, reference.data(), LCD_WIDTH))
+				return {};
+		}
+		drawn.push_back(frame + 1);
+	}
+	return drawn;
+}
+
+int TestRenderModes()
+{
+	CHECK(DrawnFrames(RENDER_ALL, 1, 4, {}) == std::vector<u64>({ 1, 2, 3, 4 }));
+	CHECK(DrawnFrames(RENDER_EVERY_NTH, 3, 8, {}) == std::vector<u64>({ 1, 4, 7 }));
+	CHECK(DrawnFrames(RENDER_EVERY_NTH, 0, 3, {}) == std::vector<u64>({ 1, 2, 3 }));
+	CHECK(DrawnFrames(RENDER_ON_REQUEST, 1, 8, { 2, 5 }) == std::vector<u64>({ 1, 4, 7 }));
+	CHECK(DrawnFrames(RENDER_NONE, 1, 4, {}) == std::vector<u64>({ 1 }));
+	return 0;
+}
+
+/* the same frame again into each format, rows padded so stride mistakes show */
+int TestFrameTargets()
+{
+	std::mt19937 rng(0x3C3C);
+	Rom rom;
+	Bus bus(&rom);
+	Scheduler scheduler;
+	Ppu ppu(&bus, &scheduler);
+	const u32 bytes[PIXEL_FORMAT_COUNT] = { 1, 1, 2, 4 };
+	const u32 colors[PIXEL_FORMAT_COUNT][4] = {
+		{ 0, 1, 2, 3 }, { 0xFF, 0xAA, 0x55, 0x00 }, { 0xFFFF, 0xAD55, 0x52AA, 0x0000 },
+		{ 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 },
+	};
+	u64 frameStart = FRAME_T_CYCLES;
+
+	now = 0;
+	scheduler.SetClock(&now);
+	Randomize(bus, rng);
+	RunTo(scheduler, 2 * FRAME_T_CYCLES);
+	std::vector<u8> shades(ppu.Framebuffer(), ppu.Framebuffer() + LCD_WIDTH * LCD_HEIGHT);
+
+	for (int format = 0; format < PIXEL_FORMAT_COUNT; format++) {
+		u32 stride = LCD_WIDTH * bytes[format] + 12;
+		std::vector<u32> memory((stride * LCD_HEIGHT + 3) / 4, 0xDEADBEEF);
+		FrameTarget target = { memory.data(), stride, static_cast<PixelFormat>(format) };
+		const u8* pixels = reinterpret_cast<const u8*>(memory.data());
+
+		target.stride = LCD_WIDTH * bytes[format] - 1;
+		CHECK(ppu.SetFrameTarget(&target) == STT_FAILED);
+		target.stride = stride;
+		CHECK(ppu.SetFrameTarget(&target) == STT_SUCCESS);
+		frameStart += FRAME_T_CYCLES;
+		RunTo(scheduler, frameStart + FRAME_T_CYCLES);
+		for (u32 y = 0; y < LCD_HEIGHT; y++) {
+			for (u32 x = 0; x < LCD_WIDTH; x++) {
+				u32 pixel = 0;
+
+				std::memcpy(&pixel, pixels + y * stride + x * bytes[format], bytes[format]);
+				CHECK(pixel == colors[format][shades[y * LCD_WIDTH + x]]);
+			}
+			if (y + 1 < LCD_HEIGHT)
+				CHECK(pixels[y * stride + LCD_WIDTH * bytes[format]] == 0xEF);
+		}
+	}
+	CHECK(ppu.SetFrameTarget(nullptr) == STT_SUCCESS && ppu.GetFrameTarget().pixels == ppu.Framebuffer());
+	return 0;
+}
+
+typedef struct Machine {
+	Rom rom;
+	Bus bus;
+	Scheduler scheduler;
+	Ppu ppu;
+	std::mt19937 rng;
+	BusSaveState busSave;
+	PpuSaveState ppuSave;
+
+	Machine() : bus(&rom), ppu(&bus, &scheduler), rng(0x9191)
+	{
+		scheduler.SetClock(&now);
+	}
+} Machine;
+
+/* a few VRAM, OAM and register writes, as a game would make between two points of a line */
+void Scribble(Bus& bus, std::mt19937& rng)
+{
+	const u16 regs[] = { REG_SCY, REG_SCX, REG_BGP, REG_OBP0, REG_OBP1, REG_WY, REG_WX };
+
+	for (int i = 0; i < 6; i++)
+		bus.Write(0x8000 + rng() % 0x2000, rng());
+	for (int i = 0; i < 2; i++)
+		bus.Write(0xFE00 + rng() % (OAM_SPRITES * 4), rng());
+	bus.Write(regs[rng() % std::size(regs)], rng());
+	if (rng() % 128 == 0)
+		bus.Write(REG_LCDC, rng() | LCDC_LCD_ENABLE);
+}
+
+/*
+	Two machines get the same writes at the same points, one drawing in place and one on
+	the render thread. After every frame the pipelined one is synced and both must match:
+	with writes mid-line, skipped frames, a state loaded mid-frame (at the point of the frame
+	it was saved at, so frames stay aligned with the checks), RGBA targets, the LCD
+	turned off in the middle of a frame and the pipeline stopped half way through one.
+*/
+int TestPipelined()
+{
+	std::unique_ptr<Machine> inPlace = std::make_unique<Machine>(), piped = std::make_unique<Machine>();
+	std::vector<u32> inPlacePixels(LCD_WIDTH * LCD_HEIGHT), pipedPixels(LCD_WIDTH * LCD_HEIGHT);
+	FrameTarget inPlaceTarget = { inPlacePixels.data(), LCD_WIDTH * 4, PIXEL_FORMAT_RGBA8888 };
+	FrameTarget pipedTarget = { pipedPixels.data(), LCD_WIDTH * 4, PIXEL_FORMAT_RGBA8888 };
+	u64 end = 0;
+
+	now = 0;
+	for (Machine* machine : { inPlace.get(), piped.get() })
+		Randomize(machine->bus, machine->rng);
+	piped->ppu.SetPipelined(true);
+	for (u32 frame = 0; frame < 30; frame++) {
+		for (Machine* machine : { inPlace.get(), piped.get() }) {
+			if (frame == 8)
+				machine->ppu.SetRenderMode(RENDER_EVERY_NTH, 3);
+			if (frame == 14)
+				machine->ppu.SetRenderMode(RENDER_ALL);
+		}
+		if (frame == 18) {
+			CHECK(inPlace->ppu.SetFrameTarget(&inPlaceTarget) == STT_SUCCESS);
+			CHECK(piped->ppu.SetFrameTarget(&pipedTarget) == STT_SUCCESS);
+		}
+		if (frame == 22) {
+			inPlace->ppu.SetFrameTarget(nullptr);
+			piped->ppu.SetFrameTarget(nullptr);
+		}
+		for (u64 at = end + 152; at < end + FRAME_T_CYCLES; at += 152) {
+			for (Machine* machine : { inPlace.get(), piped.get() }) {
+				RunTo(machine->scheduler, at);
+				Scribble(machine->bus, machine->rng);
+				if (frame == 5 && at - end == 152 * 300) {
+					machine->bus.SaveState(machine->busSave);
+					machine->ppu.SaveState(machine->ppuSave);
+				}
+				if (frame == 11 && at - end == 152 * 300) {
+					machine->bus.LoadState(machine->busSave);
+					machine->ppu.LoadState(machine->ppuSave);
+				}
+			}
+		}
+		end += FRAME_T_CYCLES;
+		RunTo(inPlace->scheduler, end);
+		RunTo(piped->scheduler, end);
+		piped->ppu.Sync();
+		CHECK(!std::memcmp(inPlace->ppu.Framebuffer(), piped->ppu.Framebuffer(), LCD_WIDTH * LCD_HEIGHT));
+		CHECK(inPlace->ppu.RenderedFrame() == piped->ppu.RenderedFrame());
+		CHECK(inPlacePixels == pipedPixels);
+	}
+
+	/* the LCD goes off at line 40 and back on, then the pipeline stops at line 90 */
+	for (Machine* machine : { inPlace.get(), piped.get() }) {
+		RunTo(machine->scheduler, end + 40 * LINE_T_CYCLES);
+		machine->bus.Write(REG_LCDC, machine->bus.Read(REG_LCDC) & ~LCDC_LCD_ENABLE);
+		RunTo(machine->scheduler, end + 50 * LINE_T_CYCLES);
+		machine->bus.Write(REG_LCDC, machine->bus.Read(REG_LCDC) | LCDC_LCD_ENABLE);
+		RunTo(machine->scheduler, end + 140 * LINE_T_CYCLES);
+	}
+	piped->ppu.SetPipelined(false);
+	CHECK(!piped->ppu.IsPipelined());
+	CHECK(!std::memcmp(inPlace->ppu.Framebuffer(), piped->ppu.Framebuffer(), LCD_WIDTH * LCD_HEIGHT));
+	/* the render thread's tile cache did the decoding, and its counts were handed back */
+	CHECK(piped->ppu.GetTileCacheStats().decodes > 0);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	for (int isa = PIXEL_ISA_SCALAR; isa < PIXEL_ISA_COUNT; isa++) {
+		if (TestFrames(static_cast<PixelIsa>(isa)))
+			return EXIT_FAILURE;
+	}
+	if (TestBackgroundOff() || TestTiming() || TestHeadless() || TestRenderModes() || TestFrameTargets() || TestPipelined())
+		return EXIT_FAILURE;
+	spdlog::info("PPU test passed");
+	return 0;
+}
\ No newline at end of file
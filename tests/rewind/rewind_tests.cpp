@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <emulator.h>
+#include <rewind.h>
+#include <test_cartridge.h>
+
+/*
+	Records the banking test cartridge, which changes WRAM, cartridge RAM and the ROM bank
+	all the time, and steps back to frames between snapshots: the machine must end up in
+	exactly the state it had when that frame was first run. A small ring must evict whole
+	groups and refuse to go back past its oldest snapshot.
+*/
+
+#define RUN_FRAMES				600
+#define REFERENCE_FRAMES		{ 97, 342, 517, 598 }
+
+std::vector<u64> SaveState(Emulator& emulator)
+{
+	std::vector<u64> state((emulator.SaveStateSize() + 7) / 8);
+
+	emulator.SaveState(reinterpret_cast<u8*>(state.data()), emulator.SaveStateSize());
+	return state;
+}
+
+int main(int argc, char* argv[])
+{
+	std::filesystem::path romPath = WriteBankingCartridge("usagbi_rewind_test.gb");
+	Emulator emulator;
+	std::map<u64, std::vector<u64>> references;
+	std::vector<u64> referenceFrames = REFERENCE_FRAMES;
+	Rewinder rewinder(&emulator, REWIND_DEFAULT_CAPACITY, 4, 16);
+	Rewinder small(&emulator, 64 * KiB, 4, 16);
+
+	CHECK(emulator.Load(romPath.string().c_str()) == STT_SUCCESS);
+	std::filesystem::remove(romPath);
+	for (u64 frame = 1; frame <= RUN_FRAMES; frame++) {
+		CHECK(emulator.RunFrame() == STT_SUCCESS);
+		rewinder.Record();
+		small.Record();
+		if (std::find(referenceFrames.begin(), referenceFrames.end(), frame) != referenceFrames.end())
+			references[frame] = SaveState(emulator);
+	}
+
+	RewindStats stats = rewinder.Stats();
+	RewindStats smallStats = small.Stats();
+	CHECK(stats.snapshots == RUN_FRAMES / 4 && stats.keyframes == (RUN_FRAMES / 4 + 16) / 17 && !stats.dropped);
+	CHECK(stats.bytesUsed <= stats.capacity);
+	CHECK(smallStats.bytesUsed <= 64 * KiB && smallStats.snapshots < stats.snapshots && smallStats.keyframes >= 1);
+	CHECK(small.StepBack(RUN_FRAMES - 8) == STT_FAILED);
+	spdlog::info("{:.1f} s of history in {} KiB, {:.0f} KiB per second; 64 KiB ring: {:.1f} s",
+		stats.secondsOfHistory, stats.bytesUsed / KiB, stats.bytesPerSecond / KiB, smallStats.secondsOfHistory);
+
+	/* newest reference first: every step back drops the snapshots after its target */
+	for (auto it = references.rbegin(); it != references.rend(); it++) {
+		CHECK(rewinder.StepBack(emulator.GetFrameCount() - it->first) == STT_SUCCESS);
+		CHECK(emulator.GetFrameCount() == it->first);
+		CHECK(SaveState(emulator) == it->second);
+		spdlog::info("Back to frame {}: {:.0f} us", it->first, rewinder.Stats().lastRewindMicros);
+	}
+	CHECK(rewinder.Stats().snapshots == 97 / 4);
+
+	/* history recorded again after a rewind replays the same way */
+	while (emulator.GetFrameCount() < 342) {
+		CHECK(emulator.RunFrame() == STT_SUCCESS);
+		rewinder.Record();
+	}
+	CHECK(SaveState(emulator) == references[342]);
+	CHECK(rewinder.StepBack(342 - 97) == STT_SUCCESS);
+	CHECK(SaveState(emulator) == references[97]);
+	CHECK(rewinder.StepBack(98) == STT_FAILED);
+
+	stats = rewinder.Stats();
+	spdlog::info("Rewind test passed: {} rewinds, {:.0f} us per second of history stepped back",
+		stats.rewinds, stats.rewindMicrosPerSecond);
+	return 0;
+}
\ No newline at end of file
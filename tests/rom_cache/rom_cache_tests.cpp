@@ -0,0 +1,62 @@
+#include <filesystem>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <rom.h>
+#include <rom_cache.h>
+#include <test_cartridge.h>
+
+/*
+	Loads the same cartridge through one path several times and through a copy of the file,
+	then checks that every Rom reads from the same image, that a cached path loads after
+	the file is gone and that unused images are purged.
+*/
+
+std::filesystem::path WriteCartridge(const std::string& name, u8 romSizeCode, u8 fill)
+{
+	std::vector<u8> image((32 * KiB) << romSizeCode, fill);
+
+	WriteHeader(image, 0x01, romSizeCode, 0x00);
+	return SaveCartridge(image, name);
+}
+
+int main(int argc, char* argv[])
+{
+	std::filesystem::path first = WriteCartridge("usagbi_cache_a.gb", 2, 0x11);
+	std::filesystem::path copy = WriteCartridge("usagbi_cache_b.gb", 2, 0x11), other = WriteCartridge("usagbi_cache_c.gb", 2, 0x22);
+	RomCache& cache = RomCache::Instance();
+
+	{
+		Rom a, b, c, d;
+
+		CHECK(a.Load(first.string().c_str()) == STT_SUCCESS);
+		CHECK(b.Load(first.string().c_str()) == STT_SUCCESS);
+		CHECK(c.Load(copy.string().c_str()) == STT_SUCCESS);
+		CHECK(d.Load(other.string().c_str()) == STT_SUCCESS);
+		CHECK(a.RomBankData(0) == b.RomBankData(0));
+		CHECK(a.RomBankData(0) == c.RomBankData(0));
+		CHECK(a.RomBankData(0) != d.RomBankData(0));
+		CHECK(a.RomBankData(7)[0] == 0x11 && d.RomBankData(7)[0] == 0x22);
+		CHECK(a.GetMbc() != b.GetMbc());				// bank state stays per instance
+
+		RomCacheStats stats = cache.Stats();
+		CHECK(stats.loaded == 2 && stats.shared == 1 && stats.hits == 1);
+
+		std::filesystem::remove(first);
+		std::filesystem::remove(copy);
+		std::filesystem::remove(other);
+		Rom e;
+		CHECK(e.Load(first.string().c_str()) == STT_SUCCESS);
+		CHECK(e.RomBankData(3) == a.RomBankData(3));
+		CHECK(cache.Size() == 3);
+	}
+	cache.Purge();
+	CHECK(cache.Size() == 0);
+
+	Rom missing;
+	CHECK(missing.Load(first.string().c_str()) != STT_SUCCESS);
+	spdlog::info("ROM cache test passed");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#include <filesystem>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <emulator.h>
+#include <run_ahead.h>
+#include <test_cartridge.h>
+
+/*
+	Runs the banking test cartridge with and without run-ahead. Whatever the speculative
+	frames did, after every host frame both machines must be in the same state, and output
+	must be back on. Reports the host time run-ahead adds per frame.
+*/
+
+#define HOST_FRAMES				120
+#define RUN_AHEAD_FRAMES		2
+
+std::vector<u64> SaveState(Emulator& emulator)
+{
+	std::vector<u64> state((emulator.SaveStateSize() + 7) / 8);
+
+	emulator.SaveState(reinterpret_cast<u8*>(state.data()), emulator.SaveStateSize());
+	return state;
+}
+
+int main(int argc, char* argv[])
+{
+	std::filesystem::path romPath = WriteBankingCartridge("usagbi_run_ahead_test.gb");
+	Emulator plain, ahead;
+	RunAhead runAhead(&ahead, RUN_AHEAD_FRAMES);
+
+	CHECK(plain.Load(romPath.string().c_str()) == STT_SUCCESS);
+	CHECK(ahead.Load(romPath.string().c_str()) == STT_SUCCESS);
+	std::filesystem::remove(romPath);
+	for (int frame = 0; frame < HOST_FRAMES; frame++) {
+		if (frame == HOST_FRAMES / 2)
+			runAhead.SetFrames(1);
+		CHECK(plain.RunFrame() == STT_SUCCESS);
+		CHECK(runAhead.RunFrame() == STT_SUCCESS);
+		CHECK(ahead.IsOutputEnabled());
+		CHECK(ahead.GetFrameCount() == plain.GetFrameCount());
+		CHECK(SaveState(ahead) == SaveState(plain));
+	}
+
+	const RunAheadStats& stats = runAhead.Stats();
+	CHECK(stats.frames == HOST_FRAMES);
+	spdlog::info("Run-ahead test passed: {:.0f} us per real frame, {:.0f} us added by run-ahead", stats.frameMicros,
+		stats.addedMicros);
+	return 0;
+}
\ No newline at end of file
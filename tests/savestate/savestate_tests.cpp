@@ -0,0 +1,104 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <emulator.h>
+#include <test_cartridge.h>
+
+/*
+	Runs a cartridge that keeps changing WRAM, cartridge RAM and the ROM bank, and one with
+	no cartridge RAM at all, saves a state, runs on, then loads the state and runs the same
+	frames again: both runs must end in the same state, byte for byte. Also checks that
+	damaged states are refused and reports how long a save and a load take.
+*/
+
+#define WARMUP_FRAMES			30
+#define REPLAY_FRAMES			20
+#define TIMING_ROUNDS			20000
+
+/*
+	0150: LD HL, C000
+	0153: INC (HL) / LD A, (HL) / ADD A, B / LD B, A / JR 0153		WRAM only, the cartridge has no RAM
+*/
+static const std::vector<u8> romOnlyProgram = {
+	0x21, 0x00, 0xC0,
+	0x34, 0x7E, 0x80, 0x47, 0x18, 0xFA,
+};
+
+/* save, run on, load and run the same frames again: both runs must end in the same state */
+int TestReplay(const char* romPath)
+{
+	Emulator emulator;
+	std::vector<u64> saved, first, replay;
+	size_t size;
+
+	CHECK(emulator.Load(romPath) == STT_SUCCESS);
+	size = emulator.SaveStateSize();
+	/* u64 storage keeps the buffers 8-byte aligned */
+	saved.resize((size + 7) / 8);
+	first.resize(saved.size());
+	replay.resize(saved.size());
+	for (int i = 0; i < WARMUP_FRAMES; i++)
+		CHECK(emulator.RunFrame() == STT_SUCCESS);
+	CHECK(emulator.SaveState(reinterpret_cast<u8*>(saved.data()), size) == size);
+	for (int i = 0; i < REPLAY_FRAMES; i++)
+		CHECK(emulator.RunFrame() == STT_SUCCESS);
+	CHECK(emulator.SaveState(reinterpret_cast<u8*>(first.data()), size) == size);
+	CHECK(std::memcmp(first.data(), saved.data(), size));
+	CHECK(emulator.LoadState(reinterpret_cast<u8*>(saved.data()), size) == STT_SUCCESS);
+	for (int i = 0; i < REPLAY_FRAMES; i++)
+		CHECK(emulator.RunFrame() == STT_SUCCESS);
+	CHECK(emulator.SaveState(reinterpret_cast<u8*>(replay.data()), size) == size);
+	CHECK(!std::memcmp(first.data(), replay.data(), size));
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	std::filesystem::path romOnlyPath = WriteProgramCartridge("usagbi_savestate_rom_only.gb", romOnlyProgram);
+	std::filesystem::path romPath = WriteBankingCartridge("usagbi_savestate_test.gb");
+	int failed = TestReplay(romOnlyPath.string().c_str()) || TestReplay(romPath.string().c_str());
+	Emulator emulator;
+	std::vector<u64> saved, damaged;
+	size_t size;
+
+	std::filesystem::remove(romOnlyPath);
+	CHECK(!failed);
+	CHECK(emulator.Load(romPath.string().c_str()) == STT_SUCCESS);
+	std::filesystem::remove(romPath);
+	size = emulator.SaveStateSize();
+	/* u64 storage keeps the buffers 8-byte aligned */
+	saved.resize((size + 7) / 8);
+	u8* savedBytes = reinterpret_cast<u8*>(saved.data());
+
+	for (int i = 0; i < WARMUP_FRAMES; i++)
+		CHECK(emulator.RunFrame() == STT_SUCCESS);
+	CHECK(emulator.SaveState(savedBytes, size) == size);
+	damaged.resize(saved.size());
+	CHECK(emulator.SaveState(reinterpret_cast<u8*>(damaged.data()), size - 1) == 0);
+
+	damaged = saved;
+	reinterpret_cast<SaveStateHeader*>(damaged.data())->version++;
+	CHECK(emulator.LoadState(reinterpret_cast<u8*>(damaged.data()), size) == STT_FAILED);
+	damaged = saved;
+	reinterpret_cast<SaveStateHeader*>(damaged.data())->romHash ^= 1;
+	CHECK(emulator.LoadState(reinterpret_cast<u8*>(damaged.data()), size) == STT_FAILED);
+	CHECK(emulator.LoadState(savedBytes, size / 2) == STT_FAILED);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < TIMING_ROUNDS; i++)
+		emulator.SaveState(savedBytes, size);
+	auto middle = std::chrono::steady_clock::now();
+	for (int i = 0; i < TIMING_ROUNDS; i++)
+		emulator.LoadState(savedBytes, size);
+	auto end = std::chrono::steady_clock::now();
+
+	spdlog::info("Savestate test passed: {} bytes, {:.2f} us per save, {:.2f} us per load", size,
+		std::chrono::duration<double, std::micro>(middle - start).count() / TIMING_ROUNDS,
+		std::chrono::duration<double, std::micro>(end - middle).count() / TIMING_ROUNDS);
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include <map>
+#include <random>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <bus.h>
+#include <cpu.h>
+#include <scheduler.h>
+
+/*
+	Checks the scheduler heap against a plain map under random schedule/cancel/service
+	calls, then runs a CPU with a periodic event and checks that it fires the right number
+	of times, never early and never more than one instruction late, whether the code runs
+	from the JIT, from blocks or through the interpreter.
+*/
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			spdlog::error("{}:{}: {} failed", __FILE__, __LINE__, #cond); \
+			return EXIT_FAILURE; \
+		} \
+	} while (0)
+
+#define RANDOM_OPS				100000
+#define LINE_T_CYCLES			456
+#define MAX_INSTR_T_CYCLES		24
+#define RUN_T_CYCLES			(70224 * 4)
+
+/* (type, deadline) of every event the last Service() call ran */
+static std::vector<std::pair<u8, u64>> fired;
+
+void Record(void* ctx, u64 when)
+{
+	fired.push_back({ static_cast<u8>(reinterpret_cast<uintptr_t>(ctx)), when });
+}
+
+int TestHeap()
+{
+	std::mt19937 rng(0x5C4E);
+	std::map<u8, u64> reference;
+	Scheduler scheduler;
+	u64 now = 0;
+
+	for (u8 type = 0; type < EVENT_TYPE_COUNT; type++)
+		scheduler.SetHandler(type, Record, reinterpret_cast<void*>((uintptr_t)type));
+	for (int i = 0; i < RANDOM_OPS; i++) {
+		u8 type = rng() % EVENT_TYPE_COUNT;
+		u32 roll = rng() % 8;
+
+		if (roll < 5) {
+			u64 when = now + rng() % 1000;
+
+			scheduler.Schedule(type, when);
+			reference[type] = when;
+		} else if (roll < 6) {
+			scheduler.Cancel(type);
+			reference.erase(type);
+		} else {
+			now += rng() % 300;
+			fired.clear();
+			scheduler.Service(now);
+			for (auto& event : fired) {
+				CHECK(reference.count(event.first) && reference[event.first] == event.second);
+				CHECK(event.second <= now);
+				reference.erase(event.first);
+			}
+			for (size_t j = 1; j < fired.size(); j++)
+				CHECK(fired[j - 1].second <= fired[j].second);
+		}
+
+		u64 next = EVENT_NONE;
+		for (auto& entry : reference)
+			next = std::min(next, entry.second);
+		CHECK(scheduler.NextEvent() == next);
+		CHECK(scheduler.Deadline(type) == (reference.count(type) ? reference[type] : EVENT_NONE));
+	}
+	return 0;
+}
+
+typedef struct LineCounter {
+	Scheduler* scheduler;
+	const u64* clock;
+	u64 lines;
+	u64 maxLate;
+	bool early;
+} LineCounter;
+
+void LineEvent(void* ctx, u64 when)
+{
+	LineCounter* counter = static_cast<LineCounter*>(ctx);
+
+	counter->lines++;
+	counter->early |= *counter->clock < when;
+	counter->maxLate = std::max(counter->maxLate, *counter->clock - when);
+	counter->scheduler->Schedule(EVENT_PPU_LINE, when + LINE_T_CYCLES);
+}
+
+void FillProgram(Bus& bus)
+{
+	std::mt19937 rng(0xE7E7);
+	std::vector<u8> ops = { 0x00, 0x03, 0x04, 0x05, 0x07, 0x0B, 0x0C, 0x0D, 0x0F, 0x13, 0x14, 0x15, 0x17, 0x1B };
+
+	for (int op = 0x40; op <= 0xBF; op++) {
+		if ((op & 0x07) != 0x06 && !IN_RANGE(op, 0x70, 0x77))
+			ops.push_back(op);
+	}
+	for (u32 addr = 0; addr < 0x10000; addr++)
+		bus.Write(addr, ops[rng() % ops.size()]);
+}
+
+int TestCpu(bool blockCache, bool jit, bool byInstructions)
+{
+	Bus bus;
+	Cpu cpu(&bus);
+	Scheduler scheduler;
+	LineCounter counter = { &scheduler, cpu.GetCycleCounter(), 0, 0, false };
+
+	FillProgram(bus);
+	cpu.SetBlockCacheEnabled(blockCache);
+	cpu.SetJitEnabled(jit);
+	scheduler.SetClock(cpu.GetCycleCounter());
+	scheduler.SetHandler(EVENT_PPU_LINE, LineEvent, &counter);
+	scheduler.Schedule(EVENT_PPU_LINE, LINE_T_CYCLES);
+	cpu.SetScheduler(&scheduler);
+	if (byInstructions) {
+		while (cpu.GetCycleCount() < RUN_T_CYCLES)
+			cpu.RunInstructions(1000);
+	} else {
+		cpu.RunFor(RUN_T_CYCLES);
+	}
+
+	CHECK(!counter.early);
+	CHECK(counter.maxLate < MAX_INSTR_T_CYCLES);
+	CHECK(counter.lines == cpu.GetCycleCount() / LINE_T_CYCLES);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (TestHeap() || TestCpu(true, true, false) || TestCpu(true, false, false) || TestCpu(false, false, false)
+			|| TestCpu(true, true, true))
+		return EXIT_FAILURE;
+	spdlog::info("Scheduler test passed");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include <random>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <bus.h>
+#include <rom.h>
+#include <scheduler.h>
+#include <timer.h>
+
+/*
+	Runs the lazy timer next to a reference that ticks a 16-bit counter every T-cycle and
+	clocks TIMA on each falling edge of the selected bit, with random writes to DIV, TIMA,
+	TMA, TAC and IF at random times, and checks DIV, TIMA and the timer interrupt after
+	every step. Also checks the DIV and TAC write glitches on their own and that a stopped
+	timer leaves nothing on the scheduler.
+*/
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			spdlog::error("{}:{}: {} failed", __FILE__, __LINE__, #cond); \
+			return EXIT_FAILURE; \
+		} \
+	} while (0)
+
+#define RANDOM_STEPS			200000
+#define MAX_STEP_T_CYCLES		2048
+
+static u64 now;
+
+/* services every event up to end, as the CPU would between instructions */
+void RunTo(Scheduler& scheduler, u64 end)
+{
+	while (scheduler.NextEvent() <= end) {
+		now = scheduler.NextEvent();
+		scheduler.Service(now);
+	}
+	now = end;
+}
+
+/* the timer as the hardware builds it, one T-cycle at a time */
+typedef struct ReferenceTimer {
+	u16 counter = 0;
+	u8 tima = 0, tma = 0, tac = 0;
+	bool interrupt = false;
+
+	bool Signal() const
+	{
+		static const u32 bits[4] = { 9, 3, 5, 7 };
+
+		return (tac & TAC_ENABLE) && ((counter >> bits[tac & TAC_CLOCK_MASK]) & 1);
+	}
+	void Clock()
+	{
+		if (++tima == 0) {
+			tima = tma;
+			interrupt = true;
+		}
+	}
+	void Step()
+	{
+		bool before = Signal();
+
+		counter++;
+		if (before && !Signal())
+			Clock();
+	}
+	void WriteDivOrTac(u16 addr, u8 val)
+	{
+		bool before = Signal();
+
+		if (addr == REG_DIV)
+			counter = 0;
+		else
+			tac = val & 7;
+		if (before && !Signal())
+			Clock();
+	}
+} ReferenceTimer;
+
+int TestRandom()
+{
+	std::mt19937 rng(0x71AA);
+	Rom rom;
+	Bus bus(&rom);
+	Scheduler scheduler;
+	Timer timer(&bus, &scheduler);
+	ReferenceTimer ref;
+
+	now = 0;
+	scheduler.SetClock(&now);
+	for (int i = 0; i < RANDOM_STEPS; i++) {
+		/* mostly short steps, so writes land close to edges and overflows */
+		u64 end = now + ((rng() % 4) ? rng() % 64 : rng() % MAX_STEP_T_CYCLES);
+		u32 roll = rng() % 16;
+		u8 val = rng();
+
+		while (now < end) {
+			ref.Step();
+			now++;
+		}
+		RunTo(scheduler, end);
+		if (roll == 0) {
+			bus.Write(REG_DIV, val);
+			ref.WriteDivOrTac(REG_DIV, val);
+		} else if (roll == 1) {
+			bus.Write(REG_TAC, val);
+			ref.WriteDivOrTac(REG_TAC, val);
+		} else if (roll == 2) {
+			bus.Write(REG_TIMA, val);
+			ref.tima = val;
+		} else if (roll == 3) {
+			/* TMA near the top overflows often */
+			val |= (rng() % 2) ? 0xF0 : 0;
+			bus.Write(REG_TMA, val);
+			ref.tma = val;
+		} else if (roll == 4) {
+			bus.Write(REG_IF, 0);
+			ref.interrupt = false;
+		}
+		CHECK(bus.Read(REG_DIV) == (ref.counter >> 8));
+		CHECK(bus.Read(REG_TIMA) == ref.tima);
+		CHECK(bus.Read(REG_TMA) == ref.tma);
+		CHECK(bus.Read(REG_TAC) == (ref.tac | 0xF8));
+		CHECK(!!(bus.Read(REG_IF) & INT_TIMER) == ref.interrupt);
+		CHECK(scheduler.IsScheduled(EVENT_TIMER_OVERFLOW) == !!(ref.tac & TAC_ENABLE));
+	}
+	return 0;
+}
+
+int TestGlitches()
+{
+	Rom rom;
+	Bus bus(&rom);
+	Scheduler scheduler;
+	Timer timer(&bus, &scheduler);
+
+	now = 0;
+	scheduler.SetClock(&now);
+	/* 262144 Hz: bit 3 of the counter */
+	bus.Write(REG_TAC, TAC_ENABLE | 1);
+	CHECK(scheduler.IsScheduled(EVENT_TIMER_OVERFLOW));
+	CHECK(scheduler.Deadline(EVENT_TIMER_OVERFLOW) == 0x100 * 16);
+	RunTo(scheduler, 8);
+	CHECK(bus.Read(REG_TIMA) == 0);
+	bus.Write(REG_DIV, 0x55);
+	CHECK(bus.Read(REG_DIV) == 0);
+	CHECK(bus.Read(REG_TIMA) == 1);
+	RunTo(scheduler, 8 + 15);
+	CHECK(bus.Read(REG_TIMA) == 1);
+	RunTo(scheduler, 8 + 16);
+	CHECK(bus.Read(REG_TIMA) == 2);
+	/* bit 3 set again: switching to bit 9, which is clear, is an edge; so is stopping */
+	RunTo(scheduler, 8 + 24);
+	bus.Write(REG_TAC, TAC_ENABLE | 0);
+	CHECK(bus.Read(REG_TIMA) == 3);
+	bus.Write(REG_TAC, TAC_ENABLE | 1);
+	bus.Write(REG_TAC, 1);
+	CHECK(bus.Read(REG_TIMA) == 4);
+	CHECK(!scheduler.IsScheduled(EVENT_TIMER_OVERFLOW));
+	RunTo(scheduler, 0x10000);
+	CHECK(bus.Read(REG_TIMA) == 4);
+	/* an edge from the glitch overflows like any other */
+	bus.Write(REG_TMA, 0xAB);
+	bus.Write(REG_TIMA, 0xFF);
+	bus.Write(REG_TAC, TAC_ENABLE | 1);
+	RunTo(scheduler, 0x10000 + 4);
+	bus.Write(REG_DIV, 0);
+	CHECK(bus.Read(REG_TIMA) == 0xAB);
+	CHECK(bus.Read(REG_IF) & INT_TIMER);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (TestGlitches() || TestRandom())
+		return EXIT_FAILURE;
+	spdlog::info("Timer test passed");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <new>
+#include <vector>
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <common.h>
+#include <vecenv.h>
+#include <test_cartridge.h>
+
+/*
+	Creates a batch over a cartridge that shows the buttons it reads in WRAM and counts
+	its loops, checks the layout and that every instance starts from the same snapshot,
+	then steps it with different buttons per instance. An instance that runs into an
+	invalid opcode stops alone and comes back with a reset of just itself. Steps and
+	resets after warming up must not allocate: every operator new is counted.
+*/
+
+#define INSTANCES				8
+#define FRAME_SKIP				4
+#define RESET_FRAMES			340			// the boot ROM has handed over and the program is looping
+#define WARM_STEPS				8
+#define COUNTED_STEPS			16
+
+static std::atomic<u64> allocations = 0;
+
+void* operator new(size_t size)
+{
+	void* block = std::malloc(size ? size : 1);
+
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (!block)
+		throw std::bad_alloc();
+	return block;
+}
+
+void operator delete(void* block) noexcept
+{
+	std::free(block);
+}
+
+void operator delete(void* block, size_t) noexcept
+{
+	std::free(block);
+}
+
+/*
+	0150: LD HL, C001
+	0153: LD A, 10 / LDH (00), A / LDH A, (00) / CPL / AND 0F / LD (C000), A	buttons held
+	015F: CP 02 / JR NZ, 0164 / DB D3											B alone stops it
+	0164: INC (HL) / JR 0153
+*/
+static const std::vector<u8> program = {
+	0x21, 0x01, 0xC0,
+	0x3E, 0x10, 0xE0, 0x00, 0xF0, 0x00, 0x2F, 0xE6, 0x0F, 0xEA, 0x00, 0xC0,
+	0xFE, 0x02, 0x20, 0x01, 0xD3,
+	0x34, 0x18, 0xEC,
+};
+
+static const std::array<u16, 2> ramAddresses = { 0xC000, 0xC001 };
+
+int TestVecEnv(const char* romPath)
+{
+	VecEnvConfig config = {};
+	VecEnvLayout layout;
+	VecEnv* env;
+	std::vector<u8> resetRow, buttons(INSTANCES), mask(INSTANCES, 0);
+	bool drawn = false;
+	u64 before;
+
+	config.rom = romPath;
+	config.instances = INSTANCES;
+	config.threads = 3;
+	config.frameSkip = FRAME_SKIP;
+	config.observations = VECENV_OBS_FRAME | VECENV_OBS_RAM;
+	config.pixels = VECENV_PIXELS_GRAY8;
+	config.ramAddresses = ramAddresses.data();
+	config.ramCount = ramAddresses.size();
+	config.resetFrames = RESET_FRAMES;
+	env = vecenv_create(&config);
+	CHECK(env);
+	vecenv_layout(env, &layout);
+	CHECK(layout.instances == INSTANCES);
+	CHECK(reinterpret_cast<uintptr_t>(layout.observations) % VECENV_ALIGN == 0);
+	CHECK(layout.rowStride % VECENV_ALIGN == 0);
+	CHECK(layout.frameBytes == VECENV_FRAME_WIDTH * VECENV_FRAME_HEIGHT);
+	CHECK(layout.ramOffset == layout.frameBytes && layout.ramBytes == ramAddresses.size());
+	CHECK(layout.rowStride >= layout.ramOffset + layout.ramBytes);
+
+	/* the boot logo is on screen and the program has looped */
+	resetRow.assign(layout.observations, layout.observations + layout.rowStride);
+	for (size_t i = 0; i < layout.frameBytes; i++)
+		drawn |= resetRow[i] != 0xFF;
+	CHECK(drawn);
+	CHECK(resetRow[layout.ramOffset] == 0 && resetRow[layout.ramOffset + 1] != 0);
+	for (u32 i = 1; i < INSTANCES; i++)
+		CHECK(!std::memcmp(layout.observations + i * layout.rowStride, resetRow.data(), layout.rowStride));
+
+	for (u32 i = 0; i < INSTANCES; i++)
+		buttons[i] = i % 2 ? VECENV_BUTTON_A : VECENV_BUTTON_START | VECENV_BUTTON_UP;
+	for (u32 step = 0; step < WARM_STEPS; step++)
+		CHECK(vecenv_step(env, buttons.data()) == VECENV_SUCCESS);
+	for (u32 i = 0; i < INSTANCES; i++) {
+		const u8* row = layout.observations + i * layout.rowStride;
+
+		CHECK(row[layout.ramOffset] == (i % 2 ? 0x01 : 0x08));
+		CHECK(row[layout.ramOffset + 1] != resetRow[layout.ramOffset + 1]);
+		CHECK(!std::memcmp(row, resetRow.data(), layout.frameBytes));
+	}
+	CHECK(vecenv_reset(env, nullptr) == VECENV_SUCCESS);
+
+	/* B stops instance 3 alone; resetting it brings back the snapshot's observation */
+	before = allocations.load();
+	buttons[3] = VECENV_BUTTON_B;
+	for (u32 step = 0; step < COUNTED_STEPS; step++)
+		vecenv_step(env, buttons.data());
+	CHECK(vecenv_step(env, buttons.data()) == VECENV_FAILED);
+	for (u32 i = 0; i < INSTANCES; i++)
+		CHECK(!vecenv_stopped(env)[i] == (i != 3));
+	buttons[3] = 0;
+	mask[3] = 1;
+	CHECK(vecenv_reset(env, mask.data()) == VECENV_SUCCESS);
+	CHECK(!vecenv_stopped(env)[3]);
+	CHECK(!std::memcmp(layout.observations + 3 * layout.rowStride, resetRow.data(), layout.rowStride));
+	CHECK(std::memcmp(layout.observations + 2 * layout.rowStride, resetRow.data(), layout.rowStride));
+	CHECK(vecenv_step(env, buttons.data()) == VECENV_SUCCESS);
+	CHECK(allocations.load() == before);
+
+	vecenv_destroy(env);
+	config.ramAddresses = nullptr;
+	CHECK(!vecenv_create(&config));
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	std::filesystem::path romPath = WriteProgramCartridge("usagbi_vecenv_test.gb", program);
+	int failed = TestVecEnv(romPath.string().c_str());
+
+	std::filesystem::remove(romPath);
+	if (failed)
+		return EXIT_FAILURE;
+	spdlog::info("Vector environment test passed");
+	return 0;
+}
\ No newline at end of file
@@ -1,16 +1,63 @@
-﻿#include "emulator.h"
+﻿#include <cstdlib>
+#include <cstring>
+#include "emulator.h"
 
+/*
+	usagbi [-j off|lockstep] [-s scalar|sse2|avx2] [-r none|request|N] [-p] [-m] <rom>
+	-j turns the JIT off, or checks every native block against the interpreter. -s holds the
+	pixel kernels below the best set. -r runs headless, draws only requested frames or
+	every Nth frame. -p draws on a second thread and -m runs the APU headless.
+*/
 int main(int argc, char* argv[])
 {
-	if (argc < 2) {
-		spdlog::error("Usage: {} <path_to_rom>", argv[0]);
+	const char* romPath = nullptr;
+	const char* jitMode = nullptr;
+	const char* simd = nullptr;
+	const char* render = nullptr;
+	bool pipelined = false, mute = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "-p"))
+			pipelined = true;
+		else if (!std::strcmp(argv[i], "-m"))
+			mute = true;
+		else if (argv[i][0] == '-' && argv[i][1] && std::strchr("jsr", argv[i][1]) && !argv[i][2] && i + 1 < argc) {
+			const char* value = argv[++i];
+
+			switch (argv[i - 1][1]) {
+			case 'j': jitMode = value; break;
+			case 's': simd = value; break;
+			case 'r': render = value; break;
+			}
+		} else {
+			romPath = argv[i];
+		}
+	}
+	if (!romPath) {
+		spdlog::error("Usage: {} [-j off|lockstep] [-s scalar|sse2|avx2] [-r none|request|N] [-p] [-m] <rom>", argv[0]);
 		return EXIT_FAILURE;
 	}
 
-	Emulator emu(const_cast<const char *>(argv[1]));
+	Emulator emu;
 
-	if (emu.Load(argv[1]) == STT_FAILED)
+	if (jitMode && !std::strcmp(jitMode, "off"))
+		emu.SetJitEnabled(false);
+	else if (jitMode && !std::strcmp(jitMode, "lockstep"))
+		emu.SetJitLockstep(true);
+	for (int isa = PIXEL_ISA_SCALAR; simd && isa < PIXEL_ISA_COUNT; isa++) {
+		if (!std::strcmp(simd, GetPixelKernels(static_cast<PixelIsa>(isa)).name))
+			emu.SetPixelIsa(static_cast<PixelIsa>(isa));
+	}
+	if (render && !std::strcmp(render, "none"))
+		emu.SetRenderMode(RENDER_NONE);
+	else if (render && !std::strcmp(render, "request"))
+		emu.SetRenderMode(RENDER_ON_REQUEST);
+	else if (render && std::atoi(render) > 0)
+		emu.SetRenderMode(RENDER_EVERY_NTH, std::atoi(render));
+	emu.SetVideoPipelined(pipelined);
+	emu.SetAudioEnabled(!mute);
+	if (emu.Load(romPath) == STT_FAILED)
 		return EXIT_FAILURE;
 	emu.Run();
 	return 0;
-}
+}
\ No newline at end of file
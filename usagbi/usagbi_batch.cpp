@@ -0,0 +1,50 @@
+#include <cstring>
+#include <string>
+#include "batch_runner.h"
+
+#define FMT_HEADER_ONLY
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+/*
+	usagbi_batch [-n instances] [-f frames] [-t threads] [-q quantum frames] [-r] <rom>...
+	Runs the instances over the ROMs given, in turn, headless unless -r, and prints the
+	aggregate frame rate and quantum latency percentiles.
+*/
+int main(int argc, char* argv[])
+{
+	BatchConfig config;
+	BatchReport report;
+
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "-r"))
+			config.headless = false;
+		else if (argv[i][0] == '-' && std::strchr("nftq", argv[i][1]) && argv[i][1] && !argv[i][2] && i + 1 < argc) {
+			u64 value = std::stoull(argv[++i]);
+
+			switch (argv[i - 1][1]) {
+			case 'n': config.instances = static_cast<u32>(value); break;
+			case 'f': config.frames = value; break;
+			case 't': config.threads = static_cast<u32>(value); break;
+			case 'q': config.quantumFrames = static_cast<u32>(value); break;
+			}
+		} else {
+			config.roms.push_back(argv[i]);
+		}
+	}
+	if (config.roms.empty() || !config.instances) {
+		spdlog::error("Usage: {} [-n instances] [-f frames] [-t threads] [-q quantum] [-r] <rom>...", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	BatchRunner runner(config);
+
+	report = runner.Run();
+	spdlog::info("{} instances on {} threads: {} frames in {:.2f} s, {:.0f} frames/s, {} failed",
+		report.instances, report.threads, report.frames, report.seconds, report.framesPerSecond, report.failed);
+	spdlog::info("Quantum latency: p50 {:.0f} us, p90 {:.0f} us, p99 {:.0f} us, max {:.0f} us; slowest instance {} at p99 {:.0f} us",
+		report.p50Us, report.p90Us, report.p99Us, report.maxUs, report.slowestInstance,
+		report.perInstance.empty() ? 0.0 : report.perInstance[report.slowestInstance].p99Us);
+	spdlog::info("Pool: {} rounds, {} of {} quanta stolen", report.pool.rounds, report.pool.steals, report.pool.items);
+	return report.failed ? EXIT_FAILURE : 0;
+}
\ No newline at end of file
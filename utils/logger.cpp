@@ -1,4 +1,5 @@
 #include "logger.h"
+#include <mutex>
 
 void Logger::LogCpuState(const CpuState state)
 {	
@@ -14,6 +15,13 @@ void Logger::LogCpuState(const CpuState state)
 
 Logger::Logger()
 {
+	/* every Emulator in the process shares the one log, whichever thread creates it first */
+	static std::mutex creating;
+	std::lock_guard<std::mutex> guard(creating);
+
+	cpuStateLogger = spdlog::get("cpu instruction");
+	if (cpuStateLogger)
+		return;
 	cpuStateLogger = spdlog::basic_logger_mt("cpu instruction", "Log/CpuInstructionLog.txt", true);
 	cpuStateLogger->set_pattern("%v");
 }